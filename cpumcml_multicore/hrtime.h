@@ -7,7 +7,7 @@
 
 // get the number of CPU cycles per microsecond from Linux /proc filesystem
 // return < 0 on error
-inline double getMHZ(void) {
+static inline double getMHZ(void) {
   double mhz = -1;
   char line[1024], *s, search_str[] = "cpu MHz";
   FILE* fp;
@@ -34,14 +34,14 @@ inline double getMHZ(void) {
 }
 
 // get the number of CPU cycles since startup using rdtsc instruction
-inline unsigned long long get_hrcycles() {
+static inline unsigned long long get_hrcycles() {
   unsigned int tmp[2];
   asm ("rdtsc" : "=a" (tmp[1]), "=d" (tmp[0]));
   return (((unsigned long long)tmp[0] << 32 | tmp[1]));
 }
 
 // get the elapsed time (in seconds) since startup
-inline double getElapsedTime() {
+static inline double getElapsedTime() {
   static double CPU_HZ = 0;
   if (CPU_HZ == 0)
     CPU_HZ = getMHZ() * 1000000;
@@ -69,12 +69,36 @@
 #include <time.h>
 #include <string.h>
 #include <ctype.h>
+#include "dSFMT.h"
 
 //>>>>>>>>>>>>>>>>>>>>Multi-threading
-#define NTHREAD 64 
-//TODO: Obtain as argv[4]?? Requires dynamic memory allocation
-int NUM_NODE; //argv[3] set at runtime 
-int CURRENT_NODE; //argv[2] set at runtime
+#define PHOTON_BATCH 1000	/* largest photon lease handed to a thread. */
+#define LEASES_PER_THREAD 16	/* leases per thread aimed for in a run. */
+extern int NumThreads; //-T<n> set at runtime, defaults to online cores
+extern int NUM_NODE; //argv[3] set at runtime 
+extern int CURRENT_NODE; //argv[2] set at runtime
+
+//>>>>>>>>>>>>>>>>>>>>Transport engines, -E<name> 
+#define ENGINE_SCALAR 0	/* one photon at a time, HopDropSpin(). */
+#define ENGINE_PACKET 1	/* photons in lockstep, mcmlpacket.c. */
+#define ENGINE_EVENT 2	/* photon bank sorted by event, mcmlevent.c. */
+extern int EngineType;
+
+/* Features the scalar engine is compiled for, see EngineVariant(). */
+#define VARIANT_NOABS 1	/* A_rz is not tallied (-A). */
+#define VARIANT_ISO 2	/* g = 0 in every layer. */
+#define VARIANT_MATCHED 4	/* the same n in every layer and medium. */
+#define VARIANT_SINGLE 8	/* one layer. */
+#define VARIANT_NOGLASS 16	/* no glass layer. */
+#define NUM_VARIANTS 32
+
+//>>>>>>>>>>>>>>>>>>>>Random number generators, -M<name> 
+#define RNG_RAN3 0	/* ran3 of Numerical Recipes, one per thread. */
+#define RNG_MWC 1	/* multi-stream MWC, mcmlrng.c. */
+#define RNG_DSFMT 2	/* dSFMT (Mersenne Twister), one per thread. */
+#define RNG_PHILOX 3	/* Philox4x32-10, one stream per photon. */
+extern int RngType;
+extern unsigned long long RngSeed; //-S<seed>
 
 
 #define PI 3.1415926
@@ -86,6 +110,75 @@ int CURRENT_NODE; //argv[2] set at runtime
 
 #define SIGN(x) ((x)>=0 ? 1:-1)
 
+/* Fixed-point tallies, as with WEIGHT_SCALE in GPUMCML. Integer */
+/* sums do not depend on the order of the additions, so together */
+/* with RNG_PHILOX the results are the same for any thread count. */
+#define WEIGHT_SCALE 4294967296.0	/* 2^32 per unit weight. */
+extern int NumShards; //-C<n>, copies of the tallies, defaults to threads
+
+/* Tabulated phase functions, see mcmlphase.c. */
+#define MAX_PHASE_FILES 16
+extern Boolean PhaseHG; //-Phg, tabulate Henyey-Greenstein
+extern int NumPhaseFiles; //-P<layer>,<file>, read a phase function
+extern short PhaseLayer[MAX_PHASE_FILES];
+extern char * PhaseFile[MAX_PHASE_FILES];
+extern double FresnelTol; //-F[<tol>], tabulate the Fresnel reflectance
+
+/* Checkpoints, see mcmlckpt.c. */
+#define CHECKPOINT_MINUTES 10.0
+extern char * CheckpointFile; //-K<file>, write checkpoints
+extern double CheckpointMinutes; //-I<minutes> between checkpoints
+extern char * ResumeFile; //-R<file>, resume from a checkpoint
+extern volatile int CheckpointPending;
+
+/* Top-ups of finished runs, see mcmlckpt.c. */
+#define RAW_SUFFIX ".raw"
+extern Boolean KeepRaw; //-X[<photons>], keep <output file>.raw of each run
+extern long TopUpPhotons; //-X<photons> more on top of <output file>.raw
+
+/* Convergence-driven photon budget, see mcmlbatch.c. */
+extern double BatchTol; //-U<err>, relative standard error aimed for
+extern double BatchRadius; //-U<err>,<radius> of the Rd_r bins checked
+#define VAR_BATCHES 20 /* default of -V. */
+extern int VarBatches; //-V[<n>], standard errors of the output from n batches
+#define BATCHED (BatchTol > 0.0 || VarBatches > 0)
+#define FRESNEL_TOL 1.0E-6 /* default of -F. */
+extern Boolean IgnoreA; //-A, do not tally absorption, as in GPUMCML
+extern Boolean WriteCombine; //-W, combine drops to A_rz before storing
+#define WC_SLOTS 32 /* entries of the A_rz write-combining buffer, 2^n. */
+extern Boolean HotTile; //-H, private A_rz tile per thread
+extern short HotNr, HotNz; //-H<nr>,<nz>, 0 to size it from the input
+
+/* Runs traced at once on the worker threads, see DoRuns(). */
+extern int ConcurrentRuns; //-J<n>
+
+/* White Monte Carlo, see mcmlwhite.c. */
+#define WHITE_BINS 4 /* default path bins per octave of -L. */
+#define WHITE_MAX_PATH 100.0 /* default longest path of -L. [cm] */
+#define WHITE_MIN_PATH 1.0E-4 /* shorter paths share the first bin. [cm] */
+#define WHITE_SHARES 8 /* bins of the share of the path in a layer. */
+#define WHITE_MAX_GROUPS 262144 /* default most groups of -L. */
+#define WHITE_MAGIC "MCMLWMC2"
+#define WHITE_RD 0 /* kinds of photon group: reflected, */
+#define WHITE_TT 1 /* transmitted, */
+#define WHITE_LOST 2 /* or stopped at WhiteMaxPath or horizontal in glass. */
+extern int WhiteBins; //-L[<bins>[,<max>[,<groups>]]], no absorption
+extern double WhiteMaxPath;
+extern long WhiteMaxGroups;
+
+/* Perturbation Monte Carlo, see mcmlpmc.c. */
+extern Boolean PmcDeriv; //-D, derivatives of Rd and Tt by mua and mus
+
+/* Baseline runs for scaling, see mcmlscale.c. */
+#define SCALE_MAGIC "MCMLSMC1"
+extern double ScaleMaxPath; //-B[<max>], 0 if off
+
+/* Result cache, see mcmlcache.c. */
+#define CACHE_MB 1024.0 /* default size of -Q. [MB] */
+#define CACHE_VERSION 1 /* of the tallies, in the key of an entry. */
+extern char * CacheDir; //-Q<dir>[,<MB>], NULL if off
+extern double CacheMB;
+
 /****************** Stuctures *****************************/
 
 /****
@@ -103,6 +196,31 @@ typedef struct {
   double sleft; /* step size left. dimensionless [-]. */
 } PhotonStruct;
 
+/****
+ *	Inverse of the cumulative distribution of cos(theta) of
+ *	a phase function at n equally spaced u in [0, 1], see
+ *	mcmlphase.c.
+ ****/
+typedef struct {
+  int n;
+  double * cost;
+  double g; /* mean cosine. */
+  double err; /* largest interpolation error found. */
+} PhaseStruct;
+
+/****
+ *	Fresnel reflectance of one side of a boundary at n
+ *	equally spaced cosines in [0, 1] of the side with the
+ *	lower refractive index, see FresnelTable().
+ ****/
+typedef struct {
+  int n;
+  double k; /* (n1/n2)^2, incident over transmit. */
+  Boolean by_ca2; /* indexed by the transmission cosine (n1>n2). */
+  double * r;
+  double err; /* largest interpolation error found. */
+} FresnelStruct;
+
 /****
  *	Structure used to describe the geometry and optical
  *	properties of a layer.
@@ -115,6 +233,10 @@ typedef struct {
  *	They are set to zero if no total internal reflection
  *	exists.
  *	They are used for computation speed.
+ *
+ *	fresnel0 and fresnel1 tabulate the reflectance of the
+ *	upper and lower boundary with -F. They are NULL for
+ *	matched boundaries or when RFresnel() is used.
  ****/
 typedef struct {
   double z0, z1; /* z coordinates of a layer. [cm] */
@@ -124,6 +246,8 @@ typedef struct {
   double g; /* anisotropy. */
 
   double cos_crit0, cos_crit1;
+  FresnelStruct * fresnel0, * fresnel1;
+  PhaseStruct * phase; /* tabulated phase function, NULL for HG. */
 } LayerStruct;
 
 /****
@@ -167,6 +291,162 @@ typedef struct {
 
 } InputStruct;
 
+/****
+ *	Photons of a run shared by the worker threads, see
+ *	LeasePhotons(). The pool holds the node photons of the
+ *	run from first on, of which left are not yet leased,
+ *	lease_size at a time.
+ ****/
+typedef struct {
+  long left;
+  long node, first;
+  long lease_size;
+} PoolStruct;
+
+/****
+ *	Photons of a white run grouped by how they left the
+ *	medium, see mcmlwhite.c. A group holds the photons of
+ *	one kind and radial bin whose total path lengths fall
+ *	in the same bin of 2^level/WhiteBins octave, and whose
+ *	shares of it in each layer fall in the same bins of
+ *	2^level/WHITE_SHARES. The table is open-addressed with
+ *	size slots (2^n); slot i has key[i*key_len..] = kind,
+ *	ir, the path bin (0 for no path) and the share bin of
+ *	each layer, n[i] photons (0 if free) and the sums of
+ *	their path lengths in layers 1..num_layers at
+ *	path[i*num_layers..]. [cm]
+ ****/
+typedef struct {
+  short num_layers;
+  int key_len;
+  int level; /* of coarsening, see above. */
+  long size, used;
+  int * key;
+  long * n;
+  double * path;
+  int * photon_key; /* of the photon being traced. */
+  double * photon_path;
+} WhiteStruct;
+
+/****
+ *	Perturbation Monte Carlo sums of a thread or a run, see
+ *	mcmlpmc.c. path and coll are the path length [cm] and
+ *	the collisions of the photon being traced in layers
+ *	1..num_layers; Rd_path and Rd_coll sum w*path and
+ *	w*coll of the reflected photons over [(layer-1)*nr+ir],
+ *	Tt_path and Tt_coll those of the transmitted ones.
+ ****/
+typedef struct {
+  short num_layers, nr;
+  double * path;
+  long * coll;
+  double * Rd_path, * Rd_coll;
+  double * Tt_path, * Tt_coll;
+} PmcStruct;
+
+/****
+ *	Exits of the photons of a baseline run, see
+ *	mcmlscale.c: kind (WHITE_RD, WHITE_TT or WHITE_LOST),
+ *	collisions, exit radius [cm] and path length [cm].
+ ****/
+typedef struct {
+  int kind, coll;
+  double r, path;
+} ScaleRecord;
+
+/****
+ *	The exits of a thread or a run, size records of which
+ *	used are filled.
+ ****/
+typedef struct {
+  long size, used;
+  ScaleRecord * rec;
+} ScaleStruct;
+
+/****
+ *	Head of a baseline file (.smc). It is followed by
+ *	num_records ScaleRecords of the reflected and
+ *	transmitted photons; the lost ones are only counted.
+ ****/
+typedef struct {
+  char magic[8];
+  long num_photons; /* launched. */
+  double w0; /* weight of a launched photon, 1-Rsp. */
+  double mua, mus, g, n, d; /* of the layer in the input. */
+  double n_above, n_below; /* of the ambient media. */
+  double dr; /* r grid separation. [cm] */
+  short nr;
+  double max_path; /* [cm] */
+  long num_lost; /* stopped at max_path. */
+  long num_records;
+} ScaleHead;
+
+/****
+ *	Head of a white Monte Carlo file (.wmc). It is followed
+ *	by the absorption coefficients of layers 1..num_layers
+ *	of the input, then by num_groups records of the kind
+ *	and ir (int), the photons (long) and the mean path
+ *	length in each layer (double) of a group.
+ ****/
+typedef struct {
+  char magic[8];
+  long num_photons; /* launched. */
+  double w0; /* weight of a launched photon, 1-Rsp. */
+  double dr; /* r grid separation. [cm] */
+  short nr, num_layers;
+  int bins; /* per octave, of -L. */
+  int level; /* a group spans 2^level of those. */
+  double max_path; /* [cm] */
+  long num_groups;
+} WhiteHead;
+
+/****
+ *	Head of a binary .mco file, written instead of the
+ *	ASCII one when the output format of a run is 'B'. All
+ *	values are little-endian; byte_order reads as
+ *	MCO_BYTE_ORDER once swapped to the host. The results
+ *	are scaled by run_photons, the photons of the run, of
+ *	which num_photons were traced: on a node of a run split
+ *	over nodes, its share. It is followed by
+ *	  num_layers+2 McoLayers, the ambient media first and
+ *	    last with only n set,
+ *	  the scaled results as doubles: A_l[1..num_layers],
+ *	    A_z[nz], Rd_r[nr], Rd_a[na], Tt_r[nr], Tt_a[na],
+ *	    A_rz[nr][nz], Rd_ra[nr][na], Tt_ra[nr][na],
+ *	  with MCO_RAW in flags, the raw tallies as unsigned
+ *	    64-bit integers: A_rz[nr][nz], Rd_ra[nr][na],
+ *	    Tt_ra[nr][na], in units of 1/weight_scale.
+ *	Every array starts on an 8-byte boundary, so the file
+ *	can be mapped and used in place. GPUMCML writes the
+ *	same layout; mcml -O turns either into ASCII.
+ ****/
+#define MCO_MAGIC "MCMLMCOB"
+#define MCO_VERSION 1
+#define MCO_BYTE_ORDER 0x01020304
+#define MCO_RAW 1 /* flag: raw tallies follow the scaled ones. */
+
+typedef struct {
+  char magic[8];
+  int version, byte_order;
+  int head_size; /* sizeof(McoHead) of the writer. */
+  int num_layers, nz, nr, na;
+  int flags;
+  long long num_photons; /* traced. */
+  long long run_photons; /* of the run, by which results are scaled. */
+  double Wth, dz, dr, da;
+  double weight_scale; /* raw units per unit weight. */
+  double Rsp, Rd, A, Tt;
+  int batches; /* of -U, with the errors below. */
+  int reserved;
+  double err_rd, err_a, err_rdr;
+  char out_fname[STRLEN];
+  char note[STRLEN]; /* time report of the run. */
+} McoHead;
+
+typedef struct {
+  double n, mua, mus, g, z0, z1;
+} McoLayer;
+
 /****
  *	Structures for scoring physical quantities. 
  *	z and r represent z and r coordinates of the 
@@ -201,8 +481,59 @@ typedef struct {
   double * Tt_a; /* 1D angular distribution of */
   /* transmittance. [1/sr] */
   double Tt; /* total transmittance. [-] */
+
+  /* Fixed-point tallies in units of 1/WEIGHT_SCALE, row-major */
+  /* [ir*nz+iz] and [ir*na+ia]. For a worker thread they point */
+  /* into its shard of the TallyStruct. */
+  unsigned long long * A_rz_raw;
+  unsigned long long * Rd_ra_raw;
+  unsigned long long * Tt_ra_raw;
+  Boolean raw_shared; /* 1 if other threads add to the same shard. */
+
+  /* Private copy of A_rz[0..hot_nr-1][0..hot_nz-1] of a worker */
+  /* thread, row-major. NULL if there is none. */
+  unsigned long long * A_hot;
+  short hot_nr, hot_nz;
+
+  /* Direct-mapped write-combining buffer in front of A_rz: */
+  /* weight wc_w[s] is pending for bin wc_key[s] = ir<<16|iz. */
+  /* wc_last is the slot of the last drop. */
+  long wc_key[WC_SLOTS];
+  unsigned long long wc_w[WC_SLOTS];
+  int wc_last;
+  long long a_drops, a_stores; /* calls of TallyA(), stores to A_rz. */
+
+  PoolStruct * pool; /* of the run, for a worker thread. */
+  WhiteStruct * white; /* photon groups of a worker thread, with -L. */
+  PmcStruct * pmc; /* with -D, NULL otherwise. */
+  ScaleStruct * scale; /* exits of a worker thread, with -B. */
+
+  /* Relative standard errors of Rd, A and the worst Rd_r bin */
+  /* reached in batches of -U; batches is 0 without -U. */
+  int batches;
+  double err_rd, err_a, err_rdr;
+
+  /* Photons traced: the share of this node of the photons of */
+  /* the run, by which the results are scaled. */
+  long num_traced;
 } OutStruct;
 
+/****
+ *	num_shards copies of the fixed-point A_rz, Rd_ra and
+ *	Tt_ra, see mcmltally.c. Shard s of A_rz starts at 
+ *	A_rz + s*rz_stride, that of Rd_ra and Tt_ra at 
+ *	s*ra_stride.
+ ****/
+typedef struct {
+  int num_shards;
+  short hot_nr, hot_nz; /* A_rz tile of each thread, 0 for none. */
+  short nz, nr, na;
+  long rz_stride, ra_stride;
+  unsigned long long * A_rz;
+  unsigned long long * Rd_ra;
+  unsigned long long * Tt_ra;
+} TallyStruct;
+
 /***********************************************************
  *	Routine prototypes for dynamic memory allocation and 
  *	release of arrays and matrices.
@@ -216,8 +547,7 @@ void nrerror(char *);
 
 
 //>>>>>>>>>>>>>>.Global Variables >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
-static OutStruct out_parm[NTHREAD]; /* distribution of photons.*/
-InputStruct * GlobalIn_Ptr;
+/* Defined in mcmlmain.c. Arrays have NumThreads elements. */
 
 /****
  * Structure used to run multiple random number generators together
@@ -229,10 +559,152 @@ typedef struct {
   int iff;
 } RandStruct;
 
-RandStruct ranparm[NTHREAD];
-static Boolean first_time[NTHREAD]; //used by RandomNumber()
-static int idum[NTHREAD]; /* seed for ran3. */
+extern RandStruct * ranparm;
+void initRandom(void);
+double RandomNum(int);
+void RandomFill(int, double *, long);
+void RandomPhoton(int, long);
+void WriteRandomState(FILE *);
+Boolean ReadRandomState(FILE *);
+
+void InitTally(InputStruct *, TallyStruct *, int, short, short);
+void FreeTally(TallyStruct *);
+void InitThreadOut(TallyStruct *, OutStruct *, int);
+void SpillThreadOut(TallyStruct *, OutStruct *);
+void FlushThreadOut(TallyStruct *, OutStruct *);
+void HotTileSize(InputStruct *, short *, short *);
+void ReduceTally(TallyStruct *, OutStruct *);
+void TallyA(InputStruct *, OutStruct *, short, short, double);
+void TallyRd(InputStruct *, OutStruct *, short, short, double);
+void TallyTt(InputStruct *, OutStruct *, short, short, double);
+
+/****
+ *	MWC_LANES multiply-with-carry streams advanced
+ *	together, each with its own safe-prime multiplier a
+ *	as the per-thread generators of GPUMCML. The upper
+ *	32 bits of x hold the carry.
+ ****/
+#define MWC_LANES 16
+
+typedef struct {
+  unsigned long long x[MWC_LANES];
+  unsigned int a[MWC_LANES];
+} MWCStruct;
+
+int InitMWC(MWCStruct *, int, const char *, unsigned long long);
+void fill_uniform_co(MWCStruct *, double *, long);
+void fill_uniform_oc(MWCStruct *, double *, long);
+void fill_uniform_co_f(MWCStruct *, float *, long);
+void fill_uniform_oc_f(MWCStruct *, float *, long);
+void fill_philox_co(unsigned long long, const long *, unsigned int *, int,
+    double *, double *, double *, double *);
+void fill_philox_photon_co(unsigned long long, long, unsigned int *,
+    double *, int);
+
+long NodePhotons(long);
+long PhotonsLeft(void);
+void RefillPhotons(long);
+long InitBatches(InputStruct *);
+long BatchDone(TallyStruct *);
+void EndBatches(InputStruct *, OutStruct *);
+void FreeBatches(InputStruct *);
+void WriteBatchErrors(FILE *, InputStruct);
+long ResumeRun(void);
+long ResumeCheckpoint(InputStruct *, TallyStruct *, long, long);
+Boolean CheckpointPause(TallyStruct *, OutStruct *);
+void CheckpointWait(InputStruct *, TallyStruct *, long);
+void CheckpointRunDone(long, Boolean);
+unsigned long long HashBytes(unsigned long long, const unsigned char *,
+    size_t);
+char * RunKey(InputStruct *);
+long TopUpStart(InputStruct *, TallyStruct *);
+void TopUpStore(InputStruct *, OutStruct *);
+void CacheLookup(InputStruct *, TallyStruct *, PoolStruct *);
+void CacheStore(InputStruct *, OutStruct *);
+
+void InitPhase(InputStruct *);
+void FreePhase(InputStruct *);
+
+/***********************************************************
+ *	Draw cos(theta) from the table of a phase function by
+ *	linear interpolation, for U in [0, 1].
+ ****/
+static inline double SamplePhase(PhaseStruct * Phase_Ptr, double U) {
+  double x = U*(Phase_Ptr->n - 1);
+  int k = (int)x;
+
+  if (k > Phase_Ptr->n - 2)
+    k = Phase_Ptr->n - 2;
+  return (Phase_Ptr->cost[k]
+      + (x - k)*(Phase_Ptr->cost[k+1] - Phase_Ptr->cost[k]));
+}
+
+void InitFresnel(InputStruct *);
+void FreeFresnel(InputStruct *);
+
+/***********************************************************
+ *	Fresnel reflectance for the cosine of the incident
+ *	angle ca1 above the critical angle, as RFresnel(). The
+ *	cosine of the transmission angle is computed exactly,
+ *	only the reflectance is interpolated. Indexing by the
+ *	cosine of the optically thinner side keeps the
+ *	reflectance smooth near the critical angle.
+ ****/
+static inline double FresnelTable(FresnelStruct * Fresnel_Ptr, double ca1,
+    double * ca2_Ptr) {
+  double s = 1.0 - Fresnel_Ptr->k*(1.0 - ca1*ca1);
+  double ca2 = s > 0.0 ? sqrt(s) : 0.0;
+  double x = (Fresnel_Ptr->by_ca2 ? ca2 : ca1)*(Fresnel_Ptr->n - 1);
+  int k = (int)x;
+
+  if (k > Fresnel_Ptr->n - 2)
+    k = Fresnel_Ptr->n - 2;
+  *ca2_Ptr = ca2;
+  return (Fresnel_Ptr->r[k]
+      + (x - k)*(Fresnel_Ptr->r[k+1] - Fresnel_Ptr->r[k]));
+}
+
+Boolean TakePhoton(PoolStruct *, long *, long *);
+int EngineVariant(InputStruct *);
+void TracePhoton(int, InputStruct *, PhotonStruct *, OutStruct *, int);
+
+/****
+ *	Per-layer constants of the vector engines, indexed by
+ *	layer like InputStruct.layerspecs (0..num_layers+1).
+ ****/
+typedef struct {
+  double * z0, * z1, * n, * g;
+  double * mut; /* mua+mus. */
+  double * rmut; /* 1/(mua+mus), 0 in glass. */
+  double * mua_mut; /* mua/(mua+mus), 0 in glass. */
+  double * cos_crit0, * cos_crit1;
+  long * glass; /* 1 if mua and mus are both 0. */
+  PhaseStruct ** phase; /* NULL if none of the layers has a table. */
+} PacketLayerStruct;
+
+void InitPacketLayers(InputStruct *, PacketLayerStruct *);
+void FreePacketLayers(PacketLayerStruct *);
+double * InitWhite(InputStruct *);
+WhiteStruct * NewWhite(short);
+void FreeWhite(WhiteStruct *);
+void MergeWhite(WhiteStruct *, WhiteStruct *);
+void WhiteTracePhoton(InputStruct *, PhotonStruct *, OutStruct *, int);
+void WriteWhite(InputStruct *, double *, WhiteStruct *, double, long);
+
+PmcStruct * NewPmc(InputStruct *);
+void FreePmc(PmcStruct *);
+void AddPmc(PmcStruct *, PmcStruct *);
+void PmcTracePhoton(InputStruct *, PhotonStruct *, OutStruct *, int);
+void PmcExit(PmcStruct *, Boolean, short, double);
+void WritePmc(FILE *, InputStruct, PmcStruct *);
+
+double InitScale(InputStruct *);
+ScaleStruct * NewScale(void);
+void FreeScale(ScaleStruct *);
+void MergeScale(ScaleStruct *, ScaleStruct *);
+void ScaleTracePhoton(InputStruct *, PhotonStruct *, OutStruct *, int);
+void WriteScale(InputStruct *, double, ScaleStruct *, double, long);
+
+void PacketTransport(InputStruct *, OutStruct *, int);
+void EventTransport(InputStruct *, OutStruct *, int);
 
-//>>>>>>>>>>>>>>> Performance Measurement 
-double start_time, end_time;
-unsigned long long start_cycle, end_cycle;
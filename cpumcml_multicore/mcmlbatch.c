@@ -0,0 +1,406 @@
+/***********************************************************
+ *	Batches: convergence-driven photon budget and standard
+ *	errors of the output.
+ *
+ *	With -U<err>[,<radius>] the number of photons of a run
+ *	becomes a cap. The photons are traced in batches of
+ *	1/BATCH_MAX of the cap, and after each batch the
+ *	relative standard errors of the total diffuse
+ *	reflectance Rd and absorption A, and of Rd_r in every
+ *	bin within <radius> cm of the source, are estimated
+ *	from the spread of the batch means. The run stops as
+ *	soon as all of them are within <err>, but not before
+ *	BATCH_MIN batches, and the errors reached are written
+ *	to the header of the output file.
+ *
+ *	With -V[<n>] the standard error of every value of the
+ *	output is estimated from the same batch means, over n
+ *	batches (default VAR_BATCHES) or over those of -U, and
+ *	written after the means as sections RAT_err, A_l_err,
+ *	A_z_err, Rd_r_err, Rd_a_err, Tt_r_err, Tt_a_err,
+ *	A_rz_err, Rd_ra_err and Tt_ra_err, in the units of the
+ *	means. Each value costs 16 bytes for the run, the last
+ *	total and the sum of the squared batch totals, i.e.
+ *	twice one shard of the tallies, and each batch one pass
+ *	over the shards. Without -U and -V the photons are not
+ *	batched and nothing is allocated.
+ *
+ *	The pool of photons holds one batch at a time; the
+ *	threads drain it and meet in CheckpointPause() while
+ *	the main thread calls BatchDone() and refills the pool
+ *	with RefillPhotons(). The tallies are then complete, so
+ *	the batch totals are differences of the summed shards.
+ *	All batches hold batch_size photons but the last, so
+ *	the sums of squares suffice for the weighted batch
+ *	means variance.
+ ****/
+
+#include "mcml.h"
+
+#define BATCH_MAX 100	/* batches in a run that reaches its cap. */
+#define BATCH_MIN 10	/* batches before the errors are trusted. */
+
+/* Defined in mcmlio.c. */
+short IzToLayer(short, InputStruct);
+void InitOutputData(InputStruct, OutStruct *);
+void FreeOutputData(InputStruct, OutStruct *);
+void ScaleRdTt(InputStruct, OutStruct *);
+void ScaleA(InputStruct, OutStruct *);
+
+/****
+ *	Quantities tracked, in this order: Rd, A, Tt and Rd_r,
+ *	and with -V also Rd_a, A_z, A_l, Tt_r, Tt_a, A_rz,
+ *	Rd_ra and Tt_ra. Their offsets are below.
+ ****/
+#define Q_RD 0
+#define Q_A 1
+#define Q_TT 2
+#define Q_RD_R 3
+static long q_rd_a, q_a_z, q_a_l, q_tt_r, q_tt_a, q_a_rz, q_rd_ra, q_tt_ra;
+static long num_q;
+static short nr_u; /* Rd_r bins within the radius of -U. */
+static short * layer_of_iz; /* IzToLayer() of each iz, with -V. */
+
+static long batch_size, batch_cap; /* photons. */
+static long batch_next; /* photons of the batch in the pool. */
+static long batch_photons; /* traced in the batches done. */
+static int num_batches;
+static double s0; /* sum of the squared batch sizes. */
+/* The weight of each quantity so far, and the sum of its squared */
+/* batch weights. After the last batch, sq holds the standard */
+/* error of the weight instead. */
+static double * last, * sq;
+static double err[3]; /* relative errors of Rd, A and the worst Rd_r bin. */
+static OutStruct err_out; /* standard errors of the output, with -V. */
+
+/***********************************************************
+ *	Start the batches of a run. Return the size of the
+ *	first one.
+ ****/
+long InitBatches(InputStruct * In_Ptr) {
+  short nr = In_Ptr->nr, nz = In_Ptr->nz, na = In_Ptr->na;
+  short iz;
+
+  nr_u = BatchTol > 0.0 ? (short)ceil(BatchRadius/In_Ptr->dr) : 0;
+  if (nr_u > nr)
+    nr_u = nr;
+  num_q = Q_RD_R + nr;
+  if (VarBatches > 0) {
+    q_rd_a = num_q;
+    q_a_z = q_rd_a + na;
+    q_a_l = q_a_z + nz;
+    q_tt_r = q_a_l + In_Ptr->num_layers + 2;
+    q_tt_a = q_tt_r + nr;
+    q_a_rz = q_tt_a + na;
+    q_rd_ra = q_a_rz + (long)nr*nz;
+    q_tt_ra = q_rd_ra + (long)nr*na;
+    num_q = q_tt_ra + (long)nr*na;
+
+    layer_of_iz = (short *)malloc(nz*sizeof(short));
+    if (layer_of_iz == NULL)
+      nrerror("allocation failure in InitBatches()");
+    for (iz=0; iz<nz; iz++)
+      layer_of_iz[iz] = IzToLayer(iz, *In_Ptr);
+  }
+  last = (double *)calloc(num_q, sizeof(double));
+  sq = (double *)calloc(num_q, sizeof(double));
+  if (last == NULL || sq == NULL)
+    nrerror("allocation failure in InitBatches()");
+
+  batch_cap = In_Ptr->num_photons;
+  if (BatchTol > 0.0)
+    batch_size = (batch_cap + BATCH_MAX - 1)/BATCH_MAX;
+  else
+    batch_size = (batch_cap + VarBatches - 1)/VarBatches;
+  if (batch_size > batch_cap)
+    batch_size = batch_cap;
+  if (batch_size < 1)
+    batch_size = 1;
+  batch_next = batch_size;
+  batch_photons = 0;
+  num_batches = 0;
+  s0 = 0.0;
+
+  printf("Batches of %ld photons up to %ld", batch_size, batch_cap);
+  if (BatchTol > 0.0)
+    printf(", relative error <= %g of Rd, %s%hd Rd_r bins", BatchTol,
+        IgnoreA ? "" : "A, ", nr_u);
+  if (VarBatches > 0)
+    printf(", standard errors of %ld values", num_q);
+  printf("\n");
+  return (batch_next);
+}
+
+/***********************************************************
+ *	Sum bin I of the N_Shards shards of Shard, Stride apart.
+ ****/
+static double ShardSum(unsigned long long * Shard, long Stride, int N_Shards,
+    long I) {
+  unsigned long long w = 0;
+  int s;
+
+  for (s=0; s<N_Shards; s++)
+    w += Shard[s*Stride + I];
+  return (w/WEIGHT_SCALE);
+}
+
+/***********************************************************
+ *	Set W[q] to the weight of each quantity so far.
+ ****/
+static void BatchWeights(TallyStruct * Tally_Ptr, double * W) {
+  short nr = Tally_Ptr->nr, nz = Tally_Ptr->nz, na = Tally_Ptr->na;
+  short ir, iz, ia;
+  long q;
+
+  for (q=0; q<num_q; q++)
+    W[q] = 0.0;
+
+  for (ir=0; ir<nr; ir++)
+    for (ia=0; ia<na; ia++) {
+      long i = (long)ir*na + ia;
+      double rd = ShardSum(Tally_Ptr->Rd_ra, Tally_Ptr->ra_stride,
+          Tally_Ptr->num_shards, i);
+      double tt = ShardSum(Tally_Ptr->Tt_ra, Tally_Ptr->ra_stride,
+          Tally_Ptr->num_shards, i);
+
+      W[Q_RD] += rd;
+      W[Q_TT] += tt;
+      W[Q_RD_R + ir] += rd;
+      if (VarBatches > 0) {
+        W[q_rd_a + ia] += rd;
+        W[q_tt_r + ir] += tt;
+        W[q_tt_a + ia] += tt;
+        W[q_rd_ra + i] = rd;
+        W[q_tt_ra + i] = tt;
+      }
+    }
+
+  if (IgnoreA)
+    return;
+  for (ir=0; ir<nr; ir++)
+    for (iz=0; iz<nz; iz++) {
+      long i = (long)ir*nz + iz;
+      double a = ShardSum(Tally_Ptr->A_rz, Tally_Ptr->rz_stride,
+          Tally_Ptr->num_shards, i);
+
+      W[Q_A] += a;
+      if (VarBatches > 0) {
+        W[q_a_z + iz] += a;
+        W[q_a_l + layer_of_iz[iz]] += a;
+        W[q_a_rz + i] = a;
+      }
+    }
+}
+
+/***********************************************************
+ *	Standard error of the weight of quantity Q, which was
+ *	Wb in the batch of N photons just done.
+ ****/
+static double WeightError(long Q, double Wb, long N) {
+  double w = last[Q];
+  double mean = w/batch_photons; /* per photon. */
+  /* sum of n_b*w_b: all batches but the last hold batch_size. */
+  double s1 = batch_size*(w - Wb) + N*Wb;
+  double var = sq[Q] - 2*mean*s1 + mean*mean*s0;
+
+  if (num_batches < 2)
+    return (0.0);
+  var *= (double)num_batches/(num_batches - 1);
+  return (sqrt(fmax(var, 0.0)));
+}
+
+/***********************************************************
+ *	Relative standard error of quantity Q.
+ ****/
+static double RelError(long Q, double Wb, long N) {
+  if (last[Q] <= 0.0)
+    return (HUGE_VAL);
+  return (WeightError(Q, Wb, N)/last[Q]);
+}
+
+/***********************************************************
+ *	Called by the main thread when the threads have traced
+ *	the batch in the pool and spilled their tallies.
+ *	Return the size of the next batch, 0 to stop.
+ ****/
+long BatchDone(TallyStruct * Tally_Ptr) {
+  long n = batch_next;
+  double * wb = (double *)malloc(num_q*sizeof(double));
+  long q;
+  Boolean done;
+
+  if (wb == NULL)
+    nrerror("allocation failure in BatchDone()");
+  BatchWeights(Tally_Ptr, wb);
+
+  num_batches++;
+  batch_photons += n;
+  s0 += (double)n*n;
+  for (q=0; q<num_q; q++) {
+    double w = wb[q];
+
+    wb[q] = w - last[q];
+    sq[q] += wb[q]*wb[q];
+    last[q] = w;
+  }
+
+  err[0] = err[1] = err[2] = 0.0;
+  if (num_batches >= 2) {
+    err[0] = RelError(Q_RD, wb[Q_RD], n);
+    if (!IgnoreA)
+      err[1] = RelError(Q_A, wb[Q_A], n);
+    for (q=Q_RD_R; q<Q_RD_R+nr_u; q++)
+      err[2] = fmax(err[2], RelError(q, wb[q], n));
+  }
+
+  if (num_batches%10 == 0) {
+    printf("Batch %d, %ld photons: relative error Rd %.3g, A %.3g, "
+        "Rd_r %.3g\n", num_batches, batch_photons, err[0], err[1], err[2]);
+    fflush(stdout);
+  }
+
+  done = BatchTol > 0.0 && num_batches >= BATCH_MIN && err[0] <= BatchTol
+      && err[1] <= BatchTol && err[2] <= BatchTol;
+  if (done || batch_photons >= batch_cap) {
+    if (VarBatches > 0)
+      for (q=0; q<num_q; q++)
+        sq[q] = WeightError(q, wb[q], n);
+    free(wb);
+    return (0);
+  }
+  free(wb);
+
+  batch_next = batch_cap - batch_photons < batch_size ?
+      batch_cap - batch_photons : batch_size;
+  return (batch_next);
+}
+
+/***********************************************************
+ *	Copy the standard errors of the weights into err_out
+ *	and scale them as the means.
+ ****/
+static void ScaleErrors(InputStruct * In_Ptr) {
+  short nr = In_Ptr->nr, nz = In_Ptr->nz, na = In_Ptr->na;
+  short ir, iz, ia, il;
+
+  InitOutputData(*In_Ptr, &err_out);
+  err_out.Rd = sq[Q_RD];
+  err_out.A = sq[Q_A];
+  err_out.Tt = sq[Q_TT];
+  for (ir=0; ir<nr; ir++) {
+    err_out.Rd_r[ir] = sq[Q_RD_R + ir];
+    err_out.Tt_r[ir] = sq[q_tt_r + ir];
+    for (ia=0; ia<na; ia++) {
+      err_out.Rd_ra[ir][ia] = sq[q_rd_ra + (long)ir*na + ia];
+      err_out.Tt_ra[ir][ia] = sq[q_tt_ra + (long)ir*na + ia];
+    }
+    for (iz=0; iz<nz; iz++)
+      err_out.A_rz[ir][iz] = sq[q_a_rz + (long)ir*nz + iz];
+  }
+  for (ia=0; ia<na; ia++) {
+    err_out.Rd_a[ia] = sq[q_rd_a + ia];
+    err_out.Tt_a[ia] = sq[q_tt_a + ia];
+  }
+  for (iz=0; iz<nz; iz++)
+    err_out.A_z[iz] = sq[q_a_z + iz];
+  for (il=0; il<=In_Ptr->num_layers+1; il++)
+    err_out.A_l[il] = sq[q_a_l + il];
+
+  ScaleRdTt(*In_Ptr, &err_out);
+  ScaleA(*In_Ptr, &err_out);
+}
+
+/***********************************************************
+ *	End the batches of a run: set the number of photons of
+ *	the run to those traced, the errors reached of the
+ *	output and with -V the standard errors to write.
+ ****/
+void EndBatches(InputStruct * In_Ptr, OutStruct * Out_Ptr) {
+  In_Ptr->num_photons = batch_photons;
+  Out_Ptr->batches = num_batches;
+  Out_Ptr->err_rd = err[0];
+  Out_Ptr->err_a = err[1];
+  Out_Ptr->err_rdr = err[2];
+  printf("Stopped after %d batches, %ld of %ld photons: relative error "
+      "Rd %.3g, A %.3g, Rd_r %.3g\n", num_batches, batch_photons, batch_cap,
+      err[0], err[1], err[2]);
+
+  if (VarBatches > 0)
+    ScaleErrors(In_Ptr);
+}
+
+/***********************************************************
+ *	Free the batches of a run, after its output is written.
+ ****/
+void FreeBatches(InputStruct * In_Ptr) {
+  if (VarBatches > 0) {
+    FreeOutputData(*In_Ptr, &err_out);
+    free(layer_of_iz);
+  }
+  free(last);
+  free(sq);
+}
+
+/***********************************************************
+ *	Write an error section of N values, one per line.
+ ****/
+static void WriteErr1D(FILE * File, char * Flag, double * V, short N) {
+  short i;
+
+  fprintf(File, "%s\n", Flag);
+  for (i=0; i<N; i++)
+    fprintf(File, "%12.4E\n", V[i]);
+  fprintf(File, "\n");
+}
+
+/***********************************************************
+ *	Write an error section of N1 x N2 values, 5 per line.
+ ****/
+static void WriteErr2D(FILE * File, char * Flag, double ** M, short N1,
+    short N2) {
+  short i, j;
+
+  fprintf(File, "%s\n", Flag);
+  for (i=0; i<N1; i++)
+    for (j=0; j<N2; j++) {
+      fprintf(File, "%12.4E ", M[i][j]);
+      if ((i*N2 + j + 1)%5 == 0)
+        fprintf(File, "\n");
+    }
+  fprintf(File, "\n\n");
+}
+
+/***********************************************************
+ *	Write the standard errors of -V after the means.
+ ****/
+void WriteBatchErrors(FILE * File, InputStruct In_Parm) {
+  if (VarBatches == 0)
+    return;
+
+  fprintf(File, "\n# Standard errors of the values above, from %d "
+      "batches.\n\n", num_batches);
+  fprintf(File, "RAT_err #Standard errors of Rd, A, Tt. [-]\n");
+  fprintf(File, "%-14.6G \t#Diffuse reflectance [-]\n", err_out.Rd);
+  fprintf(File, "%-14.6G \t#Absorbed fraction [-]\n", err_out.A);
+  fprintf(File, "%-14.6G \t#Transmittance [-]\n\n", err_out.Tt);
+
+  WriteErr1D(File, "A_l_err #A_l[1], [2],..A_l[nl]. [-]", err_out.A_l+1,
+      In_Parm.num_layers);
+  WriteErr1D(File, "A_z_err #A[0], [1],..A[nz-1]. [1/cm]", err_out.A_z,
+      In_Parm.nz);
+  WriteErr1D(File, "Rd_r_err #Rd[0], [1],..Rd[nr-1]. [1/cm2]", err_out.Rd_r,
+      In_Parm.nr);
+  WriteErr1D(File, "Rd_a_err #Rd[0], [1],..Rd[na-1]. [sr-1]", err_out.Rd_a,
+      In_Parm.na);
+  WriteErr1D(File, "Tt_r_err #Tt[0], [1],..Tt[nr-1]. [1/cm2]", err_out.Tt_r,
+      In_Parm.nr);
+  WriteErr1D(File, "Tt_a_err #Tt[0], [1],..Tt[na-1]. [sr-1]", err_out.Tt_a,
+      In_Parm.na);
+
+  WriteErr2D(File, "# A_err[r][z], as A_rz. [1/cm3]\nA_rz_err",
+      err_out.A_rz, In_Parm.nr, In_Parm.nz);
+  WriteErr2D(File, "# Rd_err[r][angle], as Rd_ra. [1/(cm2sr)]\nRd_ra_err",
+      err_out.Rd_ra, In_Parm.nr, In_Parm.na);
+  WriteErr2D(File, "# Tt_err[r][angle], as Tt_ra. [1/(cm2sr)]\nTt_ra_err",
+      err_out.Tt_ra, In_Parm.nr, In_Parm.na);
+}
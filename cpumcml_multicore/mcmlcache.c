@@ -0,0 +1,318 @@
+/***********************************************************
+ *	Result cache, -Q<dir>[,<MB>].
+ *
+ *	The summed fixed-point tallies of a run are kept in
+ *	<dir>, in a file named by a hash of everything they
+ *	depend on but the photons (CacheKey()), and by the
+ *	photons: <hash>-<photons>.mcq. A run whose entry is
+ *	there is not traced: its tallies are read into the
+ *	first shard and the photon pool is left empty, so that
+ *	the output is written at once. With RNG_PHILOX on one
+ *	node, an entry of the same parameters and fewer photons
+ *	M is topped up instead. Only the photons M.. of the run
+ *	are traced, and as the random numbers belong to the
+ *	photons, the output is that of tracing all of them.
+ *	Every traced run is stored.
+ *
+ *	An entry holds the text of its key, so a collision of
+ *	the hashes is a miss. Using an entry sets its time of
+ *	modification, and after a store the least recently
+ *	used entries are removed until the cache is within
+ *	<MB> (default CACHE_MB). Entries are written as
+ *	<entry>.<pid>.tmp and renamed, so that several jobs can
+ *	share the cache.
+ ****/
+
+#include "mcml.h"
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#define CACHE_MAGIC "MCMLQCH1"
+#define CACHE_SUFFIX ".mcq"
+#define CACHE_NAME_LEN 64 /* of <hash>-<photons>.mcq. */
+
+/****
+ *	Head of a cache entry. It is followed by the key_len
+ *	characters of the key text, then by the n_bins sums of
+ *	A_rz, Rd_ra and Tt_ra in units of 1/WEIGHT_SCALE.
+ ****/
+typedef struct {
+  char magic[8];
+  long num_photons;
+  short nz, nr, na;
+  long n_bins;
+  long key_len;
+} CacheHead;
+
+/****
+ *	An entry found in the cache directory.
+ ****/
+typedef struct {
+  char name[CACHE_NAME_LEN];
+  long long size; /* [bytes] */
+  time_t used; /* time of modification. */
+} CacheEntry;
+
+/* Stores and evictions of the runs of -J, one at a time. */
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/***********************************************************
+ *	Write the key of a run to a new string at *Text_Ptr
+ *	and return its hash. The key is that of the top-ups
+ *	(RunKey()) after the version of the tallies
+ *	(CACHE_VERSION).
+ ****/
+static unsigned long long CacheKey(InputStruct * In_Ptr, char ** Text_Ptr) {
+  char * key = RunKey(In_Ptr);
+  char * text = (char *)malloc(strlen(key) + 32);
+
+  if (text == NULL)
+    nrerror("allocation failure in CacheKey()");
+  sprintf(text, "mcml %d\n%s", CACHE_VERSION, key);
+  free(key);
+
+  *Text_Ptr = text;
+  return (HashBytes(0xcbf29ce484222325ULL, (unsigned char *)text,
+      strlen(text)));
+}
+
+/***********************************************************
+ *	Path of the entry of Key with Num_Photons.
+ ****/
+static void EntryPath(char * Path, unsigned long long Key, long Num_Photons) {
+  sprintf(Path, "%s/%016llx-%ld%s", CacheDir, Key, Num_Photons, CACHE_SUFFIX);
+}
+
+/***********************************************************
+ *	List the entries of the cache into a new array at
+ *	*Entries_Ptr and return their number.
+ ****/
+static long ListCache(CacheEntry ** Entries_Ptr) {
+  DIR * dir = opendir(CacheDir);
+  struct dirent * d;
+  CacheEntry * e = NULL;
+  long n = 0, size = 0;
+
+  *Entries_Ptr = NULL;
+  if (dir == NULL)
+    return (0);
+  while ((d = readdir(dir)) != NULL) {
+    size_t len = strlen(d->d_name);
+    char path[2*STRLEN];
+    struct stat st;
+
+    if (len >= CACHE_NAME_LEN || len <= strlen(CACHE_SUFFIX)
+        || strcmp(d->d_name + len - strlen(CACHE_SUFFIX), CACHE_SUFFIX) != 0)
+      continue;
+    sprintf(path, "%s/%s", CacheDir, d->d_name);
+    if (stat(path, &st) != 0)
+      continue; /* removed by another job. */
+    if (n == size) {
+      size = size ? 2*size : 64;
+      e = (CacheEntry *)realloc(e, size*sizeof(CacheEntry));
+      if (e == NULL)
+        nrerror("allocation failure in ListCache()");
+    }
+    strcpy(e[n].name, d->d_name);
+    e[n].size = st.st_size;
+    e[n].used = st.st_mtime;
+    n++;
+  }
+  closedir(dir);
+  *Entries_Ptr = e;
+  return (n);
+}
+
+/***********************************************************
+ *	Add the tallies of the entry Path to the first shard
+ *	of Tally_Ptr, if the entry is there and its key is
+ *	Text. Return 1 if they were added, and mark the entry
+ *	as used.
+ ****/
+static Boolean ReadEntry(char * Path, char * Text, InputStruct * In_Ptr,
+    TallyStruct * Tally_Ptr) {
+  long n_rz = (long)In_Ptr->nr*In_Ptr->nz;
+  long n_ra = (long)In_Ptr->nr*In_Ptr->na;
+  long key_len = (long)strlen(Text), i;
+  unsigned long long * buf;
+  char * key;
+  CacheHead head;
+  Boolean ok;
+  FILE * file = fopen(Path, "rb");
+
+  if (file == NULL)
+    return (0);
+  if (fread(&head, sizeof(head), 1, file) != 1
+      || memcmp(head.magic, CACHE_MAGIC, 8) != 0 || head.key_len != key_len
+      || head.n_bins != n_rz + 2*n_ra) {
+    fclose(file);
+    return (0);
+  }
+
+  key = (char *)malloc(key_len);
+  buf = (unsigned long long *)malloc(head.n_bins*sizeof(unsigned long long));
+  if (key == NULL || buf == NULL)
+    nrerror("allocation failure in ReadEntry()");
+  ok = fread(key, 1, key_len, file) == (size_t)key_len
+      && memcmp(key, Text, key_len) == 0
+      && fread(buf, sizeof(unsigned long long), head.n_bins, file)
+      == (size_t)head.n_bins;
+  fclose(file);
+
+  if (ok) {
+    for (i=0; i<n_rz; i++)
+      Tally_Ptr->A_rz[i] += buf[i];
+    for (i=0; i<n_ra; i++) {
+      Tally_Ptr->Rd_ra[i] += buf[n_rz + i];
+      Tally_Ptr->Tt_ra[i] += buf[n_rz + n_ra + i];
+    }
+    utime(Path, NULL);
+  }
+  free(key);
+  free(buf);
+  return (ok);
+}
+
+/***********************************************************
+ *	Look the run of In_Ptr up in the cache, after its
+ *	tallies and photon pool have been set up. On a hit, add
+ *	the tallies of the entry and empty the pool. On a
+ *	top-up of M photons, add them and leave the photons
+ *	M.. of the run in the pool.
+ ****/
+void CacheLookup(InputStruct * In_Ptr, TallyStruct * Tally_Ptr,
+    PoolStruct * Pool_Ptr) {
+  char path[2*STRLEN], prefix[32];
+  char * text;
+  unsigned long long key = CacheKey(In_Ptr, &text);
+  CacheEntry * e;
+  long n, i, m = 0;
+
+  EntryPath(path, key, In_Ptr->num_photons);
+  if (ReadEntry(path, text, In_Ptr, Tally_Ptr)) {
+    printf("Cache hit %s\n", path);
+    Pool_Ptr->left = 0;
+    free(text);
+    return;
+  }
+
+  /* The photons of a node are not those of the first M. */
+  if (RngType == RNG_PHILOX && NUM_NODE == 1) {
+    sprintf(prefix, "%016llx-", key);
+    n = ListCache(&e);
+    for (i=0; i<n; i++) {
+      long k;
+
+      if (strncmp(e[i].name, prefix, strlen(prefix)) == 0
+          && sscanf(e[i].name + strlen(prefix), "%ld", &k) == 1
+          && k > m && k < In_Ptr->num_photons)
+        m = k;
+    }
+    free(e);
+    EntryPath(path, key, m);
+    if (m > 0 && ReadEntry(path, text, In_Ptr, Tally_Ptr)) {
+      Pool_Ptr->first = m;
+      Pool_Ptr->left = Pool_Ptr->node = In_Ptr->num_photons - m;
+      printf("Cache top-up of %s: %ld of %ld photons left\n", path,
+          Pool_Ptr->left, In_Ptr->num_photons);
+    }
+  }
+  free(text);
+}
+
+static int CompareUsed(const void * A, const void * B) {
+  const CacheEntry * a = (const CacheEntry *)A;
+  const CacheEntry * b = (const CacheEntry *)B;
+
+  if (a->used != b->used)
+    return (a->used < b->used ? -1 : 1);
+  return (strcmp(a->name, b->name));
+}
+
+/***********************************************************
+ *	Remove the least recently used entries until the cache
+ *	is within CacheMB.
+ ****/
+static void EvictCache(void) {
+  long long limit = (long long)(CacheMB*1048576.0), total = 0;
+  char path[2*STRLEN];
+  CacheEntry * e;
+  long n = ListCache(&e), i, removed = 0;
+
+  for (i=0; i<n; i++)
+    total += e[i].size;
+  if (total > limit) {
+    qsort(e, n, sizeof(CacheEntry), CompareUsed);
+    for (i=0; i<n && total>limit; i++) {
+      sprintf(path, "%s/%s", CacheDir, e[i].name);
+      if (remove(path) == 0)
+        removed++;
+      total -= e[i].size; /* or another job removed it. */
+    }
+    printf("Cache: removed %ld least recently used entries\n", removed);
+  }
+  free(e);
+}
+
+/***********************************************************
+ *	Store the summed tallies of Out_Ptr, of the run of
+ *	In_Ptr, unless the cache has them, and keep the cache
+ *	within CacheMB. A failed write is reported, and the
+ *	run goes on.
+ ****/
+void CacheStore(InputStruct * In_Ptr, OutStruct * Out_Ptr) {
+  long n_rz = (long)In_Ptr->nr*In_Ptr->nz;
+  long n_ra = (long)In_Ptr->nr*In_Ptr->na;
+  char path[2*STRLEN], tmp[2*STRLEN+32];
+  char * text;
+  unsigned long long key = CacheKey(In_Ptr, &text);
+  CacheHead head;
+  FILE * file;
+  Boolean ok;
+
+  EntryPath(path, key, In_Ptr->num_photons);
+  pthread_mutex_lock(&cache_lock);
+  if (access(path, F_OK) == 0) { /* a hit, or stored by another job. */
+    pthread_mutex_unlock(&cache_lock);
+    free(text);
+    return;
+  }
+  if (mkdir(CacheDir, 0777) != 0 && errno != EEXIST)
+    fprintf(stderr, "cannot create the cache %s\n", CacheDir);
+
+  memset(&head, 0, sizeof(head));
+  memcpy(head.magic, CACHE_MAGIC, 8);
+  head.num_photons = In_Ptr->num_photons;
+  head.nz = In_Ptr->nz;
+  head.nr = In_Ptr->nr;
+  head.na = In_Ptr->na;
+  head.n_bins = n_rz + 2*n_ra;
+  head.key_len = (long)strlen(text);
+
+  sprintf(tmp, "%s.%ld.tmp", path, (long)getpid());
+  file = fopen(tmp, "wb");
+  ok = file != NULL
+      && fwrite(&head, sizeof(head), 1, file) == 1
+      && fwrite(text, 1, head.key_len, file) == (size_t)head.key_len
+      && fwrite(Out_Ptr->A_rz_raw, sizeof(unsigned long long), n_rz, file)
+      == (size_t)n_rz
+      && fwrite(Out_Ptr->Rd_ra_raw, sizeof(unsigned long long), n_ra, file)
+      == (size_t)n_ra
+      && fwrite(Out_Ptr->Tt_ra_raw, sizeof(unsigned long long), n_ra, file)
+      == (size_t)n_ra;
+  if (file != NULL)
+    ok = (fclose(file) == 0) && ok;
+  if (!ok || rename(tmp, path) != 0) {
+    fprintf(stderr, "cannot write the cache entry %s\n", path);
+    remove(tmp);
+  } else {
+    printf("Cache store %s\n", path);
+    EvictCache();
+  }
+  pthread_mutex_unlock(&cache_lock);
+  free(text);
+}
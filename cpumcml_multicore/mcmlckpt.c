@@ -0,0 +1,569 @@
+/***********************************************************
+ *	Checkpoints.
+ *
+ *	With -K<file>, the state of a run is written to <file>
+ *	every -I<minutes> (default 10), and -R<file> resumes
+ *	from it. To take a checkpoint the main thread sets
+ *	CheckpointPending. TakePhoton() then grants no new
+ *	lease, so each engine finishes the photons it holds and
+ *	returns, and its thread spills its A_rz tile and buffer
+ *	into the shards and parks in CheckpointPause(). Once all
+ *	threads are parked no photon is in flight, and the
+ *	checkpoint holds only the photons left in the pool, the
+ *	states of the generators and the summed tallies. The
+ *	threads then lease on. Draining costs each thread at
+ *	most the tail of one lease.
+ *
+ *	The file is written as <file>.tmp, synced and renamed
+ *	over <file>, so that an interrupted write leaves the
+ *	previous checkpoint in place. When a run ends, the
+ *	checkpoint is set to the start of the next run, and it
+ *	is removed after the last run. A checkpoint holds the
+ *	key of its run (RunKey()), and -R rejects one of another
+ *	input or other options.
+ *
+ *	With RNG_PHILOX the random numbers belong to the
+ *	photons, so a resumed run gives the same output as an
+ *	uninterrupted one, with any number of threads. The
+ *	other generators run per thread and need the same -T.
+ *
+ *	The threads meet in the same way at the end of each
+ *	batch of -U or -V, see mcmlbatch.c: they wait for the main
+ *	thread to refill the pool or to end the run.
+ *
+ *	A top-up is a checkpoint of a finished run. With -X,
+ *	each run writes its summed tallies and the states of
+ *	its generators to <output file>.raw, along with its
+ *	key (RunKey()). -X<K> reads them back instead of
+ *	starting afresh, traces K more photons and writes the
+ *	results and the .raw of all of them. A .raw of another
+ *	key is rejected. With RNG_PHILOX the photons traced are
+ *	those a run of all of them would trace after the first,
+ *	so the output is the same; the other generators go on
+ *	from their saved states and need the same -T.
+ ****/
+
+#include "mcml.h"
+#include <pthread.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define CKPT_MAGIC "MCMLCKP2"
+#define RAW_MAGIC "MCMLRAW1"
+
+/****
+ *	Head of a checkpoint file. Unless fresh is set, it is
+ *	followed by the key_len characters of the key of the
+ *	run (RunKey()), the generator states (WriteRandomState)
+ *	and the n_bins fixed-point sums of A_rz, Rd_ra and
+ *	Tt_ra.
+ ****/
+typedef struct {
+  char magic[8];
+  long run; /* index of the run in the input file. */
+  int fresh; /* 1 if the run has not started. */
+  long num_photons;
+  short nr, nz, na;
+  int num_threads, rng_type;
+  unsigned long long seed;
+  int num_node, current_node;
+  long photons_left; /* photons of this node not yet leased. */
+  long key_len;
+  long n_bins;
+} CheckpointHead;
+
+/****
+ *	Head of a top-up file. It is followed by the key_len
+ *	characters of the key of the run, the generator states
+ *	and the n_bins fixed-point sums of A_rz, Rd_ra and
+ *	Tt_ra.
+ ****/
+typedef struct {
+  char magic[8];
+  long num_photons; /* traced. */
+  int num_threads;
+  long key_len;
+  long n_bins;
+} RawHead;
+
+volatile int CheckpointPending = 0;
+
+static pthread_mutex_t ckpt_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ckpt_cond = PTHREAD_COND_INITIALIZER;
+static int ckpt_parked = 0; /* threads waiting in CheckpointPause(). */
+static int ckpt_finished = 0; /* threads done with the pool. */
+static int ckpt_round = 0; /* pools handed out, with -U or -V. */
+static Boolean ckpt_more = 0; /* 1 if the pool has been refilled. */
+
+static double Now(void) {
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (tv.tv_sec + 1.0E-6*tv.tv_usec);
+}
+
+/***********************************************************
+ *	Write the sums over the shards of N bins, Stride apart.
+ ****/
+static void WriteShards(FILE * File, unsigned long long * Shard, long Stride,
+    long N, int Num_Shards) {
+  unsigned long long buf[1024];
+  long i, k;
+  int s;
+
+  for (i=0; i<N; i+=1024) {
+    long n = N-i < 1024 ? N-i : 1024;
+
+    for (k=0; k<n; k++) {
+      buf[k] = 0;
+      for (s=0; s<Num_Shards; s++)
+        buf[k] += Shard[s*Stride + i + k];
+    }
+    fwrite(buf, sizeof(unsigned long long), n, File);
+  }
+}
+
+/***********************************************************
+ *	Add the N fixed-point sums of each of A_rz, Rd_ra and
+ *	Tt_ra in File to the first shard of Tally_Ptr. Return 0
+ *	if File ends first.
+ ****/
+static Boolean ReadTallies(FILE * File, InputStruct * In_Ptr,
+    TallyStruct * Tally_Ptr) {
+  unsigned long long * dst[3];
+  long n[3], i;
+  int k;
+
+  dst[0] = Tally_Ptr->A_rz;
+  dst[1] = Tally_Ptr->Rd_ra;
+  dst[2] = Tally_Ptr->Tt_ra;
+  n[0] = (long)In_Ptr->nr*In_Ptr->nz;
+  n[1] = n[2] = (long)In_Ptr->nr*In_Ptr->na;
+  for (k=0; k<3; k++)
+    for (i=0; i<n[k]; i++) {
+      unsigned long long v;
+
+      if (fread(&v, sizeof(v), 1, File) != 1)
+        return (0);
+      dst[k][i] += v;
+    }
+  return (1);
+}
+
+/***********************************************************
+ *	Sync and close File, written as Tmp, and rename it
+ *	over Name. Return 0, and remove Tmp, if that fails.
+ ****/
+static Boolean CommitFile(FILE * File, char * Tmp, char * Name) {
+  Boolean ok;
+
+  ok = fflush(File) == 0 && !ferror(File) && fsync(fileno(File)) == 0;
+  ok = (fclose(File) == 0) && ok;
+  if (!ok || rename(Tmp, Name) != 0) {
+    remove(Tmp);
+    return (0);
+  }
+  return (1);
+}
+
+/***********************************************************
+ *	Read the Key_Len characters of a key from File and
+ *	return 1 if they are the key of the run of In_Ptr.
+ ****/
+static Boolean SameKey(FILE * File, long Key_Len, InputStruct * In_Ptr) {
+  char * text = RunKey(In_Ptr);
+  char * key = NULL;
+  Boolean same;
+
+  if (Key_Len == (long)strlen(text))
+    key = (char *)malloc(Key_Len);
+  same = key != NULL && fread(key, 1, Key_Len, File) == (size_t)Key_Len
+      && memcmp(key, text, Key_Len) == 0;
+  free(key);
+  free(text);
+  return (same);
+}
+
+/***********************************************************
+ *	Write a checkpoint of run Run to CheckpointFile. A
+ *	fresh checkpoint marks the start of the run and holds
+ *	no state. A failed write is reported, and the run goes
+ *	on.
+ ****/
+static void WriteCheckpoint(InputStruct * In_Ptr, TallyStruct * Tally_Ptr,
+    long Run, Boolean Fresh, long Photons_Left) {
+  char tmp[STRLEN+8];
+  CheckpointHead head;
+  char * text = NULL;
+  FILE * file;
+
+  memset(&head, 0, sizeof(head));
+  memcpy(head.magic, CKPT_MAGIC, 8);
+  head.run = Run;
+  head.fresh = Fresh;
+  head.num_threads = NumThreads;
+  head.rng_type = RngType;
+  head.seed = RngSeed;
+  head.num_node = NUM_NODE;
+  head.current_node = CURRENT_NODE;
+  if (!Fresh) {
+    head.num_photons = In_Ptr->num_photons;
+    head.nr = In_Ptr->nr;
+    head.nz = In_Ptr->nz;
+    head.na = In_Ptr->na;
+    head.photons_left = Photons_Left;
+    text = RunKey(In_Ptr);
+    head.key_len = (long)strlen(text);
+    head.n_bins = (long)In_Ptr->nr*(In_Ptr->nz + 2*In_Ptr->na);
+  }
+
+  sprintf(tmp, "%.*s.tmp", STRLEN-1, CheckpointFile);
+  file = fopen(tmp, "wb");
+  if (file == NULL) {
+    fprintf(stderr, "cannot write the checkpoint %s\n", tmp);
+    free(text);
+    return;
+  }
+  fwrite(&head, sizeof(head), 1, file);
+  if (!Fresh) {
+    long n_rz = (long)In_Ptr->nr*In_Ptr->nz;
+    long n_ra = (long)In_Ptr->nr*In_Ptr->na;
+
+    fwrite(text, 1, head.key_len, file);
+    WriteRandomState(file);
+    WriteShards(file, Tally_Ptr->A_rz, Tally_Ptr->rz_stride, n_rz,
+        Tally_Ptr->num_shards);
+    WriteShards(file, Tally_Ptr->Rd_ra, Tally_Ptr->ra_stride, n_ra,
+        Tally_Ptr->num_shards);
+    WriteShards(file, Tally_Ptr->Tt_ra, Tally_Ptr->ra_stride, n_ra,
+        Tally_Ptr->num_shards);
+  }
+  if (!CommitFile(file, tmp, CheckpointFile))
+    fprintf(stderr, "cannot write the checkpoint %s\n", CheckpointFile);
+  free(text);
+}
+
+/***********************************************************
+ *	Open ResumeFile and read its head.
+ ****/
+static FILE * OpenCheckpoint(CheckpointHead * Head_Ptr) {
+  FILE * file = fopen(ResumeFile, "rb");
+
+  if (file == NULL || fread(Head_Ptr, sizeof(CheckpointHead), 1, file) != 1
+      || memcmp(Head_Ptr->magic, CKPT_MAGIC, 8) != 0) {
+    char msg[STRLEN+32];
+
+    sprintf(msg, "%.*s is not a checkpoint", STRLEN-1, ResumeFile);
+    nrerror(msg);
+  }
+  return (file);
+}
+
+/***********************************************************
+ *	Return the index of the run to resume with -R, 0 for
+ *	none. The runs before it are complete.
+ ****/
+long ResumeRun(void) {
+  CheckpointHead head;
+
+  if (ResumeFile == NULL)
+    return (0);
+  fclose(OpenCheckpoint(&head));
+  return (head.run);
+}
+
+/***********************************************************
+ *	If the checkpoint of -R is within run Run, restore the
+ *	generators and add its tallies to the first shard, and
+ *	return the photons left then. Otherwise return
+ *	Photons_Left. Call after initRandom() and InitTally().
+ ****/
+long ResumeCheckpoint(InputStruct * In_Ptr, TallyStruct * Tally_Ptr,
+    long Run, long Photons_Left) {
+  CheckpointHead head;
+  FILE * file;
+  long n_rz = (long)In_Ptr->nr*In_Ptr->nz;
+  long n_ra = (long)In_Ptr->nr*In_Ptr->na;
+
+  if (ResumeFile == NULL)
+    return (Photons_Left);
+  file = OpenCheckpoint(&head);
+  if (head.run != Run || head.fresh) {
+    fclose(file);
+    return (Photons_Left);
+  }
+
+  if (head.rng_type != RngType || head.seed != RngSeed)
+    nrerror("resume with the generator (-M) and seed (-S) of the checkpoint");
+  if (head.num_node != NUM_NODE || head.current_node != CURRENT_NODE)
+    nrerror("resume on the node of the checkpoint");
+  if (head.num_photons != In_Ptr->num_photons
+      || head.n_bins != n_rz + 2*n_ra || !SameKey(file, head.key_len, In_Ptr))
+    nrerror("the checkpoint is of another input or other options");
+  if (RngType != RNG_PHILOX && head.num_threads != NumThreads)
+    nrerror("resume with the -T of the checkpoint, or use -Mphilox");
+
+  if (!ReadRandomState(file) || !ReadTallies(file, In_Ptr, Tally_Ptr))
+    nrerror("truncated checkpoint");
+  fclose(file);
+
+  printf("Resumed run %ld from %s: %ld of %ld photons left\n", Run+1,
+      ResumeFile, head.photons_left, NodePhotons(In_Ptr->num_photons));
+  ResumeFile = NULL; /* later runs start afresh. */
+  return (head.photons_left);
+}
+
+/***********************************************************
+ *	Called by a worker thread when its engine returns.
+ *	During a checkpoint, spill the private tallies and wait
+ *	for the checkpoint to be written, then return 1 for
+ *	the engine to go on. Otherwise the pool is empty: with
+ *	-U or -V wait for the next batch and return 1 if there is
+ *	one. Return 0 when the run is done for the thread.
+ ****/
+Boolean CheckpointPause(TallyStruct * Tally_Ptr, OutStruct * Out_Ptr) {
+  Boolean more;
+
+  if (CheckpointFile == NULL && !BATCHED)
+    return (0);
+
+  SpillThreadOut(Tally_Ptr, Out_Ptr);
+  pthread_mutex_lock(&ckpt_lock);
+  if (!CheckpointPending) {
+    int round = ckpt_round;
+
+    ckpt_finished++;
+    pthread_cond_broadcast(&ckpt_cond);
+    while (BATCHED && round == ckpt_round)
+      pthread_cond_wait(&ckpt_cond, &ckpt_lock);
+    more = BATCHED && ckpt_more;
+    pthread_mutex_unlock(&ckpt_lock);
+    return (more);
+  }
+  ckpt_parked++;
+  pthread_cond_broadcast(&ckpt_cond);
+  while (CheckpointPending)
+    pthread_cond_wait(&ckpt_cond, &ckpt_lock);
+  ckpt_parked--;
+  pthread_mutex_unlock(&ckpt_lock);
+  return (1);
+}
+
+/***********************************************************
+ *	Called by the main thread of run Run while the workers
+ *	trace: take a checkpoint every CheckpointMinutes, and
+ *	with -U or -V refill the pool after each batch, until all of
+ *	the workers are done.
+ ****/
+void CheckpointWait(InputStruct * In_Ptr, TallyStruct * Tally_Ptr, long Run) {
+  double interval = CheckpointMinutes*60.0;
+  double deadline = Now() + interval;
+
+  if (CheckpointFile == NULL && !BATCHED)
+    return;
+
+  pthread_mutex_lock(&ckpt_lock);
+  for (;;) {
+    struct timespec ts;
+
+    if (ckpt_finished == NumThreads) { /* the pool is drained. */
+      long n = BATCHED ? BatchDone(Tally_Ptr) : 0;
+
+      if (n > 0)
+        RefillPhotons(n);
+      ckpt_more = n > 0;
+      ckpt_finished = 0;
+      ckpt_round++;
+      pthread_cond_broadcast(&ckpt_cond);
+      if (n == 0)
+        break;
+      continue;
+    }
+    if (CheckpointFile == NULL) {
+      pthread_cond_wait(&ckpt_cond, &ckpt_lock);
+      continue;
+    }
+
+    ts.tv_sec = (time_t)deadline;
+    ts.tv_nsec = (long)((deadline - ts.tv_sec)*1.0E9);
+    pthread_cond_timedwait(&ckpt_cond, &ckpt_lock, &ts);
+    if (ckpt_finished == NumThreads || Now() < deadline)
+      continue;
+
+    CheckpointPending = 1;
+    while (ckpt_parked + ckpt_finished < NumThreads)
+      pthread_cond_wait(&ckpt_cond, &ckpt_lock);
+    if (PhotonsLeft() > 0) {
+      double t = Now();
+
+      WriteCheckpoint(In_Ptr, Tally_Ptr, Run, 0, PhotonsLeft());
+      printf("Checkpoint %s: %ld photons left, %.3f seconds\n",
+          CheckpointFile, PhotonsLeft(), Now() - t);
+      fflush(stdout);
+    }
+    CheckpointPending = 0;
+    pthread_cond_broadcast(&ckpt_cond);
+    deadline = Now() + interval;
+  }
+  pthread_mutex_unlock(&ckpt_lock);
+}
+
+/***********************************************************
+ *	Called when run Run has been written out: point the
+ *	checkpoint at the next run, or remove it after the last.
+ ****/
+void CheckpointRunDone(long Run, Boolean Last) {
+  if (CheckpointFile == NULL)
+    return;
+  if (Last)
+    remove(CheckpointFile);
+  else
+    WriteCheckpoint(NULL, NULL, Run+1, 1, 0);
+}
+
+/***********************************************************
+ *	FNV-1a hash of N bytes at P, going on from H.
+ ****/
+unsigned long long HashBytes(unsigned long long H,
+    const unsigned char * P, size_t N) {
+  while (N-- > 0) {
+    H ^= *P++;
+    H *= 0x100000001b3ULL;
+  }
+  return (H);
+}
+
+/***********************************************************
+ *	Hash of the contents of File, 0 if it cannot be read.
+ ****/
+static unsigned long long HashFile(char * File) {
+  unsigned char buf[4096];
+  unsigned long long h = 0xcbf29ce484222325ULL;
+  FILE * file = fopen(File, "rb");
+  size_t n;
+
+  if (file == NULL)
+    return (0);
+  while ((n = fread(buf, 1, sizeof(buf), file)) > 0)
+    h = HashBytes(h, buf, n);
+  fclose(file);
+  return (h);
+}
+
+/***********************************************************
+ *	Return the key of the run of In_Ptr, a new string. It
+ *	is the text of everything the tallies depend on for a
+ *	given number of photons: the engine, the generator and
+ *	its seed, the node, the options that change the physics
+ *	or its approximations, the grid and the layers, and the
+ *	contents of the phase function files. Numbers are
+ *	written with 17 digits, so equal keys mean equal
+ *	parameters.
+ ****/
+char * RunKey(InputStruct * In_Ptr) {
+  short nl = In_Ptr->num_layers, i;
+  size_t size = 512 + (nl + 2)*160 + NumPhaseFiles*48;
+  char * text = (char *)malloc(size);
+  char * p = text;
+  int f;
+
+  if (text == NULL)
+    nrerror("allocation failure in RunKey()");
+  p += sprintf(p, "engine %d rng %d seed %llu node %d/%d\n", EngineType,
+      RngType, RngSeed, CURRENT_NODE, NUM_NODE);
+  p += sprintf(p, "A %d Phg %d F %.17g\n", IgnoreA, PhaseHG, FresnelTol);
+  p += sprintf(p, "Wth %.17g dz %.17g dr %.17g da %.17g nz %hd nr %hd "
+      "na %hd layers %hd\n", In_Ptr->Wth, In_Ptr->dz, In_Ptr->dr,
+      In_Ptr->da, In_Ptr->nz, In_Ptr->nr, In_Ptr->na, nl);
+  for (i=0; i<=nl+1; i++) {
+    LayerStruct * l = &In_Ptr->layerspecs[i];
+
+    p += sprintf(p, "%.17g %.17g %.17g %.17g %.17g %.17g\n", l->n, l->mua,
+        l->mus, l->g, l->z0, l->z1);
+  }
+  for (f=0; f<NumPhaseFiles; f++)
+    p += sprintf(p, "P %hd %016llx\n", PhaseLayer[f], HashFile(PhaseFile[f]));
+  return (text);
+}
+
+/***********************************************************
+ *	Name of the top-up file of the run of In_Ptr.
+ ****/
+static void RawPath(char * Path, InputStruct * In_Ptr) {
+  sprintf(Path, "%.*s%s", STRLEN-1, In_Ptr->out_fname, RAW_SUFFIX);
+}
+
+/***********************************************************
+ *	Start a top-up of the run of In_Ptr with -X<K>: restore
+ *	the generators and add the tallies of its top-up file
+ *	to the first shard, and make the run one of N+K photons.
+ *	Return N, the photons of the file. Call after
+ *	initRandom() and InitTally().
+ ****/
+long TopUpStart(InputStruct * In_Ptr, TallyStruct * Tally_Ptr) {
+  char path[STRLEN+8], msg[2*STRLEN];
+  RawHead head;
+  FILE * file;
+
+  RawPath(path, In_Ptr);
+  file = fopen(path, "rb");
+  if (file == NULL || fread(&head, sizeof(head), 1, file) != 1
+      || memcmp(head.magic, RAW_MAGIC, 8) != 0) {
+    sprintf(msg, "%s is not the top-up file of a run (-X)", path);
+    nrerror(msg);
+  }
+  if (!SameKey(file, head.key_len, In_Ptr)
+      || head.n_bins != (long)In_Ptr->nr*(In_Ptr->nz + 2*In_Ptr->na)) {
+    sprintf(msg, "%s is of another input or other options", path);
+    nrerror(msg);
+  }
+  if (RngType != RNG_PHILOX && head.num_threads != NumThreads)
+    nrerror("top up with the -T of the first run, or use -Mphilox");
+  if (!ReadRandomState(file) || !ReadTallies(file, In_Ptr, Tally_Ptr)) {
+    sprintf(msg, "truncated top-up file %s", path);
+    nrerror(msg);
+  }
+  fclose(file);
+
+  In_Ptr->num_photons = head.num_photons + TopUpPhotons;
+  printf("Top-up of %s: %ld photons on top of %ld\n", path, TopUpPhotons,
+      head.num_photons);
+  return (head.num_photons);
+}
+
+/***********************************************************
+ *	Write the top-up file of the run of In_Ptr, whose
+ *	threads are all done, from the summed tallies of
+ *	Out_Ptr. A failed write is reported, and the run goes
+ *	on.
+ ****/
+void TopUpStore(InputStruct * In_Ptr, OutStruct * Out_Ptr) {
+  long n_rz = (long)In_Ptr->nr*In_Ptr->nz;
+  long n_ra = (long)In_Ptr->nr*In_Ptr->na;
+  char path[STRLEN+8], tmp[STRLEN+16];
+  char * text = RunKey(In_Ptr);
+  RawHead head;
+  FILE * file;
+
+  memset(&head, 0, sizeof(head));
+  memcpy(head.magic, RAW_MAGIC, 8);
+  head.num_photons = In_Ptr->num_photons;
+  head.num_threads = NumThreads;
+  head.key_len = (long)strlen(text);
+  head.n_bins = n_rz + 2*n_ra;
+
+  RawPath(path, In_Ptr);
+  sprintf(tmp, "%s.tmp", path);
+  file = fopen(tmp, "wb");
+  if (file != NULL) {
+    fwrite(&head, sizeof(head), 1, file);
+    fwrite(text, 1, head.key_len, file);
+    WriteRandomState(file);
+    WriteShards(file, Out_Ptr->A_rz_raw, 0, n_rz, 1);
+    WriteShards(file, Out_Ptr->Rd_ra_raw, 0, n_ra, 1);
+    WriteShards(file, Out_Ptr->Tt_ra_raw, 0, n_ra, 1);
+  }
+  if (file == NULL || !CommitFile(file, tmp, path))
+    fprintf(stderr, "cannot write the top-up file %s\n", path);
+  free(text);
+}
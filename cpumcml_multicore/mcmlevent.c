@@ -0,0 +1,639 @@
+/***********************************************************
+ *	Event-based engine.
+ *
+ *	Each thread keeps a bank of up to EVENT_BANK photons in
+ *	flight and advances all of them by one step per cycle,
+ *	in phases, as the event-based codes of reactor physics
+ *	do:
+ *
+ *	  Refill	launch photons into the dead slots.
+ *	  Classify	StepSize, HitBoundary and Hop of every
+ *			photon, which decide its next event.
+ *	  Sort		counting sort of the bank into the
+ *			photons that hit a boundary and those
+ *			that interact; the dead are dropped.
+ *	  Boundary	CrossOrNot of the first segment.
+ *	  Interact	Drop and Spin of the second segment.
+ *	  Roulette	of the whole bank.
+ *
+ *	Unlike the lanes of the packet engine, which compute
+ *	both branches of a step and keep one, each loop here
+ *	does the work of one event only, over contiguous
+ *	photons. The segments are padded with dead photons to
+ *	multiples of EVENT_PAD, so the vector loops never run
+ *	their scalar remainders. The sort moves the photon
+ *	states between the two copies of the bank.
+ *
+ *	The physics, and the random numbers each photon draws
+ *	per step, are those of mcmlpacket.c: with RNG_PHILOX
+ *	the results are the same as those of the packet engine.
+ *
+ *	This file is compiled with SIMD_CFLAGS (see Makefile).
+ ****/
+
+#include "mcml.h"
+
+#define EVENT_BANK 2048	/* photons in flight per thread. */
+#define EVENT_PAD 16	/* segment alignment, >= the vector width. */
+#define EVENT_CAP (EVENT_BANK + 2*EVENT_PAD)
+/* slots of a bank. Slot EVENT_CAP holds the dead photon that */
+/* the sort pads the segments with. */
+
+#define EVENT_ARRAYS 64	/* most per-slot arrays of an EventStruct. */
+#define EVENT_ARRAY_BYTES (((EVENT_CAP+1)*sizeof(double) + 63) & ~(size_t)63)
+
+#define PAD(n) (((n) + EVENT_PAD-1) & ~(long)(EVENT_PAD-1))
+
+#define EVENT_BOUNDARY 0
+#define EVENT_INTERACT 1
+#define EVENT_DEAD 2
+
+#define COSZERO (1.0-1.0E-12)
+/* cosine of about 1e-6 rad. */
+
+#define COS90D  1.0E-6
+/* cosine of about 1.57 - 1e-6 rad. */
+
+/****
+ *	States of the photons of a bank, as PacketStruct. The
+ *	random numbers drawn with the step size are used after
+ *	the sort, so they move with the photon.
+ ****/
+typedef struct {
+  double * x, * y, * z;
+  double * ux, * uy, * uz;
+  double * w;
+  double * sleft;
+  double * theta, * psi, * cross;
+  long * layer;
+  long * alive;
+  long * id;
+  unsigned int * draw;
+} EventBankStruct;
+
+/****
+ *	The two copies of the bank of a thread, and the per-slot
+ *	scratch arrays of a cycle. Slots 0..m-1 are in use; after
+ *	the sort the first nb of them hit a boundary and the
+ *	next ni interact.
+ ****/
+typedef struct {
+  EventBankStruct bank[2];
+  int cur; /* copy in use. */
+  long m, nb, ni; /* multiples of EVENT_PAD. */
+
+  double * step, * roulette, * cost, * unused;
+  long * event, * perm;
+
+  /* Layer constants of the slots, as PacketMediumStruct. */
+  double * z0, * z1, * n, * n0, * n1, * g;
+  double * mut, * rmut, * mua_mut, * cos_crit0, * cos_crit1;
+  long * glass, * tab;
+
+  /* Tally requests, as PacketTallyStruct. */
+  long * escape, * ir, * iz;
+  double * dw;
+  double * uz1; /* cosine of the exit angle, binned by EventTally(). */
+
+  void * arrays[EVENT_ARRAYS];
+  int num_arrays;
+} EventStruct;
+
+/***********************************************************
+ *	Allocate a zeroed, aligned per-slot array of E.
+ ****/
+static void * EventArray(EventStruct * E) {
+  void * p;
+
+  if (E->num_arrays == EVENT_ARRAYS)
+    nrerror("too many arrays in EventArray()");
+  p = aligned_alloc(64, EVENT_ARRAY_BYTES);
+  if (p == NULL)
+    nrerror("allocation failure in EventArray()");
+  memset(p, 0, EVENT_ARRAY_BYTES);
+  E->arrays[E->num_arrays++] = p;
+  return (p);
+}
+
+static void InitEvent(EventStruct * E) {
+  int b, i;
+
+  memset(E, 0, sizeof(EventStruct));
+  for (b=0; b<2; b++) {
+    EventBankStruct * B = &E->bank[b];
+
+    B->x = EventArray(E);
+    B->y = EventArray(E);
+    B->z = EventArray(E);
+    B->ux = EventArray(E);
+    B->uy = EventArray(E);
+    B->uz = EventArray(E);
+    B->w = EventArray(E);
+    B->sleft = EventArray(E);
+    B->theta = EventArray(E);
+    B->psi = EventArray(E);
+    B->cross = EventArray(E);
+    B->layer = EventArray(E);
+    B->alive = EventArray(E);
+    B->id = EventArray(E);
+    B->draw = EventArray(E);
+    for (i=0; i<=EVENT_CAP; i++) {
+      B->layer[i] = 1; /* keep gathers of dead slots in range. */
+      B->uz[i] = 1.0;
+    }
+  }
+
+  E->step = EventArray(E);
+  E->roulette = EventArray(E);
+  E->cost = EventArray(E);
+  E->unused = EventArray(E);
+  E->event = EventArray(E);
+  E->perm = EventArray(E);
+  E->z0 = EventArray(E);
+  E->z1 = EventArray(E);
+  E->n = EventArray(E);
+  E->n0 = EventArray(E);
+  E->n1 = EventArray(E);
+  E->g = EventArray(E);
+  E->mut = EventArray(E);
+  E->rmut = EventArray(E);
+  E->mua_mut = EventArray(E);
+  E->cos_crit0 = EventArray(E);
+  E->cos_crit1 = EventArray(E);
+  E->glass = EventArray(E);
+  E->tab = EventArray(E);
+  E->escape = EventArray(E);
+  E->ir = EventArray(E);
+  E->iz = EventArray(E);
+  E->uz1 = EventArray(E);
+  E->dw = EventArray(E);
+}
+
+static void FreeEvent(EventStruct * E) {
+  int i;
+
+  for (i=0; i<E->num_arrays; i++)
+    free(E->arrays[i]);
+  E->num_arrays = 0;
+}
+
+/***********************************************************
+ *	Launch a photon in slot i. See LaunchPhoton().
+ ****/
+static void LaunchSlot(double Rspecular, LayerStruct * Layerspecs_Ptr,
+    EventBankStruct * B, long i, long Photon) {
+  B->id[i] = Photon;
+  B->draw[i] = 0;
+  B->w[i] = 1.0 - Rspecular;
+  B->alive[i] = 1;
+  B->layer[i] = 1;
+  B->sleft[i] = 0.0;
+  B->x[i] = B->y[i] = B->z[i] = 0.0;
+  B->ux[i] = B->uy[i] = 0.0;
+  B->uz[i] = 1.0;
+
+  if ((Layerspecs_Ptr[1].mua == 0.0) && (Layerspecs_Ptr[1].mus == 0.0)) { /* glass layer. */
+    B->layer[i] = 2;
+    B->z[i] = Layerspecs_Ptr[2].z0;
+  }
+}
+
+/***********************************************************
+ *	Launch leased photons into the dead slots, up to
+ *	EVENT_BANK live ones, and set m to cover them. Slots
+ *	from m on are left over from older cycles and count as
+ *	dead. With at most EVENT_BANK live photons, the padded
+ *	segments of the sort fit in EVENT_CAP slots. Return 0
+ *	when the bank is empty and no photon is left to lease.
+ ****/
+static Boolean RefillEvent(EventStruct * E, double Rspecular,
+    LayerStruct * Layerspecs_Ptr, PoolStruct * Pool, long * Lease_Left,
+    long * Photon_Id) {
+  EventBankStruct * B = &E->bank[E->cur];
+  Boolean more = 1; /* photons left to lease. */
+  long i, n = 0, last = -1;
+
+  for (i=0; i<E->m; i++)
+    n += B->alive[i];
+
+  for (i=0; i<EVENT_CAP; i++) {
+    if (i >= E->m)
+      B->alive[i] = 0;
+    if (!B->alive[i] && more && n < EVENT_BANK
+        && (more = TakePhoton(Pool, Lease_Left, Photon_Id))) {
+      LaunchSlot(Rspecular, Layerspecs_Ptr, B, i, *Photon_Id);
+      n++;
+    }
+    if (B->alive[i])
+      last = i;
+    else if (i >= E->m && (!more || n == EVENT_BANK))
+      break;
+  }
+
+  E->m = PAD(last + 1);
+  for (i=last+1; i<E->m; i++)
+    B->alive[i] = 0;
+  return (last >= 0);
+}
+
+/***********************************************************
+ *	Draw the random numbers of the step size, the
+ *	deflection and the boundary crossing of every slot. With
+ *	Philox every photon draws from its own stream, the
+ *	same blocks as in the packet engine.
+ ****/
+static void DrawEventStep(EventStruct * E, int pid) {
+  EventBankStruct * B = &E->bank[E->cur];
+  long i;
+
+  if (RngType == RNG_PHILOX)
+    fill_philox_co(RngSeed, B->id, B->draw, (int)E->m, E->step, B->theta,
+        B->psi, B->cross);
+  else {
+    RandomFill(pid, E->step, E->m);
+    RandomFill(pid, B->theta, E->m);
+    RandomFill(pid, B->psi, E->m);
+    RandomFill(pid, B->cross, E->m);
+  }
+  for (i=0; i<E->m; i++)
+    E->step[i] = 1.0 - E->step[i]; /* avoid zero. */
+}
+
+static void DrawEventRoulette(EventStruct * E, int pid) {
+  EventBankStruct * B = &E->bank[E->cur];
+
+  if (RngType == RNG_PHILOX)
+    fill_philox_co(RngSeed, B->id, B->draw, (int)E->m, E->roulette,
+        E->unused, E->unused, E->unused);
+  else
+    RandomFill(pid, E->roulette, E->m);
+}
+
+/***********************************************************
+ *	Gather the layer constants of the slots, those of the
+ *	step size before the sort and the others after it.
+ ****/
+static void GatherEventStep(PacketLayerStruct * L, EventStruct * E) {
+  EventBankStruct * B = &E->bank[E->cur];
+  long i;
+
+  for (i=0; i<E->m; i++) {
+    long l = B->layer[i];
+
+    E->z0[i] = L->z0[l];
+    E->z1[i] = L->z1[l];
+    E->mut[i] = L->mut[l];
+    E->rmut[i] = L->rmut[l];
+    E->glass[i] = L->glass[l];
+  }
+}
+
+static void GatherEventMedium(PacketLayerStruct * L, EventStruct * E) {
+  EventBankStruct * B = &E->bank[E->cur];
+  long i;
+
+  for (i=0; i<E->m; i++) {
+    long l = B->layer[i];
+
+    E->n[i] = L->n[l];
+    E->n0[i] = L->n[l-1];
+    E->n1[i] = L->n[l+1];
+    E->g[i] = L->g[l];
+    E->mua_mut[i] = L->mua_mut[l];
+    E->cos_crit0[i] = L->cos_crit0[l];
+    E->cos_crit1[i] = L->cos_crit1[l];
+    E->tab[i] = L->phase != NULL && L->phase[l] != NULL;
+  }
+}
+
+/***********************************************************
+ *	StepSize, HitBoundary and Hop of every slot, as in
+ *	PacketStep(), and the event that follows.
+ ****/
+static void ClassifyEvent(EventStruct * E) {
+  EventBankStruct * B = &E->bank[E->cur];
+  long i;
+
+#pragma omp simd
+  for (i=0; i<E->m; i++) {
+    long alive = B->alive[i];
+    long glass = E->glass[i];
+    double mut = E->mut[i], rmut = E->rmut[i];
+    double z = B->z[i], uz = B->uz[i];
+    double s, dl_b, zb, sleft;
+    long hit;
+    long down = uz > 0.0;
+
+    /**** StepSizeInTissue / StepSizeInGlass. ****/
+    s = B->sleft[i];
+    s = (s > 0.0 ? s : -log(E->step[i]))*rmut;
+
+    /**** HitBoundary. ****/
+    zb = down ? E->z1[i] : E->z0[i];
+    dl_b = (zb - z)/uz;
+    hit = alive & (uz != 0.0) & (glass | (s > dl_b));
+    sleft = (hit & !glass) ? (s - dl_b)*mut : 0.0;
+    s = hit ? dl_b : s;
+    /* horizontal photon in glass is killed. */
+    alive = alive & !(glass & (uz == 0.0));
+
+    /**** Hop. ****/
+    B->x[i] += s*B->ux[i];
+    B->y[i] += s*B->uy[i];
+    B->z[i] = z + s*uz;
+    B->sleft[i] = sleft;
+    B->alive[i] = alive;
+    E->event[i] = hit ? EVENT_BOUNDARY
+        : ((alive & !glass) ? EVENT_INTERACT : EVENT_DEAD);
+  }
+}
+
+/***********************************************************
+ *	D[j] = S[Perm[j]], one array at a time so that each loop
+ *	is a plain vector gather.
+ ****/
+static void PermuteDouble(double * restrict D, const double * restrict S,
+    const long * Perm, long N) {
+  long j;
+
+#pragma omp simd
+  for (j=0; j<N; j++)
+    D[j] = S[Perm[j]];
+}
+
+static void PermuteLong(long * restrict D, const long * restrict S,
+    const long * Perm, long N) {
+  long j;
+
+#pragma omp simd
+  for (j=0; j<N; j++)
+    D[j] = S[Perm[j]];
+}
+
+/***********************************************************
+ *	Sort the slots by event into the other copy of the
+ *	bank, each segment padded with the dead photon of slot
+ *	EVENT_CAP.
+ ****/
+static void SortEvent(EventStruct * E) {
+  EventBankStruct * S = &E->bank[E->cur];
+  EventBankStruct * D = &E->bank[!E->cur];
+  long * perm = E->perm;
+  long nb = 0, ni = 0, jb, ji, i, j;
+
+  for (i=0; i<E->m; i++) {
+    nb += E->event[i] == EVENT_BOUNDARY;
+    ni += E->event[i] == EVENT_INTERACT;
+  }
+  jb = 0;
+  ji = PAD(nb);
+  for (i=0; i<E->m; i++)
+    if (E->event[i] == EVENT_BOUNDARY)
+      perm[jb++] = i;
+    else if (E->event[i] == EVENT_INTERACT)
+      perm[ji++] = i;
+  for (; jb<PAD(nb); jb++)
+    perm[jb] = EVENT_CAP;
+  for (; ji<PAD(nb)+PAD(ni); ji++)
+    perm[ji] = EVENT_CAP;
+
+  E->nb = PAD(nb);
+  E->ni = PAD(ni);
+  E->m = E->nb + E->ni;
+
+  PermuteDouble(D->x, S->x, perm, E->m);
+  PermuteDouble(D->y, S->y, perm, E->m);
+  PermuteDouble(D->z, S->z, perm, E->m);
+  PermuteDouble(D->ux, S->ux, perm, E->m);
+  PermuteDouble(D->uy, S->uy, perm, E->m);
+  PermuteDouble(D->uz, S->uz, perm, E->m);
+  PermuteDouble(D->w, S->w, perm, E->m);
+  PermuteDouble(D->sleft, S->sleft, perm, E->m);
+  PermuteDouble(D->theta, S->theta, perm, E->m);
+  PermuteDouble(D->psi, S->psi, perm, E->m);
+  PermuteDouble(D->cross, S->cross, perm, E->m);
+  PermuteLong(D->layer, S->layer, perm, E->m);
+  PermuteLong(D->alive, S->alive, perm, E->m);
+  PermuteLong(D->id, S->id, perm, E->m);
+  for (j=0; j<E->m; j++)
+    D->draw[j] = S->draw[perm[j]];
+  E->cur = !E->cur;
+}
+
+/***********************************************************
+ *	CrossUpOrNot / CrossDnOrNot of the boundary segment,
+ *	with RFresnel() as in PacketStep().
+ ****/
+static void BoundaryEvent(InputStruct * In_Ptr, EventStruct * E) {
+  EventBankStruct * B = &E->bank[E->cur];
+  const long num_layers = In_Ptr->num_layers;
+  const double rdr = 1.0/In_Ptr->dr;
+  const int nr1 = In_Ptr->nr-1;
+  long i;
+
+#pragma omp simd
+  for (i=0; i<E->nb; i++) {
+    long alive = B->alive[i];
+    long l = B->layer[i];
+    double x = B->x[i], y = B->y[i];
+    double ux = B->ux[i], uy = B->uy[i], uz = B->uz[i];
+    long down = uz > 0.0;
+    double rxy = sqrt(x*x + y*y);
+
+    long nl = down ? l+1 : l-1;
+    double ni = E->n[i], nt = down ? E->n1[i] : E->n0[i];
+    double ca1 = fabs(uz);
+    double cos_crit = down ? E->cos_crit1[i] : E->cos_crit0[i];
+    double sa1 = sqrt(1.0 - ca1*ca1);
+    double sa2 = ni*sa1/nt;
+    double ca2 = sqrt(fmax(1.0 - sa2*sa2, 0.0));
+    double cap = ca1*ca2 - sa1*sa2; /* c+ = cc - ss. */
+    double cam = ca1*ca2 + sa1*sa2; /* c- = cc + ss. */
+    double sap = sa1*ca2 + ca1*sa2; /* s+ = sc + cs. */
+    double sam = sa1*ca2 - ca1*sa2; /* s- = sc - cs. */
+    double r_norm = (nt-ni)/(nt+ni);
+    double r = 0.5*sam*sam*(cam*cam+cap*cap)/(sap*sap*cam*cam);
+    double uz1 = ca2;
+
+    if (ca1 < COS90D || sa2 >= 1.0)
+      r = 1.0, uz1 = 0.0; /* very slant or total internal reflection. */
+    if (ca1 > COSZERO)
+      r = r_norm*r_norm, uz1 = ca1; /* normal incident. */
+    if (ni == nt)
+      r = 0.0, uz1 = ca1; /* matched boundary. */
+    if (ca1 <= cos_crit)
+      r = 1.0; /* total internal reflection. */
+
+    long transmit = alive & (B->cross[i] > r);
+    long escape = transmit & ((nl == 0) | (nl > num_layers));
+    double uz_t = down ? uz1 : -uz1;
+    double ni_nt = ni/nt;
+
+    B->ux[i] = transmit ? ux*ni_nt : ux;
+    B->uy[i] = transmit ? uy*ni_nt : uy;
+    B->uz[i] = transmit ? uz_t : -uz; /* reflected. */
+    B->layer[i] = (transmit & !escape) ? nl : l;
+    B->alive[i] = alive & !escape;
+
+    /* Tally requests. */
+    E->escape[i] = escape ? (down ? 2 : 1) : 0;
+    E->dw[i] = B->w[i];
+    E->ir[i] = (long)fmin(rxy*rdr, (double)nr1);
+    E->uz1[i] = uz1;
+  }
+}
+
+/***********************************************************
+ *	Draw cos(theta) of the interacting photons in layers
+ *	with a phase table, as SamplePacketPhase().
+ ****/
+static void SampleEventPhase(PacketLayerStruct * L, EventStruct * E) {
+  EventBankStruct * B = &E->bank[E->cur];
+  long i;
+
+  for (i=E->nb; i<E->m; i++)
+    if (E->tab[i])
+      E->cost[i] = SamplePhase(L->phase[B->layer[i]], B->theta[i]);
+}
+
+/***********************************************************
+ *	Drop and Spin of the interaction segment, as in
+ *	PacketStep().
+ ****/
+static void InteractEvent(InputStruct * In_Ptr, EventStruct * E) {
+  EventBankStruct * B = &E->bank[E->cur];
+  const double rdz = 1.0/In_Ptr->dz, rdr = 1.0/In_Ptr->dr;
+  const int nz1 = In_Ptr->nz-1, nr1 = In_Ptr->nr-1;
+  long i;
+
+#pragma omp simd
+  for (i=E->nb; i<E->m; i++) {
+    long alive = B->alive[i];
+    double x = B->x[i], y = B->y[i], z = B->z[i];
+    double ux = B->ux[i], uy = B->uy[i], uz = B->uz[i];
+    double w = B->w[i];
+    double rxy = sqrt(x*x + y*y);
+
+    /**** Drop. ****/
+    double dwa = w*E->mua_mut[i];
+
+    /**** SpinTheta and Spin. ****/
+    double g = E->g[i];
+    double rnd = B->theta[i];
+    double cost = 2.0*rnd - 1.0;
+    if (g != 0.0) {
+      double temp = (1.0-g*g)/(1.0-g+2.0*g*rnd);
+      cost = (1.0+g*g - temp*temp)/(2.0*g);
+      cost = fmin(fmax(cost, -1.0), 1.0);
+    }
+    cost = E->tab[i] ? E->cost[i] : cost;
+    double sint = sqrt(1.0 - cost*cost);
+    double psi = 2.0*PI*B->psi[i];
+    double cosp = cos(psi);
+    double sinp = (psi < PI ? 1.0 : -1.0)*sqrt(1.0 - cosp*cosp);
+    double temp = sqrt(1.0 - uz*uz);
+    double sux, suy, suz;
+    if (fabs(uz) > COSZERO) { /* normal incident. */
+      sux = sint*cosp;
+      suy = sint*sinp;
+      suz = cost*SIGN(uz);
+    } else { /* regular incident. */
+      sux = sint*(ux*uz*cosp - uy*sinp)/temp + ux*cost;
+      suy = sint*(uy*uz*cosp + ux*sinp)/temp + uy*cost;
+      suz = -sint*cosp*temp + uz*cost;
+    }
+
+    B->w[i] = alive ? w - dwa : w;
+    B->ux[i] = alive ? sux : ux;
+    B->uy[i] = alive ? suy : uy;
+    B->uz[i] = alive ? suz : uz;
+
+    /* Tally requests. */
+    E->dw[i] = dwa;
+    E->iz[i] = (long)fmin(z*rdz, (double)nz1);
+    E->ir[i] = (long)fmin(rxy*rdr, (double)nr1);
+  }
+}
+
+/***********************************************************
+ *	Replay the tally requests of a cycle into Out_Ptr.
+ ****/
+static void EventTally(InputStruct * In_Ptr, EventStruct * E,
+    OutStruct * Out_Ptr) {
+  EventBankStruct * B = &E->bank[E->cur];
+  const double rda = 1.0/In_Ptr->da;
+  const int na1 = In_Ptr->na-1;
+  long i;
+
+  /* Most boundary hits do not escape, so the exit angle is */
+  /* only binned here. */
+  for (i=0; i<E->nb; i++)
+    if (E->escape[i]) {
+      long ia = (long)fmin(acos(E->uz1[i])*rda, (double)na1);
+
+      if (E->escape[i] == 1)
+        TallyRd(In_Ptr, Out_Ptr, E->ir[i], ia, E->dw[i]);
+      else
+        TallyTt(In_Ptr, Out_Ptr, E->ir[i], ia, E->dw[i]);
+    }
+
+  if (IgnoreA) /* -A: the weight is still dropped. */
+    return;
+  for (i=E->nb; i<E->m; i++)
+    if (B->alive[i])
+      TallyA(In_Ptr, Out_Ptr, E->ir[i], E->iz[i], E->dw[i]);
+}
+
+/***********************************************************
+ *	Roulette of every slot, as in PacketStep().
+ ****/
+static void RouletteEvent(InputStruct * In_Ptr, EventStruct * E) {
+  EventBankStruct * B = &E->bank[E->cur];
+  const double wth = In_Ptr->Wth;
+  long i;
+
+#pragma omp simd
+  for (i=0; i<E->m; i++) {
+    long alive = B->alive[i];
+    double w = B->w[i];
+    long roulette = alive & (w < wth);
+    long survive = (w != 0.0) & (E->roulette[i] < CHANCE);
+
+    B->alive[i] = alive & !(roulette & !survive);
+    B->w[i] = (roulette & survive) ? w/CHANCE : w; /* survived the roulette.*/
+  }
+}
+
+/***********************************************************
+ *	Trace all photons the calling thread can lease, a bank
+ *	at a time, and score them in Out_Ptr.
+ ****/
+void EventTransport(InputStruct * In_Ptr, OutStruct * Out_Ptr, int pid) {
+  PacketLayerStruct layers;
+  EventStruct event;
+  long lease_left = 0; /* photons left in the current lease. */
+  long photon_id = 0; /* index of the photon in the run. */
+
+  InitPacketLayers(In_Ptr, &layers);
+  InitEvent(&event);
+
+  while (RefillEvent(&event, Out_Ptr->Rsp, In_Ptr->layerspecs, Out_Ptr->pool,
+      &lease_left, &photon_id)) {
+    DrawEventStep(&event, pid);
+    GatherEventStep(&layers, &event);
+    ClassifyEvent(&event);
+    SortEvent(&event);
+
+    DrawEventRoulette(&event, pid);
+    GatherEventMedium(&layers, &event);
+    if (layers.phase != NULL)
+      SampleEventPhase(&layers, &event);
+    BoundaryEvent(In_Ptr, &event);
+    InteractEvent(In_Ptr, &event);
+    EventTally(In_Ptr, &event, Out_Ptr);
+    RouletteEvent(In_Ptr, &event);
+  }
+
+  FreeEvent(&event);
+  FreePacketLayers(&layers);
+}
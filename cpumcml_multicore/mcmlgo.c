@@ -19,6 +19,11 @@
 #define COS90D  1.0E-6		
 /* cosine of about 1.57 - 1e-6 rad. */
 
+/* The steps below take a VARIANT_* set F. Every call passes a */
+/* constant, so each variant is compiled with the branches of its */
+/* features folded away, much like MCMLKernel<ignoreAdetection>. */
+#define VARIANT_INLINE static inline __attribute__((always_inline))
+
 /***********************************************************
  *	A random number generator from Numerical Recipes in C.
  ****/
@@ -81,17 +86,124 @@ float ran3(int *idum, int pid) {
  *	We found that when idum is too large, ran3 may return 
  *	numbers beyond 0 and 1.
  ****/
-int initRandom() {
+static Boolean * first_time = NULL; //used by RandomNumber()
+static int * idum = NULL; /* seed for ran3. */
+
+/****
+ *	Per-thread MWC, dSFMT or Philox generator and the block
+ *	of numbers RandomNum() hands out one by one. The block
+ *	is refilled in one call when it runs out, which for
+ *	dSFMT is dsfmt_fill_array_close_open(). RNG_BLOCK must
+ *	be even and at least dsfmt_get_min_array_size(); 1024
+ *	doubles stay in L1. Philox fills PHILOX_BLOCK elements
+ *	at a time from the stream of the photon being traced.
+ ****/
+#define RNG_BLOCK 1024
+#define PHILOX_BLOCK 64
+
+typedef struct {
+  dsfmt_t dsfmt; /* first, for the 16-byte alignment. */
+  double buf[RNG_BLOCK];
+  MWCStruct mwc;
+  long photon; /* photon index, the Philox counter. */
+  unsigned int draw; /* Philox blocks drawn by the photon. */
+  int len; /* elements of buf filled. */
+  int next; /* next unused element of buf. */
+} RandBlockStruct;
+
+static RandBlockStruct * ranblock = NULL;
+
+void initRandom(void) {
   int i=0;
-  for (i=0; i<NTHREAD; i++)
+
+  if (first_time == NULL) {
+    first_time = (Boolean *)malloc(NumThreads*sizeof(Boolean));
+    idum = (int *)malloc(NumThreads*sizeof(int));
+    if (first_time == NULL || idum == NULL)
+      nrerror("allocation failure in initRandom()");
+  }
+  for (i=0; i<NumThreads; i++)
     first_time[i]=1;
+
+  if (RngType != RNG_RAN3 && ranblock == NULL) {
+    ranblock = (RandBlockStruct *)malloc(NumThreads*sizeof(RandBlockStruct));
+    if (ranblock == NULL)
+      nrerror("allocation failure in initRandom()");
+  }
+
+  if (RngType == RNG_MWC) {
+    /* one set of streams, so that no multiplier is reused. */
+    MWCStruct * mwc = (MWCStruct *)malloc(NumThreads*sizeof(MWCStruct));
+
+    if (mwc == NULL)
+      nrerror("allocation failure in initRandom()");
+    if (InitMWC(mwc, NumThreads, "", RngSeed))
+      nrerror("invalid seed for the MWC generator");
+
+    for (i=0; i<NumThreads; i++) {
+      ranblock[i].mwc = mwc[i];
+      ranblock[i].len = ranblock[i].next = RNG_BLOCK;
+    }
+    free(mwc);
+  } else if (RngType == RNG_DSFMT) {
+    /* the key of thread i is (seed, i). */
+    for (i=0; i<NumThreads; i++) {
+      uint32_t key[3];
+
+      key[0] = (uint32_t)RngSeed;
+      key[1] = (uint32_t)(RngSeed>>32);
+      key[2] = (uint32_t)i;
+      dsfmt_init_by_array(&ranblock[i].dsfmt, key, 3);
+      ranblock[i].len = ranblock[i].next = RNG_BLOCK;
+    }
+  } else if (RngType == RNG_PHILOX) {
+    for (i=0; i<NumThreads; i++)
+      RandomPhoton(i, 0);
+  }
+}
+
+/***********************************************************
+ *	Start the random numbers of photon Photon on thread
+ *	pid. Only Philox streams are tied to photons.
+ ****/
+void RandomPhoton(int pid, long Photon) {
+  RandBlockStruct * b;
+
+  if (RngType != RNG_PHILOX)
+    return;
+  b = &ranblock[pid];
+  b->photon = Photon;
+  b->draw = 0;
+  b->len = b->next = PHILOX_BLOCK;
+}
+
+/***********************************************************
+ *	Refill the block of a thread.
+ ****/
+static void RefillBlock(RandBlockStruct * B) {
+  if (RngType == RNG_MWC)
+    fill_uniform_co(&B->mwc, B->buf, RNG_BLOCK);
+  else if (RngType == RNG_DSFMT)
+    dsfmt_fill_array_close_open(&B->dsfmt, B->buf, RNG_BLOCK);
+  else
+    fill_philox_photon_co(RngSeed, B->photon, &B->draw, B->buf,
+        PHILOX_BLOCK/4);
+  B->next = 0;
 }
 
 double RandomNum(int pid) {
+  if (RngType != RNG_RAN3) {
+    RandBlockStruct * b = &ranblock[pid];
+
+    if (b->next == b->len)
+      RefillBlock(b);
+    return (b->buf[b->next++]);
+  }
+
   if (first_time[pid]) {
 #if STANDARDTEST /* Use fixed seed to test the program. */
     //idum[pid] = - 1;
-    idum[pid] = -1237-pid; //need to add pid to ensure the seeds are not repeating...
+    idum[pid] = -(int)(RngSeed%(1<<15))-pid; //need to add pid to ensure the seeds are not repeating...
 #else
     //idum[pid] = -(int)time(NULL)%(1<<15)+pid; //need to add pid to ensure the seeds are not repeating...
     /* use 16-bit integer as the seed. */
@@ -105,6 +217,72 @@ double RandomNum(int pid) {
   return ( (double)ran3(&idum[pid], pid) );
 }
 
+/***********************************************************
+ *	Fill Buf[0..N-1] with random numbers in [0,1) of the
+ *	generator of thread pid. The MWC generator fills them
+ *	in bulk, dSFMT and Philox copy them from the block.
+ ****/
+void RandomFill(int pid, double * Buf, long N) {
+  RandBlockStruct * b;
+  long i;
+
+  if (RngType == RNG_RAN3) {
+    for (i=0; i<N; i++)
+      Buf[i] = RandomNum(pid);
+    return;
+  }
+
+  b = &ranblock[pid];
+  if (RngType == RNG_MWC) {
+    fill_uniform_co(&b->mwc, Buf, N);
+    return;
+  }
+
+  while (N > 0) {
+    long n;
+
+    if (b->next == b->len)
+      RefillBlock(b);
+    n = b->len - b->next;
+    if (n > N)
+      n = N;
+    memcpy(Buf, &b->buf[b->next], n*sizeof(double));
+    b->next += n;
+    Buf += n;
+    N -= n;
+  }
+}
+
+/***********************************************************
+ *	Write the generator states of all threads to File, for
+ *	a checkpoint taken between leases. Philox needs none:
+ *	every photon starts its own stream.
+ ****/
+void WriteRandomState(FILE * File) {
+  if (RngType == RNG_RAN3) {
+    fwrite(ranparm, sizeof(RandStruct), NumThreads, File);
+    fwrite(first_time, sizeof(Boolean), NumThreads, File);
+    fwrite(idum, sizeof(int), NumThreads, File);
+  } else if (RngType != RNG_PHILOX)
+    fwrite(ranblock, sizeof(RandBlockStruct), NumThreads, File);
+}
+
+/***********************************************************
+ *	Read the states written by WriteRandomState(), after
+ *	initRandom(). Return 0 if File ends first.
+ ****/
+Boolean ReadRandomState(FILE * File) {
+  int n = NumThreads;
+
+  if (RngType == RNG_RAN3)
+    return (fread(ranparm, sizeof(RandStruct), n, File) == n
+        && fread(first_time, sizeof(Boolean), n, File) == n
+        && fread(idum, sizeof(int), n, File) == n);
+  else if (RngType != RNG_PHILOX)
+    return (fread(ranblock, sizeof(RandBlockStruct), n, File) == n);
+  return (1);
+}
+
 /***********************************************************
  *	Compute the specular reflection. 
  *
@@ -202,7 +380,8 @@ double SpinTheta(double g, int pid) {
  *  	for 0-pi  sin(psi) is + 
  *  	for pi-2pi sin(psi) is - 
  ****/
-void Spin(double g, PhotonStruct * Photon_Ptr, int pid) {
+VARIANT_INLINE void SpinV(double g, PhaseStruct * Phase_Ptr,
+    PhotonStruct * Photon_Ptr, int pid, const int F) {
   double cost, sint; /* cosine and sine of the */
   /* polar deflection angle theta. */
   double cosp, sinp; /* cosine and sine of the */
@@ -212,7 +391,12 @@ void Spin(double g, PhotonStruct * Photon_Ptr, int pid) {
   double uz = Photon_Ptr->uz;
   double psi;
 
-  cost = SpinTheta(g, pid);
+  if (F & VARIANT_ISO)
+    cost = 2*RandomNum(pid) -1;
+  else if (Phase_Ptr != NULL) /* tabulated. */
+    cost = SamplePhase(Phase_Ptr, RandomNum(pid));
+  else
+    cost = SpinTheta(g, pid);
   sint = sqrt(1.0 - cost*cost);
   /* sqrt() is faster than sin(). */
 
@@ -237,6 +421,18 @@ void Spin(double g, PhotonStruct * Photon_Ptr, int pid) {
   }
 }
 
+void Spin(double g, PhotonStruct * Photon_Ptr, int pid) {
+  SpinV(g, NULL, Photon_Ptr, pid, 0);
+}
+
+/***********************************************************
+ *	Spin with the phase function of the layer, tabulated
+ *	or Henyey-Greenstein.
+ ****/
+void SpinLayer(LayerStruct * Layer_Ptr, PhotonStruct * Photon_Ptr, int pid) {
+  SpinV(Layer_Ptr->g, Layer_Ptr->phase, Photon_Ptr, pid, 0);
+}
+
 /***********************************************************
  *	Move the photon s away in the current layer of medium.  
  ****/
@@ -342,16 +538,27 @@ Boolean HitBoundary(PhotonStruct * Photon_Ptr, InputStruct * In_Ptr) {
  *	The weight drop is dw = w*mua/(mua+mus).
  *
  *	The dropped weight is assigned to the absorption array 
- *	elements.
+ *	elements, unless F has VARIANT_NOABS (-A), as DropNoAbs
+ *	of cpumcml_mt_noabs.
  ****/
-void Drop(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr, OutStruct * Out_Ptr) {
+VARIANT_INLINE void DropV(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
+    OutStruct * Out_Ptr, const int F) {
   double dwa; /* absorbed weight.*/
   double x = Photon_Ptr->x;
   double y = Photon_Ptr->y;
   short iz, ir; /* index to z & r. */
-  short layer = Photon_Ptr->layer;
+  short layer = (F & VARIANT_SINGLE) ? 1 : Photon_Ptr->layer;
   double mua, mus;
 
+  /* update photon weight. */
+  mua = In_Ptr->layerspecs[layer].mua;
+  mus = In_Ptr->layerspecs[layer].mus;
+  dwa = Photon_Ptr->w * mua/(mua+mus);
+  Photon_Ptr->w -= dwa;
+
+  if (F & VARIANT_NOABS)
+    return;
+
   /* compute array indices. */
   iz = (short)(Photon_Ptr->z/In_Ptr->dz);
   if (iz>In_Ptr->nz-1)
@@ -361,14 +568,12 @@ void Drop(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr, OutStruct * Out_Ptr)
   if (ir>In_Ptr->nr-1)
     ir=In_Ptr->nr-1;
 
-  /* update photon weight. */
-  mua = In_Ptr->layerspecs[layer].mua;
-  mus = In_Ptr->layerspecs[layer].mus;
-  dwa = Photon_Ptr->w * mua/(mua+mus);
-  Photon_Ptr->w -= dwa;
-
   /* assign dwa to the absorption array element. */
-  Out_Ptr->A_rz[ir][iz] += dwa;
+  TallyA(In_Ptr, Out_Ptr, ir, iz, dwa);
+}
+
+void Drop(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr, OutStruct * Out_Ptr) {
+  DropV(In_Ptr, Photon_Ptr, Out_Ptr, IgnoreA ? VARIANT_NOABS : 0);
 }
 
 /***********************************************************
@@ -445,6 +650,122 @@ double * ca2_Ptr) /* pointer to the */
   return (r);
 }
 
+#define FRESNEL_MIN_N 65
+#define FRESNEL_MAX_N 65537
+
+/***********************************************************
+ *	RFresnel() at the cosine t of the optically thinner
+ *	side, the index of the tables.
+ ****/
+static double FresnelAt(FresnelStruct * Fresnel_Ptr, double n1, double n2,
+    double t) {
+  double ca1 = t, ca2;
+
+  if (Fresnel_Ptr->by_ca2)
+    ca1 = sqrt(1.0 - (1.0 - t*t)/Fresnel_Ptr->k);
+  return (RFresnel(n1, n2, ca1, &ca2));
+}
+
+/***********************************************************
+ *	Tabulate the reflectance from n1 to n2, doubling the
+ *	table until the error found at the quarter points of
+ *	every interval is within FresnelTol, as BuildPhase().
+ ****/
+static FresnelStruct * BuildFresnel(double n1, double n2) {
+  FresnelStruct * fresnel = (FresnelStruct *)malloc(sizeof(FresnelStruct));
+  int n, k;
+
+  if (fresnel == NULL)
+    nrerror("allocation failure in BuildFresnel()");
+  fresnel->k = (n1/n2)*(n1/n2);
+  fresnel->by_ca2 = n1 > n2;
+  fresnel->r = NULL;
+
+  for (n=FRESNEL_MIN_N; ; n=2*n-1) {
+    double err = 0.0;
+
+    free(fresnel->r);
+    fresnel->r = (double *)malloc(n*sizeof(double));
+    if (fresnel->r == NULL)
+      nrerror("allocation failure in BuildFresnel()");
+    fresnel->n = n;
+    for (k=0; k<n; k++)
+      fresnel->r[k] = FresnelAt(fresnel, n1, n2, (double)k/(n-1));
+
+    for (k=0; k<n-1; k++) {
+      int q;
+
+      for (q=1; q<4; q++) { /* quarter points of the interval. */
+        double x = k + 0.25*q;
+        double r = fresnel->r[k] + (x - k)*(fresnel->r[k+1] - fresnel->r[k]);
+        double e = fabs(r - FresnelAt(fresnel, n1, n2, x/(n-1)));
+
+        if (e > err)
+          err = e;
+      }
+    }
+    fresnel->err = err;
+    if (err <= FresnelTol || 2*n-1 > FRESNEL_MAX_N)
+      break;
+  }
+
+  return (fresnel);
+}
+
+/***********************************************************
+ *	With -F, tabulate the reflectance of both sides of
+ *	every mismatched boundary of the tissue layers. The
+ *	layers are fixed for a run, so each side has a single
+ *	curve of the incident cosine.
+ ****/
+void InitFresnel(InputStruct * In_Ptr) {
+  LayerStruct * s = In_Ptr->layerspecs;
+  int tables = 0, most = 0;
+  double err = 0.0;
+  short i;
+
+  for (i=1; i<=In_Ptr->num_layers; i++) {
+    s[i].fresnel0 = s[i].fresnel1 = NULL;
+    if (FresnelTol <= 0.0)
+      continue;
+    if (s[i].n != s[i-1].n)
+      s[i].fresnel0 = BuildFresnel(s[i].n, s[i-1].n);
+    if (s[i].n != s[i+1].n)
+      s[i].fresnel1 = BuildFresnel(s[i].n, s[i+1].n);
+    if (s[i].fresnel0) {
+      tables++;
+      most = s[i].fresnel0->n > most ? s[i].fresnel0->n : most;
+      err = s[i].fresnel0->err > err ? s[i].fresnel0->err : err;
+    }
+    if (s[i].fresnel1) {
+      tables++;
+      most = s[i].fresnel1->n > most ? s[i].fresnel1->n : most;
+      err = s[i].fresnel1->err > err ? s[i].fresnel1->err : err;
+    }
+  }
+  if (tables > 0)
+    printf("Fresnel tables: %d, up to %d points, error <= %.2g\n", tables,
+        most, err);
+}
+
+void FreeFresnel(InputStruct * In_Ptr) {
+  short i;
+
+  for (i=1; i<=In_Ptr->num_layers; i++) {
+    LayerStruct * s = &In_Ptr->layerspecs[i];
+
+    if (s->fresnel0) {
+      free(s->fresnel0->r);
+      free(s->fresnel0);
+    }
+    if (s->fresnel1) {
+      free(s->fresnel1->r);
+      free(s->fresnel1);
+    }
+    s->fresnel0 = s->fresnel1 = NULL;
+  }
+}
+
 /***********************************************************
  *	Record the photon weight exiting the first layer(uz<0), 
  *	no matter whether the layer is glass or not, to the 
@@ -467,7 +788,9 @@ InputStruct * In_Ptr, PhotonStruct * Photon_Ptr, OutStruct * Out_Ptr) {
     ia=In_Ptr->na-1;
 
   /* assign photon to the reflection array element. */
-  Out_Ptr->Rd_ra[ir][ia] += Photon_Ptr->w*(1.0-Refl);
+  TallyRd(In_Ptr, Out_Ptr, ir, ia, Photon_Ptr->w*(1.0-Refl));
+  if (Out_Ptr->pmc != NULL)
+    PmcExit(Out_Ptr->pmc, 0, ir, Photon_Ptr->w*(1.0-Refl));
 
   Photon_Ptr->w *= Refl;
 }
@@ -494,7 +817,9 @@ void RecordT(double Refl, InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
     ia=In_Ptr->na-1;
 
   /* assign photon to the transmittance array element. */
-  Out_Ptr->Tt_ra[ir][ia] += Photon_Ptr->w*(1.0-Refl);
+  TallyTt(In_Ptr, Out_Ptr, ir, ia, Photon_Ptr->w*(1.0-Refl));
+  if (Out_Ptr->pmc != NULL)
+    PmcExit(Out_Ptr->pmc, 1, ir, Photon_Ptr->w*(1.0-Refl));
 
   Photon_Ptr->w *= Refl;
 }
@@ -517,20 +842,27 @@ void RecordT(double Refl, InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
  *	packet is transmitted, move the photon to "layer-1".
  *
  *	Update the photon parmameters.
+ *
+ *	With VARIANT_MATCHED, r is 0 and the direction does
+ *	not change, as RFresnel() gives for n1==n2.
  ****/
-void CrossUpOrNot(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
-    OutStruct * Out_Ptr, int pid) {
+VARIANT_INLINE void CrossUpV(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
+    OutStruct * Out_Ptr, int pid, const int F) {
   double uz = Photon_Ptr->uz; /* z directional cosine. */
   double uz1; /* cosines of transmission alpha. always */
   /* positive. */
   double r=0.0; /* reflectance */
-  short layer = Photon_Ptr->layer;
+  short layer = (F & VARIANT_SINGLE) ? 1 : Photon_Ptr->layer;
   double ni = In_Ptr->layerspecs[layer].n;
   double nt = In_Ptr->layerspecs[layer-1].n;
 
   /* Get r. */
-  if ( -uz <= In_Ptr->layerspecs[layer].cos_crit0)
+  if (F & VARIANT_MATCHED)
+    uz1 = -uz;
+  else if ( -uz <= In_Ptr->layerspecs[layer].cos_crit0)
     r=1.0; /* total internal reflection. */
+  else if (In_Ptr->layerspecs[layer].fresnel0)
+    r = FresnelTable(In_Ptr->layerspecs[layer].fresnel0, -uz, &uz1);
   else
     r = RFresnel(ni, nt, -uz, &uz1);
 
@@ -550,14 +882,16 @@ void CrossUpOrNot(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
   Photon_Ptr->uz = -uz;
 #else
   if (RandomNum(pid) > r) { /* transmitted to layer-1. */
-    if (layer==1) {
+    if ((F & VARIANT_SINGLE) || layer==1) {
       Photon_Ptr->uz = -uz1;
       RecordR(0.0, In_Ptr, Photon_Ptr, Out_Ptr);
       Photon_Ptr->dead = 1;
     } else {
       Photon_Ptr->layer--;
-      Photon_Ptr->ux *= ni/nt;
-      Photon_Ptr->uy *= ni/nt;
+      if (!(F & VARIANT_MATCHED)) {
+        Photon_Ptr->ux *= ni/nt;
+        Photon_Ptr->uy *= ni/nt;
+      }
       Photon_Ptr->uz = -uz1;
     }
   } else
@@ -566,6 +900,11 @@ void CrossUpOrNot(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
 #endif
 }
 
+void CrossUpOrNot(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
+    OutStruct * Out_Ptr, int pid) {
+  CrossUpV(In_Ptr, Photon_Ptr, Out_Ptr, pid, 0);
+}
+
 /***********************************************************
  *	Decide whether the photon will be transmitted  or be 
  *	reflected on the bottom boundary (uz>0) of the current 
@@ -578,18 +917,22 @@ void CrossUpOrNot(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
  *
  *	Update the photon parmameters.
  ****/
-void CrossDnOrNot(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
-    OutStruct * Out_Ptr, int pid) {
+VARIANT_INLINE void CrossDnV(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
+    OutStruct * Out_Ptr, int pid, const int F) {
   double uz = Photon_Ptr->uz; /* z directional cosine. */
   double uz1; /* cosines of transmission alpha. */
   double r=0.0; /* reflectance */
-  short layer = Photon_Ptr->layer;
+  short layer = (F & VARIANT_SINGLE) ? 1 : Photon_Ptr->layer;
   double ni = In_Ptr->layerspecs[layer].n;
   double nt = In_Ptr->layerspecs[layer+1].n;
 
   /* Get r. */
-  if (uz <= In_Ptr->layerspecs[layer].cos_crit1)
+  if (F & VARIANT_MATCHED)
+    uz1 = uz;
+  else if (uz <= In_Ptr->layerspecs[layer].cos_crit1)
     r=1.0; /* total internal reflection. */
+  else if (In_Ptr->layerspecs[layer].fresnel1)
+    r = FresnelTable(In_Ptr->layerspecs[layer].fresnel1, uz, &uz1);
   else
     r = RFresnel(ni, nt, uz, &uz1);
 
@@ -609,14 +952,16 @@ void CrossDnOrNot(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
   Photon_Ptr->uz = -uz;
 #else
   if (RandomNum(pid) > r) { /* transmitted to layer+1. */
-    if (layer == In_Ptr->num_layers) {
+    if ((F & VARIANT_SINGLE) || layer == In_Ptr->num_layers) {
       Photon_Ptr->uz = uz1;
       RecordT(0.0, In_Ptr, Photon_Ptr, Out_Ptr);
       Photon_Ptr->dead = 1;
     } else {
       Photon_Ptr->layer++;
-      Photon_Ptr->ux *= ni/nt;
-      Photon_Ptr->uy *= ni/nt;
+      if (!(F & VARIANT_MATCHED)) {
+        Photon_Ptr->ux *= ni/nt;
+        Photon_Ptr->uy *= ni/nt;
+      }
       Photon_Ptr->uz = uz1;
     }
   } else
@@ -625,14 +970,24 @@ void CrossDnOrNot(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
 #endif
 }
 
+void CrossDnOrNot(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
+    OutStruct * Out_Ptr, int pid) {
+  CrossDnV(In_Ptr, Photon_Ptr, Out_Ptr, pid, 0);
+}
+
 /***********************************************************
  ****/
-void CrossOrNot(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
-    OutStruct * Out_Ptr, int pid) {
+VARIANT_INLINE void CrossOrNotV(InputStruct * In_Ptr,
+    PhotonStruct * Photon_Ptr, OutStruct * Out_Ptr, int pid, const int F) {
   if (Photon_Ptr->uz < 0.0)
-    CrossUpOrNot(In_Ptr, Photon_Ptr, Out_Ptr, pid);
+    CrossUpV(In_Ptr, Photon_Ptr, Out_Ptr, pid, F);
   else
-    CrossDnOrNot(In_Ptr, Photon_Ptr, Out_Ptr, pid);
+    CrossDnV(In_Ptr, Photon_Ptr, Out_Ptr, pid, F);
+}
+
+void CrossOrNot(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
+    OutStruct * Out_Ptr, int pid) {
+  CrossOrNotV(In_Ptr, Photon_Ptr, Out_Ptr, pid, 0);
 }
 
 /***********************************************************
@@ -640,20 +995,23 @@ void CrossOrNot(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
  *	Horizontal photons are killed because they will
  *	never interact with tissue again.
  ****/
-void HopInGlass(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
-    OutStruct * Out_Ptr, int pid) {
-  double dl; /* step size. 1/cm */
-
+VARIANT_INLINE void HopInGlassV(InputStruct * In_Ptr,
+    PhotonStruct * Photon_Ptr, OutStruct * Out_Ptr, int pid, const int F) {
   if (Photon_Ptr->uz == 0.0) {
     /* horizontal photon in glass is killed. */
     Photon_Ptr->dead = 1;
   } else {
     StepSizeInGlass(Photon_Ptr, In_Ptr);
     Hop(Photon_Ptr);
-    CrossOrNot(In_Ptr, Photon_Ptr, Out_Ptr, pid);
+    CrossOrNotV(In_Ptr, Photon_Ptr, Out_Ptr, pid, F);
   }
 }
 
+void HopInGlass(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
+    OutStruct * Out_Ptr, int pid) {
+  HopInGlassV(In_Ptr, Photon_Ptr, Out_Ptr, pid, 0);
+}
+
 /***********************************************************
  *	Set a step size, move the photon, drop some weight, 
  *	choose a new photon direction for propagation.  
@@ -668,33 +1026,111 @@ void HopInGlass(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
  *	site.  If the unfinished stepsize is still too long, 
  *	repeat the above process.  
  ****/
-void HopDropSpinInTissue(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
-    OutStruct * Out_Ptr, int pid) {
+VARIANT_INLINE void HopDropSpinInTissueV(InputStruct * In_Ptr,
+    PhotonStruct * Photon_Ptr, OutStruct * Out_Ptr, int pid, const int F) {
   StepSizeInTissue(Photon_Ptr, In_Ptr, pid);
 
   if (HitBoundary(Photon_Ptr, In_Ptr)) {
     Hop(Photon_Ptr); /* move to boundary plane. */
-    CrossOrNot(In_Ptr, Photon_Ptr, Out_Ptr, pid);
+    CrossOrNotV(In_Ptr, Photon_Ptr, Out_Ptr, pid, F);
   } else {
+    LayerStruct * s = &In_Ptr->layerspecs[Photon_Ptr->layer];
+
     Hop(Photon_Ptr);
-    Drop(In_Ptr, Photon_Ptr, Out_Ptr);
-    Spin(In_Ptr->layerspecs[Photon_Ptr->layer].g, Photon_Ptr, pid);
+    DropV(In_Ptr, Photon_Ptr, Out_Ptr, F);
+    SpinV(s->g, s->phase, Photon_Ptr, pid, F);
   }
 }
 
+void HopDropSpinInTissue(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
+    OutStruct * Out_Ptr, int pid) {
+  HopDropSpinInTissueV(In_Ptr, Photon_Ptr, Out_Ptr, pid, 0);
+}
+
 /***********************************************************
  ****/
-void HopDropSpin(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
-    OutStruct * Out_Ptr, int pid) {
+VARIANT_INLINE void HopDropSpinV(InputStruct * In_Ptr,
+    PhotonStruct * Photon_Ptr, OutStruct * Out_Ptr, int pid, const int F) {
   short layer = Photon_Ptr->layer;
 
-  if ((In_Ptr->layerspecs[layer].mua == 0.0) && (In_Ptr->layerspecs[layer].mus
-      == 0.0))
+  if (!(F & VARIANT_NOGLASS) && (In_Ptr->layerspecs[layer].mua == 0.0)
+      && (In_Ptr->layerspecs[layer].mus == 0.0))
     /* glass layer. */
-    HopInGlass(In_Ptr, Photon_Ptr, Out_Ptr, pid);
+    HopInGlassV(In_Ptr, Photon_Ptr, Out_Ptr, pid, F);
   else
-    HopDropSpinInTissue(In_Ptr, Photon_Ptr, Out_Ptr, pid);
+    HopDropSpinInTissueV(In_Ptr, Photon_Ptr, Out_Ptr, pid, F);
 
   if (Photon_Ptr->w < In_Ptr->Wth && !Photon_Ptr->dead)
     Roulette(Photon_Ptr, pid);
 }
+
+void HopDropSpin(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
+    OutStruct * Out_Ptr, int pid) {
+  HopDropSpinV(In_Ptr, Photon_Ptr, Out_Ptr, pid, 0);
+}
+
+/***********************************************************
+ *	Find the features of In_Ptr that the engine can be
+ *	specialized on. VARIANT_NOABS comes from IgnoreA (-A).
+ ****/
+int EngineVariant(InputStruct * In_Ptr) {
+  int variant = VARIANT_ISO | VARIANT_MATCHED | VARIANT_NOGLASS;
+  short i;
+
+  if (IgnoreA)
+    variant |= VARIANT_NOABS;
+  if (In_Ptr->num_layers == 1)
+    variant |= VARIANT_SINGLE;
+
+  for (i=1; i<=In_Ptr->num_layers; i++) {
+    LayerStruct * s = &In_Ptr->layerspecs[i];
+
+    if (s->g != 0.0 || s->phase != NULL)
+      variant &= ~VARIANT_ISO;
+    if (s->mua == 0.0 && s->mus == 0.0)
+      variant &= ~VARIANT_NOGLASS;
+  }
+  for (i=1; i<=In_Ptr->num_layers+1; i++)
+    if (In_Ptr->layerspecs[i].n != In_Ptr->layerspecs[0].n)
+      variant &= ~VARIANT_MATCHED;
+
+  return (variant);
+}
+
+/***********************************************************
+ *	Trace a launched photon until it dies, with the steps
+ *	compiled for variant F. One function per variant.
+ ****/
+#define TRACE_VARIANT(F) \
+static void TracePhoton##F(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr, \
+    OutStruct * Out_Ptr, int pid) { \
+  do \
+    HopDropSpinV(In_Ptr, Photon_Ptr, Out_Ptr, pid, F); \
+  while (!Photon_Ptr->dead); \
+}
+
+TRACE_VARIANT(0)  TRACE_VARIANT(1)  TRACE_VARIANT(2)  TRACE_VARIANT(3)
+TRACE_VARIANT(4)  TRACE_VARIANT(5)  TRACE_VARIANT(6)  TRACE_VARIANT(7)
+TRACE_VARIANT(8)  TRACE_VARIANT(9)  TRACE_VARIANT(10) TRACE_VARIANT(11)
+TRACE_VARIANT(12) TRACE_VARIANT(13) TRACE_VARIANT(14) TRACE_VARIANT(15)
+TRACE_VARIANT(16) TRACE_VARIANT(17) TRACE_VARIANT(18) TRACE_VARIANT(19)
+TRACE_VARIANT(20) TRACE_VARIANT(21) TRACE_VARIANT(22) TRACE_VARIANT(23)
+TRACE_VARIANT(24) TRACE_VARIANT(25) TRACE_VARIANT(26) TRACE_VARIANT(27)
+TRACE_VARIANT(28) TRACE_VARIANT(29) TRACE_VARIANT(30) TRACE_VARIANT(31)
+
+static void (* const trace_variant[NUM_VARIANTS])(InputStruct *,
+    PhotonStruct *, OutStruct *, int) = {
+  TracePhoton0,  TracePhoton1,  TracePhoton2,  TracePhoton3,
+  TracePhoton4,  TracePhoton5,  TracePhoton6,  TracePhoton7,
+  TracePhoton8,  TracePhoton9,  TracePhoton10, TracePhoton11,
+  TracePhoton12, TracePhoton13, TracePhoton14, TracePhoton15,
+  TracePhoton16, TracePhoton17, TracePhoton18, TracePhoton19,
+  TracePhoton20, TracePhoton21, TracePhoton22, TracePhoton23,
+  TracePhoton24, TracePhoton25, TracePhoton26, TracePhoton27,
+  TracePhoton28, TracePhoton29, TracePhoton30, TracePhoton31
+};
+
+void TracePhoton(int Variant, InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
+    OutStruct * Out_Ptr, int pid) {
+  trace_variant[Variant](In_Ptr, Photon_Ptr, Out_Ptr, pid);
+}
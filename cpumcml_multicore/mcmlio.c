@@ -6,6 +6,7 @@
  ****/
 
 #include "mcml.h"
+#include <pthread.h>
 
 /***********************************************************
  *	Structure used to check against duplicated file names.
@@ -188,7 +189,7 @@ Boolean CommentLine(char *Buf)
  ****/
 char * FindDataLine(FILE *File_Ptr)
 {
-  char buf[STRLEN];
+  static char buf[STRLEN];	/* returned to the caller. */
   
   buf[0] = '\0';
   do {	/* skip space or comment lines. */
@@ -386,7 +387,7 @@ void ReadLayerSpecs(FILE *File_Ptr,
   /* Allocate an array for the layer parameters. */
   /* layer 0 and layer Num_Layers + 1 are for ambient. */
   *Layerspecs_PP = (LayerStruct *)
-    malloc((unsigned) (Num_Layers+2)*sizeof(LayerStruct));
+    calloc((unsigned) (Num_Layers+2), sizeof(LayerStruct));
   if (!(*Layerspecs_PP)) 
     nrerror("allocation failure in ReadLayerSpecs()");
   
@@ -564,6 +565,9 @@ void InitOutputData(InputStruct In_Parm,
   Out_Ptr->Rd  = 0.0;
   Out_Ptr->A   = 0.0;
   Out_Ptr->Tt  = 0.0;
+  Out_Ptr->batches = 0;
+  Out_Ptr->err_rd = Out_Ptr->err_a = Out_Ptr->err_rdr = 0.0;
+  Out_Ptr->num_traced = In_Parm.num_photons;
   
   /* Allocate the arrays and the matrices. */
   Out_Ptr->Rd_ra = AllocMatrix(0,nr-1,0,na-1);
@@ -577,13 +581,26 @@ void InitOutputData(InputStruct In_Parm,
   Out_Ptr->Tt_ra = AllocMatrix(0,nr-1,0,na-1);
   Out_Ptr->Tt_r  = AllocVector(0,nr-1);
   Out_Ptr->Tt_a  = AllocVector(0,na-1);
+
+  Out_Ptr->A_rz_raw  = (unsigned long long *)calloc((size_t)nr*nz, 
+                         sizeof(unsigned long long));
+  Out_Ptr->Rd_ra_raw = (unsigned long long *)calloc((size_t)nr*na, 
+                         sizeof(unsigned long long));
+  Out_Ptr->Tt_ra_raw = (unsigned long long *)calloc((size_t)nr*na, 
+                         sizeof(unsigned long long));
+  if(Out_Ptr->A_rz_raw==NULL || Out_Ptr->Rd_ra_raw==NULL 
+     || Out_Ptr->Tt_ra_raw==NULL)
+    nrerror("allocation failure in InitOutputData()");
+  Out_Ptr->raw_shared = 0;
+  Out_Ptr->pmc = NULL;
+  Out_Ptr->scale = NULL;
 }
 
 /***********************************************************
  *	Undo what InitOutputData did.
  *  i.e. free the data allocations.
  ****/
-void FreeData(InputStruct In_Parm, OutStruct * Out_Ptr)
+void FreeOutputData(InputStruct In_Parm, OutStruct * Out_Ptr)
 {
   short nz = In_Parm.nz;
   short nr = In_Parm.nr;
@@ -591,8 +608,6 @@ void FreeData(InputStruct In_Parm, OutStruct * Out_Ptr)
   short nl = In_Parm.num_layers;	
   /* remember to use nl+2 because of 2 for ambient. */
   
-  free(In_Parm.layerspecs);
-  
   FreeMatrix(Out_Ptr->Rd_ra, 0,nr-1,0,na-1);
   FreeVector(Out_Ptr->Rd_r, 0,nr-1);
   FreeVector(Out_Ptr->Rd_a, 0,na-1);
@@ -604,6 +619,19 @@ void FreeData(InputStruct In_Parm, OutStruct * Out_Ptr)
   FreeMatrix(Out_Ptr->Tt_ra, 0,nr-1,0,na-1);
   FreeVector(Out_Ptr->Tt_r, 0,nr-1);
   FreeVector(Out_Ptr->Tt_a, 0,na-1);
+  
+  free(Out_Ptr->A_rz_raw);
+  free(Out_Ptr->Rd_ra_raw);
+  free(Out_Ptr->Tt_ra_raw);
+}
+
+/***********************************************************
+ *	Free the layer parameters and the output data of a run.
+ ****/
+void FreeData(InputStruct In_Parm, OutStruct * Out_Ptr)
+{
+  free(In_Parm.layerspecs);
+  FreeOutputData(In_Parm, Out_Ptr);
 }
 
 /***********************************************************
@@ -622,11 +650,10 @@ void Sum2DRd(InputStruct In_Parm, OutStruct * Out_Ptr)
     Out_Ptr->Rd_r[ir] = sum;
   }
   
-  for(ia=0; ia<na; ia++)  {
-    sum = 0.0;
-    for(ir=0; ir<nr; ir++) sum += Out_Ptr->Rd_ra[ir][ia];
-    Out_Ptr->Rd_a[ia] = sum;
-  }
+  /* by rows, adding in the same order as a column at a time. */
+  for(ia=0; ia<na; ia++) Out_Ptr->Rd_a[ia] = 0.0;
+  for(ir=0; ir<nr; ir++)
+    for(ia=0; ia<na; ia++) Out_Ptr->Rd_a[ia] += Out_Ptr->Rd_ra[ir][ia];
   
   sum = 0.0;
   for(ir=0; ir<nr; ir++) sum += Out_Ptr->Rd_r[ir];
@@ -661,11 +688,10 @@ void Sum2DA(InputStruct In_Parm, OutStruct * Out_Ptr)
   short iz,ir;
   double sum;
   
-  for(iz=0; iz<nz; iz++)  {
-    sum = 0.0;
-    for(ir=0; ir<nr; ir++) sum += Out_Ptr->A_rz[ir][iz];
-    Out_Ptr->A_z[iz] = sum;
-  }
+  /* by rows, adding in the same order as a column at a time. */
+  for(iz=0; iz<nz; iz++) Out_Ptr->A_z[iz] = 0.0;
+  for(ir=0; ir<nr; ir++)
+    for(iz=0; iz<nz; iz++) Out_Ptr->A_z[iz] += Out_Ptr->A_rz[ir][iz];
   
   sum = 0.0;
   for(iz=0; iz<nz; iz++) {
@@ -692,11 +718,9 @@ void Sum2DTt(InputStruct In_Parm, OutStruct * Out_Ptr)
     Out_Ptr->Tt_r[ir] = sum;
   }
   
-  for(ia=0; ia<na; ia++)  {
-    sum = 0.0;
-    for(ir=0; ir<nr; ir++) sum += Out_Ptr->Tt_ra[ir][ia];
-    Out_Ptr->Tt_a[ia] = sum;
-  }
+  for(ia=0; ia<na; ia++) Out_Ptr->Tt_a[ia] = 0.0;
+  for(ir=0; ir<nr; ir++)
+    for(ia=0; ia<na; ia++) Out_Ptr->Tt_a[ia] += Out_Ptr->Tt_ra[ir][ia];
   
   sum = 0.0;
   for(ir=0; ir<nr; ir++) sum += Out_Ptr->Tt_r[ir];
@@ -730,16 +754,20 @@ void ScaleRdTt(InputStruct In_Parm, OutStruct *	Out_Ptr)
   double da = In_Parm.da;
   short ir,ia;
   double scale1, scale2;
+  double * sin2a = AllocVector(0,na-1); /* sin(2a) of each angle. */
   
   scale1 = 4.0*PI*PI*dr*sin(da/2)*dr*In_Parm.num_photons;
 	/* The factor (ir+0.5)*sin(2a) to be added. */
 
+  for(ia=0; ia<na; ia++)
+    sin2a[ia] = sin(2.0*(ia+0.5)*da);
   for(ir=0; ir<nr; ir++)  
     for(ia=0; ia<na; ia++) {
-      scale2 = 1.0/((ir+0.5)*sin(2.0*(ia+0.5)*da)*scale1);
+      scale2 = 1.0/((ir+0.5)*sin2a[ia]*scale1);
       Out_Ptr->Rd_ra[ir][ia] *= scale2;
       Out_Ptr->Tt_ra[ir][ia] *= scale2;
     }
+  FreeVector(sin2a, 0,na-1);
   
   scale1 = 2.0*PI*dr*dr*In_Parm.num_photons;  
 	/* area is 2*PI*[(ir+0.5)*dr]*dr.*/ 
@@ -783,8 +811,8 @@ void ScaleA(InputStruct In_Parm, OutStruct * Out_Ptr)
   scale1 = 2.0*PI*dr*dr*dz*In_Parm.num_photons;	
 	/* volume is 2*pi*(ir+0.5)*dr*dr*dz.*/ 
 	/* ir+0.5 to be added. */
-  for(iz=0; iz<nz; iz++) 
-    for(ir=0; ir<nr; ir++) 
+  for(ir=0; ir<nr; ir++) 
+    for(iz=0; iz<nz; iz++) 
       Out_Ptr->A_rz[ir][iz] /= (ir+0.5)*scale1;
   
   /* Scale A_z. */
@@ -911,194 +939,407 @@ void WriteA_layer(FILE * file,
 }
 
 /***********************************************************
- *	5 numbers each line.
+ *	Powers of ten that are exact in double.
+ ****/
+static const double Pow10[23] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/***********************************************************
+ *	Write X at P as sprintf() does with "%<Width>.<Prec>E",
+ *	Prec <= 15, and return the end. The digits come from
+ *	X*10^(Prec-e) rounded to an integer, which is exact to
+ *	half an ulp; values near a tie of the rounding, and
+ *	those out of range of the exact powers of ten, are
+ *	left to snprintf().
  ****/
-void WriteRd_ra(FILE * file, 
-				short Nr,
-				short Na,
-				OutStruct Out_Parm)
+static char * PutE(char * P, double X, int Prec, int Width)
 {
-  short ir, ia;
-  
-  fprintf(file, 
-	  "%s\n%s\n%s\n%s\n%s\n%s\n",	/* flag. */
-	  "# Rd[r][angle]. [1/(cm2sr)].",
-	  "# Rd[0][0], [0][1],..[0][na-1]",
-	  "# Rd[1][0], [1][1],..[1][na-1]",
-	  "# ...",
-	  "# Rd[nr-1][0], [nr-1][1],..[nr-1][na-1]",
-	  "Rd_ra");
-  
-  for(ir=0;ir<Nr;ir++)
-    for(ia=0;ia<Na;ia++)  {
-      fprintf(file, "%12.4E ", Out_Parm.Rd_ra[ir][ia]);
-      if( (ir*Na + ia + 1)%5 == 0) fprintf(file, "\n");
+  char buf[32], * q = buf;
+  unsigned long long m = 0;
+  int e = 0, k, i, len, tries;
+  double v;
+
+  if (X != X || X > 1e300 || X < -1e300)
+    return (P + sprintf(P, "%*.*E", Width, Prec, X));
+  if (X < 0.0 || (X == 0.0 && 1.0/X < 0.0)) {
+    *q++ = '-';
+    X = -X;
+  }
+
+  if (X != 0.0) {
+    e = (int)floor(log10(X));
+    for (tries=0; ; tries++) {
+      k = Prec - e;
+      if (tries == 3 || k > 22 || k < -22)
+        return (P + sprintf(P, "%*.*E", Width, Prec, q > buf ? -X : X));
+      v = k >= 0 ? X*Pow10[k] : X/Pow10[-k];
+      if (fabs(v - floor(v) - 0.5) < 1e-6)
+        return (P + sprintf(P, "%*.*E", Width, Prec, q > buf ? -X : X));
+      m = (unsigned long long)(v + 0.5);
+      if (m >= (unsigned long long)Pow10[Prec+1])
+        e++; /* e was too small, or the digits carried. */
+      else if (m < (unsigned long long)Pow10[Prec])
+        e--;
+      else
+        break;
     }
-  
-  fprintf(file, "\n");
+  }
+
+  /* the Prec+1 digits of m, one before the point. */
+  for (i=Prec; i>=0; i--) {
+    q[i + (i > 0)] = '0' + (char)(m%10);
+    m /= 10;
+  }
+  if (Prec > 0) {
+    q[1] = '.';
+    q += Prec + 2;
+  } else
+    q += 1;
+  *q++ = 'E';
+  *q++ = e < 0 ? '-' : '+';
+  if (e < 0)
+    e = -e;
+  if (e >= 100) {
+    *q++ = '0' + e/100;
+    e %= 100;
+  }
+  *q++ = '0' + e/10;
+  *q++ = '0' + e%10;
+
+  len = (int)(q - buf);
+  for (; Width > len; Width--)
+    *P++ = ' ';
+  memcpy(P, buf, len);
+  return (P + len);
 }
 
+/****
+ *	A section of the ASCII output: the flag lines, then n
+ *	values as "%12.4E", 5 a line in a table or 1 a line,
+ *	formatted into buf by FormatText().
+ ****/
+typedef struct {
+  char * flag;
+  double * val;
+  long n;
+  Boolean table;
+  char * buf;
+  size_t len;
+} TextStruct;
+
 /***********************************************************
- *	1 number each line.
+ *	Format the section Arg, a TextStruct, into its buffer.
+ *	Run on its own thread for the 2D arrays.
  ****/
-void WriteRd_r(FILE * file, 
-			   short Nr,
-			   OutStruct Out_Parm)
+static void * FormatText(void * Arg)
 {
-  short ir;
-  
-  fprintf(file, 
-	"Rd_r #Rd[0], [1],..Rd[nr-1]. [1/cm2]\n");	/* flag. */
-  
-  for(ir=0;ir<Nr;ir++) {
-    fprintf(file, "%12.4E\n", Out_Parm.Rd_r[ir]);
+  TextStruct * t = (TextStruct *)Arg;
+  char * p;
+  long i;
+
+  t->buf = (char *)malloc(strlen(t->flag) + 16*(size_t)t->n + 2);
+  if (t->buf == NULL)
+    nrerror("allocation failure in FormatText()");
+  p = t->buf + sprintf(t->buf, "%s", t->flag);
+  for (i=0; i<t->n; i++) {
+    p = PutE(p, t->val[i], 4, 12);
+    if (!t->table)
+      *p++ = '\n';
+    else {
+      *p++ = ' ';
+      if ((i + 1)%5 == 0)
+        *p++ = '\n';
+    }
   }
-  
-  fprintf(file, "\n");
+  *p++ = '\n';
+  t->len = (size_t)(p - t->buf);
+  return (NULL);
+}
+
+/***********************************************************
+ *	Write a formatted section and free its buffer.
+ ****/
+static void WriteText(FILE * file, TextStruct * Text)
+{
+  if (fwrite(Text->buf, 1, Text->len, file) != Text->len)
+    nrerror("Cannot write the output file.\n");
+  free(Text->buf);
 }
 
 /***********************************************************
  *	1 number each line.
  ****/
-void WriteRd_a(FILE * file, 
-			   short Na,
-			   OutStruct Out_Parm)
+void Write1D(FILE * file, char * Flag, double * Val, short N)
 {
-  short ia;
-  
-  fprintf(file, 
-	"Rd_a #Rd[0], [1],..Rd[na-1]. [sr-1]\n");	/* flag. */
-  
-  for(ia=0;ia<Na;ia++) {
-    fprintf(file, "%12.4E\n", Out_Parm.Rd_a[ia]);
-  }
-  
-  fprintf(file, "\n");
+  TextStruct t;
+
+  t.flag = Flag;
+  t.val = Val;
+  t.n = N;
+  t.table = 0;
+  FormatText(&t);
+  WriteText(file, &t);
+}
+
+//>>>>>>>>>>>>>>Multi-Node Cluster Implementation
+void generateNodeFileName (char * origFileName) {
+    char extension[10];
+
+    sprintf (extension, "%d", CURRENT_NODE);
+
+    strcat (origFileName,extension);
 }
+//>>>>>>>>>>>>
+
 
 /***********************************************************
- *	5 numbers each line.
+ *	Write the results of a run in the ASCII format. The 2D
+ *	arrays are formatted on three threads while the rest
+ *	is written.
  ****/
-void WriteTt_ra(FILE * file, 
-				short Nr,
-				short Na,
-				OutStruct Out_Parm)
+void WriteAscii(FILE * file,
+				InputStruct In_Parm, 
+				OutStruct Out_Parm,
+				char * TimeReport)
 {
-  short ir, ia;
-  
-  fprintf(file, 
-	  "%s\n%s\n%s\n%s\n%s\n%s\n",	/* flag. */
-	  "# Tt[r][angle]. [1/(cm2sr)].",
-	  "# Tt[0][0], [0][1],..[0][na-1]",
-	  "# Tt[1][0], [1][1],..[1][na-1]",
-	  "# ...",
-	  "# Tt[nr-1][0], [nr-1][1],..[nr-1][na-1]",
-	  "Tt_ra");
+  short nr = In_Parm.nr, nz = In_Parm.nz, na = In_Parm.na;
+  TextStruct text[3];
+  pthread_t thread[3];
+  int i;
+
+  text[0].flag = "# A[r][z]. [1/cm3]\n"
+      "# A[0][0], [0][1],..[0][nz-1]\n"
+      "# A[1][0], [1][1],..[1][nz-1]\n"
+      "# ...\n"
+      "# A[nr-1][0], [nr-1][1],..[nr-1][nz-1]\n"
+      "A_rz\n";
+  text[0].val = Out_Parm.A_rz[0];
+  text[0].n = (long)nr*nz;
+  text[1].flag = "# Rd[r][angle]. [1/(cm2sr)].\n"
+      "# Rd[0][0], [0][1],..[0][na-1]\n"
+      "# Rd[1][0], [1][1],..[1][na-1]\n"
+      "# ...\n"
+      "# Rd[nr-1][0], [nr-1][1],..[nr-1][na-1]\n"
+      "Rd_ra\n";
+  text[1].val = Out_Parm.Rd_ra[0];
+  text[1].n = (long)nr*na;
+  text[2].flag = "# Tt[r][angle]. [1/(cm2sr)].\n"
+      "# Tt[0][0], [0][1],..[0][na-1]\n"
+      "# Tt[1][0], [1][1],..[1][na-1]\n"
+      "# ...\n"
+      "# Tt[nr-1][0], [nr-1][1],..[nr-1][na-1]\n"
+      "Tt_ra\n";
+  text[2].val = Out_Parm.Tt_ra[0];
+  text[2].n = (long)nr*na;
+  for (i=0; i<3; i++) {
+    text[i].table = 1;
+    if (pthread_create(&thread[i], NULL, FormatText, &text[i]) != 0)
+      nrerror("Cannot start the output threads.\n");
+  }
+
+  WriteVersion(file, "A1");
+
+  fprintf(file, "# %s", TimeReport);
+  fprintf(file, "\n");
+  if (Out_Parm.num_traced != In_Parm.num_photons)
+    fprintf(file, "# Photons traced: %ld of the %ld of the run\n",
+        Out_Parm.num_traced, In_Parm.num_photons);
+  if (Out_Parm.batches > 0)
+    fprintf(file, "# Relative standard error after %d batches: Rd %.3G, "
+        "A %.3G, Rd_r %.3G\n", Out_Parm.batches, Out_Parm.err_rd,
+        Out_Parm.err_a, Out_Parm.err_rdr);
   
-  for(ir=0;ir<Nr;ir++)
-    for(ia=0;ia<Na;ia++)  {
-      fprintf(file, "%12.4E ", Out_Parm.Tt_ra[ir][ia]);
-      if( (ir*Na + ia + 1)%5 == 0) fprintf(file, "\n");
-    }
+  WriteInParm(file, In_Parm);
+  WriteRAT(file, Out_Parm);	
+	/* reflectance, absorption, transmittance. */
   
-  fprintf(file, "\n");
+  /* 1D arrays. */
+  WriteA_layer(file, In_Parm.num_layers, Out_Parm);
+  Write1D(file, "A_z #A[0], [1],..A[nz-1]. [1/cm]\n", Out_Parm.A_z,
+      In_Parm.nz);
+  Write1D(file, "Rd_r #Rd[0], [1],..Rd[nr-1]. [1/cm2]\n", Out_Parm.Rd_r,
+      In_Parm.nr);
+  Write1D(file, "Rd_a #Rd[0], [1],..Rd[na-1]. [sr-1]\n", Out_Parm.Rd_a,
+      In_Parm.na);
+  Write1D(file, "Tt_r #Tt[0], [1],..Tt[nr-1]. [1/cm2]\n", Out_Parm.Tt_r,
+      In_Parm.nr);
+  Write1D(file, "Tt_a #Tt[0], [1],..Tt[na-1]. [sr-1]\n", Out_Parm.Tt_a,
+      In_Parm.na);
+  
+  /* 2D arrays, formatted on their own threads. */
+  for (i=0; i<3; i++)
+    pthread_join(thread[i], NULL);
+  for (i=0; i<3; i++)
+    WriteText(file, &text[i]);
+  WriteBatchErrors(file, In_Parm);
+  if (Out_Parm.pmc != NULL)
+    WritePmc(file, In_Parm, Out_Parm.pmc);
 }
 
 /***********************************************************
- *	5 numbers each line.
+ *	Binary .mco files are little-endian. Return 1 on a
+ *	big-endian host, which swaps every value it writes or
+ *	reads.
  ****/
-void WriteA_rz(FILE * file, 
-			   short Nr,
-			   short Nz,
-			   OutStruct Out_Parm)
+static Boolean BigEndian(void)
 {
-  short iz, ir;
-  
-  fprintf(file, 
-	  "%s\n%s\n%s\n%s\n%s\n%s\n", /* flag. */
-	  "# A[r][z]. [1/cm3]",
-	  "# A[0][0], [0][1],..[0][nz-1]",
-	  "# A[1][0], [1][1],..[1][nz-1]",
-	  "# ...",
-	  "# A[nr-1][0], [nr-1][1],..[nr-1][nz-1]",
-	  "A_rz");
-  
-  for(ir=0;ir<Nr;ir++)
-    for(iz=0;iz<Nz;iz++)  {
-      fprintf(file, "%12.4E ", Out_Parm.A_rz[ir][iz]);
-      if( (ir*Nz + iz + 1)%5 == 0) fprintf(file, "\n");
+  unsigned int one = 1;
+
+  return (*(unsigned char *)&one == 0);
+}
+
+/***********************************************************
+ *	Reverse the bytes of each of the N elements of Size
+ *	bytes at Ptr.
+ ****/
+static void SwapBytes(void * Ptr, size_t Size, long N)
+{
+  unsigned char * p = (unsigned char *)Ptr, t;
+  size_t i;
+
+  for (; N > 0; N--, p += Size)
+    for (i=0; i<Size/2; i++) {
+      t = p[i];
+      p[i] = p[Size-1-i];
+      p[Size-1-i] = t;
     }
-  
-  fprintf(file, "\n");
 }
 
 /***********************************************************
- *	1 number each line.
+ *	Swap the numbers of Head between little-endian and
+ *	the host, on a big-endian host.
  ****/
-void WriteA_z(FILE * file, 
-			  short Nz,
-			  OutStruct Out_Parm)
+static void SwapHead(McoHead * Head)
 {
-  short iz;
-  
-  fprintf(file, 
-	"A_z #A[0], [1],..A[nz-1]. [1/cm]\n");	/* flag. */
-  
-  for(iz=0;iz<Nz;iz++) {
-    fprintf(file, "%12.4E\n", Out_Parm.A_z[iz]);
-  }
-  
-  fprintf(file, "\n");
+  if (!BigEndian())
+    return;
+  SwapBytes(&Head->version, sizeof(int), 8); /* version to flags. */
+  SwapBytes(&Head->num_photons, sizeof(long long), 2);
+  SwapBytes(&Head->Wth, sizeof(double), 9); /* Wth to Tt. */
+  SwapBytes(&Head->batches, sizeof(int), 2);
+  SwapBytes(&Head->err_rd, sizeof(double), 3);
 }
 
 /***********************************************************
- *	1 number each line.
+ *	Write N numbers of Size bytes from Ptr, little-endian,
+ *	or quit. Ptr is left as it was.
  ****/
-void WriteTt_r(FILE * file, 
-			   short Nr,
-			   OutStruct Out_Parm)
+static void WriteBlock(FILE * file, void * Ptr, size_t Size, long N)
 {
-  short ir;
-  
-  fprintf(file, 
-	"Tt_r #Tt[0], [1],..Tt[nr-1]. [1/cm2]\n"); /* flag. */
-  
-  for(ir=0;ir<Nr;ir++) {
-    fprintf(file, "%12.4E\n", Out_Parm.Tt_r[ir]);
+  void * buf = Ptr;
+
+  if (BigEndian()) {
+    buf = malloc(Size*N);
+    if (buf == NULL)
+      nrerror("allocation failure in WriteBlock()");
+    memcpy(buf, Ptr, Size*N);
+    SwapBytes(buf, Size, N);
   }
-  
-  fprintf(file, "\n");
+  if (fwrite(buf, Size, N, file) != (size_t)N)
+    nrerror("Cannot write the binary output.\n");
+  if (buf != Ptr)
+    free(buf);
 }
 
 /***********************************************************
- *	1 number each line.
+ *	Read N little-endian numbers of Size bytes to Ptr, or
+ *	quit.
  ****/
-void WriteTt_a(FILE * file, 
-			   short Na,
-			   OutStruct Out_Parm)
+static void ReadBlock(FILE * file, void * Ptr, size_t Size, long N)
 {
-  short ia;
-  
-  fprintf(file, 
-	"Tt_a #Tt[0], [1],..Tt[na-1]. [sr-1]\n"); /* flag. */
-  
-  for(ia=0;ia<Na;ia++) {
-    fprintf(file, "%12.4E\n", Out_Parm.Tt_a[ia]);
-  }
-  
-  fprintf(file, "\n");
+  if (fread(Ptr, Size, N, file) != (size_t)N)
+    nrerror("Truncated binary .mco file.\n");
+  if (BigEndian())
+    SwapBytes(Ptr, Size, N);
 }
 
-//>>>>>>>>>>>>>>Multi-Node Cluster Implementation
-void generateNodeFileName (char * origFileName) {
-    char extension[10];
+/***********************************************************
+ *	Write the results of a run in the binary format, see
+ *	McoHead. The standard errors of -V and the derivatives
+ *	of -D are only written in the ASCII format.
+ ****/
+void WriteBinary(FILE * file,
+				 InputStruct In_Parm, 
+				 OutStruct Out_Parm,
+				 char * TimeReport)
+{
+  short nz = In_Parm.nz, nr = In_Parm.nr, na = In_Parm.na;
+  short nl = In_Parm.num_layers;
+  McoHead head;
+  McoLayer * layer;
+  short i;
 
-    sprintf (extension, "%d", CURRENT_NODE);
+  memset(&head, 0, sizeof(head));
+  memcpy(head.magic, MCO_MAGIC, 8);
+  head.version = MCO_VERSION;
+  head.byte_order = MCO_BYTE_ORDER;
+  head.head_size = sizeof(McoHead);
+  head.num_layers = nl;
+  head.nz = nz;
+  head.nr = nr;
+  head.na = na;
+  head.flags = MCO_RAW;
+  head.num_photons = Out_Parm.num_traced;
+  head.run_photons = In_Parm.num_photons;
+  head.Wth = In_Parm.Wth;
+  head.dz = In_Parm.dz;
+  head.dr = In_Parm.dr;
+  head.da = In_Parm.da;
+  head.weight_scale = WEIGHT_SCALE;
+  head.Rsp = Out_Parm.Rsp;
+  head.Rd = Out_Parm.Rd;
+  head.A = Out_Parm.A;
+  head.Tt = Out_Parm.Tt;
+  head.batches = Out_Parm.batches;
+  head.err_rd = Out_Parm.err_rd;
+  head.err_a = Out_Parm.err_a;
+  head.err_rdr = Out_Parm.err_rdr;
+  strncpy(head.out_fname, In_Parm.out_fname, STRLEN-1);
+  strncpy(head.note, TimeReport, STRLEN-1);
+
+  layer = (McoLayer *)calloc(nl+2, sizeof(McoLayer));
+  if (layer == NULL)
+    nrerror("allocation failure in WriteBinary()");
+  for (i=0; i<=nl+1; i++) {
+    LayerStruct * s = &In_Parm.layerspecs[i];
+
+    layer[i].n = s->n;
+    if (i == 0 || i == nl+1)
+      continue;
+    layer[i].mua = s->mua;
+    layer[i].mus = s->mus;
+    layer[i].g = s->g;
+    layer[i].z0 = s->z0;
+    layer[i].z1 = s->z1;
+  }
 
-    strcat (origFileName,extension);
+  SwapHead(&head);
+  if (fwrite(&head, sizeof(head), 1, file) != 1)
+    nrerror("Cannot write the binary output.\n");
+  WriteBlock(file, layer, sizeof(double), 6*(nl+2)); /* n to z1. */
+  WriteBlock(file, &Out_Parm.A_l[1], sizeof(double), nl);
+  WriteBlock(file, Out_Parm.A_z, sizeof(double), nz);
+  WriteBlock(file, Out_Parm.Rd_r, sizeof(double), nr);
+  WriteBlock(file, Out_Parm.Rd_a, sizeof(double), na);
+  WriteBlock(file, Out_Parm.Tt_r, sizeof(double), nr);
+  WriteBlock(file, Out_Parm.Tt_a, sizeof(double), na);
+  WriteBlock(file, Out_Parm.A_rz[0], sizeof(double), (long)nr*nz);
+  WriteBlock(file, Out_Parm.Rd_ra[0], sizeof(double), (long)nr*na);
+  WriteBlock(file, Out_Parm.Tt_ra[0], sizeof(double), (long)nr*na);
+  WriteBlock(file, Out_Parm.A_rz_raw, sizeof(unsigned long long),
+      (long)nr*nz);
+  WriteBlock(file, Out_Parm.Rd_ra_raw, sizeof(unsigned long long),
+      (long)nr*na);
+  WriteBlock(file, Out_Parm.Tt_ra_raw, sizeof(unsigned long long),
+      (long)nr*na);
+  free(layer);
+
+  if (VarBatches > 0 || Out_Parm.pmc != NULL)
+    printf("The *_err and d*_dmu* sections are only written to ASCII "
+        "output.\n");
 }
-//>>>>>>>>>>>>
-
 
 /***********************************************************
  ****/
@@ -1114,33 +1355,98 @@ void WriteResult(InputStruct In_Parm,
 
   //>>>>>>>>>>>>>>>Multi-Node Cluster Implementation
   
-  file = fopen(In_Parm.out_fname, "w");
+  file = fopen(In_Parm.out_fname, "wb");
   if(file == NULL) nrerror("Cannot open file to write.\n");
   
   if(toupper(In_Parm.out_fformat) == 'A') 
-	WriteVersion(file, "A1");
+	WriteAscii(file, In_Parm, Out_Parm, TimeReport);
   else 
-	WriteVersion(file, "B1");
-
-  fprintf(file, "# %s", TimeReport);
-  fprintf(file, "\n");
-  
-  WriteInParm(file, In_Parm);
-  WriteRAT(file, Out_Parm);	
-	/* reflectance, absorption, transmittance. */
-  
-  /* 1D arrays. */
-  WriteA_layer(file, In_Parm.num_layers, Out_Parm);
-  WriteA_z(file, In_Parm.nz, Out_Parm);
-  WriteRd_r(file, In_Parm.nr, Out_Parm);
-  WriteRd_a(file, In_Parm.na, Out_Parm);
-  WriteTt_r(file, In_Parm.nr, Out_Parm);
-  WriteTt_a(file, In_Parm.na, Out_Parm);
-  
-  /* 2D arrays. */
-  WriteA_rz(file, In_Parm.nr, In_Parm.nz, Out_Parm);
-  WriteRd_ra(file, In_Parm.nr, In_Parm.na, Out_Parm);
-  WriteTt_ra(file, In_Parm.nr, In_Parm.na, Out_Parm);
+	WriteBinary(file, In_Parm, Out_Parm, TimeReport);
   
+  if (fclose(file) != 0)
+    nrerror("Cannot write the output file.\n");
+}
+
+/***********************************************************
+ *	Write the binary .mco file Bin_Fname, of mcml or of
+ *	GPUMCML, as the ASCII .mco file Ascii_Fname (-O).
+ ****/
+void ConvertResult(char * Bin_Fname, char * Ascii_Fname)
+{
+  InputStruct in_parm;
+  OutStruct out_parm;
+  McoHead head;
+  McoLayer * layer;
+  FILE *file;
+  short nz, nr, na, nl, i;
+
+  file = fopen(Bin_Fname, "rb");
+  if (file == NULL)
+    nrerror("Cannot open the binary .mco file.\n");
+  if (fread(&head, sizeof(head), 1, file) != 1)
+    nrerror("Truncated binary .mco file.\n");
+  SwapHead(&head);
+  if (memcmp(head.magic, MCO_MAGIC, 8) != 0 || head.version != MCO_VERSION
+      || head.byte_order != MCO_BYTE_ORDER
+      || head.head_size != sizeof(McoHead))
+    nrerror("Not a binary .mco file of this version.\n");
+
+  memset(&in_parm, 0, sizeof(in_parm));
+  strcpy(in_parm.out_fname, head.out_fname);
+  in_parm.out_fformat = 'A';
+  in_parm.num_photons = (long)head.run_photons;
+  in_parm.Wth = head.Wth;
+  in_parm.dz = head.dz;
+  in_parm.dr = head.dr;
+  in_parm.da = head.da;
+  in_parm.nz = nz = head.nz;
+  in_parm.nr = nr = head.nr;
+  in_parm.na = na = head.na;
+  in_parm.num_layers = nl = head.num_layers;
+
+  layer = (McoLayer *)malloc((nl+2)*sizeof(McoLayer));
+  in_parm.layerspecs = (LayerStruct *)calloc(nl+2, sizeof(LayerStruct));
+  if (layer == NULL || in_parm.layerspecs == NULL)
+    nrerror("allocation failure in ConvertResult()");
+  ReadBlock(file, layer, sizeof(double), 6*(nl+2));
+  for (i=0; i<=nl+1; i++) {
+    LayerStruct * s = &in_parm.layerspecs[i];
+
+    s->n = layer[i].n;
+    s->mua = layer[i].mua;
+    s->mus = layer[i].mus;
+    s->g = layer[i].g;
+    s->z0 = layer[i].z0;
+    s->z1 = layer[i].z1;
+  }
+  free(layer);
+
+  InitOutputData(in_parm, &out_parm);
+  out_parm.Rsp = head.Rsp;
+  out_parm.Rd = head.Rd;
+  out_parm.A = head.A;
+  out_parm.Tt = head.Tt;
+  out_parm.batches = head.batches;
+  out_parm.num_traced = (long)head.num_photons;
+  out_parm.err_rd = head.err_rd;
+  out_parm.err_a = head.err_a;
+  out_parm.err_rdr = head.err_rdr;
+  ReadBlock(file, &out_parm.A_l[1], sizeof(double), nl);
+  ReadBlock(file, out_parm.A_z, sizeof(double), nz);
+  ReadBlock(file, out_parm.Rd_r, sizeof(double), nr);
+  ReadBlock(file, out_parm.Rd_a, sizeof(double), na);
+  ReadBlock(file, out_parm.Tt_r, sizeof(double), nr);
+  ReadBlock(file, out_parm.Tt_a, sizeof(double), na);
+  ReadBlock(file, out_parm.A_rz[0], sizeof(double), (long)nr*nz);
+  ReadBlock(file, out_parm.Rd_ra[0], sizeof(double), (long)nr*na);
+  ReadBlock(file, out_parm.Tt_ra[0], sizeof(double), (long)nr*na);
   fclose(file);
+
+  file = fopen(Ascii_Fname, "w");
+  if (file == NULL)
+    nrerror("Cannot open file to write.\n");
+  WriteAscii(file, in_parm, out_parm, head.note);
+  if (fclose(file) != 0)
+    nrerror("Cannot write the output file.\n");
+  FreeData(in_parm, &out_parm);
 }
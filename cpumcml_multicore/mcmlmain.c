@@ -28,6 +28,69 @@
 #include "mcml.h"
 #include "hrtime.h" 
 #include <sched.h>    //Used to set Number of processors useda
+#include <pthread.h>
+#include <unistd.h>   //sysconf() for the number of online cores
+
+//>>>>>>>>>>>>>>.Global Variables >>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+int NumThreads;
+int EngineType = ENGINE_SCALAR;
+int RngType = RNG_RAN3;
+unsigned long long RngSeed = 1237;
+int NumShards = 0;
+Boolean HotTile = 0;
+short HotNr = 0, HotNz = 0;
+Boolean WriteCombine = 0;
+double FresnelTol = 0.0;
+char * CheckpointFile = NULL;
+double CheckpointMinutes = CHECKPOINT_MINUTES;
+char * ResumeFile = NULL;
+Boolean KeepRaw = 0;
+long TopUpPhotons = 0;
+double BatchTol = 0.0;
+double BatchRadius = 0.0;
+int VarBatches = 0;
+Boolean IgnoreA = 0;
+Boolean PhaseHG = 0;
+int NumPhaseFiles = 0;
+short PhaseLayer[MAX_PHASE_FILES];
+char * PhaseFile[MAX_PHASE_FILES];
+int NUM_NODE;
+int CURRENT_NODE;
+
+int ConcurrentRuns = 1;
+int WhiteBins = 0;
+double WhiteMaxPath = WHITE_MAX_PATH;
+long WhiteMaxGroups = WHITE_MAX_GROUPS;
+char * CacheDir = NULL;
+double CacheMB = CACHE_MB;
+Boolean PmcDeriv = 0;
+double ScaleMaxPath = 0.0;
+char * ConvertFile = NULL; //-O<file>, binary .mco to write as ASCII
+RandStruct * ranparm;
+
+/****
+ *	A run of the input file in progress: its input, tallies
+ *	and photons, and the output of each worker thread.
+ ****/
+typedef struct {
+  InputStruct in;
+  long index; /* in the input file. */
+  Boolean last; /* of the input file. */
+  TallyStruct tally;
+  PoolStruct pool;
+  OutStruct * out; /* NumThreads elements. */
+  int engine_variant; /* of the scalar engine, VARIANT_* bits. */
+  int workers; /* threads tracing it, with -J. */
+  double * white_mua; /* of the input, for a white run (-L). */
+  double scale_mua; /* of the input, for a baseline run (-B). */
+  double start_time;
+  unsigned long long start_cycle;
+} RunStruct;
+
+/* The run of DoOneRun(). */
+static RunStruct * cur_run;
+/* Index of the current run in the input file. */
+static long run_index;
 
 /*	Declare before they are used in main(). */
 FILE *GetFile(char *);
@@ -36,16 +99,17 @@ void ReadParm(FILE*, InputStruct *);
 void CheckParm(FILE*, InputStruct *);
 void InitOutputData(InputStruct, OutStruct *);
 void FreeData(InputStruct, OutStruct *);
+void FreeOutputData(InputStruct, OutStruct *);
+void ShowVersion(char *);
 double Rspecular(LayerStruct *);
 void LaunchPhoton(double, LayerStruct *, PhotonStruct *);
 void HopDropSpin(InputStruct *, PhotonStruct *, OutStruct *, int);
 void SumScaleResult(InputStruct, OutStruct *);
 void WriteResult(InputStruct, OutStruct, char *);
+void ConvertResult(char *, char *);
 
 //>>>>>>>>>>>>>>>>Multi-Threading>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 void * DoOneThread(void *);
-void SumOutPtr(OutStruct *sum_out_parm, OutStruct Nout_parm, short nz,
-    short nr, short na);
 
 /***********************************************************
  *	If F = 0, reset the clock and return 0.
@@ -132,6 +196,234 @@ void ReportResult(InputStruct In_Parm, OutStruct Out_Parm) {
   WriteResult(In_Parm, Out_Parm, time_report);
 }
 
+/***********************************************************
+ *	Print the command line help.
+ ****/
+void Usage(char * Prog_Name) {
+  printf("\nUsage: %s [-T<threads>] [-E<engine>] [-M<rng>] [-S<seed>] "
+      "[-C<n>] [-H[<nr>,<nz>]] [-W] [-F[<tol>]] [-A]\n"
+      "       [-Phg] [-P<layer>,<file>] [-K<file>] [-I<minutes>] [-R<file>]\n"
+      "       [-U<err>[,<radius>]] [-V[<n>]] [-J<runs>] [-Q<dir>[,<MB>]]\n"
+      "       [-L[<bins>[,<max>[,<groups>]]]] [-D] [-B[<max>]] [-X[<photons>]]\n"
+      "       <input file> [<CURRENT_NODE> <NUM_NODE>]\n"
+      "       %s -O<binary .mco> <ASCII .mco>\n\n", Prog_Name, Prog_Name);
+  printf("  -T: number of worker threads (default: online cores)\n");
+  printf("  -E: transport engine, scalar (default), packet or event\n");
+  printf("  -M: random number generator, ran3 (default), mwc, dsfmt or\n"
+      "      philox (reproducible: fixed-point tallies, results do not\n"
+      "      depend on the number of threads)\n");
+  printf("  -S: seed for random number generation (default: 1237)\n");
+  printf("  -C: copies (shards) of the tally arrays shared by the threads\n"
+      "      (default: one per thread, or one with -H)\n");
+  printf("  -H: private tile of A_rz near the source for each thread, of\n"
+      "      <nr> x <nz> bins (default: sized from the optical properties)\n");
+  printf("  -W: combine repeated drops into the same A_rz bin before\n"
+      "      storing them, for contended shards (default: off)\n");
+  printf("  -F[<tol>]: interpolate the Fresnel reflectance from a table of\n"
+      "      each boundary, to within <tol> (default: %.0e; off: exact)\n",
+      FRESNEL_TOL);
+  printf("  -A: ignore absorption detection, A_rz is not tallied\n");
+  printf("  -Phg: sample Henyey-Greenstein from tables of the inverse CDF\n");
+  printf("  -P<layer>,<file>: sample the phase function of a layer from a\n"
+      "      file of \"theta p\" lines, theta in degrees (repeatable)\n");
+  printf("  -K<file>: write a checkpoint of the run to <file> periodically\n");
+  printf("  -I<minutes>: time between checkpoints (default: %g)\n",
+      CHECKPOINT_MINUTES);
+  printf("  -R<file>: resume from the checkpoint <file>, with the options\n"
+      "      and input of the interrupted run (implies -K<file>)\n");
+  printf("  -U<err>[,<radius>]: trace the photons in batches until the\n"
+      "      relative standard error of Rd and A, and of Rd_r within\n"
+      "      <radius> cm, is <err>; the photons of the input are a cap\n");
+  printf("  -V[<n>]: standard error of every output value from <n> batches\n"
+      "      (default: %d, or those of -U), written as *_err sections;\n"
+      "      costs 16 bytes per value and a pass over the tallies per batch\n",
+      VAR_BATCHES);
+  printf("  -J<runs>: trace up to <runs> runs of the input file at once on\n"
+      "      the threads, overlapping the set-up and output of a run with\n"
+      "      the photons of the others; each costs its own tallies\n"
+      "      (default: 1, one run after another)\n");
+  printf("  -L[<bins>[,<max>[,<groups>]]]: white Monte Carlo, trace without\n"
+      "      absorption and write the path lengths of the photons in each\n"
+      "      layer, grouped by the total in <bins> per octave (default: %d)\n"
+      "      and the shares of the layers, up to <max> cm (default: %g), to\n"
+      "      <output>.wmc; the bins are widened until there are at most\n"
+      "      <groups> (default: %d) groups; see mcmlwmc for Rd, A and Tt\n"
+      "      at any mua\n",
+      WHITE_BINS, WHITE_MAX_PATH, WHITE_MAX_GROUPS);
+  printf("  -D: derivatives of Rd, Tt, Rd_r and Tt_r with respect to the mua\n"
+      "      and mus of each layer, from the same photons (perturbation\n"
+      "      Monte Carlo), written as d*_dmua and d*_dmus sections\n");
+  printf("  -B[<max>]: baseline run of a single layer for scaling, trace\n"
+      "      without absorption and write the exit radius, path length and\n"
+      "      collisions of the photons, up to <max> cm (default: %g), to\n"
+      "      <output>.smc; see mcmlsmc for Rd(r) at any mua and mus\n",
+      WHITE_MAX_PATH);
+  printf("  -X[<photons>]: keep the raw tallies and the generator states of\n"
+      "      each run in <output file>.raw; with <photons>, trace that many\n"
+      "      more photons on top of the .raw of each run, and write the\n"
+      "      results of all of them\n");
+  printf("  -Q<dir>[,<MB>]: cache the tallies of each run in <dir>, of up to\n"
+      "      <MB> (default: %g) of the most recently used runs; a cached run\n"
+      "      is not traced again, and with -Mphilox one cached with fewer\n"
+      "      photons is topped up\n", CACHE_MB);
+  printf("  -O<file>: write the binary .mco <file> (output format B of the\n"
+      "      input, of mcml or GPUMCML) as an ASCII .mco, and exit\n");
+  printf("\n");
+  fflush(stdout);
+}
+
+/***********************************************************
+ *	Parse the options that precede the input file name.
+ *	Return the number of arguments consumed, so that the
+ *	positional arguments can be read as before from
+ *	argv + the returned count.
+ ****/
+int GetOptions(int argc, char * argv[]) {
+  int i;
+
+  NumThreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (NumThreads < 1)
+    NumThreads = 1;
+
+  for (i=1; i<argc && argv[i][0]=='-'; i++) {
+    char * arg = argv[i]+1; /* skip the '-'. */
+    int pos = 0; /* of the file name in -P<layer>,<file>. */
+    short layer; /* of -P<layer>,<file>. */
+
+    if (sscanf(arg, "T%d", &NumThreads) == 1 && NumThreads > 0) {
+      /* <NumThreads> has been set. */
+    } else if (strcmp(arg, "Escalar") == 0) {
+      EngineType = ENGINE_SCALAR;
+    } else if (strcmp(arg, "Epacket") == 0) {
+      EngineType = ENGINE_PACKET;
+    } else if (strcmp(arg, "Eevent") == 0) {
+      EngineType = ENGINE_EVENT;
+    } else if (strcmp(arg, "Mran3") == 0) {
+      RngType = RNG_RAN3;
+    } else if (strcmp(arg, "Mmwc") == 0) {
+      RngType = RNG_MWC;
+    } else if (strcmp(arg, "Mdsfmt") == 0) {
+      RngType = RNG_DSFMT;
+    } else if (strcmp(arg, "Mphilox") == 0) {
+      RngType = RNG_PHILOX;
+    } else if (sscanf(arg, "S%llu", &RngSeed) == 1) {
+      /* <RngSeed> has been set. */
+    } else if (sscanf(arg, "C%d", &NumShards) == 1 && NumShards > 0) {
+      /* <NumShards> has been set. */
+    } else if (strcmp(arg, "H") == 0) {
+      HotTile = 1;
+    } else if (sscanf(arg, "H%hd,%hd", &HotNr, &HotNz) == 2
+        && HotNr > 0 && HotNz > 0) {
+      HotTile = 1;
+    } else if (strcmp(arg, "W") == 0) {
+      WriteCombine = 1;
+    } else if (strcmp(arg, "F") == 0) {
+      FresnelTol = FRESNEL_TOL;
+    } else if (sscanf(arg, "F%lf", &FresnelTol) == 1 && FresnelTol > 0.0) {
+      /* <FresnelTol> has been set. */
+    } else if (strcmp(arg, "A") == 0) {
+      IgnoreA = 1;
+    } else if (strcmp(arg, "Phg") == 0) {
+      PhaseHG = 1;
+    } else if (sscanf(arg, "P%hd,%n", &layer, &pos) == 1
+        && pos > 0 && arg[pos] != '\0') {
+      if (NumPhaseFiles >= MAX_PHASE_FILES)
+        nrerror("too many phase function files (-P)");
+      PhaseLayer[NumPhaseFiles] = layer;
+      PhaseFile[NumPhaseFiles++] = arg+pos;
+    } else if ((arg[0] == 'K' || arg[0] == 'R') && (arg[1] != '\0'
+        || i+1 < argc)) {
+      char * file = arg[1] != '\0' ? arg+1 : argv[++i]; /* -K <file>. */
+
+      if (arg[0] == 'K')
+        CheckpointFile = file;
+      else
+        ResumeFile = file;
+    } else if (sscanf(arg, "I%lf", &CheckpointMinutes) == 1
+        && CheckpointMinutes > 0.0) {
+      /* <CheckpointMinutes> has been set. */
+    } else if (sscanf(arg, "U%lf,%lf", &BatchTol, &BatchRadius) >= 1
+        && BatchTol > 0.0 && BatchRadius >= 0.0) {
+      /* <BatchTol> and <BatchRadius> have been set. */
+    } else if (strcmp(arg, "V") == 0) {
+      VarBatches = VAR_BATCHES;
+    } else if (sscanf(arg, "V%d", &VarBatches) == 1 && VarBatches >= 2) {
+      /* <VarBatches> has been set. */
+    } else if (sscanf(arg, "J%d", &ConcurrentRuns) == 1
+        && ConcurrentRuns > 0) {
+      /* <ConcurrentRuns> has been set. */
+    } else if (strcmp(arg, "L") == 0) {
+      WhiteBins = WHITE_BINS;
+    } else if (sscanf(arg, "L%d,%lf,%ld", &WhiteBins, &WhiteMaxPath,
+        &WhiteMaxGroups) >= 1 && WhiteBins > 0 && WhiteMaxPath > 0.0
+        && WhiteMaxGroups > 0) {
+      /* <WhiteBins>, <WhiteMaxPath> and <WhiteMaxGroups> have been set. */
+    } else if (strcmp(arg, "D") == 0) {
+      PmcDeriv = 1;
+    } else if (strcmp(arg, "B") == 0) {
+      ScaleMaxPath = WHITE_MAX_PATH;
+    } else if (sscanf(arg, "B%lf", &ScaleMaxPath) == 1 && ScaleMaxPath > 0.0) {
+      /* <ScaleMaxPath> has been set. */
+    } else if (strcmp(arg, "X") == 0) {
+      KeepRaw = 1;
+    } else if (sscanf(arg, "X%ld", &TopUpPhotons) == 1 && TopUpPhotons > 0) {
+      KeepRaw = 1;
+    } else if (arg[0] == 'Q' && arg[1] != '\0') {
+      char * comma = strrchr(arg+1, ',');
+
+      CacheDir = arg+1;
+      if (comma != NULL && sscanf(comma+1, "%lf", &CacheMB) == 1) {
+        *comma = '\0'; /* -Q<dir>,<MB>. */
+        if (CacheMB <= 0.0) {
+          Usage(argv[0]);
+          exit(1);
+        }
+      }
+    } else if (arg[0] == 'O' && arg[1] != '\0') {
+      ConvertFile = arg+1;
+    } else {
+      Usage(argv[0]);
+      exit(1);
+    }
+  }
+
+  if (ResumeFile != NULL && CheckpointFile == NULL)
+    CheckpointFile = ResumeFile;
+  if (CheckpointFile != NULL && strlen(CheckpointFile) >= STRLEN)
+    nrerror("checkpoint file name too long");
+  if (CheckpointFile != NULL && BATCHED)
+    nrerror("-U and -V cannot be combined with checkpoints (-K, -R)");
+  if (ConcurrentRuns > 1 && (CheckpointFile != NULL || BATCHED))
+    nrerror("-J cannot be combined with -K, -R, -U or -V");
+  if (WhiteBins > 0 && EngineType != ENGINE_SCALAR)
+    nrerror("-L needs the scalar engine");
+  if (WhiteBins > 0 && (CheckpointFile != NULL || BATCHED))
+    nrerror("-L cannot be combined with -K, -R, -U or -V");
+  if (PmcDeriv && (EngineType != ENGINE_SCALAR || WhiteBins > 0))
+    nrerror("-D needs the scalar engine, without -L");
+  if (PmcDeriv && CheckpointFile != NULL)
+    nrerror("-D cannot be combined with checkpoints (-K, -R)");
+  if (ScaleMaxPath > 0.0 && (EngineType != ENGINE_SCALAR || WhiteBins > 0
+      || PmcDeriv))
+    nrerror("-B needs the scalar engine, without -L or -D");
+  if (ScaleMaxPath > 0.0 && (CheckpointFile != NULL || BATCHED))
+    nrerror("-B cannot be combined with -K, -R, -U or -V");
+  if (KeepRaw && (CheckpointFile != NULL || BATCHED))
+    nrerror("-X cannot be combined with -K, -R, -U or -V");
+  if (KeepRaw && (WhiteBins > 0 || PmcDeriv || ScaleMaxPath > 0.0))
+    nrerror("-X cannot be combined with -L, -D or -B");
+  if (KeepRaw && ConcurrentRuns > 1 && RngType != RNG_PHILOX)
+    nrerror("-X with -J needs -Mphilox, the runs share the generators");
+  if (CacheDir != NULL && strlen(CacheDir) >= STRLEN)
+    nrerror("cache directory name too long");
+  if (CacheDir != NULL && (CheckpointFile != NULL || BATCHED || KeepRaw))
+    nrerror("-Q cannot be combined with -K, -R, -U, -V or -X");
+  if (CacheDir != NULL && (WhiteBins > 0 || PmcDeriv || ScaleMaxPath > 0.0))
+    nrerror("-Q cannot be combined with -L, -D or -B");
+
+  return (i-1);
+}
+
 /***********************************************************
  *	Get the file name of the input data file from the 
  *	argument to the command line.
@@ -143,95 +435,481 @@ void GetFnameFromArgv(int argc, char * argv[], char * input_filename) {
     input_filename[0] = '\0';
 }
 
+/***********************************************************
+ *	Return the number of photons this node simulates.
+ *	The remainder of the division by NUM_NODE goes to the
+ *	first nodes, so the nodes together trace all photons.
+ ****/
+long NodePhotons(long Num_Photons) {
+  long n = Num_Photons/NUM_NODE;
+
+  if (CURRENT_NODE < Num_Photons%NUM_NODE)
+    n++;
+  return (n);
+}
+
+/***********************************************************
+ *	Index of the first photon of this node among the 
+ *	Num_Photons of the run.
+ ****/
+long NodeFirstPhoton(long Num_Photons) {
+  long r = Num_Photons%NUM_NODE;
+
+  return (CURRENT_NODE*(Num_Photons/NUM_NODE)
+      + (CURRENT_NODE < r ? CURRENT_NODE : r));
+}
+
+/***********************************************************
+ *	Lease up to Pool->lease_size photons from the pool.
+ *	Return the number of photons granted, which is 0 once
+ *	the pool is empty, and set *First_Ptr to the index of
+ *	the first of them in the run.
+ *
+ *	The pool may go negative when several threads lease
+ *	its last photons at once; only the thread that still
+ *	saw a positive count gets the remainder.
+ ****/
+long LeasePhotons(PoolStruct * Pool, long * First_Ptr) {
+  long left = __sync_fetch_and_sub(&Pool->left, Pool->lease_size);
+
+  if (left <= 0)
+    return (0);
+  *First_Ptr = Pool->first + Pool->node - left;
+  return (left < Pool->lease_size ? left : Pool->lease_size);
+}
+
+/***********************************************************
+ *	Return the number of photons of the run of DoOneRun()
+ *	not yet leased.
+ ****/
+long PhotonsLeft(void) {
+  return (cur_run->pool.left > 0 ? cur_run->pool.left : 0);
+}
+
+/***********************************************************
+ *	Fill the empty pool of the run of DoOneRun() with its
+ *	next N photons, for the next batch of -U. Called by
+ *	the main thread while the workers wait in
+ *	CheckpointPause().
+ ****/
+void RefillPhotons(long N) {
+  PoolStruct * pool = &cur_run->pool;
+
+  pool->first += pool->node;
+  pool->node = N;
+  pool->left = N;
+}
+
+/***********************************************************
+ *	Return 1 if the calling thread may launch another
+ *	photon, leasing a new batch from Pool when its
+ *	current lease (*Lease_Left_Ptr) is used up, and set
+ *	*Photon_Ptr to the index of that photon in the run.
+ *	Return 0 once the pool is empty, or while a checkpoint
+ *	is pending, so that the engine drains and returns.
+ ****/
+Boolean TakePhoton(PoolStruct * Pool, long * Lease_Left_Ptr,
+    long * Photon_Ptr) {
+  if (*Lease_Left_Ptr == 0) {
+    if (CheckpointPending)
+      return (0);
+    *Lease_Left_Ptr = LeasePhotons(Pool, Photon_Ptr);
+    if (*Lease_Left_Ptr == 0)
+      return (0);
+  } else
+    (*Photon_Ptr)++;
+
+  (*Lease_Left_Ptr)--;
+  return (1);
+}
+
+/***********************************************************
+ *	Set up Run, whose input has been read: the tables of
+ *	the layers, the tallies and the photon pool.
+ ****/
+void StartRun(RunStruct * Run) {
+  InputStruct * in = &Run->in;
+  PoolStruct * pool = &Run->pool;
+
+  //>>>>>>>>>>>>>>Performance Measurement
+  Run->start_time = getElapsedTime();
+  Run->start_cycle = get_hrcycles();
+
+  Run->white_mua = WhiteBins > 0 ? InitWhite(in) : NULL;
+  Run->scale_mua = ScaleMaxPath > 0.0 ? InitScale(in) : 0.0;
+  InitPhase(in);
+  InitFresnel(in);
+  Run->engine_variant = EngineVariant(in);
+  if (HotTile) {
+    /* the hot bins stay private, so one shared shard will do. */
+    short hot_nr = HotNr, hot_nz = HotNz;
+
+    if (hot_nr == 0)
+      HotTileSize(in, &hot_nr, &hot_nz);
+    InitTally(in, &Run->tally, NumShards > 0 ? NumShards : 1, hot_nr, hot_nz);
+  } else
+    InitTally(in, &Run->tally, NumShards > 0 ? NumShards : NumThreads, 0, 0);
+
+  Run->out = (OutStruct *)calloc(NumThreads, sizeof(OutStruct));
+  if (Run->out == NULL)
+    nrerror("allocation failure in StartRun()");
+  Run->workers = 0;
+
+  /* Fill the photon pool and size the leases so that each thread */
+  /* gets several of them; fast threads simply lease more often. */
+  /* A top-up traces the photons N.. of a run of N+TopUpPhotons. */
+  if (TopUpPhotons > 0) {
+    pool->first = TopUpStart(in, &Run->tally);
+    pool->left = pool->node = TopUpPhotons;
+  } else {
+    pool->left = pool->node = NodePhotons(in->num_photons);
+    pool->first = NodeFirstPhoton(in->num_photons);
+  }
+  if (BATCHED)
+    pool->left = pool->node = InitBatches(in);
+  pool->lease_size = pool->left/((long)NumThreads*LEASES_PER_THREAD);
+  if (pool->lease_size > PHOTON_BATCH)
+    pool->lease_size = PHOTON_BATCH;
+  else if (pool->lease_size < 1)
+    pool->lease_size = 1;
+  pool->left = ResumeCheckpoint(in, &Run->tally, Run->index, pool->left);
+  if (CacheDir != NULL)
+    CacheLookup(in, &Run->tally, pool);
+
+  printf("Number of threads=%d, photons=%ld, lease size=%ld, "
+      "tally shards=%d, hot tile=%dx%d\n", NumThreads, pool->left,
+      pool->lease_size, Run->tally.num_shards, Run->tally.hot_nr,
+      Run->tally.hot_nz);
+  if (Run->white_mua != NULL)
+    printf("Engine: white, without absorption\n");
+  else if (ScaleMaxPath > 0.0)
+    printf("Engine: baseline, without absorption\n");
+  else if (PmcDeriv)
+    printf("Engine: perturbation, with derivatives\n");
+  else if (EngineType == ENGINE_SCALAR)
+    printf("Engine variant=%d:%s%s%s%s%s\n", Run->engine_variant,
+        Run->engine_variant & VARIANT_NOABS ? " no-absorption" : "",
+        Run->engine_variant & VARIANT_ISO ? " isotropic" : "",
+        Run->engine_variant & VARIANT_MATCHED ? " matched" : "",
+        Run->engine_variant & VARIANT_SINGLE ? " single-layer" : "",
+        Run->engine_variant & VARIANT_NOGLASS ? " no-glass" : "");
+}
+
+/***********************************************************
+ *	Sum the tallies of Run, whose threads are all done,
+ *	write its results and free it.
+ ****/
+void EndRun(RunStruct * Run) {
+  OutStruct sum_out_parm;
+  WhiteStruct * white = NULL; /* groups of all threads. */
+  ScaleStruct * scale = NULL; /* exits of all threads. */
+  long long drops = 0, stores = 0; /* of A_rz, over the threads. */
+  double end_time;
+  unsigned long long end_cycle;
+  long i;
+
+  InitOutputData(Run->in, &sum_out_parm);
+  sum_out_parm.Rsp = Rspecular(Run->in.layerspecs);
+  if (BATCHED)
+    EndBatches(&Run->in, &sum_out_parm);
+  sum_out_parm.num_traced = NodePhotons(Run->in.num_photons);
+
+  ReduceTally(&Run->tally, &sum_out_parm);
+  if (KeepRaw)
+    TopUpStore(&Run->in, &sum_out_parm);
+  if (CacheDir != NULL)
+    CacheStore(&Run->in, &sum_out_parm);
+  FreeTally(&Run->tally);
+  FreePhase(&Run->in);
+  FreeFresnel(&Run->in);
+
+  for (i=0; i<NumThreads; i++) {
+    drops += Run->out[i].a_drops;
+    stores += Run->out[i].a_stores;
+    if (Run->out[i].pmc != NULL) {
+      if (sum_out_parm.pmc == NULL)
+        sum_out_parm.pmc = NewPmc(&Run->in);
+      AddPmc(sum_out_parm.pmc, Run->out[i].pmc);
+      FreePmc(Run->out[i].pmc);
+    }
+    if (Run->out[i].scale != NULL) {
+      if (scale == NULL)
+        scale = Run->out[i].scale;
+      else {
+        MergeScale(scale, Run->out[i].scale);
+        FreeScale(Run->out[i].scale);
+      }
+    }
+    if (Run->out[i].white == NULL)
+      continue;
+    if (white == NULL)
+      white = Run->out[i].white;
+    else {
+      MergeWhite(white, Run->out[i].white);
+      FreeWhite(Run->out[i].white);
+    }
+  }
+  free(Run->out);
+  if (WriteCombine && Run->pool.node > 0 && drops > 0)
+    printf("A_rz drops per photon=%.2f, stores per photon=%.2f (%.1f%% "
+        "fewer)\n", (double)drops/Run->pool.node,
+        (double)stores/Run->pool.node, 100.0*(drops - stores)/drops);
+
+  end_cycle = get_hrcycles();
+  end_time = getElapsedTime();
+
+  printf("DoOneRun took %lf seconds \n", end_time - Run->start_time);
+  printf("DoOneRun took %lld cycles \n", end_cycle - Run->start_cycle);
+
+  if (Run->white_mua != NULL) {
+    if (white == NULL)
+      white = NewWhite(Run->in.num_layers);
+    WriteWhite(&Run->in, Run->white_mua, white, sum_out_parm.Rsp,
+        Run->pool.node);
+    FreeWhite(white);
+    free(Run->white_mua);
+  }
+  if (ScaleMaxPath > 0.0) {
+    if (scale == NULL)
+      scale = NewScale();
+    WriteScale(&Run->in, Run->scale_mua, scale, sum_out_parm.Rsp,
+        Run->pool.node);
+    FreeScale(scale);
+  }
+  ReportResult(Run->in, sum_out_parm);
+  if (sum_out_parm.pmc != NULL)
+    FreePmc(sum_out_parm.pmc);
+  if (BATCHED)
+    FreeBatches(&Run->in);
+  FreeData(Run->in, &sum_out_parm);
+  CheckpointRunDone(Run->index, Run->last);
+}
+
+/***********************************************************
+ *	Make the worker thread pid trace photons of Run.
+ ****/
+void JoinRun(RunStruct * Run, int pid) {
+  InitThreadOut(&Run->tally, &Run->out[pid], pid);
+  Run->out[pid].Rsp = Rspecular(Run->in.layerspecs);
+  Run->out[pid].pool = &Run->pool;
+  if (Run->white_mua != NULL)
+    Run->out[pid].white = NewWhite(Run->in.num_layers);
+  if (PmcDeriv)
+    Run->out[pid].pmc = NewPmc(&Run->in);
+  if (ScaleMaxPath > 0.0)
+    Run->out[pid].scale = NewScale();
+}
+
+/***********************************************************
+ *	Trace the photons of Run that the worker thread pid
+ *	can lease, until the pool is empty or a checkpoint is
+ *	pending.
+ ****/
+void TraceRun(RunStruct * Run, int pid) {
+  OutStruct * out = &Run->out[pid];
+  long lease_left = 0; /* photons left in the current lease. */
+  long photon_id = 0; /* index of the photon in the run. */
+  PhotonStruct photon;
+
+  if (EngineType == ENGINE_PACKET)
+    PacketTransport(&Run->in, out, pid);
+  else if (EngineType == ENGINE_EVENT)
+    EventTransport(&Run->in, out, pid);
+  else
+    while (TakePhoton(&Run->pool, &lease_left, &photon_id)) {
+      RandomPhoton(pid, photon_id);
+      LaunchPhoton(out->Rsp, Run->in.layerspecs, &photon);
+      if (Run->white_mua != NULL)
+        WhiteTracePhoton(&Run->in, &photon, out, pid);
+      else if (PmcDeriv)
+        PmcTracePhoton(&Run->in, &photon, out, pid);
+      else if (ScaleMaxPath > 0.0)
+        ScaleTracePhoton(&Run->in, &photon, out, pid);
+      else
+        TracePhoton(Run->engine_variant, &Run->in, &photon, out, pid);
+    }
+}
+
 /***********************************************************
  *	Execute Monte Carlo simulation for one independent run.
  ****/
 void DoOneRun(short NumRuns, InputStruct *In_Ptr) {
-  int i;
-  OutStruct sum_out_parm;
-  long num_photons = In_Ptr->num_photons;
+  RunStruct run;
+  pthread_t * thread;
+  long i;
 
 #if THINKCPROFILER
   InitProfile(200,200); cecho2file("prof.rpt",0, stdout);
 #endif
 
-  //>>>>>>>>>>>>>>Performance Measurement 
-  start_time = getElapsedTime();
-  start_cycle = get_hrcycles();
-
-  //>>>>>>>>>>>>>>>>Multi-Threading>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>> 
-  GlobalIn_Ptr=In_Ptr; //All threads share this input file pointer struct
+  //>>>>>>>>>>>>>>>>Multi-Threading>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+  run.in = *In_Ptr; //All threads share the input of the run
+  run.index = run_index;
+  run.last = NumRuns == 0;
   initRandom();
+  StartRun(&run);
+  cur_run = &run;
 
-  pthread_t thread[NTHREAD];
-  printf("Number of threads=%lu \n", NTHREAD);
-
-  for (i=0; i<NTHREAD; i++)
-    pthread_create(&thread[i], NULL, (void *) DoOneThread, (void *) i);
+  thread = (pthread_t *)malloc(NumThreads*sizeof(pthread_t));
+  if (thread == NULL)
+    nrerror("allocation failure in DoOneRun()");
+  for (i=0; i<NumThreads; i++)
+    pthread_create(&thread[i], NULL, DoOneThread, (void *) i);
   //>>>>>>>>>>>>>>>>Multi-Threading>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
 
 #if THINKCPROFILER
   exit(0);
 #endif
 
-  for (i=0; i<NTHREAD; i++)
+  CheckpointWait(&run.in, &run.tally, run.index);
+  for (i=0; i<NumThreads; i++)
     pthread_join(thread[i], NULL);
+  free(thread);
 
   printf("After pthread_join\n");
 
-  InitOutputData(*In_Ptr, &sum_out_parm);
-  sum_out_parm.Rsp = Rspecular(In_Ptr->layerspecs);
-
-  for (i=0; i<NTHREAD; i++)
-    SumOutPtr(&sum_out_parm, out_parm[i], In_Ptr->nz, In_Ptr->nr, In_Ptr->na);
+  EndRun(&run);
+}
 
-  end_cycle = get_hrcycles();
-  end_time = getElapsedTime();
+/***********************************************************
+ *	Body of a worker thread: keep leasing batches of
+ *	photons from the shared pool until it is empty.
+ ****/
+void * DoOneThread(void *i) {
+  int pid = (int)(long)i;
+  RunStruct * run = cur_run;
 
-  printf("DoOneRun took %lf seconds \n", end_time - start_time);
-  printf("DoOneRun took %lld cycles \n", end_cycle - start_cycle);
+  JoinRun(run, pid);
+  /* The engines return early for a checkpoint, see mcmlckpt.c. */
+  do
+    TraceRun(run, pid);
+  while (CheckpointPause(&run->tally, &run->out[pid]));
 
-  ReportResult(*In_Ptr, sum_out_parm);
-  FreeData(*In_Ptr, &sum_out_parm);
+  FlushThreadOut(&run->tally, &run->out[pid]);
+  return (NULL);
 }
 
-void SumOutPtr(OutStruct *sum_out_parm, OutStruct Nout_parm, short nz,
-    short nr, short na) {
-  //sum every items. 
-  short iz, ir, ia; /* index to z & r. */
+/****
+ *	With -J<n>, the runs of the input file share one set of
+ *	worker threads. Up to n runs hold a slot while they
+ *	have photons to lease; a thread that is done with a run
+ *	takes the open run with the most photons left, so the
+ *	runs' leases interleave. A run whose pool is empty
+ *	gives up its slot at once, and the next run of the file
+ *	is read and set up in it while the last photons of the
+ *	first are traced. The last thread to leave a run sums
+ *	and writes its results while the other threads trace.
+ *	Each run in flight has its own tallies.
+ ****/
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static RunStruct ** sched_slot; /* ConcurrentRuns elements, NULL if free. */
+static FILE * sched_file; /* input file, at run sched_next. */
+static long sched_next, sched_runs;
 
-  for (ir=0; ir<nr; ir++)
-    for (ia=0; ia<na; ia++) {
-      sum_out_parm->Rd_ra[ir][ia] +=Nout_parm.Rd_ra[ir][ia];
-      sum_out_parm->Tt_ra[ir][ia] +=Nout_parm.Tt_ra[ir][ia];
-    }
+/***********************************************************
+ *	Return the run the calling worker thread should trace
+ *	next, reading and setting up a new one if a slot is
+ *	free, or NULL when all runs have been handed out.
+ ****/
+RunStruct * NextRun(void) {
+  RunStruct * run = NULL;
+  int i, free_slot = -1;
+
+  pthread_mutex_lock(&sched_lock);
+  for (i=0; i<ConcurrentRuns; i++) {
+    if (sched_slot[i] != NULL && sched_slot[i]->pool.left <= 0)
+      sched_slot[i] = NULL; /* in its tail, let the next run in. */
+    if (sched_slot[i] == NULL) {
+      if (free_slot < 0)
+        free_slot = i;
+    } else if (run == NULL || sched_slot[i]->pool.left > run->pool.left)
+      run = sched_slot[i];
+  }
 
-  for (ir=0; ir<nr; ir++)
-    for (iz=0; iz<nz; iz++)
-      sum_out_parm->A_rz[ir][iz]+=Nout_parm.A_rz[ir][iz];
+  if (free_slot >= 0 && sched_next < sched_runs) {
+    run = (RunStruct *)malloc(sizeof(RunStruct));
+    if (run == NULL)
+      nrerror("allocation failure in NextRun()");
+    ReadParm(sched_file, &run->in);
+    run->index = sched_next++;
+    run->last = sched_next == sched_runs;
+    printf("Starting run %ld\n", run->index + 1);
+    StartRun(run);
+    sched_slot[free_slot] = run;
+  }
+
+  if (run != NULL)
+    run->workers++;
+  pthread_mutex_unlock(&sched_lock);
+  return (run);
 }
 
-void * DoOneThread(void *i) {
-  int pid = (int)i;
-  register long i_photon=(long)GlobalIn_Ptr->num_photons/NTHREAD/NUM_NODE; //Nphotons;
-  /* index to photon. register for speed.*/
-  //TODO: Error-check to make sure all num_photons are used !!!
+/***********************************************************
+ *	Return 1 if the calling worker thread was the last to
+ *	leave Run, whose pool is then empty.
+ ****/
+Boolean LeaveRun(RunStruct * Run) {
+  Boolean done;
+  int i;
 
-  //printf("Number of photons=%lu \n", i_photon);
+  pthread_mutex_lock(&sched_lock);
+  done = --Run->workers == 0 && Run->pool.left <= 0;
+  if (done)
+    for (i=0; i<ConcurrentRuns; i++)
+      if (sched_slot[i] == Run)
+        sched_slot[i] = NULL;
+  pthread_mutex_unlock(&sched_lock);
+  return (done);
+}
 
-  long photon_rep=10;
-  PhotonStruct photon;
-  //printf("pthread id %d \n", pid);
+/***********************************************************
+ *	Body of a worker thread with -J: trace the runs handed
+ *	out by NextRun(), and end those it leaves last.
+ ****/
+void * DoRunsThread(void *i) {
+  int pid = (int)(long)i;
+  RunStruct * run;
 
-  InitOutputData(*GlobalIn_Ptr, &out_parm[pid]);
-  out_parm[pid].Rsp = Rspecular(GlobalIn_Ptr->layerspecs);
+  while ((run = NextRun()) != NULL) {
+    JoinRun(run, pid);
+    TraceRun(run, pid);
+    FlushThreadOut(&run->tally, &run->out[pid]);
+    if (LeaveRun(run)) {
+      EndRun(run);
+      free(run);
+    }
+  }
+  return (NULL);
+}
 
-  do {
-    LaunchPhoton(out_parm[pid].Rsp, GlobalIn_Ptr->layerspecs, &photon);
-    do
-      HopDropSpin(GlobalIn_Ptr, &photon, &out_parm[pid], pid);
-    while (!photon.dead);
-  } while (--i_photon);
+/***********************************************************
+ *	Execute the Num_Runs runs of File, ConcurrentRuns at
+ *	a time, on one set of worker threads.
+ ****/
+void DoRuns(FILE * File, short Num_Runs) {
+  pthread_t * thread;
+  double start_time = getElapsedTime();
+  long i;
+
+  sched_slot = (RunStruct **)calloc(ConcurrentRuns, sizeof(RunStruct *));
+  thread = (pthread_t *)malloc(NumThreads*sizeof(pthread_t));
+  if (sched_slot == NULL || thread == NULL)
+    nrerror("allocation failure in DoRuns()");
+  sched_file = File;
+  sched_next = 0;
+  sched_runs = Num_Runs;
+
+  /* The streams of the threads go on from run to run. */
+  initRandom();
+  for (i=0; i<NumThreads; i++)
+    pthread_create(&thread[i], NULL, DoRunsThread, (void *) i);
+  for (i=0; i<NumThreads; i++)
+    pthread_join(thread[i], NULL);
+
+  printf("DoRuns took %lf seconds for %hd runs, %d at once\n",
+      getElapsedTime() - start_time, Num_Runs, ConcurrentRuns);
+  free(thread);
+  free(sched_slot);
 }
 
 //>>>>>>>>>>>>>Distributed Computing Implementation >>>>>>>>>>>>>>>>>>>>>
@@ -243,13 +921,14 @@ void getClusterParam(int argc, char *argv[]) {
   //  }
   //  NTHREAD=(int)argv[2]; 
 
-  if (argc>2) { //Distributed Computing 
+  if (argc>3) { //Distributed Computing 
     NUM_NODE=atoi(argv[3]);
     CURRENT_NODE=atoi(argv[2]);
     printf("NUM_NODE=%d\n", NUM_NODE);
     printf("CURRENT_NODE=%d\n", CURRENT_NODE);
 
-    //TODO: Error check for range
+    if (NUM_NODE<1 || CURRENT_NODE<0 || CURRENT_NODE>=NUM_NODE)
+      nrerror("CURRENT_NODE must be in 0..NUM_NODE-1.\n");
   } else { //Default - 1 Node
     printf("Defaulting to 1 Node\n");
     NUM_NODE=1;
@@ -317,10 +996,12 @@ int setNproc(int argc, char *argv[]) {
  ****/
 int main(int argc, char *argv[]) {
   int i;
+  int n_opt;
   char input_filename[STRLEN];
   FILE *input_file_ptr;
 
   short num_runs; /* number of independent runs. */
+  long first_run; /* to simulate, > 0 with -R. */
   InputStruct in_parm;
 
   ShowVersion("Version 1.2, 1993");
@@ -337,8 +1018,30 @@ int main(int argc, char *argv[]) {
 //  }
   //>>>>>>>>>>>>>
 
+  //>>>>>>>>>>>>>Multi-Threading>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+  /* Shift argv past the options; argv[0] is then the last option. */
+  n_opt = GetOptions(argc, argv);
+  argc -= n_opt;
+  argv += n_opt;
+
+  if (ConvertFile != NULL) {
+    if (argc < 2)
+      nrerror("-O needs the name of the ASCII .mco file");
+    ConvertResult(ConvertFile, argv[1]);
+    return (0);
+  }
+
+  ranparm = (RandStruct *)calloc(NumThreads, sizeof(RandStruct));
+  if (ranparm == NULL)
+    nrerror("allocation failure in main()");
+  //>>>>>>>>>>>>>Multi-Threading>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>
+
   //>>>>>>>>>>>>>Distributed Computing Implementation >>>>>>>>>>>>>>>>>>>>>
   getClusterParam(argc, argv);
+  if (BATCHED && NUM_NODE > 1)
+    nrerror("-U and -V need the results of all nodes, run them on one node");
+  if (KeepRaw && NUM_NODE > 1)
+    nrerror("-X needs all photons of a run, run it on one node");
   //>>>>>>>>>>>>>Distributed Computing Implementation >>>>>>>>>>>>>>>>>>>>>
 
   GetFnameFromArgv(argc, argv, input_filename);
@@ -347,12 +1050,23 @@ int main(int argc, char *argv[]) {
   CheckParm(input_file_ptr, &in_parm);
   num_runs = ReadNumRuns(input_file_ptr);
 
-  while (num_runs--) {
-    ReadParm(input_file_ptr, &in_parm);
-    DoOneRun(num_runs, &in_parm);
+  if (ConcurrentRuns > 1)
+    DoRuns(input_file_ptr, num_runs);
+  else {
+    /* Skip the runs completed before the checkpoint of -R. */
+    first_run = ResumeRun();
+    for (run_index=0; run_index<num_runs; run_index++) {
+      ReadParm(input_file_ptr, &in_parm);
+      if (run_index < first_run) {
+        free(in_parm.layerspecs);
+        continue;
+      }
+      DoOneRun(num_runs-1-run_index, &in_parm);
+    }
   }
 
   fclose(input_file_ptr);
+  free(ranparm);
 
   return (0);
 }
@@ -47,9 +47,13 @@ double *AllocVector(short nl, short nh) {
  *	Allocate a matrix with row index from nrl to nrh 
  *	inclusive, and column index from ncl to nch
  *	inclusive.
+ *
+ *	The rows are one block, so that the matrix can be
+ *	read and written in one piece from &m[nrl][ncl].
  ****/
 double **AllocMatrix(short nrl, short nrh, short ncl, short nch) {
   short i, j;
+  long ncol = nch-ncl+1;
   double **m;
 
   m=(double **) malloc((unsigned) (nrh-nrl+1) *sizeof(double*));
@@ -57,12 +61,12 @@ double **AllocMatrix(short nrl, short nrh, short ncl, short nch) {
     nrerror("allocation failure 1 in matrix()");
   m -= nrl;
 
-  for (i=nrl; i<=nrh; i++) {
-    m[i]=(double *) malloc((unsigned) (nch-ncl+1) *sizeof(double));
-    if (!m[i])
-      nrerror("allocation failure 2 in matrix()");
-    m[i] -= ncl;
-  }
+  m[nrl]=(double *) malloc((size_t) (nrh-nrl+1)*ncol*sizeof(double));
+  if (!m[nrl])
+    nrerror("allocation failure 2 in matrix()");
+  m[nrl] -= ncl;
+  for (i=nrl+1; i<=nrh; i++)
+    m[i] = m[i-1] + ncol;
 
   for (i=nrl; i<=nrh; i++)
     for (j=ncl; j<=nch; j++)
@@ -81,9 +85,6 @@ void FreeVector(double *v, short nl, short nh) {
  *	Release the memory.
  ****/
 void FreeMatrix(double **m, short nrl, short nrh, short ncl, short nch) {
-  short i;
-
-  for (i=nrh; i>=nrl; i--)
-    free((char*) (m[i]+ncl));
+  free((char*) (m[nrl]+ncl));
   free((char*) (m+nrl));
 }
@@ -0,0 +1,447 @@
+/***********************************************************
+ *	Photon-packet engine.
+ *
+ *	PACKET_WIDTH photon packets are traced in lockstep.
+ *	Their states are kept as a structure of arrays, in the
+ *	spirit of GPUThreadStates in GPUMCML, and one step of
+ *	HopDropSpin() (StepSize, HitBoundary, Hop, Drop, Spin,
+ *	Roulette) for all lanes is a single loop which the
+ *	compiler turns into masked vector operations: every
+ *	lane computes both the boundary and the interaction
+ *	branch and keeps the one that applies to it. The loop
+ *	must stay free of branches and gathers to vectorize,
+ *	so the layer constants of the lanes are gathered
+ *	before it by GatherPacketMedium(). Lanes whose
+ *	photon died are refilled with freshly launched photons
+ *	at the end of each step.
+ *
+ *	The physics is that of mcmlgo.c with statistical
+ *	reflection (PARTIALREFLECTION 0). Only the scatters to
+ *	the output arrays, and the lookups of tabulated phase
+ *	functions (SamplePacketPhase), are done lane by lane.
+ *
+ *	This file is compiled with SIMD_CFLAGS (see Makefile),
+ *	which must allow vectorized log/sin/cos/acos.
+ ****/
+
+#include "mcml.h"
+
+/* 8 doubles fill two AVX2 registers or one AVX-512 register. */
+#if defined(__AVX512F__)
+#define PACKET_WIDTH 16
+#else
+#define PACKET_WIDTH 8
+#endif
+
+#define COSZERO (1.0-1.0E-12)
+/* cosine of about 1e-6 rad. */
+
+#define COS90D  1.0E-6
+/* cosine of about 1.57 - 1e-6 rad. */
+
+/****
+ *	States of the photons in a packet. Lane i of each
+ *	member belongs to the same photon. The members have
+ *	the meaning of those in PhotonStruct.
+ ****/
+typedef struct {
+  double x[PACKET_WIDTH], y[PACKET_WIDTH], z[PACKET_WIDTH];
+  double ux[PACKET_WIDTH], uy[PACKET_WIDTH], uz[PACKET_WIDTH];
+  double w[PACKET_WIDTH];
+  double sleft[PACKET_WIDTH];
+  long layer[PACKET_WIDTH];
+  long alive[PACKET_WIDTH]; /* 1 if the lane carries a photon. */
+  long id[PACKET_WIDTH]; /* index of the photon in the run. */
+  unsigned int draw[PACKET_WIDTH]; /* Philox blocks drawn. */
+} PacketStruct;
+
+/****
+ *	Random numbers consumed by one step of every lane.
+ ****/
+typedef struct {
+  double step[PACKET_WIDTH]; /* (0,1], new step size. */
+  double theta[PACKET_WIDTH]; /* [0,1), polar angle. */
+  double psi[PACKET_WIDTH]; /* [0,1), azimuthal angle. */
+  double cross[PACKET_WIDTH]; /* [0,1), reflect or transmit. */
+  double roulette[PACKET_WIDTH]; /* [0,1), roulette. */
+  double cost[PACKET_WIDTH]; /* cos(theta) of a tabulated phase function. */
+} PacketRandStruct;
+
+/****
+ *	Layer constants of the layer each lane is in, gathered
+ *	before every step so that the vector loop only reads
+ *	contiguous data. n0 and n1 are the refractive indices
+ *	above and below the layer.
+ ****/
+typedef struct {
+  double z0[PACKET_WIDTH], z1[PACKET_WIDTH];
+  double n[PACKET_WIDTH], n0[PACKET_WIDTH], n1[PACKET_WIDTH];
+  double g[PACKET_WIDTH];
+  double mut[PACKET_WIDTH], rmut[PACKET_WIDTH], mua_mut[PACKET_WIDTH];
+  double cos_crit0[PACKET_WIDTH], cos_crit1[PACKET_WIDTH];
+  long glass[PACKET_WIDTH];
+  long tab[PACKET_WIDTH]; /* 1 if the layer has a phase table. */
+} PacketMediumStruct;
+
+/****
+ *	Tally requests produced by one step, replayed lane by
+ *	lane into the output arrays.
+ ****/
+typedef struct {
+  long drop[PACKET_WIDTH]; /* 1 if weight was absorbed. */
+  long escape[PACKET_WIDTH]; /* 1 Rd, 2 Tt, 0 none. */
+  long ir[PACKET_WIDTH], iz[PACKET_WIDTH], ia[PACKET_WIDTH];
+  double dw[PACKET_WIDTH]; /* absorbed or escaped weight. */
+} PacketTallyStruct;
+
+/***********************************************************
+ *	Allocate and fill the per-layer constants, also used by
+ *	the event engine.
+ ****/
+void InitPacketLayers(InputStruct * In_Ptr, PacketLayerStruct * L) {
+  short nl = In_Ptr->num_layers + 2;
+  short i;
+  Boolean tab = 0;
+  double * buf = (double *)malloc(10*nl*sizeof(double));
+
+  L->glass = (long *)malloc(nl*sizeof(long));
+  L->phase = (PhaseStruct **)calloc(nl, sizeof(PhaseStruct *));
+  if (buf == NULL || L->glass == NULL || L->phase == NULL)
+    nrerror("allocation failure in InitPacketLayers()");
+
+  L->z0 = buf;
+  L->z1 = buf + nl;
+  L->n = buf + 2*nl;
+  L->g = buf + 3*nl;
+  L->mut = buf + 4*nl;
+  L->rmut = buf + 5*nl;
+  L->mua_mut = buf + 6*nl;
+  L->cos_crit0 = buf + 7*nl;
+  L->cos_crit1 = buf + 8*nl;
+
+  for (i=0; i<nl; i++) {
+    LayerStruct * s = &In_Ptr->layerspecs[i];
+
+    L->z0[i] = s->z0;
+    L->z1[i] = s->z1;
+    L->n[i] = s->n;
+    L->g[i] = s->g;
+    L->mut[i] = s->mua + s->mus;
+    L->glass[i] = (s->mua == 0.0 && s->mus == 0.0);
+    L->rmut[i] = L->glass[i] ? 0.0 : 1.0/L->mut[i];
+    L->mua_mut[i] = L->glass[i] ? 0.0 : s->mua/L->mut[i];
+    L->cos_crit0[i] = s->cos_crit0;
+    L->cos_crit1[i] = s->cos_crit1;
+    L->phase[i] = s->phase;
+    tab |= s->phase != NULL;
+  }
+  if (!tab) {
+    free(L->phase);
+    L->phase = NULL;
+  }
+  /* The ambient media are never stepped in. */
+  L->z0[0] = L->z1[0] = L->z0[nl-1] = L->z1[nl-1] = 0.0;
+  L->cos_crit0[0] = L->cos_crit1[0] = 0.0;
+  L->cos_crit0[nl-1] = L->cos_crit1[nl-1] = 0.0;
+}
+
+void FreePacketLayers(PacketLayerStruct * L) {
+  free(L->z0);
+  free(L->glass);
+  free(L->phase);
+}
+
+/***********************************************************
+ *	Launch a photon in lane i. See LaunchPhoton().
+ ****/
+static void LaunchLane(double Rspecular, LayerStruct * Layerspecs_Ptr,
+    PacketStruct * P, int i, long Photon) {
+  P->id[i] = Photon;
+  P->draw[i] = 0;
+  P->w[i] = 1.0 - Rspecular;
+  P->alive[i] = 1;
+  P->layer[i] = 1;
+  P->sleft[i] = 0.0;
+  P->x[i] = P->y[i] = P->z[i] = 0.0;
+  P->ux[i] = P->uy[i] = 0.0;
+  P->uz[i] = 1.0;
+
+  if ((Layerspecs_Ptr[1].mua == 0.0) && (Layerspecs_Ptr[1].mus == 0.0)) { /* glass layer. */
+    P->layer[i] = 2;
+    P->z[i] = Layerspecs_Ptr[2].z0;
+  }
+}
+
+/***********************************************************
+ *	Gather the layer constants of every lane.
+ ****/
+static void GatherPacketMedium(PacketLayerStruct * L, PacketStruct * P,
+    PacketMediumStruct * M) {
+  int i;
+
+  for (i=0; i<PACKET_WIDTH; i++) {
+    long l = P->layer[i];
+
+    M->z0[i] = L->z0[l];
+    M->z1[i] = L->z1[l];
+    M->n[i] = L->n[l];
+    M->n0[i] = L->n[l-1];
+    M->n1[i] = L->n[l+1];
+    M->g[i] = L->g[l];
+    M->mut[i] = L->mut[l];
+    M->rmut[i] = L->rmut[l];
+    M->mua_mut[i] = L->mua_mut[l];
+    M->cos_crit0[i] = L->cos_crit0[l];
+    M->cos_crit1[i] = L->cos_crit1[l];
+    M->glass[i] = L->glass[l];
+    M->tab[i] = L->phase != NULL && L->phase[l] != NULL;
+  }
+}
+
+/***********************************************************
+ *	Draw cos(theta) of the lanes in layers with a phase
+ *	table, from the same random numbers as SpinTheta.
+ ****/
+static void SamplePacketPhase(PacketLayerStruct * L, PacketStruct * P,
+    PacketMediumStruct * M, PacketRandStruct * R) {
+  int i;
+
+  for (i=0; i<PACKET_WIDTH; i++)
+    if (M->tab[i])
+      R->cost[i] = SamplePhase(L->phase[P->layer[i]], R->theta[i]);
+}
+
+/***********************************************************
+ *	Draw the random numbers of one step for all lanes, in
+ *	blocks of PACKET_WIDTH. With Philox every lane draws
+ *	from the stream of its own photon.
+ ****/
+static void DrawPacketRandom(PacketStruct * P, PacketRandStruct * R,
+    int pid) {
+  int i;
+
+  if (RngType == RNG_PHILOX) {
+    double unused[PACKET_WIDTH];
+
+    fill_philox_co(RngSeed, P->id, P->draw, PACKET_WIDTH, R->step,
+        R->theta, R->psi, R->cross);
+    fill_philox_co(RngSeed, P->id, P->draw, PACKET_WIDTH, R->roulette,
+        unused, unused, unused);
+    for (i=0; i<PACKET_WIDTH; i++)
+      R->step[i] = 1.0 - R->step[i]; /* avoid zero. */
+    return;
+  }
+
+  RandomFill(pid, R->step, PACKET_WIDTH);
+  RandomFill(pid, R->theta, PACKET_WIDTH);
+  RandomFill(pid, R->psi, PACKET_WIDTH);
+  RandomFill(pid, R->cross, PACKET_WIDTH);
+  RandomFill(pid, R->roulette, PACKET_WIDTH);
+  for (i=0; i<PACKET_WIDTH; i++)
+    R->step[i] = 1.0 - R->step[i]; /* avoid zero. */
+}
+
+/***********************************************************
+ *	Advance every live lane by one step: StepSize,
+ *	HitBoundary and Hop, followed by either the boundary
+ *	crossing (CrossOrNot) or Drop and Spin, and finally
+ *	Roulette. The tally requests are left in T.
+ ****/
+static void PacketStep(InputStruct * In_Ptr, PacketMediumStruct * M,
+    PacketStruct * P, PacketRandStruct * R, PacketTallyStruct * T) {
+  const long num_layers = In_Ptr->num_layers;
+  const double rdz = 1.0/In_Ptr->dz, rdr = 1.0/In_Ptr->dr;
+  const double rda = 1.0/In_Ptr->da;
+  const int nz1 = In_Ptr->nz-1, nr1 = In_Ptr->nr-1, na1 = In_Ptr->na-1;
+  const double wth = In_Ptr->Wth;
+  int i;
+
+#pragma omp simd
+  for (i=0; i<PACKET_WIDTH; i++) {
+    long alive = P->alive[i];
+    long l = P->layer[i];
+    long glass = M->glass[i];
+    double mut = M->mut[i], rmut = M->rmut[i];
+    double x = P->x[i], y = P->y[i], z = P->z[i];
+    double ux = P->ux[i], uy = P->uy[i], uz = P->uz[i];
+    double w = P->w[i];
+    double s, dl_b, zb, sleft, rxy;
+    long hit, drop, escape;
+    long down = uz > 0.0;
+
+    /**** StepSizeInTissue / StepSizeInGlass. ****/
+    s = P->sleft[i];
+    s = (s > 0.0 ? s : -log(R->step[i]))*rmut;
+
+    /**** HitBoundary. ****/
+    zb = down ? M->z1[i] : M->z0[i];
+    dl_b = (zb - z)/uz;
+    hit = alive & (uz != 0.0) & (glass | (s > dl_b));
+    sleft = (hit & !glass) ? (s - dl_b)*mut : 0.0;
+    s = hit ? dl_b : s;
+    /* horizontal photon in glass is killed. */
+    alive = alive & !(glass & (uz == 0.0));
+
+    /**** Hop. ****/
+    x += s*ux;
+    y += s*uy;
+    z += s*uz;
+    rxy = sqrt(x*x + y*y);
+
+    /**** CrossUpOrNot / CrossDnOrNot with RFresnel. ****/
+    long nl = down ? l+1 : l-1;
+    double ni = M->n[i], nt = down ? M->n1[i] : M->n0[i];
+    double ca1 = fabs(uz);
+    double cos_crit = down ? M->cos_crit1[i] : M->cos_crit0[i];
+    double sa1 = sqrt(1.0 - ca1*ca1);
+    double sa2 = ni*sa1/nt;
+    double ca2 = sqrt(fmax(1.0 - sa2*sa2, 0.0));
+    double cap = ca1*ca2 - sa1*sa2; /* c+ = cc - ss. */
+    double cam = ca1*ca2 + sa1*sa2; /* c- = cc + ss. */
+    double sap = sa1*ca2 + ca1*sa2; /* s+ = sc + cs. */
+    double sam = sa1*ca2 - ca1*sa2; /* s- = sc - cs. */
+    double r_norm = (nt-ni)/(nt+ni);
+    double r = 0.5*sam*sam*(cam*cam+cap*cap)/(sap*sap*cam*cam);
+    double uz1 = ca2;
+
+    if (ca1 < COS90D || sa2 >= 1.0)
+      r = 1.0, uz1 = 0.0; /* very slant or total internal reflection. */
+    if (ca1 > COSZERO)
+      r = r_norm*r_norm, uz1 = ca1; /* normal incident. */
+    if (ni == nt)
+      r = 0.0, uz1 = ca1; /* matched boundary. */
+    if (ca1 <= cos_crit)
+      r = 1.0; /* total internal reflection. */
+
+    long transmit = hit & (R->cross[i] > r);
+    escape = transmit & ((nl == 0) | (nl > num_layers));
+    double uz_t = down ? uz1 : -uz1;
+    double ni_nt = ni/nt;
+
+    /**** Drop. ****/
+    drop = alive & !hit & !glass;
+    double dwa = w*M->mua_mut[i];
+
+    /**** SpinTheta and Spin. ****/
+    double g = M->g[i];
+    double rnd = R->theta[i];
+    double cost = 2.0*rnd - 1.0;
+    if (g != 0.0) {
+      double temp = (1.0-g*g)/(1.0-g+2.0*g*rnd);
+      cost = (1.0+g*g - temp*temp)/(2.0*g);
+      cost = fmin(fmax(cost, -1.0), 1.0);
+    }
+    cost = M->tab[i] ? R->cost[i] : cost;
+    double sint = sqrt(1.0 - cost*cost);
+    double psi = 2.0*PI*R->psi[i];
+    double cosp = cos(psi);
+    double sinp = (psi < PI ? 1.0 : -1.0)*sqrt(1.0 - cosp*cosp);
+    double temp = sqrt(1.0 - uz*uz);
+    double sux, suy, suz;
+    if (fabs(uz) > COSZERO) { /* normal incident. */
+      sux = sint*cosp;
+      suy = sint*sinp;
+      suz = cost*SIGN(uz);
+    } else { /* regular incident. */
+      sux = sint*(ux*uz*cosp - uy*sinp)/temp + ux*cost;
+      suy = sint*(uy*uz*cosp + ux*sinp)/temp + uy*cost;
+      suz = -sint*cosp*temp + uz*cost;
+    }
+
+    /**** Select the branch of each lane. ****/
+    w = drop ? w - dwa : w;
+    ux = drop ? sux : (transmit ? ux*ni_nt : ux);
+    uy = drop ? suy : (transmit ? uy*ni_nt : uy);
+    uz = drop ? suz : (transmit ? uz_t : (hit ? -uz : uz)); /* reflected. */
+    l = (transmit & !escape) ? nl : l;
+
+    /* Tally requests. */
+    T->drop[i] = drop;
+    T->escape[i] = escape ? (down ? 2 : 1) : 0;
+    T->dw[i] = drop ? dwa : w;
+    T->iz[i] = (long)fmin(z*rdz, (double)nz1);
+    T->ir[i] = (long)fmin(rxy*rdr, (double)nr1);
+    T->ia[i] = (long)fmin(acos(uz1)*rda, (double)na1);
+
+    alive = alive & !escape;
+
+    /**** Roulette. ****/
+    long roulette = alive & (w < wth);
+    long survive = (w != 0.0) & (R->roulette[i] < CHANCE);
+    alive = alive & !(roulette & !survive);
+    w = (roulette & survive) ? w/CHANCE : w; /* survived the roulette.*/
+
+    P->x[i] = x;
+    P->y[i] = y;
+    P->z[i] = z;
+    P->ux[i] = ux;
+    P->uy[i] = uy;
+    P->uz[i] = uz;
+    P->w[i] = w;
+    P->sleft[i] = sleft;
+    P->layer[i] = l;
+    P->alive[i] = alive;
+  }
+}
+
+/***********************************************************
+ *	Replay the tally requests of a step into Out_Ptr.
+ ****/
+static void PacketTally(InputStruct * In_Ptr, PacketTallyStruct * T,
+    OutStruct * Out_Ptr) {
+  int i;
+
+  for (i=0; i<PACKET_WIDTH; i++) {
+    if (T->drop[i]) {
+      if (!IgnoreA) /* -A: the weight is still dropped. */
+        TallyA(In_Ptr, Out_Ptr, T->ir[i], T->iz[i], T->dw[i]);
+    } else if (T->escape[i] == 1)
+      TallyRd(In_Ptr, Out_Ptr, T->ir[i], T->ia[i], T->dw[i]);
+    else if (T->escape[i] == 2)
+      TallyTt(In_Ptr, Out_Ptr, T->ir[i], T->ia[i], T->dw[i]);
+  }
+}
+
+/***********************************************************
+ *	Trace all photons the calling thread can lease,
+ *	PACKET_WIDTH at a time, and score them in Out_Ptr.
+ ****/
+void PacketTransport(InputStruct * In_Ptr, OutStruct * Out_Ptr, int pid) {
+  PacketLayerStruct layers;
+  PacketStruct packet;
+  PacketRandStruct rand;
+  PacketMediumStruct medium;
+  PacketTallyStruct tally;
+  long lease_left = 0; /* photons left in the current lease. */
+  long photon_id = 0; /* index of the photon in the run. */
+  int n_alive, i;
+
+  InitPacketLayers(In_Ptr, &layers);
+
+  memset(&packet, 0, sizeof(packet));
+  memset(&rand, 0, sizeof(rand));
+  for (i=0; i<PACKET_WIDTH; i++)
+    packet.layer[i] = 1; /* keep gathers of dead lanes in range. */
+
+  do {
+    /* Refill the dead lanes. */
+    n_alive = 0;
+    for (i=0; i<PACKET_WIDTH; i++) {
+      if (!packet.alive[i]
+          && TakePhoton(Out_Ptr->pool, &lease_left, &photon_id))
+        LaunchLane(Out_Ptr->Rsp, In_Ptr->layerspecs, &packet, i, photon_id);
+      n_alive += packet.alive[i];
+    }
+    if (n_alive == 0)
+      break;
+
+    GatherPacketMedium(&layers, &packet, &medium);
+    DrawPacketRandom(&packet, &rand, pid);
+    if (layers.phase != NULL)
+      SamplePacketPhase(&layers, &packet, &medium, &rand);
+    PacketStep(In_Ptr, &medium, &packet, &rand, &tally);
+    PacketTally(In_Ptr, &tally, Out_Ptr);
+  } while (1);
+
+  FreePacketLayers(&layers);
+}
@@ -0,0 +1,276 @@
+/***********************************************************
+ *	Tabulated phase functions.
+ *
+ *	The cosine of the polar deflection angle of a layer can
+ *	be drawn from a table of the inverse of its cumulative
+ *	distribution at n equally spaced u in [0, 1], with
+ *	linear interpolation, in place of the Henyey-Greenstein
+ *	inverse of SpinTheta(). Sampling then costs a multiply
+ *	and two loads instead of two divisions.
+ *
+ *	The table is doubled, from PHASE_MIN_N points, until
+ *	the interpolation error found at the quarter points of
+ *	every interval is within PHASE_TOL in cos(theta), or
+ *	PHASE_MAX_N points are reached. The error found is
+ *	reported with the table. The inverse CDF is concave up
+ *	or down over long stretches, so the error between the
+ *	probes is bounded by about the error at the midpoints.
+ *
+ *	The same tables take measured or Mie phase functions,
+ *	read from a file of lines "theta p", with the angle
+ *	theta in degrees from 0 to 180 and p in any unit. p is
+ *	taken as linear in cos(theta) between the points, so
+ *	the distribution is piecewise quadratic and its exact
+ *	inverse is the reference of the table.
+ ****/
+
+#include "mcml.h"
+
+#define PHASE_MIN_N 257
+#define PHASE_MAX_N 65537
+#define PHASE_TOL 1.0E-4	/* in cos(theta). */
+
+/* Inverse CDF of cos(theta), for u in [0, 1]. */
+typedef double (* InvCdfFn)(void *, double);
+
+/****
+ *	Phase function read from a file, in ascending mu =
+ *	cos(theta). cdf[k] is the integral of p from -1 to mu[k].
+ ****/
+typedef struct {
+  int n;
+  double * mu, * p, * cdf;
+} PhaseFileStruct;
+
+/***********************************************************
+ *	Henyey-Greenstein, as SpinTheta().
+ ****/
+static double HGInvCdf(void * Ctx, double U) {
+  double g = *(double *)Ctx;
+  double temp, cost;
+
+  if (g == 0.0)
+    return (2*U - 1);
+  temp = (1-g*g)/(1-g+2*g*U);
+  cost = (1+g*g - temp*temp)/(2*g);
+  if (cost < -1)
+    cost = -1;
+  else if (cost > 1)
+    cost = 1;
+  return (cost);
+}
+
+/***********************************************************
+ *	Tabulated phase function of a file. Find the interval
+ *	holding the fraction U of the total, and solve
+ *	p0*t + (p1-p0)/(2h)*t^2 = c for the offset t into it.
+ ****/
+static double FileInvCdf(void * Ctx, double U) {
+  PhaseFileStruct * f = (PhaseFileStruct *)Ctx;
+  double c = U*f->cdf[f->n-1];
+  double h, a, b, d, t;
+  int lo = 0, hi = f->n-1;
+
+  while (hi - lo > 1) { /* cdf[lo] <= c <= cdf[hi]. */
+    int mid = (lo + hi)/2;
+
+    if (f->cdf[mid] <= c)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  h = f->mu[hi] - f->mu[lo];
+  a = (f->p[hi] - f->p[lo])/(2*h);
+  b = f->p[lo];
+  c -= f->cdf[lo];
+  d = sqrt(fmax(b*b + 4*a*c, 0.0));
+  t = (b + d > 0.0) ? 2*c/(b + d) : 0.0; /* stable root. */
+  if (t > h)
+    t = h;
+  return (f->mu[lo] + t);
+}
+
+/***********************************************************
+ *	Read a phase function file, see the top of the file.
+ ****/
+static void ReadPhaseFile(char * Name, PhaseFileStruct * F) {
+  FILE * file = fopen(Name, "r");
+  char buf[STRLEN], msg[STRLEN+64];
+  int size = 0, i;
+
+  if (file == NULL) {
+    sprintf(msg, "cannot open phase function file %s", Name);
+    nrerror(msg);
+  }
+
+  F->n = 0;
+  F->mu = F->p = NULL;
+  while (fgets(buf, STRLEN, file)) {
+    double theta, p;
+    char * hash = strchr(buf, '#');
+
+    if (hash)
+      *hash = '\0'; /* comment. */
+    if (sscanf(buf, "%lf%lf", &theta, &p) != 2)
+      continue;
+    if (theta < 0.0 || theta > 180.0 || p < 0.0) {
+      sprintf(msg, "bad line in phase function file %s", Name);
+      nrerror(msg);
+    }
+    if (F->n == size) {
+      size = size ? 2*size : 256;
+      F->mu = (double *)realloc(F->mu, size*sizeof(double));
+      F->p = (double *)realloc(F->p, size*sizeof(double));
+      if (F->mu == NULL || F->p == NULL)
+        nrerror("allocation failure in ReadPhaseFile()");
+    }
+    F->mu[F->n] = cos(theta*PI/180.0);
+    F->p[F->n] = p;
+    F->n++;
+  }
+  fclose(file);
+
+  /* Sort by ascending mu, i.e. descending theta. */
+  for (i=1; i<F->n; i++) {
+    double mu = F->mu[i], p = F->p[i];
+    int j = i;
+
+    for (; j>0 && F->mu[j-1]>mu; j--) {
+      F->mu[j] = F->mu[j-1];
+      F->p[j] = F->p[j-1];
+    }
+    F->mu[j] = mu;
+    F->p[j] = p;
+  }
+  if (F->n < 2 || F->mu[0] > -1.0+1.0E-6 || F->mu[F->n-1] < 1.0-1.0E-6) {
+    sprintf(msg, "phase function file %s must cover 0 to 180 degrees", Name);
+    nrerror(msg);
+  }
+  F->mu[0] = -1.0; /* theta=180 in degrees is not quite -1. */
+  F->mu[F->n-1] = 1.0;
+
+  F->cdf = (double *)malloc(F->n*sizeof(double));
+  if (F->cdf == NULL)
+    nrerror("allocation failure in ReadPhaseFile()");
+  F->cdf[0] = 0.0;
+  for (i=1; i<F->n; i++)
+    F->cdf[i] = F->cdf[i-1]
+        + 0.5*(F->p[i-1] + F->p[i])*(F->mu[i] - F->mu[i-1]);
+  if (F->cdf[F->n-1] <= 0.0) {
+    sprintf(msg, "phase function file %s is zero", Name);
+    nrerror(msg);
+  }
+}
+
+static void FreePhaseFile(PhaseFileStruct * F) {
+  free(F->mu);
+  free(F->p);
+  free(F->cdf);
+}
+
+/***********************************************************
+ *	Tabulate the inverse CDF InvCdf, growing the table until
+ *	it is within PHASE_TOL.
+ ****/
+static PhaseStruct * BuildPhase(InvCdfFn InvCdf, void * Ctx) {
+  PhaseStruct * phase = (PhaseStruct *)malloc(sizeof(PhaseStruct));
+  int n, k;
+
+  if (phase == NULL)
+    nrerror("allocation failure in BuildPhase()");
+  phase->cost = NULL;
+
+  for (n=PHASE_MIN_N; ; n=2*n-1) {
+    double err = 0.0;
+
+    free(phase->cost);
+    phase->cost = (double *)malloc(n*sizeof(double));
+    if (phase->cost == NULL)
+      nrerror("allocation failure in BuildPhase()");
+    phase->n = n;
+    for (k=0; k<n; k++)
+      phase->cost[k] = InvCdf(Ctx, (double)k/(n-1));
+
+    for (k=0; k<n-1; k++) {
+      int q;
+
+      for (q=1; q<4; q++) { /* quarter points of the interval. */
+        double u = (k + 0.25*q)/(n-1);
+        double e = fabs(SamplePhase(phase, u) - InvCdf(Ctx, u));
+
+        if (e > err)
+          err = e;
+      }
+    }
+    phase->err = err;
+    if (err <= PHASE_TOL || 2*n-1 > PHASE_MAX_N)
+      break;
+  }
+
+  /* Mean cosine of the interpolated table. */
+  phase->g = 0.0;
+  for (k=0; k<phase->n-1; k++)
+    phase->g += 0.5*(phase->cost[k] + phase->cost[k+1]);
+  phase->g /= phase->n-1;
+
+  return (phase);
+}
+
+/***********************************************************
+ *	Build the phase tables of the tissue layers of a run:
+ *	those of the files of -P<layer>,<file>, and with -Phg
+ *	Henyey-Greenstein tables of the other layers.
+ ****/
+void InitPhase(InputStruct * In_Ptr) {
+  short i;
+  int f;
+
+  for (f=0; f<NumPhaseFiles; f++)
+    if (PhaseLayer[f] < 1 || PhaseLayer[f] > In_Ptr->num_layers) {
+      char msg[2*STRLEN];
+
+      sprintf(msg, "no layer %hd for the phase function %s", PhaseLayer[f],
+          PhaseFile[f]);
+      nrerror(msg);
+    }
+
+  for (i=1; i<=In_Ptr->num_layers; i++) {
+    LayerStruct * s = &In_Ptr->layerspecs[i];
+    PhaseFileStruct file;
+
+    s->phase = NULL;
+    if (s->mua == 0.0 && s->mus == 0.0) /* glass layer. */
+      continue;
+
+    for (f=NumPhaseFiles-1; f>=0; f--) /* the last one given wins. */
+      if (PhaseLayer[f] == i)
+        break;
+    if (f >= 0) {
+      ReadPhaseFile(PhaseFile[f], &file);
+      s->phase = BuildPhase(FileInvCdf, &file);
+      FreePhaseFile(&file);
+      printf("Layer %hd phase function %s: ", i, PhaseFile[f]);
+    } else if (PhaseHG) {
+      s->phase = BuildPhase(HGInvCdf, &s->g);
+      printf("Layer %hd Henyey-Greenstein g=%g: ", i, s->g);
+    } else
+      continue;
+    printf("%d points, mean cosine %.5f, error <= %.2g\n", s->phase->n,
+        s->phase->g, s->phase->err);
+  }
+}
+
+void FreePhase(InputStruct * In_Ptr) {
+  short i;
+
+  for (i=1; i<=In_Ptr->num_layers; i++) {
+    LayerStruct * s = &In_Ptr->layerspecs[i];
+
+    if (s->phase) {
+      free(s->phase->cost);
+      free(s->phase);
+      s->phase = NULL;
+    }
+  }
+}
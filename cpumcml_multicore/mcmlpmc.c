@@ -0,0 +1,217 @@
+/***********************************************************
+ *	Perturbation Monte Carlo.
+ *
+ *	With -D, each photon keeps its path length L_l and its
+ *	collisions k_l in every layer. A photon that leaves
+ *	the medium with weight w stands for the density
+ *	prod_l mus_l^k_l exp(-(mua_l+mus_l) L_l) of its path,
+ *	as the steps are drawn with mua+mus and the weight is
+ *	scaled by mus/(mua+mus) at each collision. So to first
+ *	order
+ *		dw/dmua_l = -w L_l,
+ *		dw/dmus_l = w (k_l/mus_l - L_l),
+ *	and RecordR() and RecordT() add w L_l and w k_l to the
+ *	radial bin of the photon. The derivatives of Rd, Rd_r,
+ *	Tt and Tt_r with respect to the mua and mus of every
+ *	layer then come out of the one run, scaled as Rd_r and
+ *	Tt_r, instead of 2*num_layers+1 runs for finite
+ *	differences. Roulette is taken as independent of the
+ *	optical properties, as usual.
+ *
+ *	Each thread sums its own photons in double precision,
+ *	so with RNG_PHILOX the derivatives may differ in the
+ *	last digits with the number of threads.
+ ****/
+
+#include "mcml.h"
+
+void Hop(PhotonStruct *);
+void StepSizeInGlass(PhotonStruct *, InputStruct *);
+void StepSizeInTissue(PhotonStruct *, InputStruct *, int);
+Boolean HitBoundary(PhotonStruct *, InputStruct *);
+void SpinLayer(LayerStruct *, PhotonStruct *, int);
+void Drop(InputStruct *, PhotonStruct *, OutStruct *);
+void Roulette(PhotonStruct *, int);
+void CrossOrNot(InputStruct *, PhotonStruct *, OutStruct *, int);
+
+/***********************************************************
+ *	Return zeroed sums for the layers and r grid of In_Ptr.
+ ****/
+PmcStruct * NewPmc(InputStruct * In_Ptr) {
+  PmcStruct * pmc = (PmcStruct *)malloc(sizeof(PmcStruct));
+  long n = (long)In_Ptr->num_layers*In_Ptr->nr;
+
+  if (pmc == NULL)
+    nrerror("allocation failure in NewPmc()");
+  pmc->num_layers = In_Ptr->num_layers;
+  pmc->nr = In_Ptr->nr;
+  pmc->path = (double *)calloc(pmc->num_layers, sizeof(double));
+  pmc->coll = (long *)calloc(pmc->num_layers, sizeof(long));
+  pmc->Rd_path = (double *)calloc(n, sizeof(double));
+  pmc->Rd_coll = (double *)calloc(n, sizeof(double));
+  pmc->Tt_path = (double *)calloc(n, sizeof(double));
+  pmc->Tt_coll = (double *)calloc(n, sizeof(double));
+  if (pmc->path == NULL || pmc->coll == NULL || pmc->Rd_path == NULL
+      || pmc->Rd_coll == NULL || pmc->Tt_path == NULL || pmc->Tt_coll == NULL)
+    nrerror("allocation failure in NewPmc()");
+  return (pmc);
+}
+
+void FreePmc(PmcStruct * Pmc_Ptr) {
+  free(Pmc_Ptr->path);
+  free(Pmc_Ptr->coll);
+  free(Pmc_Ptr->Rd_path);
+  free(Pmc_Ptr->Rd_coll);
+  free(Pmc_Ptr->Tt_path);
+  free(Pmc_Ptr->Tt_coll);
+  free(Pmc_Ptr);
+}
+
+/***********************************************************
+ *	Add the sums of Src to Dst.
+ ****/
+void AddPmc(PmcStruct * Dst, PmcStruct * Src) {
+  long i, n = (long)Dst->num_layers*Dst->nr;
+
+  for (i=0; i<n; i++) {
+    Dst->Rd_path[i] += Src->Rd_path[i];
+    Dst->Rd_coll[i] += Src->Rd_coll[i];
+    Dst->Tt_path[i] += Src->Tt_path[i];
+    Dst->Tt_coll[i] += Src->Tt_coll[i];
+  }
+}
+
+/***********************************************************
+ *	Add the photon that leaves with weight W in radial bin
+ *	Ir, reflected or Transmitted, to the sums.
+ ****/
+void PmcExit(PmcStruct * Pmc_Ptr, Boolean Transmitted, short Ir, double W) {
+  double * path = Transmitted ? Pmc_Ptr->Tt_path : Pmc_Ptr->Rd_path;
+  double * coll = Transmitted ? Pmc_Ptr->Tt_coll : Pmc_Ptr->Rd_coll;
+  short l, nr = Pmc_Ptr->nr;
+
+  for (l=0; l<Pmc_Ptr->num_layers; l++) {
+    path[l*nr+Ir] += W*Pmc_Ptr->path[l];
+    coll[l*nr+Ir] += W*Pmc_Ptr->coll[l];
+  }
+}
+
+/***********************************************************
+ *	Trace a launched photon until it dies, as
+ *	TracePhoton(), keeping its path length and collisions
+ *	in each layer for PmcExit().
+ ****/
+void PmcTracePhoton(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
+    OutStruct * Out_Ptr, int pid) {
+  PmcStruct * pmc = Out_Ptr->pmc;
+  short l;
+
+  for (l=0; l<pmc->num_layers; l++) {
+    pmc->path[l] = 0.0;
+    pmc->coll[l] = 0;
+  }
+
+  do {
+    short layer = Photon_Ptr->layer;
+    LayerStruct * s = &In_Ptr->layerspecs[layer];
+
+    if (s->mua == 0.0 && s->mus == 0.0) { /* glass layer. */
+      if (Photon_Ptr->uz == 0.0) {
+        Photon_Ptr->dead = 1; /* horizontal photon in glass. */
+        break;
+      }
+      StepSizeInGlass(Photon_Ptr, In_Ptr);
+      pmc->path[layer-1] += Photon_Ptr->s;
+      Hop(Photon_Ptr);
+      CrossOrNot(In_Ptr, Photon_Ptr, Out_Ptr, pid);
+    } else {
+      StepSizeInTissue(Photon_Ptr, In_Ptr, pid);
+      if (HitBoundary(Photon_Ptr, In_Ptr)) {
+        pmc->path[layer-1] += Photon_Ptr->s;
+        Hop(Photon_Ptr);
+        CrossOrNot(In_Ptr, Photon_Ptr, Out_Ptr, pid);
+      } else {
+        pmc->path[layer-1] += Photon_Ptr->s;
+        pmc->coll[layer-1]++;
+        Hop(Photon_Ptr);
+        Drop(In_Ptr, Photon_Ptr, Out_Ptr);
+        SpinLayer(s, Photon_Ptr, pid);
+      }
+    }
+
+    if (Photon_Ptr->w < In_Ptr->Wth && !Photon_Ptr->dead)
+      Roulette(Photon_Ptr, pid);
+  } while (!Photon_Ptr->dead);
+}
+
+/***********************************************************
+ *	Write one derivative section of Pmc_Ptr over layer and
+ *	r, 5 numbers per line. The sums of w*k_l are divided by
+ *	mus_l if Coll is not NULL.
+ ****/
+static void WriteDeriv(FILE * File, char * Flag, InputStruct * In_Ptr,
+    double * Path, double * Coll) {
+  short nl = In_Ptr->num_layers, nr = In_Ptr->nr;
+  double dr = In_Ptr->dr;
+  short l, ir;
+
+  fprintf(File, "%s\n", Flag);
+  for (l=0; l<nl; l++)
+    for (ir=0; ir<nr; ir++) {
+      double mus = In_Ptr->layerspecs[l+1].mus;
+      double d = -Path[l*nr+ir];
+
+      if (Coll != NULL && mus > 0.0)
+        d += Coll[l*nr+ir]/mus;
+      fprintf(File, "%12.4E ",
+          d/(2.0*PI*(ir+0.5)*dr*dr*In_Ptr->num_photons));
+      if ((l*nr + ir + 1)%5 == 0)
+        fprintf(File, "\n");
+    }
+  fprintf(File, "\n\n");
+}
+
+/***********************************************************
+ *	Write the derivatives of Rd, Tt, Rd_r and Tt_r after
+ *	the results of a run with -D.
+ ****/
+void WritePmc(FILE * File, InputStruct In_Parm, PmcStruct * Pmc_Ptr) {
+  short nl = In_Parm.num_layers, nr = In_Parm.nr;
+  short l, ir;
+
+  fprintf(File, "\n# Derivatives of Rd and Tt with respect to the mua "
+      "and mus of each layer,\n# to first order from the photons "
+      "above (perturbation Monte Carlo).\n\n");
+  fprintf(File, "dRT #dRd/dmua, dRd/dmus, dTt/dmua, dTt/dmus of "
+      "layers 1..nl. [cm]\n");
+  for (l=0; l<nl; l++) {
+    double mus = In_Parm.layerspecs[l+1].mus;
+    double rd_l = 0.0, rd_k = 0.0, tt_l = 0.0, tt_k = 0.0;
+
+    for (ir=0; ir<nr; ir++) {
+      rd_l += Pmc_Ptr->Rd_path[l*nr+ir];
+      rd_k += Pmc_Ptr->Rd_coll[l*nr+ir];
+      tt_l += Pmc_Ptr->Tt_path[l*nr+ir];
+      tt_k += Pmc_Ptr->Tt_coll[l*nr+ir];
+    }
+    if (mus > 0.0) {
+      rd_k /= mus;
+      tt_k /= mus;
+    }
+    fprintf(File, "%12.4E %12.4E %12.4E %12.4E\n",
+        -rd_l/In_Parm.num_photons, (rd_k - rd_l)/In_Parm.num_photons,
+        -tt_l/In_Parm.num_photons, (tt_k - tt_l)/In_Parm.num_photons);
+  }
+  fprintf(File, "\n");
+
+  WriteDeriv(File, "# dRd_r/dmua[layer][r]. [1/cm]\n"
+      "# dRd[1][0], [1][1],..[1][nr-1]\n# ...\n"
+      "# dRd[nl][0], [nl][1],..[nl][nr-1]\ndRd_r_dmua", &In_Parm,
+      Pmc_Ptr->Rd_path, NULL);
+  WriteDeriv(File, "# dRd_r/dmus[layer][r], as dRd_r_dmua. [1/cm]\n"
+      "dRd_r_dmus", &In_Parm, Pmc_Ptr->Rd_path, Pmc_Ptr->Rd_coll);
+  WriteDeriv(File, "# dTt_r/dmua[layer][r], as dRd_r_dmua. [1/cm]\n"
+      "dTt_r_dmua", &In_Parm, Pmc_Ptr->Tt_path, NULL);
+  WriteDeriv(File, "# dTt_r/dmus[layer][r], as dRd_r_dmua. [1/cm]\n"
+      "dTt_r_dmus", &In_Parm, Pmc_Ptr->Tt_path, Pmc_Ptr->Tt_coll);
+}
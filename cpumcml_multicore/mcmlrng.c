@@ -0,0 +1,338 @@
+/***********************************************************
+ *	Vectorized random number generators.
+ *
+ *	Multi-stream multiply-with-carry: the generator of rand_MWC_co() in GPUMCML and
+ *	cpumcml_mwc, x = (x & 0xffffffff)*a + (x >> 32), run
+ *	on MWC_LANES streams at once. Each stream has its own
+ *	multiplier a such that a*2^32-1 is a safe prime, and
+ *	the streams are seeded as in init_RNG(). Advancing
+ *	the lanes of an MWCStruct is a loop the compiler
+ *	vectorizes (a 32x32->64-bit multiply per lane), so
+ *	random numbers are cheapest when drawn in blocks with
+ *	the fill_uniform_*() routines.
+ *
+ *	Philox4x32-10, counter-based, for the reproducible
+ *	mode; see fill_philox_co().
+ ****/
+
+#include "mcml.h"
+
+#define SAFEPRIMES_FILE "safeprimes_base32.txt"
+#define MWC_A_MAX 4294967118u
+/* largest multiplier, the first one of SAFEPRIMES_FILE. */
+
+/***********************************************************
+ *	Miller-Rabin test of a 64-bit number, deterministic
+ *	for this set of bases.
+ ****/
+static unsigned long long MulMod(unsigned long long A,
+    unsigned long long B, unsigned long long M) {
+  return (unsigned long long)((unsigned __int128)A*B % M);
+}
+
+static Boolean IsPrime64(unsigned long long N) {
+  static const unsigned long long bases[7] = {2, 325, 9375, 28178,
+      450775, 9780504, 1795265022};
+  unsigned long long d = N-1;
+  int r = 0, i, j;
+
+  if (N < 2)
+    return 0;
+  for (i=2; i<64; i++) /* trial division by small numbers. */
+    if (N % i == 0)
+      return N == (unsigned long long)i;
+
+  while ((d & 1) == 0) {
+    d >>= 1;
+    r++;
+  }
+
+  for (i=0; i<7; i++) {
+    unsigned long long b = bases[i] % N, p = 1, e = d;
+
+    if (b == 0)
+      continue;
+    while (e) { /* p = b^d mod N. */
+      if (e & 1)
+        p = MulMod(p, b, N);
+      b = MulMod(b, b, N);
+      e >>= 1;
+    }
+    if (p == 1 || p == N-1)
+      continue;
+    for (j=1; j<r; j++) {
+      p = MulMod(p, p, N);
+      if (p == N-1)
+        break;
+    }
+    if (j == r)
+      return 0;
+  }
+  return 1;
+}
+
+/***********************************************************
+ *	Find the next multiplier below A for which A*2^32-1
+ *	and (A*2^32-2)/2 are both prime. Used when
+ *	SAFEPRIMES_FILE is not found.
+ ****/
+static unsigned int NextSafePrimeMultiplier(unsigned int A) {
+  for (A--; A > 1; A--) {
+    unsigned long long m = ((unsigned long long)A << 32) - 1;
+
+    if (IsPrime64(m >> 1) && IsPrime64(m))
+      return A;
+  }
+  nrerror("ran out of MWC multipliers");
+  return 0;
+}
+
+/***********************************************************
+ *	Initialize N_Gen generators, i.e. N_Gen*MWC_LANES
+ *	streams, from the seed Xinit. The multipliers are read
+ *	from Safeprimes_File (SAFEPRIMES_FILE if empty), whose
+ *	first multiplier only seeds the others as in
+ *	init_RNG(). If the file cannot be opened, the same
+ *	multipliers are computed instead.
+ *
+ *	Return 1 if Xinit is not a valid seed, 0 otherwise.
+ ****/
+int InitMWC(MWCStruct * Mwc_Ptr, int N_Gen, const char * Safeprimes_File,
+    unsigned long long Xinit) {
+  FILE * fp;
+  unsigned int begin, fora, tmp1, tmp2;
+  long n_rng = (long)N_Gen*MWC_LANES, i;
+
+  if (Safeprimes_File == NULL || strlen(Safeprimes_File) == 0)
+    Safeprimes_File = SAFEPRIMES_FILE;
+  fp = fopen(Safeprimes_File, "r");
+
+  if (fp == NULL || fscanf(fp, "%u %u %u", &begin, &tmp1, &tmp2) < 1) {
+    if (fp != NULL)
+      fclose(fp);
+    fp = NULL;
+    begin = MWC_A_MAX;
+  }
+  fora = begin;
+
+  /* 0<=c<a and 0<=x<b, where b is the base 2^32, and */
+  /* [x,c]=[0,0] and [b-1,a-1] are not allowed. */
+  if ((Xinit == 0ull) | (((unsigned int)(Xinit>>32)) >= (begin-1))
+      | (((unsigned int)Xinit) >= 0xffffffffu)) {
+    printf("%llu not a valid seed!\n", Xinit);
+    if (fp != NULL)
+      fclose(fp);
+    return 1;
+  }
+
+  for (i=0; i<n_rng; i++) {
+    unsigned long long * x = &Mwc_Ptr[i/MWC_LANES].x[i%MWC_LANES];
+
+    if (fp == NULL || fscanf(fp, "%u %u %u", &fora, &tmp1, &tmp2) < 1) {
+      if (fp != NULL) { /* file exhausted, carry on computing. */
+        fclose(fp);
+        fp = NULL;
+      }
+      fora = NextSafePrimeMultiplier(fora);
+    }
+    Mwc_Ptr[i/MWC_LANES].a[i%MWC_LANES] = fora;
+
+    *x = 0;
+    while ((*x == 0) | (((unsigned int)(*x>>32)) >= (fora-1))
+        | (((unsigned int)*x) >= 0xffffffffu)) {
+      /* the carry c in the upper 32 bits, 0<=c<a. */
+      Xinit = (Xinit & 0xffffffffull)*begin + (Xinit>>32);
+      *x = (unsigned int)floor(
+          ((double)((unsigned int)Xinit)/(double)0x100000000)*fora);
+      *x <<= 32;
+
+      /* the initial x in the lower 32 bits, 0<=x<b. */
+      Xinit = (Xinit & 0xffffffffull)*begin + (Xinit>>32);
+      *x += (unsigned int)Xinit;
+    }
+  }
+
+  if (fp != NULL)
+    fclose(fp);
+  return 0;
+}
+
+/***********************************************************
+ *	Fill Buf[0..N-1] with uniform numbers in [0,1), lane
+ *	k of the generator supplying Buf[k], Buf[k+MWC_LANES],
+ *	... With 32 random bits per number, doubles have the
+ *	resolution 2^-32 of the GPU generator.
+ ****/
+void fill_uniform_co(MWCStruct * Mwc_Ptr, double * Buf, long N) {
+  unsigned long long x[MWC_LANES];
+  unsigned long long a[MWC_LANES];
+  long i;
+  int k;
+
+  for (k=0; k<MWC_LANES; k++) {
+    x[k] = Mwc_Ptr->x[k];
+    a[k] = Mwc_Ptr->a[k];
+  }
+
+  for (i=0; i+MWC_LANES<=N; i+=MWC_LANES) {
+#pragma omp simd
+    for (k=0; k<MWC_LANES; k++) {
+      x[k] = (x[k] & 0xffffffffull)*a[k] + (x[k]>>32);
+      Buf[i+k] = (double)(long long)(x[k] & 0xffffffffull)
+          *(1.0/(double)0x100000000);
+    }
+  }
+  for (k=0; i+k<N; k++) { /* the remainder. */
+    x[k] = (x[k] & 0xffffffffull)*a[k] + (x[k]>>32);
+    Buf[i+k] = (double)(unsigned int)x[k]*(1.0/(double)0x100000000);
+  }
+
+  for (k=0; k<MWC_LANES; k++)
+    Mwc_Ptr->x[k] = x[k];
+}
+
+/***********************************************************
+ *	As fill_uniform_co(), but in (0,1].
+ ****/
+void fill_uniform_oc(MWCStruct * Mwc_Ptr, double * Buf, long N) {
+  long i;
+
+  fill_uniform_co(Mwc_Ptr, Buf, N);
+  for (i=0; i<N; i++)
+    Buf[i] = 1.0 - Buf[i];
+}
+
+/***********************************************************
+ *	Single-precision [0,1), rounded toward zero from the
+ *	32-bit integer so that 1 is never returned, like
+ *	__uint2float_rz in rand_MWC_co().
+ ****/
+void fill_uniform_co_f(MWCStruct * Mwc_Ptr, float * Buf, long N) {
+  unsigned long long x[MWC_LANES];
+  unsigned long long a[MWC_LANES];
+  long i;
+  int k;
+
+  for (k=0; k<MWC_LANES; k++) {
+    x[k] = Mwc_Ptr->x[k];
+    a[k] = Mwc_Ptr->a[k];
+  }
+
+  /* the upper 24 bits are exact in a float. */
+  for (i=0; i+MWC_LANES<=N; i+=MWC_LANES) {
+#pragma omp simd
+    for (k=0; k<MWC_LANES; k++) {
+      x[k] = (x[k] & 0xffffffffull)*a[k] + (x[k]>>32);
+      Buf[i+k] = (float)(int)((x[k] & 0xffffffffull) >> 8)
+          *(1.0f/(float)0x1000000);
+    }
+  }
+  for (k=0; i+k<N; k++) {
+    x[k] = (x[k] & 0xffffffffull)*a[k] + (x[k]>>32);
+    Buf[i+k] = (float)(int)((unsigned int)x[k] >> 8)*(1.0f/(float)0x1000000);
+  }
+
+  for (k=0; k<MWC_LANES; k++)
+    Mwc_Ptr->x[k] = x[k];
+}
+
+/***********************************************************
+ *	Single-precision (0,1].
+ ****/
+void fill_uniform_oc_f(MWCStruct * Mwc_Ptr, float * Buf, long N) {
+  long i;
+
+  fill_uniform_co_f(Mwc_Ptr, Buf, N);
+  for (i=0; i<N; i++)
+    Buf[i] = 1.0f - Buf[i];
+}
+
+/***********************************************************
+ *	Counter-based Philox4x32-10 generator (Salmon et al.,
+ *	SC'11). A block of 4 numbers is a pure function of the
+ *	key, here the seed, and the counter, here the photon
+ *	index and the number of blocks the photon has drawn.
+ *	A photon therefore sees the same numbers whichever
+ *	thread or lane traces it.
+ ****/
+#define PHILOX_M0 0xD2511F53u
+#define PHILOX_M1 0xCD9E8D57u
+#define PHILOX_W0 0x9E3779B9u
+#define PHILOX_W1 0xBB67AE85u
+
+/***********************************************************
+ *	For lanes i=0..N-1, draw block Draw[i] of photon
+ *	Photon[i] into Out0[i]..Out3[i] in [0,1), and advance
+ *	Draw[i].
+ ****/
+void fill_philox_co(unsigned long long Seed, const long * Photon,
+    unsigned int * Draw, int N, double * Out0, double * Out1,
+    double * Out2, double * Out3) {
+  int i;
+
+#pragma omp simd
+  for (i=0; i<N; i++) {
+    unsigned int c0 = Draw[i], c1 = 0;
+    unsigned int c2 = (unsigned int)Photon[i];
+    unsigned int c3 = (unsigned int)((unsigned long long)Photon[i]>>32);
+    unsigned int k0 = (unsigned int)Seed, k1 = (unsigned int)(Seed>>32);
+    int r;
+
+    for (r=0; r<10; r++) {
+      unsigned long long p0 = (unsigned long long)PHILOX_M0*c0;
+      unsigned long long p1 = (unsigned long long)PHILOX_M1*c2;
+
+      c0 = (unsigned int)(p1>>32) ^ c1 ^ k0;
+      c2 = (unsigned int)(p0>>32) ^ c3 ^ k1;
+      c1 = (unsigned int)p1;
+      c3 = (unsigned int)p0;
+      k0 += PHILOX_W0;
+      k1 += PHILOX_W1;
+    }
+
+    Out0[i] = (double)(long long)c0*(1.0/(double)0x100000000);
+    Out1[i] = (double)(long long)c1*(1.0/(double)0x100000000);
+    Out2[i] = (double)(long long)c2*(1.0/(double)0x100000000);
+    Out3[i] = (double)(long long)c3*(1.0/(double)0x100000000);
+    Draw[i]++;
+  }
+}
+
+/***********************************************************
+ *	Draw N blocks Draw..Draw+N-1 of photon Photon, 4*N
+ *	numbers in [0,1), into Buf[0..4N-1], and advance *Draw.
+ *	The blocks are computed side by side, which is how a
+ *	single photon gets vector speed.
+ ****/
+void fill_philox_photon_co(unsigned long long Seed, long Photon,
+    unsigned int * Draw, double * Buf, int N) {
+  unsigned int draw = *Draw;
+  int j;
+
+#pragma omp simd
+  for (j=0; j<N; j++) {
+    unsigned int c0 = draw + j, c1 = 0;
+    unsigned int c2 = (unsigned int)Photon;
+    unsigned int c3 = (unsigned int)((unsigned long long)Photon>>32);
+    unsigned int k0 = (unsigned int)Seed, k1 = (unsigned int)(Seed>>32);
+    int r;
+
+    for (r=0; r<10; r++) {
+      unsigned long long p0 = (unsigned long long)PHILOX_M0*c0;
+      unsigned long long p1 = (unsigned long long)PHILOX_M1*c2;
+
+      c0 = (unsigned int)(p1>>32) ^ c1 ^ k0;
+      c2 = (unsigned int)(p0>>32) ^ c3 ^ k1;
+      c1 = (unsigned int)p1;
+      c3 = (unsigned int)p0;
+      k0 += PHILOX_W0;
+      k1 += PHILOX_W1;
+    }
+
+    Buf[j] = (double)(long long)c0*(1.0/(double)0x100000000);
+    Buf[N+j] = (double)(long long)c1*(1.0/(double)0x100000000);
+    Buf[2*N+j] = (double)(long long)c2*(1.0/(double)0x100000000);
+    Buf[3*N+j] = (double)(long long)c3*(1.0/(double)0x100000000);
+  }
+  *Draw = draw + N;
+}
@@ -0,0 +1,184 @@
+/***********************************************************
+ *	Baseline runs for scaling.
+ *
+ *	With -B, a single-layer run is traced without
+ *	absorption and the exit radius r, path length L and
+ *	collisions k of every photon that leaves the medium
+ *	are kept. In a homogeneous layer, a medium with
+ *	scattering coefficient mus and the same g and n is the
+ *	baseline medium of mus0 shrunk by s = mus0/mus, so a
+ *	baseline photon stands for one that exits at r*s after
+ *	L*s, and by Beer-Lambert leaves w0*exp(-mua*L*s)
+ *	(Graaff, Kienle). mcmlsmc.c turns one baseline file
+ *	into Rd(r) for any (mua, mus) this way, or with the
+ *	albedo mus/(mua+mus) to the power k and s =
+ *	mus0/(mua+mus), as the weight of MCML drops at each
+ *	collision.
+ *
+ *	The thickness of the layer scales as well, to d*s; a
+ *	semi-infinite medium needs a layer thick enough for
+ *	the smallest s of the grid. Photons still inside after
+ *	ScaleMaxPath cm are stopped and only counted.
+ ****/
+
+#include "mcml.h"
+
+void Hop(PhotonStruct *);
+void StepSizeInTissue(PhotonStruct *, InputStruct *, int);
+Boolean HitBoundary(PhotonStruct *, InputStruct *);
+void SpinLayer(LayerStruct *, PhotonStruct *, int);
+void CrossOrNot(InputStruct *, PhotonStruct *, OutStruct *, int);
+
+#define SCALE_RECORDS 4096 /* initial records of a thread. */
+
+/***********************************************************
+ *	Check that In_Ptr is a single scattering layer, set
+ *	its absorption coefficient to 0 and return the old
+ *	one.
+ ****/
+double InitScale(InputStruct * In_Ptr) {
+  double mua = In_Ptr->layerspecs[1].mua;
+
+  if (In_Ptr->num_layers != 1 || In_Ptr->layerspecs[1].mus <= 0.0)
+    nrerror("-B needs a single scattering layer");
+  In_Ptr->layerspecs[1].mua = 0.0;
+  return (mua);
+}
+
+/***********************************************************
+ *	Return an empty list of exits.
+ ****/
+ScaleStruct * NewScale(void) {
+  ScaleStruct * scale = (ScaleStruct *)malloc(sizeof(ScaleStruct));
+
+  if (scale == NULL)
+    nrerror("allocation failure in NewScale()");
+  scale->size = SCALE_RECORDS;
+  scale->used = 0;
+  scale->rec = (ScaleRecord *)malloc(scale->size*sizeof(ScaleRecord));
+  if (scale->rec == NULL)
+    nrerror("allocation failure in NewScale()");
+  return (scale);
+}
+
+void FreeScale(ScaleStruct * Scale_Ptr) {
+  free(Scale_Ptr->rec);
+  free(Scale_Ptr);
+}
+
+/***********************************************************
+ *	Make room for N more records, doubling the list.
+ ****/
+static void GrowScale(ScaleStruct * Scale_Ptr, long N) {
+  if (Scale_Ptr->used + N <= Scale_Ptr->size)
+    return;
+  while (Scale_Ptr->used + N > Scale_Ptr->size)
+    Scale_Ptr->size *= 2;
+  Scale_Ptr->rec = (ScaleRecord *)realloc(Scale_Ptr->rec,
+      Scale_Ptr->size*sizeof(ScaleRecord));
+  if (Scale_Ptr->rec == NULL)
+    nrerror("allocation failure in GrowScale()");
+}
+
+/***********************************************************
+ *	Append the records of Src to Dst.
+ ****/
+void MergeScale(ScaleStruct * Dst, ScaleStruct * Src) {
+  GrowScale(Dst, Src->used);
+  memcpy(&Dst->rec[Dst->used], Src->rec, Src->used*sizeof(ScaleRecord));
+  Dst->used += Src->used;
+}
+
+/***********************************************************
+ *	Trace a launched photon without absorption until it
+ *	leaves the layer or has gone ScaleMaxPath cm, and add
+ *	its exit to the list of the thread. Rd and Tt are
+ *	tallied as usual.
+ ****/
+void ScaleTracePhoton(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
+    OutStruct * Out_Ptr, int pid) {
+  ScaleStruct * scale = Out_Ptr->scale;
+  LayerStruct * s = &In_Ptr->layerspecs[1];
+  ScaleRecord * rec;
+  double path = 0.0; /* [cm] */
+  int coll = 0;
+  double x, y;
+
+  do {
+    StepSizeInTissue(Photon_Ptr, In_Ptr, pid);
+    if (HitBoundary(Photon_Ptr, In_Ptr)) {
+      path += Photon_Ptr->s;
+      Hop(Photon_Ptr);
+      CrossOrNot(In_Ptr, Photon_Ptr, Out_Ptr, pid);
+    } else {
+      path += Photon_Ptr->s;
+      coll++;
+      Hop(Photon_Ptr);
+      SpinLayer(s, Photon_Ptr, pid);
+    }
+  } while (!Photon_Ptr->dead && path < ScaleMaxPath);
+
+  GrowScale(scale, 1);
+  rec = &scale->rec[scale->used++];
+  if (!Photon_Ptr->dead)
+    rec->kind = WHITE_LOST;
+  else
+    rec->kind = Photon_Ptr->uz < 0.0 ? WHITE_RD : WHITE_TT;
+  x = Photon_Ptr->x;
+  y = Photon_Ptr->y;
+  rec->r = sqrt(x*x+y*y);
+  rec->path = path;
+  rec->coll = coll;
+}
+
+/***********************************************************
+ *	Write the exits of Scale_Ptr, traced for Num_Photons
+ *	photons of In_Ptr whose layer had the absorption
+ *	coefficient Mua, to the .smc file of the run.
+ ****/
+void WriteScale(InputStruct * In_Ptr, double Mua, ScaleStruct * Scale_Ptr,
+    double Rsp, long Num_Photons) {
+  char fname[STRLEN+16], * dot;
+  LayerStruct * s = In_Ptr->layerspecs;
+  ScaleHead head;
+  FILE * file;
+  long i;
+
+  strcpy(fname, In_Ptr->out_fname);
+  dot = strrchr(fname, '.');
+  if (dot != NULL && strchr(dot, '/') == NULL)
+    *dot = '\0';
+  sprintf(fname + strlen(fname), ".smc%d", CURRENT_NODE);
+
+  memset(&head, 0, sizeof(head));
+  memcpy(head.magic, SCALE_MAGIC, 8);
+  head.num_photons = Num_Photons;
+  head.w0 = 1.0 - Rsp;
+  head.mua = Mua;
+  head.mus = s[1].mus;
+  head.g = s[1].g;
+  head.n = s[1].n;
+  head.d = s[1].z1 - s[1].z0;
+  head.n_above = s[0].n;
+  head.n_below = s[2].n;
+  head.dr = In_Ptr->dr;
+  head.nr = In_Ptr->nr;
+  head.max_path = ScaleMaxPath;
+  for (i=0; i<Scale_Ptr->used; i++)
+    if (Scale_Ptr->rec[i].kind == WHITE_LOST)
+      head.num_lost++;
+  head.num_records = Scale_Ptr->used - head.num_lost;
+
+  file = fopen(fname, "wb");
+  if (file == NULL)
+    nrerror("Cannot write the baseline file.");
+  fwrite(&head, sizeof(head), 1, file);
+  for (i=0; i<Scale_Ptr->used; i++)
+    if (Scale_Ptr->rec[i].kind != WHITE_LOST)
+      fwrite(&Scale_Ptr->rec[i], sizeof(ScaleRecord), 1, file);
+  if (fclose(file) != 0)
+    nrerror("Cannot write the baseline file.");
+
+  printf("Baseline run: %ld exits of %ld photons, %ld lost, written to %s\n",
+      head.num_records, Num_Photons, head.num_lost, fname);
+}
@@ -0,0 +1,238 @@
+/***********************************************************
+ *	Evaluate a baseline file by scaling.
+ *
+ *	mcmlsmc [-T<threads>] [-k] <file.smc> [<grid file>]
+ *
+ *	Reads the exits written by mcml -B (see mcmlscale.c)
+ *	and, for each line of the grid file (or of stdin) that
+ *	holds a mua and a mus of the layer in 1/cm, prints one
+ *	line of
+ *		mua mus d Rsp Rd Tt Rd_r[0..nr-1]
+ *	scaled as in the .mco file, where d is the thickness
+ *	of the layer that the baseline stands for. By default
+ *	a photon of path length L is scaled by s = mus0/mus
+ *	and weighted by exp(-mua*L*s); with -k it is scaled by
+ *	mus0/(mua+mus) and weighted by the albedo to the power
+ *	of its collisions. Both give the same mean. Lines
+ *	starting with '#' are skipped; "-" reads the mua and
+ *	mus of the input. The points of the grid are shared
+ *	among the threads (default: online cores).
+ ****/
+
+#include "mcml.h"
+#include <pthread.h>
+#include <unistd.h>   //sysconf() for the number of online cores
+
+/****
+ *	A baseline file and the grid to evaluate it on.
+ ****/
+typedef struct {
+  ScaleHead head;
+  ScaleRecord * rec;
+  Boolean albedo; /* -k. */
+  long num_points;
+  double * mua, * mus; /* of each point. */
+  double * result; /* d Rd Tt Rd_r[0..nr-1] of each point. */
+  int num_threads;
+} GridStruct;
+
+/* Values of result for each point, before Rd_r. */
+#define SMC_HEAD 3
+
+/***********************************************************
+ *	Read the .smc file Fname into G.
+ ****/
+void ReadExits(char * Fname, GridStruct * G) {
+  FILE * file = fopen(Fname, "rb");
+  long n;
+
+  if (file == NULL || fread(&G->head, sizeof(ScaleHead), 1, file) != 1
+      || memcmp(G->head.magic, SCALE_MAGIC, 8) != 0)
+    nrerror("Not a baseline file.");
+  n = G->head.num_records;
+  G->rec = (ScaleRecord *)malloc((n > 0 ? n : 1)*sizeof(ScaleRecord));
+  if (G->rec == NULL)
+    nrerror("allocation failure in ReadExits()");
+  if (fread(G->rec, sizeof(ScaleRecord), n, file) != (size_t)n)
+    nrerror("Truncated baseline file.");
+  fclose(file);
+}
+
+/***********************************************************
+ *	Read the points of the grid from File into G.
+ ****/
+void ReadGrid(FILE * File, GridStruct * G) {
+  long size = 64;
+  char line[STRLEN];
+
+  G->num_points = 0;
+  G->mua = (double *)malloc(size*sizeof(double));
+  G->mus = (double *)malloc(size*sizeof(double));
+  while (fgets(line, sizeof(line), File) != NULL) {
+    char * p = line;
+    double mua, mus;
+
+    while (isspace((unsigned char)*p))
+      p++;
+    if (*p == '\0' || *p == '#')
+      continue;
+    if (*p == '-' && (p[1] == '\0' || isspace((unsigned char)p[1]))) {
+      mua = G->head.mua;
+      mus = G->head.mus;
+    } else if (sscanf(p, "%lf %lf", &mua, &mus) != 2 || mua < 0.0
+        || mus <= 0.0)
+      nrerror("Need the mua and mus of the layer on each line.");
+
+    if (G->num_points == size) {
+      size *= 2;
+      G->mua = (double *)realloc(G->mua, size*sizeof(double));
+      G->mus = (double *)realloc(G->mus, size*sizeof(double));
+    }
+    if (G->mua == NULL || G->mus == NULL)
+      nrerror("allocation failure in ReadGrid()");
+    G->mua[G->num_points] = mua;
+    G->mus[G->num_points++] = mus;
+  }
+}
+
+/***********************************************************
+ *	Fill the result of point I of G.
+ ****/
+void Evaluate(GridStruct * G, long I) {
+  short nr = G->head.nr;
+  double * res = &G->result[I*(SMC_HEAD+nr)];
+  double * rd_r = res + SMC_HEAD;
+  double mua = G->mua[I], mus = G->mus[I];
+  double s, log_a = 0.0;
+  double rd = 0.0, tt = 0.0;
+  double dr = G->head.dr;
+  double n = (double)G->head.num_photons;
+  long i;
+  short ir;
+
+  if (G->albedo) {
+    s = G->head.mus/(mua + mus);
+    log_a = log(mus/(mua + mus));
+  } else
+    s = G->head.mus/mus;
+  for (ir=0; ir<nr; ir++)
+    rd_r[ir] = 0.0;
+
+  for (i=0; i<G->head.num_records; i++) {
+    ScaleRecord * rec = &G->rec[i];
+    double w;
+
+    if (G->albedo)
+      w = exp(rec->coll*log_a);
+    else
+      w = exp(-mua*rec->path*s);
+    if (rec->kind == WHITE_RD) {
+      double r = rec->r*s/dr;
+
+      ir = r < nr - 1 ? (short)r : nr - 1;
+      rd_r[ir] += w;
+      rd += w;
+    } else
+      tt += w;
+  }
+
+  res[0] = G->head.d*s;
+  res[1] = G->head.w0*rd/n;
+  res[2] = G->head.w0*tt/n;
+  for (ir=0; ir<nr; ir++)
+    rd_r[ir] *= G->head.w0/(2.0*PI*(ir+0.5)*dr*dr*n);
+}
+
+/****
+ *	Worker thread id of EvaluateThread().
+ ****/
+typedef struct {
+  GridStruct * grid;
+  int id;
+} WorkerStruct;
+
+/***********************************************************
+ *	Evaluate every num_threads-th point of the grid.
+ ****/
+void * EvaluateThread(void * Arg) {
+  WorkerStruct * worker = (WorkerStruct *)Arg;
+  GridStruct * g = worker->grid;
+  long i;
+
+  for (i=worker->id; i<g->num_points; i+=g->num_threads)
+    Evaluate(g, i);
+  return (NULL);
+}
+
+int main(int argc, char * argv[]) {
+  GridStruct g;
+  FILE * grid_file = stdin;
+  pthread_t * thread;
+  WorkerStruct * worker;
+  short nr;
+  long i;
+  int t, a;
+
+  g.albedo = 0;
+  g.num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  for (a=1; a<argc && argv[a][0]=='-' && argv[a][1]!='\0'; a++)
+    if (strcmp(argv[a], "-k") == 0)
+      g.albedo = 1;
+    else if (sscanf(argv[a], "-T%d", &g.num_threads) != 1
+        || g.num_threads < 1)
+      break;
+  if (argc - a < 1 || argc - a > 2 || argv[a][0] == '-') {
+    fprintf(stderr, "Usage: %s [-T<threads>] [-k] <file.smc> [<grid file>]\n",
+        argv[0]);
+    exit(1);
+  }
+  if (g.num_threads < 1)
+    g.num_threads = 1;
+
+  ReadExits(argv[a], &g);
+  nr = g.head.nr;
+  if (argc - a == 2 && (grid_file = fopen(argv[a+1], "r")) == NULL)
+    nrerror("Cannot open the grid file.");
+  ReadGrid(grid_file, &g);
+  if (grid_file != stdin)
+    fclose(grid_file);
+
+  g.result = (double *)malloc((g.num_points > 0 ? g.num_points : 1)
+      *(SMC_HEAD+nr)*sizeof(double));
+  thread = (pthread_t *)malloc(g.num_threads*sizeof(pthread_t));
+  worker = (WorkerStruct *)malloc(g.num_threads*sizeof(WorkerStruct));
+  if (g.result == NULL || thread == NULL || worker == NULL)
+    nrerror("allocation failure in main()");
+  for (t=0; t<g.num_threads; t++) {
+    worker[t].grid = &g;
+    worker[t].id = t;
+    if (pthread_create(&thread[t], NULL, EvaluateThread, &worker[t]) != 0)
+      nrerror("Cannot start the worker threads.");
+  }
+  for (t=0; t<g.num_threads; t++)
+    pthread_join(thread[t], NULL);
+
+  printf("# %s: %ld photons, %ld exits, %ld lost; mua=%G mus=%G g=%G n=%G "
+      "d=%G cm, nr=%hd, dr=%G cm\n", argv[a], g.head.num_photons,
+      g.head.num_records, g.head.num_lost, g.head.mua, g.head.mus, g.head.g,
+      g.head.n, g.head.d, nr, g.head.dr);
+  printf("# mua mus d Rsp Rd Tt Rd_r[0..%hd]\n", nr - 1);
+  for (i=0; i<g.num_points; i++) {
+    double * res = &g.result[i*(SMC_HEAD+nr)];
+    short ir;
+
+    printf("%-12.4G %-12.4G %-12.4G %-12.4G %-12.4G %-12.4G", g.mua[i],
+        g.mus[i], res[0], 1.0 - g.head.w0, res[1], res[2]);
+    for (ir=0; ir<nr; ir++)
+      printf(" %12.4E", res[SMC_HEAD+ir]);
+    printf("\n");
+  }
+
+  free(g.rec);
+  free(g.mua);
+  free(g.mus);
+  free(g.result);
+  free(thread);
+  free(worker);
+  return (0);
+}
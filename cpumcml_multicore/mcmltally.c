@@ -0,0 +1,385 @@
+/***********************************************************
+ *	Sharded fixed-point tallies.
+ *
+ *	A_rz, Rd_ra and Tt_ra are kept as contiguous unsigned
+ *	64-bit arrays in units of 1/WEIGHT_SCALE, in the spirit
+ *	of the N_A_RZ_COPIES copies of A_rz in GPUMCML. There
+ *	are NumShards copies of each array; thread pid scores
+ *	into shard pid%NumShards. When a shard is shared by
+ *	several threads, the additions are relaxed atomics.
+ *	Fewer shards save memory at the cost of contention.
+ *
+ *	With HotTile, each thread also keeps a private tile
+ *	of the high-fluence corner of A_rz near the source,
+ *	like the shared-memory A_rz cache of MCMLKernel, and
+ *	scores there with plain additions. The tile is added
+ *	to the shard when the thread finishes, so a single
+ *	shared shard (-C1) costs atomics only in the cold
+ *	region.
+ *
+ *	Drops into A_rz go through a small direct-mapped
+ *	write-combining buffer per thread, the CPU analogue of
+ *	last_addr/last_w in MCMLKernel: repeated drops into
+ *	the same bin, as in runs of scatters in one voxel, are
+ *	summed in the buffer and reach the tile or the shard as
+ *	a single store when the entry is evicted or flushed.
+ *	The weights are rounded before they are combined, so
+ *	the tallies are the same as without the buffer. The
+ *	lookup costs a hard-to-predict branch per drop, which
+ *	is only repaid where the stores are contended atomics,
+ *	so the buffer is enabled by WriteCombine (-W).
+ *
+ *	At the end of a run the shards are summed and scaled
+ *	by NumThreads threads in parallel (ReduceTally), which
+ *	replaces the serial SumOutPtr().
+ ****/
+
+#include "mcml.h"
+#include <pthread.h>
+
+#define CACHE_LINE 64 /* bytes. */
+#define HOT_TILE_BYTES (256*1024) /* per thread, to stay in L2. */
+#define HOT_DECAY 3.0
+/* fluence attenuation, in penetration depths, covered by a tile. */
+
+/****
+ *	Work of one thread of ReduceTally(): the bins
+ *	[Begin, End) of A_rz, Rd_ra and Tt_ra laid end to end.
+ ****/
+typedef struct {
+  TallyStruct * tally;
+  OutStruct * out;
+  long begin, end;
+} ReduceStruct;
+
+/***********************************************************
+ *	Allocate Num_Shards zeroed shards of each array. Each
+ *	shard starts on a cache line of its own. Hot_Nr x Hot_Nz
+ *	is the A_rz tile of each thread, 0 x 0 for none.
+ ****/
+void InitTally(InputStruct * In_Ptr, TallyStruct * Tally_Ptr, int Num_Shards,
+    short Hot_Nr, short Hot_Nz) {
+  long per_line = CACHE_LINE/sizeof(unsigned long long);
+  long n_rz = (long)In_Ptr->nr*In_Ptr->nz;
+  long n_ra = (long)In_Ptr->nr*In_Ptr->na;
+  long stride;
+  void * buf;
+
+  if (Num_Shards < 1)
+    Num_Shards = 1;
+  Tally_Ptr->num_shards = Num_Shards;
+  Tally_Ptr->nz = In_Ptr->nz;
+  Tally_Ptr->nr = In_Ptr->nr;
+  Tally_Ptr->na = In_Ptr->na;
+  Tally_Ptr->hot_nr = Hot_Nr < In_Ptr->nr ? Hot_Nr : In_Ptr->nr;
+  Tally_Ptr->hot_nz = Hot_Nz < In_Ptr->nz ? Hot_Nz : In_Ptr->nz;
+
+  /* A_rz, Rd_ra and Tt_ra of a shard, each rounded up to a line. */
+  Tally_Ptr->rz_stride = (n_rz + per_line - 1)/per_line*per_line;
+  Tally_Ptr->ra_stride = (n_ra + per_line - 1)/per_line*per_line;
+  stride = Tally_Ptr->rz_stride + 2*Tally_Ptr->ra_stride;
+
+  if (posix_memalign(&buf, CACHE_LINE,
+      (size_t)Num_Shards*stride*sizeof(unsigned long long)))
+    nrerror("allocation failure in InitTally()");
+  memset(buf, 0, (size_t)Num_Shards*stride*sizeof(unsigned long long));
+
+  Tally_Ptr->A_rz = (unsigned long long *)buf;
+  Tally_Ptr->Rd_ra = Tally_Ptr->A_rz + (long)Num_Shards*Tally_Ptr->rz_stride;
+  Tally_Ptr->Tt_ra = Tally_Ptr->Rd_ra + (long)Num_Shards*Tally_Ptr->ra_stride;
+}
+
+void FreeTally(TallyStruct * Tally_Ptr) {
+  free(Tally_Ptr->A_rz);
+  Tally_Ptr->A_rz = Tally_Ptr->Rd_ra = Tally_Ptr->Tt_ra = NULL;
+}
+
+/***********************************************************
+ *	Choose the A_rz tile of each thread from the grid and
+ *	the optics of the layers. The fluence near the source
+ *	falls off roughly as exp(-z/delta), with the diffusion
+ *	penetration depth delta = 1/sqrt(3 mua (mua+mus')), so
+ *	the tile reaches down to where the attenuation summed
+ *	over the layers is HOT_DECAY, and as far out in r as
+ *	in z. It is shrunk to HOT_TILE_BYTES if need be.
+ ****/
+void HotTileSize(InputStruct * In_Ptr, short * Nr_Ptr, short * Nz_Ptr) {
+  long max_bins = HOT_TILE_BYTES/sizeof(unsigned long long);
+  double depth = 0.0, decay = 0.0;
+  long nr, nz;
+  short i;
+
+  for (i=1; i<=In_Ptr->num_layers && decay<HOT_DECAY; i++) {
+    LayerStruct * s = &In_Ptr->layerspecs[i];
+    double thick = s->z1 - s->z0;
+    double musp = s->mus*(1.0 - s->g);
+    double delta;
+
+    if (s->mua <= 0.0) { /* glass or no absorption. */
+      depth += thick;
+      continue;
+    }
+    delta = 1.0/sqrt(3.0*s->mua*(s->mua + musp));
+    if (decay + thick/delta >= HOT_DECAY) {
+      depth += (HOT_DECAY - decay)*delta;
+      decay = HOT_DECAY;
+    } else {
+      depth += thick;
+      decay += thick/delta;
+    }
+  }
+
+  nz = (long)ceil(depth/In_Ptr->dz);
+  nr = (long)ceil(depth/In_Ptr->dr);
+  if (nz > In_Ptr->nz)
+    nz = In_Ptr->nz;
+  if (nr > In_Ptr->nr)
+    nr = In_Ptr->nr;
+  if (nz < 1)
+    nz = 1;
+  if (nr < 1)
+    nr = 1;
+
+  if (nr*nz > max_bins) { /* keep the aspect ratio. */
+    double f = sqrt((double)max_bins/(nr*nz));
+
+    nr = (long)(nr*f);
+    nz = (long)(nz*f);
+    if (nr < 1)
+      nr = 1;
+    if (nz < 1)
+      nz = 1;
+    while (nr*nz > max_bins)
+      nz--;
+  }
+  *Nr_Ptr = (short)nr;
+  *Nz_Ptr = (short)nz;
+}
+
+/***********************************************************
+ *	Point the scoring arrays of thread pid's OutStruct at
+ *	its shard and allocate its A_rz tile. The OutStruct of
+ *	a thread owns no other arrays.
+ ****/
+void InitThreadOut(TallyStruct * Tally_Ptr, OutStruct * Out_Ptr, int pid) {
+  int shard = pid%Tally_Ptr->num_shards;
+
+  memset(Out_Ptr, 0, sizeof(OutStruct));
+  Out_Ptr->A_rz_raw = Tally_Ptr->A_rz + (long)shard*Tally_Ptr->rz_stride;
+  Out_Ptr->Rd_ra_raw = Tally_Ptr->Rd_ra + (long)shard*Tally_Ptr->ra_stride;
+  Out_Ptr->Tt_ra_raw = Tally_Ptr->Tt_ra + (long)shard*Tally_Ptr->ra_stride;
+  Out_Ptr->raw_shared = NumThreads > Tally_Ptr->num_shards;
+
+  if (Tally_Ptr->hot_nr > 0 && Tally_Ptr->hot_nz > 0) {
+    Out_Ptr->hot_nr = Tally_Ptr->hot_nr;
+    Out_Ptr->hot_nz = Tally_Ptr->hot_nz;
+    Out_Ptr->A_hot = (unsigned long long *)calloc(
+        (size_t)Out_Ptr->hot_nr*Out_Ptr->hot_nz, sizeof(unsigned long long));
+    if (Out_Ptr->A_hot == NULL)
+      nrerror("allocation failure in InitThreadOut()");
+  }
+}
+
+/***********************************************************
+ *	Store W fixed-point units into A_rz[Ir][Iz]: into the
+ *	tile if the bin is in it, otherwise into the shard.
+ ****/
+static void StoreA(OutStruct * Out_Ptr, long Nz, short Ir, short Iz,
+    unsigned long long W) {
+  unsigned long long * bin;
+
+  Out_Ptr->a_stores++;
+  if (Ir < Out_Ptr->hot_nr && Iz < Out_Ptr->hot_nz) { /* private tile. */
+    Out_Ptr->A_hot[(long)Ir*Out_Ptr->hot_nz + Iz] += W;
+    return;
+  }
+  bin = &Out_Ptr->A_rz_raw[(long)Ir*Nz + Iz];
+  if (Out_Ptr->raw_shared)
+    __atomic_fetch_add(bin, W, __ATOMIC_RELAXED);
+  else
+    *bin += W;
+}
+
+/***********************************************************
+ *	Store the pending weight of slot S of the buffer.
+ ****/
+static void EvictA(OutStruct * Out_Ptr, long Nz, int S) {
+  long key = Out_Ptr->wc_key[S];
+
+  if (Out_Ptr->wc_w[S] == 0) /* empty. */
+    return;
+  StoreA(Out_Ptr, Nz, (short)(key>>16), (short)(key&0xffff),
+      Out_Ptr->wc_w[S]);
+  Out_Ptr->wc_w[S] = 0;
+}
+
+/***********************************************************
+ *	Empty the write-combining buffer of a thread and move
+ *	its A_rz tile into its shard, leaving the tile zero.
+ *	Called by the thread before a checkpoint, when the
+ *	shards must hold all of its weight.
+ ****/
+void SpillThreadOut(TallyStruct * Tally_Ptr, OutStruct * Out_Ptr) {
+  long nz = Out_Ptr->hot_nz;
+  short ir, iz;
+  int s;
+
+  for (s=0; s<WC_SLOTS; s++)
+    EvictA(Out_Ptr, Tally_Ptr->nz, s);
+
+  if (Out_Ptr->A_hot == NULL)
+    return;
+
+  for (ir=0; ir<Out_Ptr->hot_nr; ir++)
+    for (iz=0; iz<Out_Ptr->hot_nz; iz++) {
+      unsigned long long w = Out_Ptr->A_hot[ir*nz + iz];
+      unsigned long long * bin =
+          &Out_Ptr->A_rz_raw[(long)ir*Tally_Ptr->nz + iz];
+
+      if (w == 0)
+        continue;
+      if (Out_Ptr->raw_shared)
+        __atomic_fetch_add(bin, w, __ATOMIC_RELAXED);
+      else
+        *bin += w;
+      Out_Ptr->A_hot[ir*nz + iz] = 0;
+    }
+}
+
+/***********************************************************
+ *	Spill the private tallies of a thread, then free its
+ *	tile. Called by the thread when it has traced its
+ *	photons.
+ ****/
+void FlushThreadOut(TallyStruct * Tally_Ptr, OutStruct * Out_Ptr) {
+  SpillThreadOut(Tally_Ptr, Out_Ptr);
+  free(Out_Ptr->A_hot);
+  Out_Ptr->A_hot = NULL;
+}
+
+/***********************************************************
+ *	Add weight W to A_rz[Ir][Iz], Rd_ra[Ir][Ia] or
+ *	Tt_ra[Ir][Ia] of the shard of Out_Ptr. The weight is
+ *	rounded to the nearest 1/WEIGHT_SCALE.
+ ****/
+static void TallyAdd(OutStruct * Out_Ptr, unsigned long long * Bin, double W) {
+  unsigned long long w = (unsigned long long)(W*WEIGHT_SCALE + 0.5);
+
+  if (Out_Ptr->raw_shared)
+    __atomic_fetch_add(Bin, w, __ATOMIC_RELAXED);
+  else
+    *Bin += w;
+}
+
+void TallyA(InputStruct * In_Ptr, OutStruct * Out_Ptr, short Ir, short Iz,
+    double W) {
+  unsigned long long w = (unsigned long long)(W*WEIGHT_SCALE + 0.5);
+  long key = (long)Ir<<16 | Iz;
+  int s = Out_Ptr->wc_last;
+
+  Out_Ptr->a_drops++;
+  if (!WriteCombine) {
+    StoreA(Out_Ptr, In_Ptr->nz, Ir, Iz, w);
+    return;
+  }
+  if (Out_Ptr->wc_key[s] != key) { /* not the bin of the last drop. */
+    s = (Iz + 8*Ir) & (WC_SLOTS-1);
+    if (Out_Ptr->wc_key[s] != key) {
+      EvictA(Out_Ptr, In_Ptr->nz, s);
+      Out_Ptr->wc_key[s] = key;
+    }
+    Out_Ptr->wc_last = s;
+  }
+  Out_Ptr->wc_w[s] += w;
+}
+
+void TallyRd(InputStruct * In_Ptr, OutStruct * Out_Ptr, short Ir, short Ia,
+    double W) {
+  TallyAdd(Out_Ptr, &Out_Ptr->Rd_ra_raw[(long)Ir*In_Ptr->na + Ia], W);
+}
+
+void TallyTt(InputStruct * In_Ptr, OutStruct * Out_Ptr, short Ir, short Ia,
+    double W) {
+  TallyAdd(Out_Ptr, &Out_Ptr->Tt_ra_raw[(long)Ir*In_Ptr->na + Ia], W);
+}
+
+/***********************************************************
+ *	Sum the shards of the bins of one ReduceStruct into the
+ *	raw arrays of the output, and scale them into A_rz,
+ *	Rd_ra and Tt_ra.
+ ****/
+static void * ReduceSlice(void * Arg) {
+  ReduceStruct * r = (ReduceStruct *)Arg;
+  TallyStruct * t = r->tally;
+  OutStruct * out = r->out;
+  long n_rz = (long)t->nr*t->nz;
+  long n_ra = (long)t->nr*t->na;
+  long i;
+  int s;
+
+  for (i=r->begin; i<r->end; i++) {
+    unsigned long long * shard, * sum;
+    long stride, j;
+    double * bin;
+    unsigned long long v = 0;
+
+    if (i < n_rz) { /* A_rz. */
+      j = i;
+      shard = t->A_rz;
+      stride = t->rz_stride;
+      sum = out->A_rz_raw;
+      bin = &out->A_rz[j/t->nz][j%t->nz];
+    } else if (i < n_rz + n_ra) { /* Rd_ra. */
+      j = i - n_rz;
+      shard = t->Rd_ra;
+      stride = t->ra_stride;
+      sum = out->Rd_ra_raw;
+      bin = &out->Rd_ra[j/t->na][j%t->na];
+    } else { /* Tt_ra. */
+      j = i - n_rz - n_ra;
+      shard = t->Tt_ra;
+      stride = t->ra_stride;
+      sum = out->Tt_ra_raw;
+      bin = &out->Tt_ra[j/t->na][j%t->na];
+    }
+
+    for (s=0; s<t->num_shards; s++)
+      v += shard[s*stride + j];
+    sum[j] = v;
+    *bin = v/WEIGHT_SCALE;
+  }
+  return (NULL);
+}
+
+/***********************************************************
+ *	Reduce the shards into Out_Ptr, whose arrays were
+ *	allocated by InitOutputData(), with NumThreads threads.
+ ****/
+void ReduceTally(TallyStruct * Tally_Ptr, OutStruct * Out_Ptr) {
+  long n = (long)Tally_Ptr->nr*(Tally_Ptr->nz + 2*Tally_Ptr->na);
+  int n_threads = NumThreads, i;
+  ReduceStruct * slice;
+  pthread_t * thread;
+
+  if (n_threads > n)
+    n_threads = (int)n;
+  slice = (ReduceStruct *)malloc(n_threads*sizeof(ReduceStruct));
+  thread = (pthread_t *)malloc(n_threads*sizeof(pthread_t));
+  if (slice == NULL || thread == NULL)
+    nrerror("allocation failure in ReduceTally()");
+
+  for (i=0; i<n_threads; i++) {
+    slice[i].tally = Tally_Ptr;
+    slice[i].out = Out_Ptr;
+    slice[i].begin = n*i/n_threads;
+    slice[i].end = n*(i+1)/n_threads;
+  }
+  for (i=1; i<n_threads; i++)
+    pthread_create(&thread[i], NULL, ReduceSlice, &slice[i]);
+  ReduceSlice(&slice[0]);
+  for (i=1; i<n_threads; i++)
+    pthread_join(thread[i], NULL);
+
+  free(slice);
+  free(thread);
+}
@@ -0,0 +1,379 @@
+/***********************************************************
+ *	White Monte Carlo.
+ *
+ *	With -L, a run is traced without absorption: mua is set
+ *	to 0 in every layer, so the photons scatter by mus
+ *	alone and keep their weight until they leave the
+ *	medium, as with DropNoAbs of cpumcml_mt_noabs but
+ *	without the weight loss. Along the way each photon sums
+ *	its path length in every layer. By Beer-Lambert, a
+ *	photon with path lengths L_l would have left with
+ *	w*exp(-sum mua_l*L_l) in the absorbing medium, so one
+ *	white run gives Rd(r), Tt(r) and A for any absorption
+ *	coefficients (mcmlwmc.c), as long as mus, g and n are
+ *	those of the input.
+ *
+ *	To keep the output small, the photons are grouped by
+ *	kind, radial bin, total path length in bins of
+ *	1/WhiteBins octave and the share of it in each layer
+ *	in bins of 1/WHITE_SHARES, and a group keeps only its
+ *	photons and mean path lengths. The error of using the
+ *	mean is of second order in the width of a bin. Binning
+ *	the path length of each layer on its own would keep
+ *	nearly every photon of a multi-layered input apart.
+ *	Each thread fills its own table; EndRun() merges them
+ *	and writes <output>.wmc<node>, see WhiteHead.
+ *
+ *	A table of more than WhiteMaxGroups groups is
+ *	coarsened: its level goes up by one, and pairs of bins
+ *	merge into one twice as wide. A bin of level k is that
+ *	of level 0 shifted right by k, so the groups of a level
+ *	do not depend on when the table got there, and tables
+ *	of other levels merge at the coarser one. The output is
+ *	that of the finest level within WhiteMaxGroups, for any
+ *	number of threads.
+ *
+ *	Photons still inside after WhiteMaxPath cm are stopped
+ *	and kept as WHITE_LOST, so the absorption they would
+ *	have had is still counted.
+ ****/
+
+#include "mcml.h"
+
+void Hop(PhotonStruct *);
+void StepSizeInGlass(PhotonStruct *, InputStruct *);
+void StepSizeInTissue(PhotonStruct *, InputStruct *, int);
+Boolean HitBoundary(PhotonStruct *, InputStruct *);
+void SpinLayer(LayerStruct *, PhotonStruct *, int);
+void CrossOrNot(InputStruct *, PhotonStruct *, OutStruct *, int);
+
+#define WHITE_SLOTS 1024 /* initial slots of a table, 2^n. */
+
+/***********************************************************
+ *	Keep the absorption coefficients of the layers of
+ *	In_Ptr and set them to 0. Return the kept ones,
+ *	indexed like layerspecs.
+ ****/
+double * InitWhite(InputStruct * In_Ptr) {
+  double * mua;
+  short i;
+
+  mua = (double *)malloc((In_Ptr->num_layers+2)*sizeof(double));
+  if (mua == NULL)
+    nrerror("allocation failure in InitWhite()");
+  for (i=0; i<=In_Ptr->num_layers+1; i++) {
+    mua[i] = In_Ptr->layerspecs[i].mua;
+    In_Ptr->layerspecs[i].mua = 0.0;
+  }
+  return (mua);
+}
+
+/***********************************************************
+ *	Allocate the slots of a table.
+ ****/
+static void AllocSlots(WhiteStruct * White_Ptr, long Size) {
+  White_Ptr->size = Size;
+  White_Ptr->used = 0;
+  White_Ptr->key = (int *)malloc(Size*White_Ptr->key_len*sizeof(int));
+  White_Ptr->n = (long *)calloc(Size, sizeof(long));
+  White_Ptr->path = (double *)malloc(Size*White_Ptr->num_layers
+      *sizeof(double));
+  if (White_Ptr->key == NULL || White_Ptr->n == NULL
+      || White_Ptr->path == NULL)
+    nrerror("allocation failure in AllocSlots()");
+}
+
+/***********************************************************
+ *	Return an empty table for Num_Layers layers.
+ ****/
+WhiteStruct * NewWhite(short Num_Layers) {
+  WhiteStruct * white = (WhiteStruct *)malloc(sizeof(WhiteStruct));
+
+  if (white == NULL)
+    nrerror("allocation failure in NewWhite()");
+  white->num_layers = Num_Layers;
+  white->key_len = 3 + Num_Layers;
+  white->level = 0;
+  AllocSlots(white, WHITE_SLOTS);
+  white->photon_key = (int *)malloc(white->key_len*sizeof(int));
+  white->photon_path = (double *)malloc(Num_Layers*sizeof(double));
+  if (white->photon_key == NULL || white->photon_path == NULL)
+    nrerror("allocation failure in NewWhite()");
+  return (white);
+}
+
+void FreeWhite(WhiteStruct * White_Ptr) {
+  free(White_Ptr->key);
+  free(White_Ptr->n);
+  free(White_Ptr->path);
+  free(White_Ptr->photon_key);
+  free(White_Ptr->photon_path);
+  free(White_Ptr);
+}
+
+/***********************************************************
+ *	Return the slot of Key, which is free if the key is
+ *	not in the table. FNV-1a over the ints of the key.
+ ****/
+static long FindSlot(WhiteStruct * White_Ptr, int * Key) {
+  int key_len = White_Ptr->key_len;
+  unsigned long long h = 14695981039346656037ULL;
+  long i;
+  int k;
+
+  for (k=0; k<key_len; k++) {
+    h ^= (unsigned int)Key[k];
+    h *= 1099511628211ULL;
+  }
+  for (i = (long)(h & (White_Ptr->size - 1)); White_Ptr->n[i] != 0;
+      i = (i + 1) & (White_Ptr->size - 1))
+    if (memcmp(&White_Ptr->key[i*key_len], Key, key_len*sizeof(int)) == 0)
+      break;
+  return (i);
+}
+
+/***********************************************************
+ *	Add N photons of Key with the summed path lengths Path
+ *	to the table, doubling it when half full.
+ ****/
+static void AddGroup(WhiteStruct * White_Ptr, int * Key, long N,
+    double * Path) {
+  short nl = White_Ptr->num_layers;
+  long i, j;
+  short l;
+
+  if (2*(White_Ptr->used + 1) > White_Ptr->size) {
+    WhiteStruct old = *White_Ptr;
+
+    AllocSlots(White_Ptr, 2*old.size);
+    for (j=0; j<old.size; j++)
+      if (old.n[j] != 0)
+        AddGroup(White_Ptr, &old.key[j*old.key_len], old.n[j],
+            &old.path[j*nl]);
+    free(old.key);
+    free(old.n);
+    free(old.path);
+  }
+
+  i = FindSlot(White_Ptr, Key);
+  if (White_Ptr->n[i] == 0) {
+    memcpy(&White_Ptr->key[i*White_Ptr->key_len], Key,
+        White_Ptr->key_len*sizeof(int));
+    for (l=0; l<nl; l++)
+      White_Ptr->path[i*nl+l] = 0.0;
+    White_Ptr->used++;
+  }
+  White_Ptr->n[i] += N;
+  for (l=0; l<nl; l++)
+    White_Ptr->path[i*nl+l] += Path[l];
+}
+
+/***********************************************************
+ *	Path bin B, Shift levels coarser. Bins 0 (no path) and
+ *	1 (below WHITE_MIN_PATH) are kept.
+ ****/
+static int CoarserBin(int B, int Shift) {
+  return (B < 2 ? B : 2 + ((B - 2) >> Shift));
+}
+
+/***********************************************************
+ *	Add the groups of Src, of the same or a finer level,
+ *	to the table of White_Ptr, re-keyed to its level.
+ ****/
+static void AddGroups(WhiteStruct * White_Ptr, WhiteStruct * Src) {
+  int shift = White_Ptr->level - Src->level;
+  int * key = White_Ptr->photon_key;
+  long i;
+  int k;
+
+  for (i=0; i<Src->size; i++)
+    if (Src->n[i] != 0) {
+      int * src_key = &Src->key[i*Src->key_len];
+
+      key[0] = src_key[0];
+      key[1] = src_key[1];
+      key[2] = CoarserBin(src_key[2], shift);
+      for (k=3; k<Src->key_len; k++)
+        key[k] = src_key[k] >> shift;
+      AddGroup(White_Ptr, key, Src->n[i], &Src->path[i*Src->num_layers]);
+    }
+}
+
+/***********************************************************
+ *	Coarsen the table of White_Ptr to level Level.
+ ****/
+static void CoarsenWhite(WhiteStruct * White_Ptr, int Level) {
+  WhiteStruct old = *White_Ptr;
+
+  White_Ptr->level = Level;
+  AllocSlots(White_Ptr, WHITE_SLOTS);
+  AddGroups(White_Ptr, &old);
+  free(old.key);
+  free(old.n);
+  free(old.path);
+}
+
+/***********************************************************
+ *	Coarsen the table of White_Ptr until it has at most
+ *	WhiteMaxGroups groups, or its bins cannot widen.
+ ****/
+static void LimitWhite(WhiteStruct * White_Ptr) {
+  while (White_Ptr->used > WhiteMaxGroups && White_Ptr->level < 30)
+    CoarsenWhite(White_Ptr, White_Ptr->level + 1);
+}
+
+/***********************************************************
+ *	Add the groups of Src to Dst.
+ ****/
+void MergeWhite(WhiteStruct * Dst, WhiteStruct * Src) {
+  if (Dst->level < Src->level)
+    CoarsenWhite(Dst, Src->level);
+  AddGroups(Dst, Src);
+  LimitWhite(Dst);
+}
+
+/***********************************************************
+ *	Bin of total path length L at level Level: 0 for none,
+ *	then 2^Level/WhiteBins octave wide from WHITE_MIN_PATH
+ *	on.
+ ****/
+static int PathBin(double L, int Level) {
+  double x;
+
+  if (L <= 0.0)
+    return (0);
+  x = WhiteBins*log2(L/WHITE_MIN_PATH);
+  return (x < 0.0 ? 1 : CoarserBin(2 + (int)x, Level));
+}
+
+/***********************************************************
+ *	Trace a launched photon without absorption until it
+ *	leaves the medium or has gone WhiteMaxPath cm, and add
+ *	it to the table of the thread. Rd and Tt are tallied
+ *	as usual.
+ ****/
+void WhiteTracePhoton(InputStruct * In_Ptr, PhotonStruct * Photon_Ptr,
+    OutStruct * Out_Ptr, int pid) {
+  WhiteStruct * white = Out_Ptr->white;
+  double * path = white->photon_path;
+  int * key = white->photon_key;
+  double total = 0.0; /* path length so far. [cm] */
+  double x, y;
+  short nl = In_Ptr->num_layers;
+  short l;
+
+  for (l=0; l<nl; l++)
+    path[l] = 0.0;
+
+  do {
+    LayerStruct * s = &In_Ptr->layerspecs[Photon_Ptr->layer];
+
+    if (s->mus == 0.0) { /* glass, mua is 0 in a white run. */
+      if (Photon_Ptr->uz == 0.0) {
+        Photon_Ptr->dead = 1; /* horizontal photon in glass. */
+        break;
+      }
+      StepSizeInGlass(Photon_Ptr, In_Ptr);
+      path[Photon_Ptr->layer-1] += Photon_Ptr->s;
+      total += Photon_Ptr->s;
+      Hop(Photon_Ptr);
+      CrossOrNot(In_Ptr, Photon_Ptr, Out_Ptr, pid);
+    } else {
+      StepSizeInTissue(Photon_Ptr, In_Ptr, pid);
+      if (HitBoundary(Photon_Ptr, In_Ptr)) {
+        path[Photon_Ptr->layer-1] += Photon_Ptr->s;
+        total += Photon_Ptr->s;
+        Hop(Photon_Ptr);
+        CrossOrNot(In_Ptr, Photon_Ptr, Out_Ptr, pid);
+      } else {
+        path[Photon_Ptr->layer-1] += Photon_Ptr->s;
+        total += Photon_Ptr->s;
+        Hop(Photon_Ptr);
+        SpinLayer(s, Photon_Ptr, pid);
+      }
+    }
+  } while (!Photon_Ptr->dead && total < WhiteMaxPath);
+
+  if (!Photon_Ptr->dead || Photon_Ptr->uz == 0.0)
+    key[0] = WHITE_LOST;
+  else
+    key[0] = Photon_Ptr->uz < 0.0 ? WHITE_RD : WHITE_TT;
+  x = Photon_Ptr->x;
+  y = Photon_Ptr->y;
+  key[1] = (int)(sqrt(x*x+y*y)/In_Ptr->dr);
+  if (key[1] > In_Ptr->nr-1)
+    key[1] = In_Ptr->nr-1;
+  key[2] = PathBin(total, white->level);
+  for (l=0; l<nl; l++)
+    key[3+l] = total > 0.0 ?
+        (int)(WHITE_SHARES*path[l]/total) >> white->level : 0;
+
+  AddGroup(white, key, 1, path);
+  if (white->used > WhiteMaxGroups)
+    LimitWhite(white);
+}
+
+/***********************************************************
+ *	Write the groups of White_Ptr, traced for Num_Photons
+ *	photons of In_Ptr whose absorption coefficients were
+ *	Mua, to the .wmc file of the run.
+ ****/
+void WriteWhite(InputStruct * In_Ptr, double * Mua, WhiteStruct * White_Ptr,
+    double Rsp, long Num_Photons) {
+  char fname[STRLEN+16], * dot;
+  WhiteHead head;
+  FILE * file;
+  short nl = In_Ptr->num_layers;
+  double * mean;
+  long i, lost = 0;
+  short l;
+
+  strcpy(fname, In_Ptr->out_fname);
+  dot = strrchr(fname, '.');
+  if (dot != NULL && strchr(dot, '/') == NULL)
+    *dot = '\0';
+  sprintf(fname + strlen(fname), ".wmc%d", CURRENT_NODE);
+
+  file = fopen(fname, "wb");
+  mean = (double *)malloc(nl*sizeof(double));
+  if (file == NULL || mean == NULL)
+    nrerror("Cannot write the white Monte Carlo file.");
+
+  memset(&head, 0, sizeof(head));
+  memcpy(head.magic, WHITE_MAGIC, 8);
+  head.num_photons = Num_Photons;
+  head.w0 = 1.0 - Rsp;
+  head.dr = In_Ptr->dr;
+  head.nr = In_Ptr->nr;
+  head.num_layers = nl;
+  head.bins = WhiteBins;
+  head.level = White_Ptr->level;
+  head.max_path = WhiteMaxPath;
+  head.num_groups = White_Ptr->used;
+  fwrite(&head, sizeof(head), 1, file);
+  fwrite(&Mua[1], sizeof(double), nl, file);
+
+  for (i=0; i<White_Ptr->size; i++) {
+    long n = White_Ptr->n[i];
+
+    if (n == 0)
+      continue;
+    for (l=0; l<nl; l++)
+      mean[l] = White_Ptr->path[i*nl+l]/n;
+    fwrite(&White_Ptr->key[i*White_Ptr->key_len], sizeof(int), 2, file);
+    fwrite(&n, sizeof(long), 1, file);
+    fwrite(mean, sizeof(double), nl, file);
+    if (White_Ptr->key[i*White_Ptr->key_len] == WHITE_LOST)
+      lost += n;
+  }
+  if (fclose(file) != 0)
+    nrerror("Cannot write the white Monte Carlo file.");
+  free(mean);
+
+  printf("White run: %ld groups of %ld photons (%.1f per group, bins of "
+      "%g octave and %g of the path), %ld lost, written to %s\n",
+      White_Ptr->used, Num_Photons,
+      White_Ptr->used > 0 ? (double)Num_Photons/White_Ptr->used : 0.0,
+      (double)(1 << White_Ptr->level)/WhiteBins,
+      (double)(1 << White_Ptr->level)/WHITE_SHARES, lost, fname);
+}
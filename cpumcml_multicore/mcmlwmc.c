@@ -0,0 +1,188 @@
+/***********************************************************
+ *	Evaluate a white Monte Carlo file for absorption.
+ *
+ *	mcmlwmc <file.wmc> [<mua file>]
+ *
+ *	Reads the photon groups written by mcml -L (see
+ *	mcmlwhite.c) and, for each line of the mua file (or of
+ *	stdin) that holds the absorption coefficients of the
+ *	layers in 1/cm, prints one line of
+ *		Rsp Rd A Tt lost A_l[1..nl] Rd_r[0..nr-1] Tt_r[0..nr-1]
+ *	scaled as in the .mco file. A group of n photons with
+ *	mean path lengths L_l leaves n*w0*exp(-sum mua_l*L_l);
+ *	the rest is absorbed and shared among the layers in
+ *	proportion to mua_l*L_l, which is exact for A but only
+ *	approximate for A_l of several absorbing layers, as the
+ *	order of the layers along the path is not kept. Lines
+ *	starting with '#' are skipped; "-" reads the input mua.
+ *	"lost" is the weight of the photons stopped at the path
+ *	limit of the white run that would not have been
+ *	absorbed by then.
+ ****/
+
+#include "mcml.h"
+
+/****
+ *	The groups of a .wmc file, as arrays.
+ ****/
+typedef struct {
+  WhiteHead head;
+  double * mua; /* of the input, layers 1..num_layers. */
+  int * kind, * ir;
+  double * w; /* weight of each group. */
+  double * path; /* mean path lengths, [group*num_layers+l]. */
+} GroupStruct;
+
+/***********************************************************
+ *	Read the .wmc file Fname into G.
+ ****/
+void ReadGroups(char * Fname, GroupStruct * G) {
+  FILE * file = fopen(Fname, "rb");
+  long i, ng;
+  short nl;
+
+  if (file == NULL || fread(&G->head, sizeof(WhiteHead), 1, file) != 1
+      || memcmp(G->head.magic, WHITE_MAGIC, 8) != 0)
+    nrerror("Not a white Monte Carlo file.");
+  ng = G->head.num_groups;
+  nl = G->head.num_layers;
+
+  G->mua = (double *)malloc(nl*sizeof(double));
+  G->kind = (int *)malloc(ng*sizeof(int));
+  G->ir = (int *)malloc(ng*sizeof(int));
+  G->w = (double *)malloc(ng*sizeof(double));
+  G->path = (double *)malloc(ng*nl*sizeof(double));
+  if (G->mua == NULL || G->kind == NULL || G->ir == NULL || G->w == NULL
+      || G->path == NULL)
+    nrerror("allocation failure in ReadGroups()");
+  if (fread(G->mua, sizeof(double), nl, file) != (size_t)nl)
+    nrerror("Truncated white Monte Carlo file.");
+
+  for (i=0; i<ng; i++) {
+    int key[2];
+    long n;
+
+    if (fread(key, sizeof(int), 2, file) != 2
+        || fread(&n, sizeof(long), 1, file) != 1
+        || fread(&G->path[i*nl], sizeof(double), nl, file) != (size_t)nl)
+      nrerror("Truncated white Monte Carlo file.");
+    G->kind[i] = key[0];
+    G->ir[i] = key[1] < G->head.nr ? key[1] : G->head.nr - 1;
+    G->w[i] = n*G->head.w0;
+  }
+  fclose(file);
+}
+
+/***********************************************************
+ *	Print the results of G for the absorption coefficients
+ *	Mua of layers 1..num_layers. Rd_r and Tt_r have nr
+ *	elements and A_l num_layers.
+ ****/
+void Evaluate(GroupStruct * G, double * Mua, double * A_l, double * Rd_r,
+    double * Tt_r) {
+  short nl = G->head.num_layers, nr = G->head.nr;
+  double rd = 0.0, a = 0.0, tt = 0.0, lost = 0.0;
+  double dr = G->head.dr;
+  double n = (double)G->head.num_photons;
+  long i;
+  short l, ir;
+
+  for (l=0; l<nl; l++)
+    A_l[l] = 0.0;
+  for (ir=0; ir<nr; ir++)
+    Rd_r[ir] = Tt_r[ir] = 0.0;
+
+  for (i=0; i<G->head.num_groups; i++) {
+    double * path = &G->path[i*nl];
+    double x = 0.0, left, absorbed;
+
+    for (l=0; l<nl; l++)
+      x += Mua[l]*path[l];
+    left = G->w[i]*exp(-x);
+    absorbed = G->w[i] - left;
+
+    if (G->kind[i] == WHITE_RD)
+      Rd_r[G->ir[i]] += left;
+    else if (G->kind[i] == WHITE_TT)
+      Tt_r[G->ir[i]] += left;
+    else
+      lost += left;
+    if (x > 0.0)
+      for (l=0; l<nl; l++)
+        A_l[l] += absorbed*Mua[l]*path[l]/x;
+  }
+
+  for (ir=0; ir<nr; ir++) {
+    rd += Rd_r[ir];
+    tt += Tt_r[ir];
+  }
+  for (l=0; l<nl; l++)
+    a += A_l[l];
+
+  printf("%-12.4G %-12.4G %-12.4G %-12.4G %-12.4G", 1.0 - G->head.w0,
+      rd/n, a/n, tt/n, lost/n);
+  for (l=0; l<nl; l++)
+    printf(" %12.4E", A_l[l]/n);
+  for (ir=0; ir<nr; ir++)
+    printf(" %12.4E", Rd_r[ir]/(2.0*PI*(ir+0.5)*dr*dr*n));
+  for (ir=0; ir<nr; ir++)
+    printf(" %12.4E", Tt_r[ir]/(2.0*PI*(ir+0.5)*dr*dr*n));
+  printf("\n");
+}
+
+int main(int argc, char * argv[]) {
+  GroupStruct g;
+  FILE * mua_file = stdin;
+  char line[4096];
+  double * mua, * a_l, * rd_r, * tt_r;
+  short nl;
+
+  if (argc < 2 || argc > 3) {
+    fprintf(stderr, "Usage: %s <file.wmc> [<mua file>]\n", argv[0]);
+    exit(1);
+  }
+  ReadGroups(argv[1], &g);
+  nl = g.head.num_layers;
+  if (argc == 3 && (mua_file = fopen(argv[2], "r")) == NULL)
+    nrerror("Cannot open the mua file.");
+
+  mua = (double *)malloc(nl*sizeof(double));
+  a_l = (double *)malloc(nl*sizeof(double));
+  rd_r = (double *)malloc(g.head.nr*sizeof(double));
+  tt_r = (double *)malloc(g.head.nr*sizeof(double));
+  if (mua == NULL || a_l == NULL || rd_r == NULL || tt_r == NULL)
+    nrerror("allocation failure in main()");
+
+  printf("# %s: %ld photons in %ld groups, %hd layers, nr=%hd, dr=%G cm\n",
+      argv[1], g.head.num_photons, g.head.num_groups, nl, g.head.nr,
+      g.head.dr);
+  printf("# Rsp Rd A Tt lost A_l[1..%hd] Rd_r[0..%hd] Tt_r[0..%hd]\n", nl,
+      g.head.nr - 1, g.head.nr - 1);
+
+  while (fgets(line, sizeof(line), mua_file) != NULL) {
+    char * p = line;
+    int pos;
+    short l;
+
+    while (isspace((unsigned char)*p))
+      p++;
+    if (*p == '\0' || *p == '#')
+      continue;
+    if (*p == '-' && (p[1] == '\0' || isspace((unsigned char)p[1]))) {
+      memcpy(mua, g.mua, nl*sizeof(double));
+    } else {
+      for (l=0; l<nl; l++, p+=pos)
+        if (sscanf(p, "%lf%n", &mua[l], &pos) != 1 || mua[l] < 0.0)
+          nrerror("Need the mua of every layer on each line.");
+    }
+    Evaluate(&g, mua, a_l, rd_r, tt_r);
+  }
+
+  if (mua_file != stdin)
+    fclose(mua_file);
+  free(mua);
+  free(a_l);
+  free(rd_r);
+  free(tt_r);
+  return (0);
+}
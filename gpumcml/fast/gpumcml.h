@@ -127,6 +127,8 @@ typedef struct
 
   UINT32 number_of_photons;
   int ignoreAdetection;
+  int tabulatePhase;        // sample cos(theta) from tables (-Phg)
+  int tabulateFresnel;      // interpolate the Fresnel reflectance (-F)
   float start_weight;
 
   DetStruct det;
@@ -156,6 +158,15 @@ typedef struct
   UINT64* Rd_ra;
   UINT64* A_rz;			// Pointer to a 2D absorption matrix!
   UINT64* Tt_ra;
+
+  // inverse CDF of cos(theta) of each layer, PHASE_TABLE_SIZE points
+  // per layer (device only, NULL unless tabulatePhase)
+  GFLOAT* phase_table;
+
+  // Fresnel reflectance of the upper (2*layer) and lower (2*layer+1)
+  // boundary of each layer, FRESNEL_TABLE_SIZE points each
+  // (device only, NULL unless tabulateFresnel)
+  GFLOAT* fresnel_table;
 } SimState;
 
 // Everything a host thread needs to know in order to run simulation on
@@ -182,6 +193,46 @@ typedef struct
 
 } HostThreadState;
 
+// Head of a binary .mco file, written when the output format of a
+// simulation is B; the same layout as McoHead of cpumcml_multicore, whose
+// mcml -O writes it as ASCII. It is followed by n_layers+2 McoLayers
+// (the ambient media with only n set), the scaled results as doubles
+// (A_l[n_layers], A_z[nz], Rd_r[nr], Rd_a[na], Tt_r[nr], Tt_a[na],
+// A_rz[nr][nz], Rd_ra[nr][na], Tt_ra[nr][na]) and, with MCO_RAW, the raw
+// tallies as UINT64 (A_rz[nr][nz], Rd_ra[nr][na], Tt_ra[nr][na]) in units
+// of 1/weight_scale, each array in one piece on an 8-byte boundary. All
+// values are little-endian. The results are scaled by run_photons, of which
+// num_photons were traced; both are the photons of the simulation here.
+#define MCO_MAGIC "MCMLMCOB"
+#define MCO_VERSION 1
+#define MCO_BYTE_ORDER 0x01020304
+#define MCO_RAW 1
+#define MCO_STRLEN 256
+
+typedef struct
+{
+  char magic[8];
+  int version, byte_order;
+  int head_size;            // sizeof(McoHead) of the writer
+  int num_layers, nz, nr, na;
+  int flags;
+  long long num_photons;    // traced
+  long long run_photons;    // by which the results are scaled
+  double Wth, dz, dr, da;
+  double weight_scale;      // raw units per unit weight
+  double Rsp, Rd, A, Tt;
+  int batches;              // of -U, with the errors below
+  int reserved;
+  double err_rd, err_a, err_rdr;
+  char out_fname[MCO_STRLEN];
+  char note[MCO_STRLEN];    // simulation time
+} McoHead;
+
+typedef struct
+{
+  double n, mua, mus, g, z0, z1;
+} McoLayer;
+
 //////////////////////////////////////////////////////////////////////////////
 //////////////////////////////////////////////////////////////////////////////
 
@@ -191,7 +242,8 @@ extern void usage(const char *prog_name);
 // Return 0 if successfull or a +ive error code.
 extern int interpret_arg(int argc, char* argv[], char **fpath_p,
         unsigned long long* seed,
-        int* ignoreAdetection, unsigned int *num_GPUs);
+        int* ignoreAdetection, int* tabulatePhase, int* tabulateFresnel,
+        unsigned int *num_GPUs);
 
 extern int read_simulation_data(char* filename,
         SimulationStruct** simulations, int ignoreAdetection);
@@ -41,9 +41,11 @@
 //////////////////////////////////////////////////////////////////////////////
 void usage(const char *prog_name)
 {
-  printf("\nUsage: %s [-A] [-S<seed>] [-G<num GPUs>] <input file>\n\n",
+  printf("\nUsage: %s [-A] [-Phg] [-F] [-S<seed>] [-G<num GPUs>] <input file>\n\n",
     prog_name);
   printf("  -A: ignore A detection\n");
+  printf("  -Phg: sample the scattering angle from tabulated inverse CDFs\n");
+  printf("  -F: interpolate the Fresnel reflectance from tables\n");
   printf("  -S: seed for random number generation (MT only)\n");
   printf("  -G: set the number of GPUs this program uses\n");
   printf("\n");
@@ -55,7 +57,8 @@ void usage(const char *prog_name)
 //////////////////////////////////////////////////////////////////////////////
 int interpret_arg(int argc, char* argv[], char **fpath_p,
                   unsigned long long* seed,
-                  int* ignoreAdetection, unsigned int *num_GPUs)
+                  int* ignoreAdetection, int* tabulatePhase,
+                  int* tabulateFresnel, unsigned int *num_GPUs)
 {
   int i;
   char *fpath = NULL;
@@ -80,6 +83,14 @@ int interpret_arg(int argc, char* argv[], char **fpath_p,
     {
       *ignoreAdetection = 1;
     }
+    else if (strcmp(arg, "Phg") == 0)
+    {
+      *tabulatePhase = 1;
+    }
+    else if (strcmp(arg, "F") == 0)
+    {
+      *tabulateFresnel = 1;
+    }
     else if (sscanf(arg, "S%llu", seed) == 1)
     {
       // <seed> has been set.
@@ -123,6 +134,262 @@ void WriteInParm(FILE *file, SimulationStruct * sim)
   fprintf(file, "%G\t\t\t\t\t# n for medium below\n", sim->layers[i].n); 
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//   Binary .mco files are little-endian: on a big-endian host, fwrite_le
+//   writes a copy of the n values of size bytes at p with their bytes
+//   reversed. Return 1 if successful.
+//////////////////////////////////////////////////////////////////////////////
+static int big_endian()
+{
+  unsigned int one = 1;
+  return *(unsigned char*)&one == 0;
+}
+
+static void swap_bytes(void *p, size_t size, size_t n)
+{
+  unsigned char *c = (unsigned char*)p, t;
+  for (; n > 0; --n, c += size)
+  {
+    for (size_t i = 0; i < size / 2; ++i)
+    {
+      t = c[i]; c[i] = c[size-1-i]; c[size-1-i] = t;
+    }
+  }
+}
+
+static int fwrite_le(const void *p, size_t size, size_t n, FILE *file)
+{
+  if (!big_endian()) return fwrite(p, size, n, file) == n;
+
+  void *buf = malloc(size * n);
+  int ok = buf != NULL;
+  if (ok)
+  {
+    memcpy(buf, p, size * n);
+    swap_bytes(buf, size, n);
+    ok = fwrite(buf, size, n, file) == n;
+  }
+  free(buf);
+  return ok;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//   Write the results in the binary format of McoHead, with one fwrite per
+//   array. Rd_ra and Tt_ra are turned into [r*na+a] as in the ASCII file.
+//////////////////////////////////////////////////////////////////////////////
+static int WriteBinary(FILE *file, SimState *HostMem, SimulationStruct *sim,
+    float simulation_time)
+{
+  double dr = (double)sim->det.dr;
+  double dz = (double)sim->det.dz;
+  double da = PI_const / (2 * sim->det.na);
+  int nr = sim->det.nr, nz = sim->det.nz, na = sim->det.na;
+  int nl = sim->n_layers;
+  double scale1 = (double)WEIGHT_SCALE * (double)sim->number_of_photons;
+  double *val, *a_l, *a_z, *rd_r, *rd_a, *tt_r, *tt_a, *a_rz, *rd_ra, *tt_ra;
+  double *ring, *cone;        // area of each r and solid angle of each a
+  UINT64 *rd_raw, *tt_raw;
+  UINT64 Rd = 0, A = 0, T = 0;
+  McoHead head;
+  McoLayer *layer;
+  size_t n_val = nl + nz + 2*nr + 2*na + nr*nz + 2*nr*na;
+  int r, a, z, l, ok;
+
+  val = (double*)calloc(n_val + nr + na, sizeof(double));
+  rd_raw = (UINT64*)malloc(nr * na * sizeof(UINT64));
+  tt_raw = (UINT64*)malloc(nr * na * sizeof(UINT64));
+  layer = (McoLayer*)calloc(nl + 2, sizeof(McoLayer));
+  if (val == NULL || rd_raw == NULL || tt_raw == NULL || layer == NULL)
+  {
+    perror("Error allocating the binary output"); return 0;
+  }
+  a_l = val; a_z = a_l + nl; rd_r = a_z + nz; rd_a = rd_r + nr;
+  tt_r = rd_a + na; tt_a = tt_r + nr; a_rz = tt_a + na;
+  rd_ra = a_rz + nr*nz; tt_ra = rd_ra + nr*na;
+  ring = tt_ra + nr*na; cone = ring + nr;
+
+  for (r = 0; r < nr; ++r) ring[r] = 2 * PI_const * (r + 0.5) * dr * dr;
+  for (a = 0; a < na; ++a)
+    cone[a] = 4 * PI_const * sin((a + 0.5) * da) * sin(da / 2);
+
+  // A_rz, A_z and A_l as in Write_Simulation_Results
+  for (r = 0; r < nr; ++r)
+  {
+    for (z = 0; z < nz; ++z)
+    {
+      UINT64 w = HostMem->A_rz[r*nz + z];
+      A += w;
+      a_z[z] += (double)w;
+      a_rz[r*nz + z] = (double)w / (scale1 * ring[r] * dz);
+    }
+  }
+  z = 0;
+  for (l = 1; l <= nl; ++l)
+  {
+    while (((double)z + 0.5) * dz <= sim->layers[l].z_max)
+    {
+      a_l[l-1] += a_z[z];
+      z++;
+      if (z == nz) break;
+    }
+    a_l[l-1] /= scale1;
+  }
+  for (z = 0; z < nz; ++z) a_z[z] /= scale1 * dz;
+
+  // Rd_ra and Tt_ra, from [a*nr+r]
+  for (r = 0; r < nr; ++r)
+  {
+    for (a = 0; a < na; ++a)
+    {
+      UINT64 wr = HostMem->Rd_ra[a*nr + r], wt = HostMem->Tt_ra[a*nr + r];
+      double s = scale1 * ring[r] * cos((a + 0.5) * da) * cone[a];
+      rd_raw[r*na + a] = wr; tt_raw[r*na + a] = wt;
+      Rd += wr; T += wt;
+      rd_r[r] += (double)wr; rd_a[a] += (double)wr;
+      tt_r[r] += (double)wt; tt_a[a] += (double)wt;
+      rd_ra[r*na + a] = (double)wr / s;
+      tt_ra[r*na + a] = (double)wt / s;
+    }
+  }
+  for (r = 0; r < nr; ++r)
+  {
+    rd_r[r] /= scale1 * ring[r]; tt_r[r] /= scale1 * ring[r];
+  }
+  for (a = 0; a < na; ++a)
+  {
+    rd_a[a] /= scale1 * cone[a]; tt_a[a] /= scale1 * cone[a];
+  }
+
+  memset(&head, 0, sizeof(head));
+  memcpy(head.magic, MCO_MAGIC, 8);
+  head.version = MCO_VERSION;
+  head.byte_order = MCO_BYTE_ORDER;
+  head.head_size = sizeof(McoHead);
+  head.num_layers = nl;
+  head.nz = nz; head.nr = nr; head.na = na;
+  head.flags = MCO_RAW;
+  head.num_photons = sim->number_of_photons;
+  head.run_photons = sim->number_of_photons;
+  head.Wth = WEIGHT;
+  head.dz = dz; head.dr = dr; head.da = da;
+  head.weight_scale = WEIGHT_SCALE;
+  head.Rsp = 1.0F - sim->start_weight;
+  head.Rd = (double)Rd / scale1;
+  head.A = (double)A / scale1;
+  head.Tt = (double)T / scale1;
+  strncpy(head.out_fname, sim->outp_filename, MCO_STRLEN - 1);
+  sprintf(head.note, "User time: %.2f sec", simulation_time/1000.0);
+
+  for (l = 0; l <= nl + 1; ++l)
+  {
+    layer[l].n = sim->layers[l].n;
+    if (l == 0 || l == nl + 1) continue;
+    layer[l].mua = sim->layers[l].mua;
+    layer[l].mus = 1 / sim->layers[l].mutr - sim->layers[l].mua;
+    if (layer[l].mus < 0) layer[l].mus = 0;     // glass
+    layer[l].g = sim->layers[l].g;
+    layer[l].z0 = sim->layers[l].z_min;
+    layer[l].z1 = sim->layers[l].z_max;
+  }
+
+  if (big_endian())
+  {
+    swap_bytes(&head.version, sizeof(int), 8);          // version to flags
+    swap_bytes(&head.num_photons, sizeof(long long), 2);
+    swap_bytes(&head.Wth, sizeof(double), 9);           // Wth to Tt
+    swap_bytes(&head.batches, sizeof(int), 2);
+    swap_bytes(&head.err_rd, sizeof(double), 3);
+  }
+  ok = fwrite(&head, sizeof(head), 1, file) == 1
+    && fwrite_le(layer, sizeof(double), 6 * (nl + 2), file)
+    && fwrite_le(val, sizeof(double), n_val, file)
+    && fwrite_le(HostMem->A_rz, sizeof(UINT64), nr*nz, file)
+    && fwrite_le(rd_raw, sizeof(UINT64), nr*na, file)
+    && fwrite_le(tt_raw, sizeof(UINT64), nr*na, file);
+  if (!ok) perror("Error writing the binary output");
+
+  free(val);
+  free(rd_raw);
+  free(tt_raw);
+  free(layer);
+  return ok;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//   Powers of ten that are exact in double
+//////////////////////////////////////////////////////////////////////////////
+static const double pow10_exact[23] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+//////////////////////////////////////////////////////////////////////////////
+//   Write x at p as sprintf(p, "%E", x) does and return the end. The seven
+//   digits are x*10^(6-e) rounded to an integer, which is exact to half an
+//   ulp; values near a tie of the rounding, and those out of range of
+//   pow10_exact, are left to sprintf.
+//////////////////////////////////////////////////////////////////////////////
+static char *put_E(char *p, double x)
+{
+  unsigned long long m = 0;
+  int e = 0, k, i, tries;
+  double v;
+
+  if (x != x || x > 1e300 || x < -1e300) return p + sprintf(p, "%E", x);
+  if (x < 0 || (x == 0 && 1 / x < 0)) { *p++ = '-'; x = -x; }
+
+  if (x != 0)
+  {
+    e = (int)floor(log10(x));
+    for (tries = 0; ; ++tries)
+    {
+      k = 6 - e;
+      if (tries == 3 || k > 22 || k < -22) return p + sprintf(p, "%E", x);
+      v = (k >= 0) ? x * pow10_exact[k] : x / pow10_exact[-k];
+      if (fabs(v - floor(v) - 0.5) < 1e-6) return p + sprintf(p, "%E", x);
+      m = (unsigned long long)(v + 0.5);
+      if (m >= 10000000ULL) ++e;        // e was too small, or the digits carried
+      else if (m < 1000000ULL) --e;
+      else break;
+    }
+  }
+
+  for (i = 6; i >= 0; --i) { p[i + (i > 0)] = '0' + (char)(m % 10); m /= 10; }
+  p[1] = '.';
+  p += 8;
+  *p++ = 'E';
+  *p++ = (e < 0) ? '-' : '+';
+  if (e < 0) e = -e;
+  if (e >= 100) { *p++ = '0' + e / 100; e %= 100; }
+  *p++ = '0' + e / 10;
+  *p++ = '0' + e % 10;
+  return p;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//   Write the n1 x n2 table x[i*s1 + j*s2] / scale[i*t1 + j*t2] as " %E "
+//   with a newline after every 5th value, from one buffer and one fwrite.
+//////////////////////////////////////////////////////////////////////////////
+static void write_table(FILE *file, const UINT64 *x, int n1, int n2,
+    int s1, int s2, const double *scale, int t1, int t2)
+{
+  char *buf = (char *)malloc((size_t)n1 * n2 * 18 + 1);
+  char *p = buf;
+  int i, j, c = 0;
+
+  if (buf == NULL) { perror("Error writing output file"); return; }
+  for (i = 0; i < n1; ++i)
+    for (j = 0; j < n2; ++j)
+    {
+      *p++ = ' ';
+      p = put_E(p, (double)x[i*s1 + j*s2] / scale[i*t1 + j*t2]);
+      *p++ = ' ';
+      if ((c++) == 4) { c = 0; *p++ = '\n'; }
+    }
+  fwrite(buf, 1, p - buf, file);
+  free(buf);
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //   Scale raw data and format data for file output 
 //////////////////////////////////////////////////////////////////////////////
@@ -144,7 +411,6 @@ int Write_Simulation_Results(SimState* HostMem, SimulationStruct* sim,
   int nz=sim->det.nz;			// Number of grid elements in z-direction
 
 
-  int rz_size = nr*nz;
   int ra_size = nr*na;
   int r,a,z;
   unsigned int l;
@@ -159,13 +425,24 @@ int Write_Simulation_Results(SimState* HostMem, SimulationStruct* sim,
   unsigned long long A=0;		// Absorbed fraction [-]
   unsigned long long T=0;		// Transmittance [-]
 
+  // A_z and the ring areas r of the 2D arrays, and the solid angles a
+  UINT64 *A_z;
+  double *ring, *scale_ra;
+
   // Open the output file
   /*pFile_inp = fopen (sim->inp_filename , "r");
   if (pFile_inp == NULL){perror ("Error opening input file");return 0;}*/
 
-  pFile_outp = fopen (sim->outp_filename , "w");
+  pFile_outp = fopen (sim->outp_filename , "wb");
   if (pFile_outp == NULL){perror ("Error opening output file");return 0;}
 
+  if (sim->AorB == 'B' || sim->AorB == 'b')
+  {
+    WriteBinary(pFile_outp, HostMem, sim, simulation_time);
+    fclose(pFile_outp);
+    return 0;
+  }
+
   // Write other stuff here first!
 
   fprintf(pFile_outp,"A1 	# Version number of the file format.\n\n");
@@ -194,7 +471,20 @@ int Write_Simulation_Results(SimState* HostMem, SimulationStruct* sim,
   //printf("pos=%d\n",ftell(pFile_inp));
   /*fclose(pFile_inp);*/
 
-  for(i=0;i<rz_size;i++)A+= HostMem->A_rz[i];
+  // One pass over A_rz for A_z, A_l and A; the sums are exact in integers.
+  A_z = (UINT64 *)calloc(nz, sizeof(UINT64));
+  ring = (double *)malloc(nr * sizeof(double));
+  scale_ra = (double *)malloc(ra_size * sizeof(double));
+  if (A_z == NULL || ring == NULL || scale_ra == NULL)
+  {
+    perror("Error writing output file");
+    free(A_z); free(ring); free(scale_ra);
+    fclose(pFile_outp);
+    return 0;
+  }
+  for (r = 0; r < nr; ++r)
+    for (z = 0; z < nz; ++z) A_z[z] += HostMem->A_rz[r*nz + z];
+  for(z=0;z<nz;z++)A+= A_z[z];
   for(i=0;i<ra_size;i++){T += HostMem->Tt_ra[i];Rd += HostMem->Rd_ra[i];}
 
   fprintf(pFile_outp,"\nRAT #Reflectance, absorption transmission\n");
@@ -212,11 +502,7 @@ int Write_Simulation_Results(SimState* HostMem, SimulationStruct* sim,
     temp=0;
     while(((double)z+0.5)*dz<=sim->layers[l].z_max)
     {
-#if 0
-      for(r=0;r<nr;r++) temp+=HostMem->A_rz[z*nr+r];
-#else
-      for (r = 0; r < nr; ++r) temp += HostMem->A_rz[r*nz + z];
-#endif
+      temp += A_z[z];
       z++;
       if(z==nz)break;
     }
@@ -228,13 +514,7 @@ int Write_Simulation_Results(SimState* HostMem, SimulationStruct* sim,
   fprintf(pFile_outp,"\nA_z #A[0], [1],..A[nz-1]. [1/cm]\n");
   for(z=0;z<nz;z++)
   {
-    temp=0;
-#if 0
-    for(r=0;r<nr;r++) temp+=HostMem->A_rz[z*nr+r]; 
-#else
-    for (r = 0; r < nr; ++r) temp += HostMem->A_rz[r*nz + z];
-#endif
-    fprintf(pFile_outp,"%E\n",(double)temp/scale2);
+    fprintf(pFile_outp,"%E\n",(double)A_z[z]/scale2);
   }
 
   // Calculate and write Rd_r
@@ -278,48 +558,30 @@ int Write_Simulation_Results(SimState* HostMem, SimulationStruct* sim,
   }
 
 
-  // Scale and write A_rz
-  i=0;
-  fprintf(pFile_outp,"\n# A[r][z]. [1/cm3]\n# A[0][0], [0][1],..[0][nz-1]\n# A[1][0], [1][1],..[1][nz-1]\n# ...\n# A[nr-1][0], [nr-1][1],..[nr-1][nz-1]\nA_rz\n");
-  for(r=0;r<nr;r++)
+  // Scale and write A_rz, Rd_ra and Tt_ra. The scales are multiplied in
+  // the order of scale1*2*PI_const*(r+0.5)*dr*dr*dz and
+  // scale1*2*PI_const*(r+0.5)*dr*dr*cos(..)*4*PI_const*sin(..)*sin(da/2),
+  // so each value comes out as before.
+  for(r=0;r<nr;r++) ring[r]=scale1*2*PI_const*(r+0.5)*dr*dr;
+  for(a=0;a<na;a++)
   {
-    for(z=0;z<nz;z++)
-    {
-      scale2=scale1*2*PI_const*(r+0.5)*dr*dr*dz;
-#if 0
-      fprintf(pFile_outp," %E ",(double)HostMem->A_rz[z*nr+r]/scale2);
-#else
-      fprintf(pFile_outp, " %E ", (double)HostMem->A_rz[r*nz + z] / scale2);
-#endif
-      if((i++)==4){i=0;fprintf(pFile_outp,"\n");}
-    }
+    double c=cos((a+0.5)*da), s=sin((a+0.5)*da), h=sin(da/2);
+    for(r=0;r<nr;r++) scale_ra[r*na+a]=ring[r]*c*4*PI_const*s*h;
   }
+  for(r=0;r<nr;r++) ring[r]*=dz;
+
+  fprintf(pFile_outp,"\n# A[r][z]. [1/cm3]\n# A[0][0], [0][1],..[0][nz-1]\n# A[1][0], [1][1],..[1][nz-1]\n# ...\n# A[nr-1][0], [nr-1][1],..[nr-1][nz-1]\nA_rz\n");
+  write_table(pFile_outp, HostMem->A_rz, nr, nz, nz, 1, ring, 1, 0);
 
-  // Scale and write Rd_ra 
-  i=0;
   fprintf(pFile_outp,"\n\n# Rd[r][angle]. [1/(cm2sr)].\n# Rd[0][0], [0][1],..[0][na-1]\n# Rd[1][0], [1][1],..[1][na-1]\n# ...\n# Rd[nr-1][0], [nr-1][1],..[nr-1][na-1]\nRd_ra\n");
-  for(r=0;r<nr;r++)
-  {
-    for(a=0;a<na;a++)
-    {
-      scale2=scale1*2*PI_const*(r+0.5)*dr*dr*cos((a+0.5)*da)*4*PI_const*sin((a+0.5)*da)*sin(da/2);
-      fprintf(pFile_outp," %E ",(double)HostMem->Rd_ra[a*nr+r]/scale2);
-      if((i++)==4){i=0;fprintf(pFile_outp,"\n");}
-    }
-  }
+  write_table(pFile_outp, HostMem->Rd_ra, nr, na, 1, nr, scale_ra, na, 1);
 
-  // Scale and write Tt_ra
-  i=0;
   fprintf(pFile_outp,"\n\n# Tt[r][angle]. [1/(cm2sr)].\n# Tt[0][0], [0][1],..[0][na-1]\n# Tt[1][0], [1][1],..[1][na-1]\n# ...\n# Tt[nr-1][0], [nr-1][1],..[nr-1][na-1]\nTt_ra\n");
-  for(r=0;r<nr;r++)
-  {
-    for(a=0;a<na;a++)
-    {
-      scale2=scale1*2*PI_const*(r+0.5)*dr*dr*cos((a+0.5)*da)*4*PI_const*sin((a+0.5)*da)*sin(da/2);
-      fprintf(pFile_outp," %E ",(double)HostMem->Tt_ra[a*nr+r]/scale2);
-      if((i++)==4){i=0;fprintf(pFile_outp,"\n");}
-    }
-  }
+  write_table(pFile_outp, HostMem->Tt_ra, nr, na, 1, nr, scale_ra, na, 1);
+
+  free(A_z);
+  free(ring);
+  free(scale_ra);
 
   fclose(pFile_outp);
   return 0;
@@ -428,6 +690,7 @@ int read_simulation_data(char* filename, SimulationStruct** simulations, int ign
 
     // Read the output filename and determine ASCII or Binary output
     ii=0;
+    AorB='A';
     while(ii<=0)
     {
       (*simulations)[i].begin=ftell(pFile);
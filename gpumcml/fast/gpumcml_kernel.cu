@@ -330,35 +330,54 @@ __device__ void FastReflectTransmit(PhotonStructGPU *photon,
     GFLOAT ni = d_layerspecs[photon->layer].n;
     GFLOAT nt = d_layerspecs[new_layer].n;
     GFLOAT ni_nt = FAST_DIV(ni, nt);   // reused later
+    GFLOAT uz1, rFresnel;
 
-    GFLOAT sa1 = SQRT(FP_ONE-ca1*ca1);
-    if (ca1 > COSZERO) sa1 = MCML_FP_ZERO;
-    GFLOAT sa2 = fminf(ni_nt * sa1, FP_ONE);
-    GFLOAT uz1 = SQRT(FP_ONE-sa2*sa2);    // uz1 = ca2
-
-    GFLOAT ca1ca2 = ca1 * uz1;
-    GFLOAT sa1sa2 = sa1 * sa2;
-    GFLOAT sa1ca2 = sa1 * uz1;
-    GFLOAT ca1sa2 = ca1 * sa2;
-
-    // normal incidence: [(1-ni_nt)/(1+ni_nt)]^2
-    // We ensure that ca1ca2 = 1, sa1sa2 = 0, sa1ca2 = 1, ca1sa2 = ni_nt
-    if (ca1 > COSZERO)
+    if (d_state_ptr->fresnel_table != NULL)
     {
-      sa1ca2 = FP_ONE;
-      ca1sa2 = ni_nt;
+      // With -F, only uz1 = ca2 is computed. The reflectance is
+      // interpolated from the table of this side of the boundary,
+      // indexed by the cosine of the optically thinner side.
+      const GFLOAT *table = d_state_ptr->fresnel_table + FRESNEL_TABLE_SIZE *
+        (photon->layer * 2 + (new_layer > photon->layer));
+      uz1 = SQRT(fmaxf(FP_ONE - ni_nt*ni_nt*(FP_ONE-ca1*ca1),
+        MCML_FP_ZERO));
+      GFLOAT x = ((ni > nt) ? uz1 : ca1) * (FRESNEL_TABLE_SIZE - 1);
+      // automatic __float2uint_rz
+      UINT32 k = min((UINT32)x, (UINT32)(FRESNEL_TABLE_SIZE - 2));
+      GFLOAT r0 = table[k];
+      rFresnel = r0 + (x - k) * (table[k+1] - r0);
     }
+    else
+    {
+      GFLOAT sa1 = SQRT(FP_ONE-ca1*ca1);
+      if (ca1 > COSZERO) sa1 = MCML_FP_ZERO;
+      GFLOAT sa2 = fminf(ni_nt * sa1, FP_ONE);
+      uz1 = SQRT(FP_ONE-sa2*sa2);    // uz1 = ca2
+
+      GFLOAT ca1ca2 = ca1 * uz1;
+      GFLOAT sa1sa2 = sa1 * sa2;
+      GFLOAT sa1ca2 = sa1 * uz1;
+      GFLOAT ca1sa2 = ca1 * sa2;
+
+      // normal incidence: [(1-ni_nt)/(1+ni_nt)]^2
+      // We ensure that ca1ca2 = 1, sa1sa2 = 0, sa1ca2 = 1, ca1sa2 = ni_nt
+      if (ca1 > COSZERO)
+      {
+        sa1ca2 = FP_ONE;
+        ca1sa2 = ni_nt;
+      }
 
-    GFLOAT cam = ca1ca2 + sa1sa2; /* c- = cc + ss. */
-    GFLOAT sap = sa1ca2 + ca1sa2; /* s+ = sc + cs. */
-    GFLOAT sam = sa1ca2 - ca1sa2; /* s- = sc - cs. */
+      GFLOAT cam = ca1ca2 + sa1sa2; /* c- = cc + ss. */
+      GFLOAT sap = sa1ca2 + ca1sa2; /* s+ = sc + cs. */
+      GFLOAT sam = sa1ca2 - ca1sa2; /* s- = sc - cs. */
 
-    GFLOAT rFresnel = FAST_DIV(sam, sap*cam);
-    rFresnel *= rFresnel;
-    rFresnel *= (ca1ca2*ca1ca2 + sa1sa2*sa1sa2);
+      rFresnel = FAST_DIV(sam, sap*cam);
+      rFresnel *= rFresnel;
+      rFresnel *= (ca1ca2*ca1ca2 + sa1sa2*sa1sa2);
 
-    // In this case, we do not care if "uz1" is exactly 0.
-    if (ca1 < COSNINETYDEG || sa2 == FP_ONE) rFresnel = FP_ONE;
+      // In this case, we do not care if "uz1" is exactly 0.
+      if (ca1 < COSNINETYDEG || sa2 == FP_ONE) rFresnel = FP_ONE;
+    }
 
     GFLOAT rand = rand_MWC_co(rnd_x, rnd_a);
 
@@ -403,7 +422,7 @@ __device__ void FastReflectTransmit(PhotonStructGPU *photon,
 //	 sampling the polar deflection angle theta and the
 // 	 azimuthal angle psi.
 //////////////////////////////////////////////////////////////////////////////
-__device__ void Spin(GFLOAT g, PhotonStructGPU *photon,
+__device__ void Spin(GFLOAT g, const GFLOAT *phase, PhotonStructGPU *photon,
                      UINT64 *rnd_x, UINT32 *rnd_a)
 {
   GFLOAT cost, sint; // cosine and sine of the polar deflection angle theta
@@ -424,13 +443,24 @@ __device__ void Spin(GFLOAT g, PhotonStructGPU *photon,
   *		sample according to the Henyey-Greenstein function.
   *
   *	Returns the cosine of the polar deflection angle theta.
+  *
+  *	With -Phg, phase points to the inverse CDF of the layer
+  *	(PHASE_TABLE_SIZE points), which is interpolated instead.
   ****/
 
   rand = rand_MWC_oc(rnd_x, rnd_a); 
 
   cost = FP_TWO * rand - FP_ONE;
 
-  if (g != MCML_FP_ZERO)
+  if (phase != NULL)
+  {
+    GFLOAT x = rand * (PHASE_TABLE_SIZE - 1);
+    // automatic __float2uint_rz
+    UINT32 k = min((UINT32)x, (UINT32)(PHASE_TABLE_SIZE - 2));
+    GFLOAT c0 = phase[k];
+    cost = c0 + (x - k) * (phase[k+1] - c0);
+  }
+  else if (g != MCML_FP_ZERO)
   {
     temp = FAST_DIV((FP_ONE - g * g), FP_ONE + g*cost);
     cost = FAST_DIV(FP_ONE + g * g - temp*temp, FP_TWO * g);
@@ -639,7 +669,9 @@ __global__ void MCMLKernel(SimState d_state, GPUThreadStates tstates)
         }
         //>>>>>>>>> end of Drop()
 
-        Spin(d_layerspecs[photon.layer].g, &photon, &rnd_x, &rnd_a);
+        Spin(d_layerspecs[photon.layer].g, (d_state.phase_table == NULL) ?
+          NULL : d_state.phase_table + photon.layer * PHASE_TABLE_SIZE,
+          &photon, &rnd_x, &rnd_a);
       }
 
       /***********************************************************
@@ -179,6 +179,18 @@ typedef UINT64 ARZ_SMEM_TY;
 */
 #define NUM_STEPS 50000  //Use 5000 for faster response time
 
+/*  Points of the inverse CDF of cos(theta) tabulated for each layer (-Phg).
+    The interpolation error of Henyey-Greenstein is reported by
+    InitSimStates; it is below 1.5E-4 in cos(theta) for g <= 0.95.
+*/
+#define PHASE_TABLE_SIZE 4096
+
+/*  Points of the Fresnel reflectance tabulated for each side of each
+    boundary (-F), over the cosine of the optically thinner side. The
+    largest interpolation error is reported by InitSimStates.
+*/
+#define FRESNEL_TABLE_SIZE 2048
+
 /*  Multi-GPU support: 
     Sets the maximum number of GPUs to 6
     (assuming 3 dual-GPU cards - e.g., GTX 295) 
@@ -230,6 +230,39 @@ static CUT_THREADPROC RunGPUi(HostThreadState *hstate)
   // We still need the host-side structure.
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//   The results of a simulation are written by a host thread of their own
+//   while the next simulation runs on the GPUs, so that the GPUs do not sit
+//   idle while the output is formatted. One simulation is written at a time.
+//////////////////////////////////////////////////////////////////////////////
+typedef struct
+{
+  SimState results;         // summed over the GPUs, owned by the writer
+  SimulationStruct *sim;
+  float simulation_time;    // [ms]
+} WriterState;
+
+static WriterState writer;
+static CUTThread writer_thread;
+static int writer_busy = 0;
+
+static CUT_THREADPROC WriteResults(WriterState *w)
+{
+  Write_Simulation_Results(&w->results, w->sim, w->simulation_time);
+  FreeHostSimState(&w->results);
+  CUT_THREADEND;
+}
+
+// Wait for the results of the previous simulation to be written.
+static void WaitForWriter()
+{
+  if (writer_busy)
+  {
+    cutEndThread(writer_thread);
+    writer_busy = 0;
+  }
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //   Perform MCML simulation for one run out of N runs (in the input file)
 //////////////////////////////////////////////////////////////////////////////
@@ -333,7 +366,15 @@ static void DoOneSimulation(int sim_id, SimulationStruct* simulation,
     float elapsedTime = cutGetTimerValue(execTimer);
     printf("\n\n>>>>>>Simulation time: %.3f ms\n", elapsedTime);
 
-    Write_Simulation_Results(hss0, simulation, elapsedTime);
+    // Hand the summed results over to the writer.
+    WaitForWriter();
+    writer.results = *hss0;
+    writer.results.n_photons_left = NULL;
+    hss0->A_rz = hss0->Rd_ra = hss0->Tt_ra = NULL;
+    writer.sim = simulation;
+    writer.simulation_time = elapsedTime;
+    writer_thread = cutStartThread((CUT_THREADROUTINE)WriteResults, &writer);
+    writer_busy = 1;
   }
 
   CUT_SAFE_CALL( cutDeleteTimer(execTimer) );
@@ -353,6 +394,8 @@ int main(int argc, char* argv[])
   char* filename = NULL;
   UINT64 seed = (UINT64) time(NULL);
   int ignoreAdetection = 0;
+  int tabulatePhase = 0;
+  int tabulateFresnel = 0;
   UINT32 num_GPUs = 1;
 
   SimulationStruct* simulations;
@@ -362,7 +405,7 @@ int main(int argc, char* argv[])
 
   // Parse command-line arguments.
   if (interpret_arg(argc, argv, &filename,
-    &seed, &ignoreAdetection, &num_GPUs))
+    &seed, &ignoreAdetection, &tabulatePhase, &tabulateFresnel, &num_GPUs))
   {
     usage(argv[0]);
     return 1;
@@ -390,6 +433,10 @@ int main(int argc, char* argv[])
   printf("EXECUTION MODE:\n");
   printf("  ignore A-detection:      %s\n",
     ignoreAdetection ? "YES" : "NO");
+  printf("  tabulated phase:         %s\n",
+    tabulatePhase ? "YES" : "NO");
+  printf("  tabulated Fresnel:       %s\n",
+    tabulateFresnel ? "YES" : "NO");
   printf("  seed:                    %llu\n", seed);
   printf("  # of GPUs:               %u\n", num_GPUs);
   printf("====================================\n\n");
@@ -402,6 +449,11 @@ int main(int argc, char* argv[])
     printf("Something wrong with read_simulation_data!\n");
     return 1;
   }
+  for (i = 0; i < n_simulations; ++i)
+  {
+    simulations[i].tabulatePhase = tabulatePhase;
+    simulations[i].tabulateFresnel = tabulateFresnel;
+  }
   printf("Read %d simulations\n\n",n_simulations);
 
   // Allocate one host thread state for each GPU.
@@ -464,6 +516,7 @@ int main(int argc, char* argv[])
     // Run a simulation
     DoOneSimulation(i, &simulations[i], hstates, num_GPUs, x, a);
   }
+  WaitForWriter();
 
   // Free host thread states.
   for (i = 0; i < num_GPUs; ++i) free(hstates[i]);
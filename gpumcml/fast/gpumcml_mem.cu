@@ -21,6 +21,8 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
 
 #include "gpumcml_kernel.h"
 
@@ -90,6 +92,123 @@ int InitDCMem(SimulationStruct *sim, UINT32 A_rz_overflow)
   return 0;
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//   Tabulate the Henyey-Greenstein inverse CDF of cos(theta) of each layer
+//   at PHASE_TABLE_SIZE equally spaced u in [0, 1], for Spin().
+//
+//   Linear interpolation is off by at most h^2/8 max|F''|, h = 1/(N-1),
+//   and |F''| is largest at u = 0, where it is 12g(1-g^2)^2/(1-g)^4.
+//////////////////////////////////////////////////////////////////////////////
+static GFLOAT *BuildPhaseTables(SimulationStruct *sim)
+{
+  UINT32 n_layers = sim->n_layers + 2;
+  GFLOAT *table = (GFLOAT*)malloc(
+    n_layers * PHASE_TABLE_SIZE * sizeof(GFLOAT));
+  if (table == NULL)
+  {
+    fprintf(stderr, "Error allocating the phase function tables");
+    exit(1);
+  }
+
+  for (UINT32 i = 0; i < n_layers; ++i)
+  {
+    GFLOAT *t = table + i * PHASE_TABLE_SIZE;
+    double g = sim->layers[i].g;
+    double h = 1.0 / (PHASE_TABLE_SIZE - 1);
+
+    for (int k = 0; k < PHASE_TABLE_SIZE; ++k)
+    {
+      double u = k * h, cost;
+
+      if (g == 0.0)
+      {
+        cost = 2.0 * u - 1.0;
+      }
+      else
+      {
+        double temp = (1.0 - g * g) / (1.0 - g + 2.0 * g * u);
+        cost = (1.0 + g * g - temp * temp) / (2.0 * g);
+        if (cost < -1.0) cost = -1.0;
+        if (cost > 1.0) cost = 1.0;
+      }
+      t[k] = (GFLOAT)cost;
+    }
+
+    if (i > 0 && i < n_layers-1 && g != 0.0)
+    {
+      double a = 1.0 - fabs(g);
+      printf("Layer %u: tabulated phase function, error <= %.2G\n", i,
+        h * h / 8.0 * 12.0 * fabs(g) * (1.0 - g * g) * (1.0 - g * g)
+        / (a * a * a * a));
+    }
+  }
+
+  return table;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//   Fresnel reflectance from n1 to n2 at the cosine t of the optically
+//   thinner side, in double precision.
+//////////////////////////////////////////////////////////////////////////////
+static double FresnelAt(double n1, double n2, double t)
+{
+  double ca1 = t, ca2 = t;
+  if (n1 > n2)
+    ca1 = sqrt(1.0 - (n2 * n2) / (n1 * n1) * (1.0 - t * t));
+  else
+    ca2 = sqrt(1.0 - (n1 * n1) / (n2 * n2) * (1.0 - t * t));
+
+  double rs = (n1 * ca1 - n2 * ca2) / (n1 * ca1 + n2 * ca2);
+  double rp = (n1 * ca2 - n2 * ca1) / (n1 * ca2 + n2 * ca1);
+  return 0.5 * (rs * rs + rp * rp);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//   Tabulate the Fresnel reflectance of both boundaries of each layer at
+//   FRESNEL_TABLE_SIZE equally spaced cosines of the optically thinner
+//   side, for FastReflectTransmit(). The reflectance is smooth in this
+//   cosine, also near the critical angle.
+//////////////////////////////////////////////////////////////////////////////
+static GFLOAT *BuildFresnelTables(SimulationStruct *sim)
+{
+  UINT32 n_layers = sim->n_layers + 2;
+  GFLOAT *table = (GFLOAT*)calloc(
+    n_layers * 2 * FRESNEL_TABLE_SIZE, sizeof(GFLOAT));
+  if (table == NULL)
+  {
+    fprintf(stderr, "Error allocating the Fresnel tables");
+    exit(1);
+  }
+
+  double err = 0.0;
+  for (UINT32 i = 1; i < n_layers-1; ++i)
+  {
+    for (int side = 0; side < 2; ++side)
+    {
+      GFLOAT *t = table + (i * 2 + side) * FRESNEL_TABLE_SIZE;
+      double n1 = sim->layers[i].n;
+      double n2 = sim->layers[side ? i+1 : i-1].n;
+      double h = 1.0 / (FRESNEL_TABLE_SIZE - 1);
+
+      for (int k = 0; k < FRESNEL_TABLE_SIZE; ++k)
+      {
+        t[k] = (GFLOAT)FresnelAt(n1, n2, k * h);
+      }
+
+      // error at the midpoints, including the rounding to GFLOAT
+      for (int k = 0; k < FRESNEL_TABLE_SIZE-1; ++k)
+      {
+        double e = fabs(0.5 * ((double)t[k] + (double)t[k+1])
+          - FresnelAt(n1, n2, (k + 0.5) * h));
+        if (e > err) err = e;
+      }
+    }
+  }
+  printf("Tabulated Fresnel reflectance, error <= %.2G\n", err);
+
+  return table;
+}
+
 //////////////////////////////////////////////////////////////////////////////
 //   Initialize Device Memory (global) for read/write data
 //////////////////////////////////////////////////////////////////////////////
@@ -146,6 +265,32 @@ int InitSimStates(SimState* HostMem, SimState* DeviceMem,
   CUDA_SAFE_CALL( cudaMalloc((void**)&DeviceMem->Tt_ra, size) );
   CUDA_SAFE_CALL( cudaMemset(DeviceMem->Tt_ra, 0, size) );
 
+  // Tabulated phase functions (on device only)
+  HostMem->phase_table = NULL;
+  DeviceMem->phase_table = NULL;
+  if (sim->tabulatePhase)
+  {
+    GFLOAT *table = BuildPhaseTables(sim);
+    size = (sim->n_layers + 2) * PHASE_TABLE_SIZE * sizeof(GFLOAT);
+    CUDA_SAFE_CALL( cudaMalloc((void**)&DeviceMem->phase_table, size) );
+    CUDA_SAFE_CALL( cudaMemcpy(DeviceMem->phase_table, table, size,
+      cudaMemcpyHostToDevice) );
+    free(table);
+  }
+
+  // Tabulated Fresnel reflectance (on device only)
+  HostMem->fresnel_table = NULL;
+  DeviceMem->fresnel_table = NULL;
+  if (sim->tabulateFresnel)
+  {
+    GFLOAT *table = BuildFresnelTables(sim);
+    size = (sim->n_layers + 2) * 2 * FRESNEL_TABLE_SIZE * sizeof(GFLOAT);
+    CUDA_SAFE_CALL( cudaMalloc((void**)&DeviceMem->fresnel_table, size) );
+    CUDA_SAFE_CALL( cudaMemcpy(DeviceMem->fresnel_table, table, size,
+      cudaMemcpyHostToDevice) );
+    free(table);
+  }
+
   /* Allocate and initialize GPU thread states on the device.
   *
   * We only initialize rnd_a and rnd_x here. For all other fields, whose
@@ -232,6 +377,14 @@ void FreeDeviceSimStates(SimState *dstate, GPUThreadStates *tstates)
   cudaFree(dstate->A_rz); dstate->A_rz = NULL;
   cudaFree(dstate->Rd_ra); dstate->Rd_ra = NULL;
   cudaFree(dstate->Tt_ra); dstate->Tt_ra = NULL;
+  if (dstate->phase_table != NULL)
+  {
+    cudaFree(dstate->phase_table); dstate->phase_table = NULL;
+  }
+  if (dstate->fresnel_table != NULL)
+  {
+    cudaFree(dstate->fresnel_table); dstate->fresnel_table = NULL;
+  }
 
   cudaFree(tstates->photon_x); tstates->photon_x = NULL;
   cudaFree(tstates->photon_y); tstates->photon_y = NULL;
@@ -0,0 +1,609 @@
+/*****************************************************************************
+*
+*   Reading and comparing .mco result files
+*
+****************************************************************************/
+
+#include "mco.h"
+
+#include <charconv>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <memory>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace mco {
+
+namespace {
+
+//////////////////////////////////////////////////////////////////////////////
+//   A file mapped read-only for the life of the object
+//////////////////////////////////////////////////////////////////////////////
+class Mapping
+{
+ public:
+  explicit Mapping(const std::string &path)
+    : data(NULL), size(0)
+  {
+    struct stat st;
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd < 0) { error = "cannot open"; return; }
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+      error = "empty file";
+      close(fd);
+      return;
+    }
+    size = st.st_size;
+    void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) { error = "cannot map"; size = 0; return; }
+    madvise(p, size, MADV_SEQUENTIAL);
+    data = (const char *)p;
+  }
+
+  ~Mapping() { if (data != NULL) munmap((void *)data, size); }
+
+  const char *data;
+  size_t size;
+  std::string error;
+};
+
+// The bytes of one section of an ASCII file, parsed by ParseSection().
+struct Range
+{
+  size_t file, section;
+  const char *begin, *end;
+};
+
+const double kNaN = std::numeric_limits<double>::quiet_NaN();
+
+inline bool IsSpace(char c)
+{
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\f'
+    || c == '\v';
+}
+
+inline bool IsAlpha(char c)
+{
+  return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//   Read the next number of [p, end) into x, skipping blanks and comments
+//   from '#' to the end of the line. A token that is not a number, such as
+//   1.#INF of old Windows builds, reads as NaN. Returns false at the end.
+//////////////////////////////////////////////////////////////////////////////
+bool NextNumber(const char *&p, const char *end, double &x)
+{
+  for (;;)
+  {
+    while (p < end && IsSpace(*p)) ++p;
+    if (p == end) return false;
+    if (*p != '#') break;
+    while (p < end && *p != '\n') ++p;
+  }
+
+  const char *q = p;
+  while (q < end && !IsSpace(*q) && *q != '#') ++q;
+  const char *s = (*p == '+') ? p + 1 : p;
+  std::from_chars_result r = std::from_chars(s, q, x);
+  if (r.ec != std::errc() || r.ptr != q)
+  {
+    if (r.ec == std::errc::result_out_of_range) x = 0;    // denormal
+    else x = kNaN;
+  }
+  p = q;
+  return true;
+}
+
+// The start of the line after p.
+inline const char *NextLine(const char *p, const char *end)
+{
+  const char *q = (const char *)memchr(p, '\n', end - p);
+  return (q == NULL) ? end : q + 1;
+}
+
+// The first token of the line at p, up to a blank or a '#'.
+std::string LineToken(const char *p, const char *end)
+{
+  const char *q = p;
+  while (q < end && !IsSpace(*q) && *q != '#') ++q;
+  return std::string(p, q);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//   The rows and columns of a section of n values, by its name: the 2D
+//   arrays and their standard errors (_err) over r and z or a, and the
+//   derivatives of -D over layer and r.
+//////////////////////////////////////////////////////////////////////////////
+void SetShape(const File &f, Section &s)
+{
+  std::string base = s.name;
+  size_t n = s.val.size();
+
+  if (base.size() > 4 && base.compare(base.size() - 4, 4, "_err") == 0)
+    base.resize(base.size() - 4);
+  s.rows = (int)n;
+  s.cols = 1;
+  if (base == "A_rz") { s.rows = f.nr; s.cols = f.nz; }
+  else if (base == "Rd_ra" || base == "Tt_ra") { s.rows = f.nr; s.cols = f.na; }
+  else if (base.compare(0, 4, "dRd_") == 0 || base.compare(0, 4, "dTt_") == 0)
+  {
+    s.rows = (int)f.layers.size();
+    s.cols = f.nr;
+  }
+  if ((size_t)s.rows * s.cols != n || s.cols == 0)
+  {
+    s.rows = (int)n;
+    s.cols = 1;
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//   Parse InParm of an ASCII file at p and return the start of the first
+//   section after it, or NULL.
+//////////////////////////////////////////////////////////////////////////////
+const char *ParseInParm(File &f, const char *p, const char *end)
+{
+  double x[7];
+  int i;
+
+  p = NextLine(p, end);                 // the output file name and format
+  for (;;)
+  {
+    if (p == end) return NULL;
+    const char *q = p;
+    while (q < end && (*q == ' ' || *q == '\t')) ++q;
+    if (q < end && *q != '#' && *q != '\r' && *q != '\n') break;
+    p = NextLine(p, end);
+  }
+  p = NextLine(p, end);
+
+  // photons, dz, dr, nz, nr, na, layers
+  for (i = 0; i < 7; ++i)
+    if (!NextNumber(p, end, x[i])) return NULL;
+  f.num_photons = (long long)x[0];
+  f.dz = x[1];
+  f.dr = x[2];
+  f.nz = (int)x[3];
+  f.nr = (int)x[4];
+  f.na = (int)x[5];
+  if (!(x[6] >= 1 && x[6] < 1e6) || f.nz < 1 || f.nr < 1 || f.na < 1)
+    return NULL;
+
+  f.layers.resize((size_t)x[6]);
+  if (!NextNumber(p, end, f.n_above)) return NULL;
+  for (Layer &l : f.layers)
+    if (!NextNumber(p, end, l.n) || !NextNumber(p, end, l.mua)
+        || !NextNumber(p, end, l.mus) || !NextNumber(p, end, l.g)
+        || !NextNumber(p, end, l.d))
+      return NULL;
+  if (!NextNumber(p, end, f.n_below)) return NULL;
+  return NextLine(p, end);
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//   Find the sections of an ASCII file: a line that starts with a letter
+//   starts one, named by its first token, and the numbers up to the next
+//   one are its values.
+//////////////////////////////////////////////////////////////////////////////
+void IndexAscii(File &f, size_t file, const Mapping &m,
+    std::vector<Range> &ranges)
+{
+  const char *end = m.data + m.size;
+  const char *p = m.data;
+  const char kTraced[] = "# Photons traced:";
+  long long traced = -1;
+
+  // The file of a node of a split run says how many photons it traced.
+  for (; p < end && LineToken(p, end) != "InParm"; p = NextLine(p, end))
+  {
+    if ((size_t)(end - p) > sizeof(kTraced)
+        && memcmp(p, kTraced, sizeof(kTraced) - 1) == 0)
+    {
+      std::string line(p, NextLine(p, end));
+      sscanf(line.c_str() + sizeof(kTraced) - 1, "%lld", &traced);
+    }
+  }
+  if (p == end || (p = ParseInParm(f, p, end)) == NULL)
+  {
+    f.error = "no InParm section";
+    return;
+  }
+  f.run_photons = f.num_photons;
+  if (traced > 0) f.num_photons = traced;
+
+  for (; p < end; p = NextLine(p, end))
+  {
+    if (!IsAlpha(*p)) continue;
+    if (!ranges.empty()) ranges.back().end = p;
+    Section s;
+    s.name = LineToken(p, end);
+    s.rows = s.cols = 0;
+    f.sections.push_back(s);
+
+    Range r;
+    r.file = file;
+    r.section = f.sections.size() - 1;
+    r.begin = p + s.name.size();
+    r.end = end;
+    ranges.push_back(r);
+  }
+  if (f.sections.empty()) f.error = "no results";
+}
+
+void ParseSection(std::vector<File> &files, const Range &r)
+{
+  Section &s = files[r.file].sections[r.section];
+  const char *p = r.begin;
+  double x;
+
+  // ~13 bytes a number in the 2D arrays
+  s.val.reserve((r.end - r.begin) / 13 + 1);
+  while (NextNumber(p, r.end, x)) s.val.push_back(x);
+}
+
+// Append the n doubles at offset off of m as a section, if they fit.
+bool AddBlock(File &f, const Mapping &m, size_t &off, const char *name,
+    size_t n)
+{
+  Section s;
+
+  if (off + n * sizeof(double) > m.size) return false;
+  s.name = name;
+  s.val.resize(n);
+  memcpy(s.val.data(), m.data + off, n * sizeof(double));
+  if (BigEndian()) SwapBytes(s.val.data(), sizeof(double), n);
+  off += n * sizeof(double);
+  SetShape(f, s);
+  f.sections.push_back(std::move(s));
+  return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//   Read a binary file of output format B: McoHead, the layers, the scaled
+//   results and the raw tallies of MCO_RAW.
+//////////////////////////////////////////////////////////////////////////////
+void ReadBinary(File &f, const Mapping &m)
+{
+  McoHead head;
+  size_t off, nl, nr, nz, na, i;
+
+  f.binary = true;
+  if (m.size < sizeof(McoHead))
+  {
+    f.error = "truncated binary file";
+    return;
+  }
+  memcpy(&head, m.data, sizeof(head));
+  SwapHead(head);
+  if (head.byte_order != kMcoByteOrder)
+  {
+    f.error = "binary file of another byte order";
+    return;
+  }
+  if (head.version != kMcoVersion || head.head_size != (int)sizeof(McoHead)
+      || head.num_layers < 1 || head.nz < 1 || head.nr < 1 || head.na < 1)
+  {
+    f.error = "binary file of another version";
+    return;
+  }
+
+  f.num_photons = head.num_photons;
+  f.run_photons = head.run_photons;
+  f.Wth = head.Wth;
+  f.dz = head.dz;
+  f.dr = head.dr;
+  f.nz = head.nz;
+  f.nr = head.nr;
+  f.na = head.na;
+  nl = head.num_layers;
+  nz = head.nz;
+  nr = head.nr;
+  na = head.na;
+
+  off = head.head_size;
+  if (off + (nl + 2) * sizeof(McoLayer) > m.size)
+  {
+    f.error = "truncated binary file";
+    return;
+  }
+  std::vector<McoLayer> layer(nl + 2);
+  memcpy(layer.data(), m.data + off, (nl + 2) * sizeof(McoLayer));
+  if (BigEndian()) SwapBytes(layer.data(), sizeof(double), 6 * (nl + 2));
+  off += (nl + 2) * sizeof(McoLayer);
+  f.n_above = layer[0].n;
+  f.n_below = layer[nl + 1].n;
+  f.layers.resize(nl);
+  for (i = 0; i < nl; ++i)
+  {
+    const McoLayer &l = layer[i + 1];
+    f.layers[i] = Layer { l.n, l.mua, l.mus, l.g, l.z1 - l.z0 };
+  }
+
+  const double rat[4] = { head.Rsp, head.Rd, head.A, head.Tt };
+  const char *rat_name[4] = { "Rsp", "Rd", "A", "Tt" };
+  for (i = 0; i < 4; ++i)
+  {
+    Section s;
+    s.name = rat_name[i];
+    s.rows = s.cols = 1;
+    s.val.assign(1, rat[i]);
+    f.sections.push_back(s);
+  }
+  if (!AddBlock(f, m, off, "A_l", nl) || !AddBlock(f, m, off, "A_z", nz)
+      || !AddBlock(f, m, off, "Rd_r", nr) || !AddBlock(f, m, off, "Rd_a", na)
+      || !AddBlock(f, m, off, "Tt_r", nr) || !AddBlock(f, m, off, "Tt_a", na)
+      || !AddBlock(f, m, off, "A_rz", nr * nz)
+      || !AddBlock(f, m, off, "Rd_ra", nr * na)
+      || !AddBlock(f, m, off, "Tt_ra", nr * na))
+  {
+    f.error = "truncated binary file";
+    return;
+  }
+
+  if (!(head.flags & kMcoRaw)) return;
+  const size_t n_raw[3] = { nr * nz, nr * na, nr * na };
+  for (i = 0; i < 3; ++i)
+  {
+    if (off + n_raw[i] * sizeof(unsigned long long) > m.size)
+    {
+      f.error = "truncated binary file";
+      return;
+    }
+    f.raw[i].resize(n_raw[i]);
+    memcpy(f.raw[i].data(), m.data + off,
+      n_raw[i] * sizeof(unsigned long long));
+    if (BigEndian())
+      SwapBytes(f.raw[i].data(), sizeof(unsigned long long), n_raw[i]);
+    off += n_raw[i] * sizeof(unsigned long long);
+  }
+  f.weight_scale = head.weight_scale;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//   Shape the parsed sections of an ASCII file, and split RAT into Rsp, Rd,
+//   A and Tt.
+//////////////////////////////////////////////////////////////////////////////
+void FinishAscii(File &f)
+{
+  std::vector<Section> out;
+
+  out.reserve(f.sections.size() + 3);
+  for (Section &s : f.sections)
+  {
+    if (s.name == "RAT" && s.val.size() == 4)
+    {
+      const char *rat_name[4] = { "Rsp", "Rd", "A", "Tt" };
+      for (int i = 0; i < 4; ++i)
+      {
+        Section r;
+        r.name = rat_name[i];
+        r.rows = r.cols = 1;
+        r.val.assign(1, s.val[i]);
+        out.push_back(r);
+      }
+      continue;
+    }
+    SetShape(f, s);
+    out.push_back(std::move(s));
+  }
+  f.sections.swap(out);
+}
+
+inline bool Close(double a, double b)
+{
+  // %G keeps 6 digits
+  return std::fabs(a - b) <= 1e-5 * std::max(std::fabs(a), std::fabs(b));
+}
+
+}  // namespace
+
+bool BigEndian()
+{
+  const unsigned int one = 1;
+  return *(const unsigned char *)&one == 0;
+}
+
+void SwapBytes(void *p, size_t size, size_t n)
+{
+  unsigned char *c = (unsigned char *)p;
+  for (; n > 0; --n, c += size) std::reverse(c, c + size);
+}
+
+void SwapHead(McoHead &head)
+{
+  if (!BigEndian()) return;
+  SwapBytes(&head.version, sizeof(int), 8);             // version to flags
+  SwapBytes(&head.num_photons, sizeof(long long), 2);
+  SwapBytes(&head.Wth, sizeof(double), 9);              // Wth to Tt
+  SwapBytes(&head.batches, sizeof(int), 2);
+  SwapBytes(&head.err_rd, sizeof(double), 3);
+}
+
+const Section *File::find(const std::string &name) const
+{
+  for (const Section &s : sections)
+    if (s.name == name) return &s;
+  return NULL;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//   Map the files and index their sections on num_threads threads, then
+//   parse the sections of all the ASCII files on the same threads.
+//////////////////////////////////////////////////////////////////////////////
+void Load(const std::vector<std::string> &paths, int num_threads,
+    std::vector<File> &files)
+{
+  size_t n = paths.size();
+  std::vector<std::unique_ptr<Mapping> > maps(n);
+  std::vector<std::vector<Range> > ranges(n);
+
+  files.assign(n, File());
+  ParallelFor(n, num_threads, [&](size_t i) {
+    File &f = files[i];
+
+    f.path = paths[i];
+    f.binary = false;
+    f.num_photons = f.run_photons = 0;
+    f.dz = f.dr = 0;
+    f.nz = f.nr = f.na = 0;
+    f.n_above = f.n_below = 0;
+    f.Wth = f.weight_scale = 0;
+    maps[i].reset(new Mapping(paths[i]));
+    if (!maps[i]->error.empty()) { f.error = maps[i]->error; return; }
+    if (maps[i]->size >= 8 && memcmp(maps[i]->data, kMcoMagic, 8) == 0)
+    {
+      ReadBinary(f, *maps[i]);
+      maps[i].reset();
+    }
+    else
+      IndexAscii(f, i, *maps[i], ranges[i]);
+  });
+
+  std::vector<Range> all;
+  for (size_t i = 0; i < n; ++i)
+    if (files[i].error.empty())
+      all.insert(all.end(), ranges[i].begin(), ranges[i].end());
+  // the largest sections first, so that no thread is left with A_rz
+  std::sort(all.begin(), all.end(), [](const Range &a, const Range &b) {
+    return a.end - a.begin > b.end - b.begin;
+  });
+  ParallelFor(all.size(), num_threads, [&](size_t i) {
+    ParseSection(files, all[i]);
+  });
+
+  ParallelFor(n, num_threads, [&](size_t i) {
+    if (!files[i].binary && files[i].error.empty()) FinishAscii(files[i]);
+    maps[i].reset();
+  });
+}
+
+File Read(const std::string &path)
+{
+  std::vector<File> files;
+
+  Load(std::vector<std::string>(1, path), 1, files);
+  return std::move(files[0]);
+}
+
+std::string Incomparable(const File &ref, const File &cmp)
+{
+  if (ref.nz != cmp.nz || ref.nr != cmp.nr || ref.na != cmp.na)
+    return "the numbers of dz, dr, da differ";
+  if (!Close(ref.dz, cmp.dz) || !Close(ref.dr, cmp.dr))
+    return "dz, dr differ";
+  if (ref.layers.size() != cmp.layers.size())
+    return "the numbers of layers differ";
+  if (!Close(ref.n_above, cmp.n_above) || !Close(ref.n_below, cmp.n_below))
+    return "the ambient media differ";
+  for (size_t i = 0; i < ref.layers.size(); ++i)
+  {
+    const Layer &a = ref.layers[i], &b = cmp.layers[i];
+    if (!Close(a.n, b.n) || !Close(a.mua, b.mua) || !Close(a.mus, b.mus)
+        || !Close(a.g, b.g) || !Close(a.d, b.d))
+      return "layer " + std::to_string(i + 1) + " differs";
+  }
+  return std::string();
+}
+
+std::vector<double> RelDiff(const Section &ref, const Section &cmp)
+{
+  size_t i, n = std::min(ref.val.size(), cmp.val.size());
+  std::vector<double> d(n);
+
+  for (i = 0; i < n; ++i)
+    d[i] = (ref.val[i] == 0) ? kNaN
+      : 100 * std::fabs(cmp.val[i] - ref.val[i]) / std::fabs(ref.val[i]);
+  return d;
+}
+
+Stats Summarize(const std::string &name, const Section &ref,
+    const Section &cmp)
+{
+  std::vector<double> d = RelDiff(ref, cmp);
+  std::vector<double> v;
+  double sum = 0, sum2 = 0, sum_d = 0, sum_ref = 0;
+  Stats s;
+  size_t i;
+
+  s.name = name;
+  s.n = s.n_zero = s.i_max = 0;
+  s.max = 0;
+  v.reserve(d.size());
+  for (i = 0; i < d.size(); ++i)
+  {
+    if (ref.val[i] == 0)
+    {
+      if (cmp.val[i] != 0) ++s.n_zero;
+    }
+    if (std::isfinite(cmp.val[i]) && std::isfinite(ref.val[i]))
+    {
+      sum_d += std::fabs(cmp.val[i] - ref.val[i]);
+      sum_ref += std::fabs(ref.val[i]);
+    }
+    if (!std::isfinite(d[i])) continue;
+    v.push_back(d[i]);
+    sum += d[i];
+    sum2 += d[i] * d[i];
+    if (d[i] > s.max) { s.max = d[i]; s.i_max = i; }
+  }
+
+  s.n = v.size();
+  if (s.n == 0)
+  {
+    s.mean = s.rms = s.p95 = 0;
+  }
+  else
+  {
+    size_t k = (size_t)(0.95 * (s.n - 1));
+    std::nth_element(v.begin(), v.begin() + k, v.end());
+    s.p95 = v[k];
+    s.mean = sum / s.n;
+    s.rms = std::sqrt(sum2 / s.n);
+  }
+  s.l1 = (sum_ref > 0) ? 100 * sum_d / sum_ref : (sum_d > 0 ? kNaN : 0);
+  return s;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//   Compare the sections of ref that cmp has too, with the same size. The
+//   fluence of compare_simulations2.m is A_rz over the mua of each depth,
+//   so its relative difference is that of A_rz and is not repeated.
+//////////////////////////////////////////////////////////////////////////////
+Result Compare(const File &ref, const File &cmp)
+{
+  Result r;
+
+  r.ref = ref.path;
+  r.cmp = cmp.path;
+  r.worst_l1 = 0;
+  if (!ref.error.empty()) { r.error = ref.path + ": " + ref.error; return r; }
+  if (!cmp.error.empty()) { r.error = cmp.path + ": " + cmp.error; return r; }
+  r.error = Incomparable(ref, cmp);
+  if (!r.error.empty()) return r;
+
+  for (const Section &s : ref.sections)
+  {
+    const Section *c = cmp.find(s.name);
+    if (c == NULL || c->val.size() != s.val.size()) continue;
+    r.stats.push_back(Summarize(s.name, s, *c));
+    const Stats &st = r.stats.back();
+    if (!std::isnan(r.worst_l1) && !(st.l1 <= r.worst_l1))  // NaN is the worst
+    {
+      r.worst_l1 = st.l1;
+      r.worst = st.name;
+    }
+  }
+  if (r.stats.empty()) r.error = "no common sections";
+  return r;
+}
+
+}  // namespace mco
@@ -0,0 +1,175 @@
+/*****************************************************************************
+*
+*   Reading and comparing .mco result files
+*
+*   A C++ replacement of read_file_mco.m, compare_simulations2.m and
+*   diffmap.m. Files are mapped with mmap; the sections of the ASCII files
+*   of MCML, CUDAMCML and GPUMCML, and the binary files of output format B
+*   (McoHead), are parsed by a pool of threads.
+*
+****************************************************************************/
+
+#ifndef MCO_H
+#define MCO_H
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace mco {
+
+// One layer of InParm, as in the .mci file.
+struct Layer
+{
+  double n, mua, mus, g, d;
+};
+
+// One section of results, such as A_z or Rd_ra. The RAT section is kept as
+// the four one-value sections Rsp, Rd, A and Tt. 2D sections are stored by
+// rows, [r*nz + z] for A_rz and [r*na + a] for Rd_ra and Tt_ra.
+struct Section
+{
+  std::string name;
+  int rows, cols;               // cols is 1 for 1D sections
+  std::vector<double> val;
+};
+
+struct File
+{
+  std::string path;
+  std::string error;            // empty if the file was read
+  bool binary;
+  long long num_photons;        // traced
+  long long run_photons;        // of the run, by which the results are
+                                // scaled: more than num_photons only in
+                                // the file of a node of a split run
+  double dz, dr;
+  int nz, nr, na;
+  double n_above, n_below;
+  std::vector<Layer> layers;    // layers 1..nl
+  std::vector<Section> sections;  // in the order of the file
+
+  // Binary files only: the roulette threshold, and with MCO_RAW the raw
+  // tallies of A_rz, Rd_ra and Tt_ra, by rows as the sections, in units of
+  // 1/weight_scale (0 without them).
+  double Wth;
+  double weight_scale;
+  std::vector<unsigned long long> raw[3];
+
+  const Section *find(const std::string &name) const;
+};
+
+enum { kRawA_rz, kRawRd_ra, kRawTt_ra };
+
+// The binary layout of output format B, as McoHead and McoLayer of mcml.h
+// and gpumcml.h. All values are little-endian.
+const char kMcoMagic[8] = { 'M', 'C', 'M', 'L', 'M', 'C', 'O', 'B' };
+const int kMcoVersion = 1;
+const int kMcoByteOrder = 0x01020304;
+const int kMcoRaw = 1;          // flag: raw tallies follow the scaled ones
+
+struct McoHead
+{
+  char magic[8];
+  int version, byte_order;
+  int head_size;
+  int num_layers, nz, nr, na;
+  int flags;
+  long long num_photons;
+  long long run_photons;
+  double Wth, dz, dr, da;
+  double weight_scale;
+  double Rsp, Rd, A, Tt;
+  int batches;
+  int reserved;
+  double err_rd, err_a, err_rdr;
+  char out_fname[256];
+  char note[256];
+};
+
+struct McoLayer
+{
+  double n, mua, mus, g, z0, z1;
+};
+
+// True on a big-endian host, which swaps the values of binary files.
+bool BigEndian();
+
+// Reverse the bytes of each of the n values of size bytes at p.
+void SwapBytes(void *p, size_t size, size_t n);
+
+// Swap the numbers of head between little-endian and the host, on a
+// big-endian host.
+void SwapHead(McoHead &head);
+
+// Read the files of paths into files, on up to num_threads threads. A file
+// that cannot be read gets a non-empty error.
+void Load(const std::vector<std::string> &paths, int num_threads,
+    std::vector<File> &files);
+
+// Read one file on the calling thread.
+File Read(const std::string &path);
+
+// Relative difference 100*|cmp-ref|/|ref| [%] of one section, as in
+// compare_simulations2.m, over the bins with ref != 0.
+struct Stats
+{
+  std::string name;
+  size_t n;                     // bins compared
+  size_t n_zero;                // bins with ref == 0 but cmp != 0
+  double mean, rms, p95, max;   // of the relative difference [%]
+  size_t i_max;                 // bin of max
+  double l1;                    // 100*sum|cmp-ref|/sum|ref| [%]
+};
+
+struct Result
+{
+  std::string ref, cmp;
+  std::string error;            // not read, or not comparable
+  std::vector<Stats> stats;     // sections of ref that cmp also has
+  double worst_l1;              // largest l1 of stats
+  std::string worst;            // its section
+};
+
+// Write f to fname as an ASCII .mco file in the layout of mcml, with note
+// in place of the user time, or as a binary file of output format B, with
+// the raw tallies if f has them. f needs the sections of a run, RAT to
+// Tt_ra. Returns an error, or an empty string.
+std::string WriteAscii(const std::string &fname, const File &f,
+    const std::string &note);
+std::string WriteBinary(const std::string &fname, const File &f,
+    const std::string &note);
+
+// Why ref and cmp cannot be compared bin by bin (grid or layers differ), or
+// an empty string.
+std::string Incomparable(const File &ref, const File &cmp);
+
+// The relative difference of cmp against ref in each bin of a section [%],
+// NaN where ref == 0.
+std::vector<double> RelDiff(const Section &ref, const Section &cmp);
+
+Stats Summarize(const std::string &name, const Section &ref,
+    const Section &cmp);
+
+Result Compare(const File &ref, const File &cmp);
+
+// Call f(0), .., f(n-1) on up to num_threads threads, each taking the next
+// index until none are left.
+template <class F>
+void ParallelFor(size_t n, int num_threads, F f)
+{
+  std::atomic<size_t> next(0);
+  auto work = [&]() { for (size_t i; (i = next++) < n; ) f(i); };
+  std::vector<std::thread> pool;
+  size_t t, m = std::min((size_t)std::max(num_threads, 1), n);
+
+  for (t = 1; t < m; ++t) pool.emplace_back(work);
+  work();
+  for (auto &th : pool) th.join();
+}
+
+}  // namespace mco
+
+#endif  // MCO_H
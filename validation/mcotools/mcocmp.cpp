@@ -0,0 +1,284 @@
+/*****************************************************************************
+*
+*   Compare .mco files against baselines
+*
+*   mcocmp [-T<threads>] -L<limit %> [-o<report>] [-m<dir>]
+*          <ref> <cmp> [<ref> <cmp> ...]
+*
+*   Each <ref> and <cmp> is an .mco file, or a directory whose .mco files
+*   (searched recursively) are paired with those of the same relative path
+*   in the other one. For each pair, every section of results that both
+*   have is compared bin by bin as in compare_simulations2.m, by the
+*   relative difference 100*|cmp-ref|/|ref| [%], and summarized by its
+*   mean, rms, 95th percentile and maximum, and by the L1 difference
+*   100*sum|cmp-ref|/sum|ref|, which the noise of the empty bins far from
+*   the source does not dominate.
+*
+*   One line per pair goes to stdout: ok, FAIL (the L1 difference of a
+*   section is over the limit of -L) or ERR (not read, or not comparable),
+*   the largest L1 difference and its section. -L has no default: the noise
+*   of two runs of the same input goes from some 40% in Tt_ra at 2E4
+*   photons to 6% at 1E6, and is 0 for runs that must be identical. -o writes every statistic
+*   as JSON, and -m writes the maps of relative differences of each pair to
+*   <dir>, as diffmap.m plots them. The exit status is 1 if a pair is not
+*   ok.
+*
+****************************************************************************/
+
+#include "mco.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+
+namespace fs = std::filesystem;
+
+struct Pair
+{
+  std::string ref, cmp;
+  std::string error;                    // such as a file missing in <cmp>
+};
+
+static void usage(const char *prog_name)
+{
+  fprintf(stderr, "Usage: %s [-T<threads>] -L<limit %%> [-o<report>] "
+    "[-m<dir>]\n       <ref> <cmp> [<ref> <cmp> ...]\n", prog_name);
+  exit(2);
+}
+
+// The .mco files under Dir, relative to it and sorted.
+static std::vector<std::string> list_mco(const std::string &dir)
+{
+  std::vector<std::string> names;
+
+  for (const fs::directory_entry &e : fs::recursive_directory_iterator(dir))
+    if (e.is_regular_file() && e.path().extension() == ".mco")
+      names.push_back(fs::relative(e.path(), dir).string());
+  std::sort(names.begin(), names.end());
+  return names;
+}
+
+static void add_pairs(const std::string &ref, const std::string &cmp,
+    std::vector<Pair> &pairs)
+{
+  std::error_code ec;
+
+  if (!fs::is_directory(ref, ec))
+  {
+    pairs.push_back(Pair { ref, cmp, std::string() });
+    return;
+  }
+  if (!fs::is_directory(cmp, ec))
+  {
+    pairs.push_back(Pair { ref, cmp, "not a directory" });
+    return;
+  }
+  for (const std::string &name : list_mco(ref))
+  {
+    fs::path c = fs::path(cmp) / name;
+    Pair p { (fs::path(ref) / name).string(), c.string(), std::string() };
+    if (!fs::exists(c, ec)) p.error = "missing";
+    pairs.push_back(p);
+  }
+}
+
+static void json_string(FILE *file, const std::string &s)
+{
+  fputc('"', file);
+  for (unsigned char c : s)
+  {
+    if (c == '"' || c == '\\') fprintf(file, "\\%c", c);
+    else if (c < 0x20) fprintf(file, "\\u%04x", c);
+    else fputc(c, file);
+  }
+  fputc('"', file);
+}
+
+static void json_number(FILE *file, double x)
+{
+  if (std::isfinite(x)) fprintf(file, "%.6G", x);
+  else fprintf(file, "null");
+}
+
+static const char *status(const mco::Result &r, double limit)
+{
+  if (!r.error.empty()) return "ERR";
+  return (r.worst_l1 <= limit) ? "ok" : "FAIL";
+}
+
+static void write_report(const std::string &fname,
+    const std::vector<mco::Result> &results, double limit)
+{
+  FILE *file = fopen(fname.c_str(), "w");
+  size_t i, j;
+
+  if (file == NULL) { perror("Error opening report file"); exit(2); }
+  fprintf(file, "{\n  \"limit\": ");
+  json_number(file, limit);
+  fprintf(file, ",\n  \"pairs\": [");
+  for (i = 0; i < results.size(); ++i)
+  {
+    const mco::Result &r = results[i];
+
+    fprintf(file, "%s\n    { \"ref\": ", i ? "," : "");
+    json_string(file, r.ref);
+    fprintf(file, ", \"cmp\": ");
+    json_string(file, r.cmp);
+    fprintf(file, ", \"status\": \"%s\"", status(r, limit));
+    if (!r.error.empty())
+    {
+      fprintf(file, ", \"error\": ");
+      json_string(file, r.error);
+      fprintf(file, " }");
+      continue;
+    }
+    fprintf(file, ", \"worst\": ");
+    json_string(file, r.worst);
+    fprintf(file, ", \"worst_l1\": ");
+    json_number(file, r.worst_l1);
+    fprintf(file, ",\n      \"sections\": [");
+    for (j = 0; j < r.stats.size(); ++j)
+    {
+      const mco::Stats &s = r.stats[j];
+
+      fprintf(file, "%s\n        { \"name\": ", j ? "," : "");
+      json_string(file, s.name);
+      fprintf(file, ", \"n\": %zu, \"n_zero\": %zu, \"mean\": ", s.n,
+        s.n_zero);
+      json_number(file, s.mean);
+      fprintf(file, ", \"rms\": ");
+      json_number(file, s.rms);
+      fprintf(file, ", \"p95\": ");
+      json_number(file, s.p95);
+      fprintf(file, ", \"max\": ");
+      json_number(file, s.max);
+      fprintf(file, ", \"i_max\": %zu, \"l1\": ", s.i_max);
+      json_number(file, s.l1);
+      fprintf(file, " }");
+    }
+    fprintf(file, " ] }");
+  }
+  fprintf(file, "\n  ]\n}\n");
+  if (fclose(file) != 0) { perror("Error writing report file"); exit(2); }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//   Write the relative differences of every compared section of pair K to
+//   <dir>/<K>_<name of cmp>.rel, one row of the section per line and nan
+//   where ref is 0.
+//////////////////////////////////////////////////////////////////////////////
+static void write_maps(const std::string &dir, size_t k, const mco::File &ref,
+    const mco::File &cmp)
+{
+  std::string fname = dir + "/" + std::to_string(k) + "_"
+    + fs::path(cmp.path).stem().string() + ".rel";
+  FILE *file = fopen(fname.c_str(), "w");
+
+  if (file == NULL) { perror("Error opening map file"); return; }
+  fprintf(file, "# 100*|cmp-ref|/|ref| [%%], nan where ref == 0\n"
+    "# ref %s\n# cmp %s\n", ref.path.c_str(), cmp.path.c_str());
+  for (const mco::Section &s : ref.sections)
+  {
+    const mco::Section *c = cmp.find(s.name);
+    if (c == NULL || c->val.size() != s.val.size()) continue;
+
+    std::vector<double> d = mco::RelDiff(s, *c);
+    std::string buf;
+    char num[32];
+    int row, col;
+
+    fprintf(file, "\n%s %d %d\n", s.name.c_str(), s.rows, s.cols);
+    buf.reserve(d.size() * 11);
+    for (row = 0; row < s.rows; ++row)
+    {
+      for (col = 0; col < s.cols; ++col)
+      {
+        double x = d[(size_t)row * s.cols + col];
+        if (std::isnan(x)) buf += "nan";
+        else { snprintf(num, sizeof(num), "%.4G", x); buf += num; }
+        buf += (col + 1 < s.cols) ? ' ' : '\n';
+      }
+    }
+    fwrite(buf.data(), 1, buf.size(), file);
+  }
+  fclose(file);
+}
+
+int main(int argc, char *argv[])
+{
+  int num_threads = (int)std::thread::hardware_concurrency();
+  double limit = -1;
+  std::string report, map_dir;
+  std::vector<Pair> pairs;
+  int i;
+
+  for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; ++i)
+  {
+    if (sscanf(argv[i], "-T%d", &num_threads) == 1 && num_threads > 0) continue;
+    if (sscanf(argv[i], "-L%lf", &limit) == 1 && limit >= 0) continue;
+    if (strncmp(argv[i], "-o", 2) == 0 && argv[i][2])
+    {
+      report = argv[i] + 2;
+      continue;
+    }
+    if (strncmp(argv[i], "-m", 2) == 0 && argv[i][2])
+    {
+      map_dir = argv[i] + 2;
+      continue;
+    }
+    usage(argv[0]);
+  }
+  if (limit < 0 || i == argc || (argc - i) % 2 != 0) usage(argv[0]);
+  if (num_threads < 1) num_threads = 1;
+  for (; i < argc; i += 2) add_pairs(argv[i], argv[i+1], pairs);
+  if (!map_dir.empty()) fs::create_directories(map_dir);
+
+  // Read every file once, even if it is the baseline of many pairs.
+  std::map<std::string, size_t> index;
+  std::vector<std::string> paths;
+  for (const Pair &p : pairs)
+  {
+    if (!p.error.empty()) continue;
+    for (const std::string *s : { &p.ref, &p.cmp })
+      if (index.emplace(*s, paths.size()).second) paths.push_back(*s);
+  }
+  std::vector<mco::File> files;
+  mco::Load(paths, num_threads, files);
+
+  std::vector<mco::Result> results(pairs.size());
+  mco::ParallelFor(pairs.size(), num_threads, [&](size_t k) {
+    const Pair &p = pairs[k];
+    if (!p.error.empty())
+    {
+      results[k].ref = p.ref;
+      results[k].cmp = p.cmp;
+      results[k].error = p.cmp + ": " + p.error;
+      results[k].worst_l1 = 0;
+      return;
+    }
+    const mco::File &ref = files[index.at(p.ref)];
+    const mco::File &cmp = files[index.at(p.cmp)];
+    results[k] = mco::Compare(ref, cmp);
+    if (!map_dir.empty() && results[k].error.empty())
+      write_maps(map_dir, k, ref, cmp);
+  });
+
+  int n_bad = 0;
+  for (const mco::Result &r : results)
+  {
+    const char *st = status(r, limit);
+    if (strcmp(st, "ok") != 0) ++n_bad;
+    if (r.error.empty())
+      printf("%-4s %10.4G %-8s %s %s\n", st, r.worst_l1, r.worst.c_str(),
+        r.ref.c_str(), r.cmp.c_str());
+    else
+      printf("%-4s %10s %-8s %s %s (%s)\n", st, "-", "-", r.ref.c_str(),
+        r.cmp.c_str(), r.error.c_str());
+  }
+  if (!report.empty()) write_report(report, results, limit);
+  fprintf(stderr, "%zu pairs, %d not ok.\n", results.size(), n_bad);
+  return n_bad ? 1 : 0;
+}
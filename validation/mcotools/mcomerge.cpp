@@ -0,0 +1,254 @@
+/*****************************************************************************
+*
+*   Merge the .mco files of runs of the same model
+*
+*   mcomerge [-T<threads>] [-b] <out.mco> <in> [<in> ...]
+*
+*   The inputs, such as the .mco0, .mco1, .. of the nodes of cpumcml or
+*   the run1..run4 files of a baseline, must have the same grid and layers.
+*   Input i traced N_i photons and its results x_i are scaled by S_i, the
+*   photons of its run: N_i but for the file of a node, which holds its
+*   share of a run of S_i. Every result is sum(S_i*x_i)/sum(N_i), the
+*   tallies of all the photons over their number; for whole runs that is
+*   their mean weighted by photons, and for the nodes of a run their sum.
+*   Rsp, which does not depend on the photons, is their mean weighted by
+*   photons. If all the inputs are binary files with raw tallies of the
+*   same weight scale, the raw tallies are summed as integers and A_rz,
+*   Rd_ra and Tt_ra are scaled from the sums, so that merging is exact and
+*   the output can be merged again. The sections of -U and -D are not
+*   merged.
+*
+*   Each of the threads (default: online cores) reads every T-th input on
+*   its own, adds it to its sums and drops it, so the memory is that of two
+*   results a thread whatever the number of inputs. The sums of the threads
+*   are then added in order, so the output depends only on the inputs and
+*   the number of threads. -b writes output format B instead of ASCII.
+*
+****************************************************************************/
+
+#include "mco.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+static const char *kMerged[] = { "Rsp", "Rd", "A", "Tt", "A_l", "A_z",
+  "Rd_r", "Rd_a", "Tt_r", "Tt_a", "A_rz", "Rd_ra", "Tt_ra" };
+static const size_t kNumMerged = sizeof(kMerged) / sizeof(kMerged[0]);
+
+// The sums of the inputs of one thread.
+struct Sum
+{
+  std::vector<double> val[kNumMerged];  // sum of S_i*x_i, N_i*x_i for Rsp
+  std::vector<unsigned long long> raw[3];
+  long long num_photons;                // sum of N_i
+  bool all_raw;                         // every input had raw tallies
+  double weight_scale;                  // of the first of them, or 0
+};
+
+static void usage(const char *prog_name)
+{
+  fprintf(stderr, "Usage: %s [-T<threads>] [-b] <out.mco> <in> [<in> ...]\n",
+    prog_name);
+  exit(2);
+}
+
+static void init_sum(Sum &s, const mco::File &f)
+{
+  for (size_t k = 0; k < kNumMerged; ++k)
+    s.val[k].assign(f.find(kMerged[k])->val.size(), 0.0);
+  for (int k = 0; k < 3; ++k) s.raw[k].assign(f.raw[k].size(), 0);
+  s.num_photons = 0;
+  s.all_raw = true;
+  s.weight_scale = 0;
+}
+
+// Add input f to s, or return why it cannot be merged with the first, t.
+static std::string add_file(Sum &s, const mco::File &f, const mco::File &t)
+{
+  if (!f.error.empty()) return f.error;
+  std::string why = mco::Incomparable(t, f);
+  if (!why.empty()) return why;
+  if (f.num_photons <= 0 || f.run_photons < f.num_photons)
+    return "no photons";
+
+  double n = (double)f.num_photons, run = (double)f.run_photons;
+  for (size_t k = 0; k < kNumMerged; ++k)
+  {
+    const mco::Section *sec = f.find(kMerged[k]);
+    if (sec == NULL || sec->val.size() != s.val[k].size())
+      return std::string("no ") + kMerged[k];
+  }
+  for (size_t k = 0; k < kNumMerged; ++k)
+  {
+    const std::vector<double> &v = f.find(kMerged[k])->val;
+    double *sum = s.val[k].data();
+    double w = (k == 0) ? n : run;      // Rsp, or a tally
+    for (size_t i = 0; i < v.size(); ++i) sum[i] += w * v[i];
+  }
+  s.num_photons += f.num_photons;
+
+  if (f.weight_scale <= 0 || (s.weight_scale > 0
+      && f.weight_scale != s.weight_scale) || !s.all_raw)
+  {
+    s.all_raw = false;
+    return std::string();
+  }
+  s.weight_scale = f.weight_scale;
+  for (int k = 0; k < 3; ++k)
+  {
+    if (s.raw[k].size() != f.raw[k].size())
+      s.raw[k].assign(f.raw[k].size(), 0);
+    unsigned long long *sum = s.raw[k].data();
+    for (size_t i = 0; i < f.raw[k].size(); ++i) sum[i] += f.raw[k][i];
+  }
+  return std::string();
+}
+
+// Add the sums of thread Src to Dst.
+static void add_sum(Sum &dst, const Sum &src)
+{
+  for (size_t k = 0; k < kNumMerged; ++k)
+    for (size_t i = 0; i < dst.val[k].size(); ++i)
+      dst.val[k][i] += src.val[k][i];
+  dst.num_photons += src.num_photons;
+  if (src.num_photons == 0) return;     // a thread without inputs
+  if (!src.all_raw || (dst.weight_scale > 0
+      && src.weight_scale != dst.weight_scale))
+  {
+    dst.all_raw = false;
+    return;
+  }
+  dst.weight_scale = src.weight_scale;
+  for (int k = 0; k < 3; ++k)
+  {
+    if (dst.raw[k].size() != src.raw[k].size())
+      dst.raw[k].assign(src.raw[k].size(), 0);
+    for (size_t i = 0; i < src.raw[k].size(); ++i)
+      dst.raw[k][i] += src.raw[k][i];
+  }
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//   Scale the summed raw tallies of the 2D arrays into out, as ScaleA()
+//   and ScaleRdTt() of mcml: A_rz by the volume 2*pi*(r+0.5)*dr*dr*dz of
+//   its ring and Rd_ra and Tt_ra by the area of their ring times the solid
+//   angle 4*pi*sin(a)*cos(a)*sin(da/2) of their cone, for N photons.
+//////////////////////////////////////////////////////////////////////////////
+static void scale_raw(mco::File &out, const Sum &s)
+{
+  int nr = out.nr, nz = out.nz, na = out.na, r, i;
+  double n = (double)s.num_photons * s.weight_scale;
+  double dr = out.dr, dz = out.dz, da = 0.5 * M_PI / na;
+  std::vector<double> *A_rz = NULL, *Rd_ra = NULL, *Tt_ra = NULL;
+  for (mco::Section &sec : out.sections)
+  {
+    if (sec.name == "A_rz") A_rz = &sec.val;
+    else if (sec.name == "Rd_ra") Rd_ra = &sec.val;
+    else if (sec.name == "Tt_ra") Tt_ra = &sec.val;
+  }
+
+  for (r = 0; r < nr; ++r)
+  {
+    double v = 2.0 * M_PI * (r + 0.5) * dr * dr * dz * n;
+    for (i = 0; i < nz; ++i)
+      (*A_rz)[r*nz + i] = (double)s.raw[mco::kRawA_rz][r*nz + i] / v;
+    for (i = 0; i < na; ++i)
+    {
+      double w = 4.0 * M_PI * M_PI * dr * sin(da / 2) * dr * n
+        * (r + 0.5) * sin(2.0 * (i + 0.5) * da);
+      (*Rd_ra)[r*na + i] = (double)s.raw[mco::kRawRd_ra][r*na + i] / w;
+      (*Tt_ra)[r*na + i] = (double)s.raw[mco::kRawTt_ra][r*na + i] / w;
+    }
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  int num_threads = (int)std::thread::hardware_concurrency();
+  bool binary = false;
+  int i;
+
+  for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; ++i)
+  {
+    if (sscanf(argv[i], "-T%d", &num_threads) == 1 && num_threads > 0) continue;
+    if (strcmp(argv[i], "-b") == 0) { binary = true; continue; }
+    usage(argv[0]);
+  }
+  if (argc - i < 2) usage(argv[0]);
+  std::string out_name = argv[i++];
+  std::vector<std::string> inputs(argv + i, argv + argc);
+  size_t n = inputs.size();
+  if (num_threads < 1) num_threads = 1;
+  if ((size_t)num_threads > n) num_threads = (int)n;
+
+  // the first input sets the grid, the layers and the size of the sums
+  mco::File first = mco::Read(inputs[0]);
+  std::string why = first.error;
+  for (size_t k = 0; k < kNumMerged && why.empty(); ++k)
+    if (first.find(kMerged[k]) == NULL) why = std::string("no ") + kMerged[k];
+  if (!why.empty())
+  {
+    fprintf(stderr, "%s: %s\n", inputs[0].c_str(), why.c_str());
+    return 1;
+  }
+
+  std::vector<Sum> sums(num_threads);
+  std::vector<std::string> errors(n);
+  for (Sum &s : sums) init_sum(s, first);
+  mco::ParallelFor(num_threads, num_threads, [&](size_t t) {
+    for (size_t k = t; k < n; k += num_threads)
+      errors[k] = (k == 0) ? add_file(sums[t], first, first)
+        : add_file(sums[t], mco::Read(inputs[k]), first);
+  });
+
+  int n_bad = 0;
+  for (size_t k = 0; k < n; ++k)
+    if (!errors[k].empty())
+    {
+      fprintf(stderr, "%s: %s\n", inputs[k].c_str(), errors[k].c_str());
+      ++n_bad;
+    }
+  if (n_bad) return 1;
+
+  Sum &s = sums[0];
+  for (int t = 1; t < num_threads; ++t) add_sum(s, sums[t]);
+
+  mco::File out = first;
+  out.path = out_name;
+  out.binary = binary;
+  out.num_photons = out.run_photons = s.num_photons;
+  out.sections.clear();
+  for (size_t k = 0; k < kNumMerged; ++k)
+  {
+    mco::Section sec = *first.find(kMerged[k]);
+    for (size_t j = 0; j < sec.val.size(); ++j)
+      sec.val[j] = s.val[k][j] / (double)s.num_photons;
+    out.sections.push_back(sec);
+  }
+  if (s.all_raw && s.weight_scale > 0)
+  {
+    scale_raw(out, s);
+    for (int k = 0; k < 3; ++k) out.raw[k].swap(s.raw[k]);
+    out.weight_scale = s.weight_scale;
+  }
+  else
+  {
+    for (int k = 0; k < 3; ++k) out.raw[k].clear();
+    out.weight_scale = 0;
+  }
+
+  char note[256];
+  snprintf(note, sizeof(note), "Merged from %zu files, %lld photons%s.", n,
+    s.num_photons, out.weight_scale > 0 ? ", from their raw tallies" : "");
+  why = binary ? mco::WriteBinary(out_name, out, note)
+    : mco::WriteAscii(out_name, out, note);
+  if (!why.empty())
+  {
+    fprintf(stderr, "%s: %s\n", out_name.c_str(), why.c_str());
+    return 1;
+  }
+  printf("%s: %s\n", out_name.c_str(), note);
+  return 0;
+}
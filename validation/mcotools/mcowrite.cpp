@@ -0,0 +1,217 @@
+/*****************************************************************************
+*
+*   Writing .mco result files, as WriteAscii() and WriteBinary() of mcml
+*
+****************************************************************************/
+
+#include "mco.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace mco {
+
+namespace {
+
+const char *kRunSections[] = { "Rsp", "Rd", "A", "Tt", "A_l", "A_z", "Rd_r",
+  "Rd_a", "Tt_r", "Tt_a", "A_rz", "Rd_ra", "Tt_ra" };
+
+// The sections of a run that f lacks, or with the wrong number of values.
+std::string MissingSections(const File &f)
+{
+  const size_t nl = f.layers.size(), nz = f.nz, nr = f.nr, na = f.na;
+  const size_t n[] = { 1, 1, 1, 1, nl, nz, nr, na, nr, na, nr * nz, nr * na,
+    nr * na };
+  std::string missing;
+
+  for (size_t i = 0; i < sizeof(n) / sizeof(n[0]); ++i)
+  {
+    const Section *s = f.find(kRunSections[i]);
+    if (s == NULL || s->val.size() != n[i])
+      missing += std::string(missing.empty() ? "" : " ") + kRunSections[i];
+  }
+  return missing;
+}
+
+void Append(std::string &buf, const char *format, double x)
+{
+  char num[64];
+  int len = snprintf(num, sizeof(num), format, x);
+  buf.append(num, len);
+}
+
+// A 1D section: Flag, then one "%12.4E" per line and an empty line.
+void Put1D(std::string &buf, const char *flag, const Section &s)
+{
+  buf += flag;
+  for (double x : s.val) { Append(buf, "%12.4E", x); buf += '\n'; }
+  buf += '\n';
+}
+
+// A 2D section: Flag, then "%12.4E " five to a line.
+void Put2D(std::string &buf, const char *flag, const Section &s)
+{
+  buf += flag;
+  for (size_t i = 0; i < s.val.size(); ++i)
+  {
+    Append(buf, "%12.4E ", s.val[i]);
+    if ((i + 1) % 5 == 0) buf += '\n';
+  }
+  buf += '\n';
+}
+
+// Append the n values of size bytes at p to buf, little-endian.
+void AppendLE(std::string &buf, const void *p, size_t size, size_t n)
+{
+  size_t at = buf.size();
+  buf.append((const char *)p, size * n);
+  if (BigEndian()) SwapBytes(&buf[at], size, n);
+}
+
+std::string Write(const std::string &fname, const std::string &buf)
+{
+  FILE *file = fopen(fname.c_str(), "wb");
+
+  if (file == NULL) return "cannot open " + fname;
+  size_t n = fwrite(buf.data(), 1, buf.size(), file);
+  if (fclose(file) != 0 || n != buf.size()) return "cannot write " + fname;
+  return std::string();
+}
+
+}  // namespace
+
+std::string WriteAscii(const std::string &fname, const File &f,
+    const std::string &note)
+{
+  std::string missing = MissingSections(f), buf;
+  char line[512];
+  size_t i;
+
+  if (!missing.empty()) return "no " + missing;
+
+  buf = "A1 \t# Version number of the file format.\n\n"
+    "####\n# Data categories include: \n# InParm, RAT, \n"
+    "# A_l, A_z, Rd_r, Rd_a, Tt_r, Tt_a, \n# A_rz, Rd_ra, Tt_ra \n####\n\n";
+  buf += "# " + note + "\n";
+  if (f.num_photons != f.run_photons)
+  {
+    snprintf(line, sizeof(line), "# Photons traced: %lld of the %lld of the "
+      "run\n", f.num_photons, f.run_photons);
+    buf += line;
+  }
+  buf += "\n";
+
+  buf += "InParm \t\t\t# Input parameters. cm is used.\n";
+  buf += fname + " \tA\t\t# output file name, ASCII.\n";
+  snprintf(line, sizeof(line), "%lld \t\t\t# No. of photons\n"
+    "%G\t%G\t\t# dz, dr [cm]\n%d\t%d\t%d\t# No. of dz, dr, da.\n\n"
+    "%zu\t\t\t\t\t# Number of layers\n"
+    "#n\tmua\tmus\tg\td\t# One line for each layer\n"
+    "%G\t\t\t\t\t# n for medium above\n", f.run_photons, f.dz, f.dr,
+    f.nz, f.nr, f.na, f.layers.size(), f.n_above);
+  buf += line;
+  for (i = 0; i < f.layers.size(); ++i)
+  {
+    const Layer &l = f.layers[i];
+    snprintf(line, sizeof(line), "%G\t%G\t%G\t%G\t%G\t# layer %zu\n", l.n,
+      l.mua, l.mus, l.g, l.d, i + 1);
+    buf += line;
+  }
+  snprintf(line, sizeof(line), "%G\t\t\t\t\t# n for medium below\n\n",
+    f.n_below);
+  buf += line;
+
+  buf += "RAT #Reflectance, absorption, transmission. \n";
+  Append(buf, "%-14.6G \t#Specular reflectance [-]\n", f.find("Rsp")->val[0]);
+  Append(buf, "%-14.6G \t#Diffuse reflectance [-]\n", f.find("Rd")->val[0]);
+  Append(buf, "%-14.6G \t#Absorbed fraction [-]\n", f.find("A")->val[0]);
+  Append(buf, "%-14.6G \t#Transmittance [-]\n", f.find("Tt")->val[0]);
+  buf += '\n';
+
+  buf += "A_l #Absorption as a function of layer. [-]\n";
+  for (double x : f.find("A_l")->val) Append(buf, "%12.4G\n", x);
+  buf += '\n';
+  Put1D(buf, "A_z #A[0], [1],..A[nz-1]. [1/cm]\n", *f.find("A_z"));
+  Put1D(buf, "Rd_r #Rd[0], [1],..Rd[nr-1]. [1/cm2]\n", *f.find("Rd_r"));
+  Put1D(buf, "Rd_a #Rd[0], [1],..Rd[na-1]. [sr-1]\n", *f.find("Rd_a"));
+  Put1D(buf, "Tt_r #Tt[0], [1],..Tt[nr-1]. [1/cm2]\n", *f.find("Tt_r"));
+  Put1D(buf, "Tt_a #Tt[0], [1],..Tt[na-1]. [sr-1]\n", *f.find("Tt_a"));
+
+  Put2D(buf, "# A[r][z]. [1/cm3]\n# A[0][0], [0][1],..[0][nz-1]\n"
+    "# A[1][0], [1][1],..[1][nz-1]\n# ...\n"
+    "# A[nr-1][0], [nr-1][1],..[nr-1][nz-1]\nA_rz\n", *f.find("A_rz"));
+  Put2D(buf, "# Rd[r][angle]. [1/(cm2sr)].\n# Rd[0][0], [0][1],..[0][na-1]\n"
+    "# Rd[1][0], [1][1],..[1][na-1]\n# ...\n"
+    "# Rd[nr-1][0], [nr-1][1],..[nr-1][na-1]\nRd_ra\n", *f.find("Rd_ra"));
+  Put2D(buf, "# Tt[r][angle]. [1/(cm2sr)].\n# Tt[0][0], [0][1],..[0][na-1]\n"
+    "# Tt[1][0], [1][1],..[1][na-1]\n# ...\n"
+    "# Tt[nr-1][0], [nr-1][1],..[nr-1][na-1]\nTt_ra\n", *f.find("Tt_ra"));
+  return Write(fname, buf);
+}
+
+std::string WriteBinary(const std::string &fname, const File &f,
+    const std::string &note)
+{
+  std::string missing = MissingSections(f), buf;
+  size_t nl = f.layers.size(), i;
+  bool raw = f.weight_scale > 0
+    && f.raw[kRawA_rz].size() == (size_t)f.nr * f.nz
+    && f.raw[kRawRd_ra].size() == (size_t)f.nr * f.na
+    && f.raw[kRawTt_ra].size() == (size_t)f.nr * f.na;
+  McoHead head;
+
+  if (!missing.empty()) return "no " + missing;
+
+  memset(&head, 0, sizeof(head));
+  memcpy(head.magic, kMcoMagic, 8);
+  head.version = kMcoVersion;
+  head.byte_order = kMcoByteOrder;
+  head.head_size = sizeof(McoHead);
+  head.num_layers = (int)nl;
+  head.nz = f.nz;
+  head.nr = f.nr;
+  head.na = f.na;
+  head.flags = raw ? kMcoRaw : 0;
+  head.num_photons = f.num_photons;
+  head.run_photons = f.run_photons;
+  head.Wth = f.Wth;
+  head.dz = f.dz;
+  head.dr = f.dr;
+  head.da = 0.5 * M_PI / f.na;
+  head.weight_scale = raw ? f.weight_scale : 0;
+  head.Rsp = f.find("Rsp")->val[0];
+  head.Rd = f.find("Rd")->val[0];
+  head.A = f.find("A")->val[0];
+  head.Tt = f.find("Tt")->val[0];
+  snprintf(head.out_fname, sizeof(head.out_fname), "%s", fname.c_str());
+  snprintf(head.note, sizeof(head.note), "%s", note.c_str());
+  SwapHead(head);
+  buf.append((const char *)&head, sizeof(head));
+
+  // the ambient media first and last, with only n set
+  std::vector<McoLayer> layer(nl + 2);
+  memset(layer.data(), 0, layer.size() * sizeof(McoLayer));
+  layer[0].n = f.n_above;
+  layer[nl + 1].n = f.n_below;
+  for (i = 0; i < nl; ++i)
+  {
+    const Layer &l = f.layers[i];
+    double z0 = (i == 0) ? 0 : layer[i].z1;
+    layer[i + 1] = McoLayer { l.n, l.mua, l.mus, l.g, z0, z0 + l.d };
+  }
+  AppendLE(buf, layer.data(), sizeof(double), 6 * layer.size());
+
+  for (i = 4; i < sizeof(kRunSections) / sizeof(kRunSections[0]); ++i)
+  {
+    const std::vector<double> &v = f.find(kRunSections[i])->val;
+    AppendLE(buf, v.data(), sizeof(double), v.size());
+  }
+  if (raw)
+    for (i = 0; i < 3; ++i)
+      AppendLE(buf, f.raw[i].data(), sizeof(unsigned long long),
+        f.raw[i].size());
+  return Write(fname, buf);
+}
+
+}  // namespace mco
@@ -0,0 +1,60 @@
+#!/bin/sh
+#
+#   Merge the node files of runs split over 3 nodes with mcomerge, and
+#   compare them with the same runs on one node, in output formats B and A.
+#   With -Mphilox the nodes trace the very photons of the single run, so
+#   the binary merge, summed from the raw tallies, must match it but for
+#   the PI of mcml (3.1415926, 3E-8 off) in the scales of the 2D arrays,
+#   and the ASCII one to the digits it keeps. Merging the nodes as whole
+#   runs would be off by tens of percent.
+#
+#   Run by make check, with mcml built in cpumcml_multicore.
+#
+set -e
+here=$(cd "$(dirname "$0")" && pwd)
+mcml=$here/../../cpumcml_multicore/mcml
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+cat > slab.mci <<EOF
+1.0						# file version
+2						# number of runs
+
+slabB.mco	B				# output filename, ASCII/Binary
+20001						# No. of photons
+0.01	0.01					# dz, dr
+40	50	10				# No. of dz, dr & da.
+
+2						# No. of layers
+# n	mua	mus	g	d		# One line for each layer
+1.0						# n for medium above.
+1.37	1	100	0.9	0.1		# layer 1
+1.37	0.5	50	0.8	0.2		# layer 2
+1.0						# n for medium below.
+
+slabA.mco	A				# output filename, ASCII/Binary
+20001						# No. of photons
+0.01	0.01					# dz, dr
+40	50	10				# No. of dz, dr & da.
+
+2						# No. of layers
+# n	mua	mus	g	d		# One line for each layer
+1.0						# n for medium above.
+1.37	1	100	0.9	0.1		# layer 1
+1.37	0.5	50	0.8	0.2		# layer 2
+1.0						# n for medium below.
+EOF
+
+"$mcml" -Mphilox slab.mci < /dev/null > /dev/null
+mv slabB.mco0 slabB.ref
+mv slabA.mco0 slabA.ref
+for node in 0 1 2
+do
+  "$mcml" -Mphilox slab.mci $node 3 < /dev/null > /dev/null
+done
+
+"$here/mcomerge" -b slabB.mco slabB.mco0 slabB.mco1 slabB.mco2
+"$here/mcomerge" slabA.mco slabA.mco0 slabA.mco1 slabA.mco2
+"$here/mcocmp" -L1e-4 slabB.ref slabB.mco
+"$here/mcocmp" -L0.01 slabA.ref slabA.mco
@@ -0,0 +1,124 @@
+#!/bin/sh
+#
+#   With -Mphilox the random numbers belong to the photons and the tallies
+#   are fixed-point sums, so the output of a run must not depend on how
+#   its photons were traced. Run a slab input in every way that should
+#   not matter and compare the .mco files byte for byte with a run on one
+#   thread: other -T, -F, a run killed after its first checkpoint and
+#   resumed on other threads, -J, top-ups from the cache of -Q and from
+#   the .raw of -X, and the binary writer, converted back by -O. The
+#   packet and event engines draw alike, but not like the scalar one, so
+#   they are compared with each other.
+#
+#   Run by make check, with mcml built in cpumcml_multicore.
+#
+set -e
+here=$(cd "$(dirname "$0")" && pwd)
+mcml=$here/../../cpumcml_multicore/mcml
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+photons=100001
+half=50000
+
+# The head of an input file of $1 runs.
+header() {
+  printf '1.0\t\t\t\t\t\t# file version\n'
+  printf '%s\t\t\t\t\t\t# number of runs\n' "$1"
+}
+
+# A run of $1 photons of the slab to $2 in format $3.
+slab() {
+  cat <<END
+
+$2	$3				# output filename, ASCII/Binary
+$1						# No. of photons
+0.01	0.01					# dz, dr
+40	50	10				# No. of dz, dr & da.
+
+2						# No. of layers
+# n	mua	mus	g	d		# One line for each layer
+1.0						# n for medium above.
+1.37	1	100	0.9	0.1		# layer 1
+1.37	0.5	50	0.8	0.2		# layer 2
+1.0						# n for medium below.
+END
+}
+
+{ header 1; slab $photons slab.mco A; } > slab.mci
+{ header 1; slab $half slab.mco A; } > half.mci
+{ header 1; slab $photons slab.mco B; } > binary.mci
+{ header 2; slab $photons slab.mco A; slab $half half.mco A; } > two.mci
+
+# Run mcml -Mphilox in directory $1 on input $2, with the other arguments.
+run() {
+  d=$1
+  mci=$2
+  shift 2
+  mkdir -p "$d"
+  (cd "$d" && "$mcml" -Mphilox "$@" "../$mci" < /dev/null > /dev/null)
+}
+
+fail=0
+# Compare file $1 in directories $2 and $3.
+same() {
+  if cmp -s "$2/$1" "$3/$1"; then
+    echo "ok   $2/$1 $3/$1"
+  else
+    echo "FAIL $2/$1 $3/$1"
+    fail=1
+  fi
+}
+
+run ref slab.mci -T1
+run T3 slab.mci -T3
+same slab.mco0 ref T3
+run F slab.mci -T2 -F
+same slab.mco0 ref F
+
+run packet slab.mci -T1 -Epacket
+run packetT3 slab.mci -T3 -Epacket
+same slab.mco0 packet packetT3
+run event slab.mci -T2 -Eevent
+same slab.mco0 packet event
+
+# Kill the run once it has written a checkpoint, and resume it.
+mkdir ckpt
+(cd ckpt && exec "$mcml" -Mphilox -T1 -Kck -I0.0005 ../slab.mci \
+    < /dev/null > /dev/null) &
+pid=$!
+while kill -0 $pid 2> /dev/null && [ ! -f ckpt/ck ]; do
+  sleep 0.01
+done
+kill -9 $pid 2> /dev/null || true
+wait $pid 2> /dev/null || true
+if [ -f ckpt/ck ]; then
+  run ckpt slab.mci -T3 -Rck
+  same slab.mco0 ref ckpt
+else
+  echo "FAIL ckpt: the run ended before its first checkpoint"
+  fail=1
+fi
+
+run J1 two.mci -T1
+run J2 two.mci -T3 -J2
+same slab.mco0 ref J2
+same half.mco0 J1 J2
+
+run cache half.mci -Qq
+run cache slab.mci -T2 -Qq
+same slab.mco0 ref cache
+
+run raw half.mci -X
+run raw half.mci -T3 -X$((photons - half))
+same slab.mco0 ref raw
+
+run binary binary.mci -T1
+run binaryT3 binary.mci -T3
+same slab.mco0 binary binaryT3
+mkdir ascii
+(cd ascii && "$mcml" -O../binary/slab.mco0 slab.mco0 > /dev/null)
+same slab.mco0 ref ascii
+
+exit $fail
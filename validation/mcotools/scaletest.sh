@@ -0,0 +1,63 @@
+#!/bin/sh
+#
+#   Scale a baseline run of one layer (mcml -B) with mcmlsmc, by path
+#   length and with -k by collisions, and compare Rd and Tt with direct
+#   runs of the layers they stand for. The weights of both are within
+#   [0,1], so each estimate is off by at most sqrt(p(1-p)/N) for one
+#   standard deviation; they must agree to 4 of those of the difference.
+#   A path length that counts the whole step to a boundary, not the part
+#   the photon travels, makes Tt of the default scaling 4% low.
+#
+#   Run by make check, with mcml and mcmlsmc built in cpumcml_multicore.
+#
+set -e
+here=$(cd "$(dirname "$0")" && pwd)
+bin=$here/../../cpumcml_multicore
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+cd "$dir"
+
+photons=100000
+mua=2
+mus=50
+
+# The input of one run of a layer of mua $1, mus $2 and thickness $3.
+layer() {
+  cat <<END
+1.0						# file version
+1						# number of runs
+
+$4	A				# output filename, ASCII/Binary
+$photons						# No. of photons
+0.01	0.01					# dz, dr
+40	50	10				# No. of dz, dr & da.
+
+1						# No. of layers
+# n	mua	mus	g	d		# One line for each layer
+1.0						# n for medium above.
+1.37	$1	$2	0.9	$3		# layer 1
+1.0						# n for medium below.
+END
+}
+
+layer 0 100 0.1 base.mco > base.mci
+"$bin/mcml" -Mphilox -B base.mci < /dev/null > /dev/null
+
+for mode in "" -k
+do
+  echo "$mua $mus" | "$bin/mcmlsmc" $mode base.smc0 | grep -v '^#' > scaled
+  d=$(awk '{ print $3 }' scaled)
+  layer $mua $mus "$d" direct.mco > direct.mci
+  "$bin/mcml" -Mphilox -S7 direct.mci < /dev/null > /dev/null
+  awk -v n=$photons -v mode="mcmlsmc ${mode:-by path}" '
+    FNR == NR { rd = $5; tt = $6; next }
+    /^RAT/ { getline; getline; drd = $1; getline; getline; dtt = $1 }
+    function off(name, p, q) {
+      tol = 4*sqrt(2*q*(1 - q)/n)
+      printf("%s: %s %.5f, direct %.5f, tolerance %.5f\n", mode, name, p, q,
+          tol)
+      return (p - q > tol || q - p > tol)
+    }
+    END { bad = off("Rd", rd, drd); bad += off("Tt", tt, dtt); exit bad }
+  ' scaled direct.mco0
+done